@@ -0,0 +1,339 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_batch.cc
+// Implementation of KnvBatchExecutor
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "knv_batch.h"
+#include "knv_metrics.h"
+
+static __thread uint64_t task_deadline_us; // deadline of the task being run by this thread
+
+static inline uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+bool KnvBatchExecutor::DeadlinePassed()
+{
+	return task_deadline_us && now_us()>=task_deadline_us;
+}
+
+KnvBatchExecutor::KnvBatchExecutor(KnvBodyHandler h, void *a) :
+	handler(h), arg(a), stopping(false), nr_unfinished(0)
+{
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work, NULL);
+}
+
+KnvBatchExecutor::~KnvBatchExecutor()
+{
+	Stop();
+	pthread_cond_destroy(&work);
+	pthread_mutex_destroy(&lock);
+}
+
+int KnvBatchExecutor::Start(int nr_threads)
+{
+	if(!threads.empty())
+	{
+		errmsg = "already started";
+		return -1;
+	}
+	if(nr_threads<0 || nr_threads>KNV_BATCH_MAX_THREADS)
+	{
+		errmsg = "bad number of threads";
+		return -2;
+	}
+	stopping = false;
+	for(int i=0; i<nr_threads; i++)
+	{
+		pthread_t t;
+		int ret = pthread_create(&t, NULL, WorkerEntry, this);
+		if(ret)
+		{
+			errmsg = "pthread_create failed: "; errmsg += strerror(ret);
+			Stop();
+			return -3;
+		}
+		threads.push_back(t);
+	}
+	return 0;
+}
+
+void KnvBatchExecutor::Stop()
+{
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+	for(size_t i=0; i<threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	threads.clear();
+
+	// only tasks of abandoned batches can be left
+	pthread_mutex_lock(&lock);
+	while(!queue.empty())
+	{
+		Task *t = queue.front();
+		queue.pop_front();
+		PutBatch(t->batch);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void *KnvBatchExecutor::WorkerEntry(void *arg)
+{
+	((KnvBatchExecutor *)arg)->WorkerLoop();
+	return NULL;
+}
+
+void KnvBatchExecutor::PutBatch(Batch *b)
+{
+	if(--b->refs==0)
+	{
+		pthread_cond_destroy(&b->done);
+		delete b;
+	}
+}
+
+int KnvBatchExecutor::RunTask(Task &t)
+{
+	KnvNode *n = KnvNode::New(t.req, false);
+	if(n==NULL)
+		return -1;
+	task_deadline_us = t.batch->deadline_us;
+	int ret = handler(n, t.rsp, arg);
+	task_deadline_us = 0;
+	KnvNode::Delete(n);
+	return ret;
+}
+
+void KnvBatchExecutor::WorkerLoop()
+{
+	pthread_mutex_lock(&lock);
+	while(true)
+	{
+		while(queue.empty() && !stopping)
+			pthread_cond_wait(&work, &lock);
+		if(stopping)
+			break;
+
+		Task *t = queue.front();
+		queue.pop_front();
+		Batch *b = t->batch;
+		if(b->abandoned) // too late to start
+		{
+			PutBatch(b);
+			continue;
+		}
+		t->state = TASK_RUNNING;
+		pthread_mutex_unlock(&lock);
+
+		int ret = RunTask(*t);
+
+		pthread_mutex_lock(&lock);
+		if(b->abandoned)
+		{
+			KnvMetrics::Add(KNV_METRIC_BATCH_LATE, 1);
+		}
+		else
+		{
+			t->state = ret? TASK_FAILED : TASK_DONE;
+			if(--b->remaining==0)
+				pthread_cond_signal(&b->done);
+		}
+		PutBatch(b);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int KnvBatchExecutor::Execute(KnvProtocol &req, int timeout_ms, UcMem *(&rsp))
+{
+	nr_unfinished = 0;
+	if(!req.IsValid())
+	{
+		errmsg = "request is invalid";
+		return -1;
+	}
+
+	vector<KnvNode *> bodies;
+	Batch *b = NULL;
+	try
+	{
+		for(KnvNode *n=req.GetFirstRequest(); n; n=req.GetNextRequest())
+			bodies.push_back(n);
+		b = new Batch;
+		b->tasks.resize(bodies.size());
+	}
+	catch(...)
+	{
+		delete b;
+		errmsg = "out of memory";
+		return -2;
+	}
+	b->deadline_us = timeout_ms>0? now_us() + (uint64_t)timeout_ms*1000 : 0;
+	b->remaining = bodies.size();
+	b->refs = 1;
+	b->abandoned = false;
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&b->done, &attr);
+	pthread_condattr_destroy(&attr);
+
+	// workers get their own copy of the request bodies, as they may outlive req
+	for(size_t i=0; i<bodies.size(); i++)
+	{
+		Task &t = b->tasks[i];
+		t.state = TASK_PENDING;
+		t.batch = b;
+		if(bodies[i]->Serialize(t.req))
+		{
+			errmsg = "serializing request body failed: "; errmsg += bodies[i]->GetErrorMsg();
+			pthread_mutex_lock(&lock);
+			PutBatch(b);
+			pthread_mutex_unlock(&lock);
+			return -3;
+		}
+	}
+	KnvMetrics::Add(KNV_METRIC_BATCH_BODIES, bodies.size());
+
+	if(threads.empty()) // process in this thread, stopping at the deadline
+	{
+		for(size_t i=0; i<bodies.size(); i++)
+		{
+			Task &t = b->tasks[i];
+			if(b->deadline_us && now_us()>=b->deadline_us)
+				break;
+			t.state = RunTask(t)? TASK_FAILED : TASK_DONE;
+		}
+	}
+	else
+	{
+		pthread_mutex_lock(&lock);
+		for(size_t i=0; i<bodies.size(); i++)
+			queue.push_back(&b->tasks[i]);
+		b->refs += bodies.size();
+		pthread_cond_broadcast(&work);
+
+		struct timespec ts;
+		ts.tv_sec = b->deadline_us/1000000;
+		ts.tv_nsec = (b->deadline_us%1000000)*1000;
+		while(b->remaining>0)
+		{
+			if(b->deadline_us==0)
+				pthread_cond_wait(&b->done, &lock);
+			else if(pthread_cond_timedwait(&b->done, &lock, &ts)==ETIMEDOUT)
+				break;
+		}
+		// tasks still queued are skipped by the workers, running ones are left to finish alone,
+		// results of finished tasks are not touched any more, so they can be read without the lock
+		b->abandoned = true;
+		pthread_mutex_unlock(&lock);
+	}
+
+	int ret = EncodeResponse(req, bodies, *b, rsp);
+
+	pthread_mutex_lock(&lock);
+	PutBatch(b);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+// response = header + response bodies of finished keys + KNV_PKG_UNFINISHED_TAG{ 1:key, 1:key, ... }
+int KnvBatchExecutor::EncodeResponse(KnvProtocol &req, const vector<KnvNode *> &bodies, Batch &b, UcMem *(&rsp))
+{
+	vector<knv_seg_t> segs;
+	string unfinished;
+	uint32_t unfinished_len = 0;
+	try
+	{
+		segs.reserve(bodies.size()+1);
+		for(size_t i=0; i<bodies.size(); i++)
+		{
+			Task &t = b.tasks[i];
+			if(t.state==TASK_DONE)
+			{
+				if(t.rsp.length())
+				{
+					knv_seg_t s = { t.rsp.data(), (int)t.rsp.length() };
+					segs.push_back(s);
+				}
+				continue;
+			}
+			nr_unfinished ++;
+			const knv_key_t &k = bodies[i]->GetKey();
+			if(k.GetLength()) // a body without a key can not be listed
+				unfinished_len += knv_eval_field_length(1, k.GetType(), &k.GetValue());
+		}
+
+		if(nr_unfinished)
+		{
+			knv_value_t v;
+			v.str.len = unfinished_len;
+			unfinished.resize(knv_eval_field_length(KNV_PKG_UNFINISHED_TAG, KNV_NODE, &v));
+			knv_buff_t kb;
+			int ret = knv_init_buff(&kb, &unfinished[0], unfinished.length()) ||
+				knv_add_string_head(&kb, KNV_PKG_UNFINISHED_TAG, unfinished_len);
+			for(size_t i=0; ret==0 && i<bodies.size(); i++)
+			{
+				const knv_key_t &k = bodies[i]->GetKey();
+				if(b.tasks[i].state!=TASK_DONE && k.GetLength())
+					ret = knv_add_field_val(&kb, 1, k.GetType(), &k.GetValue());
+			}
+			if(ret)
+			{
+				errmsg = "encoding unfinished keys failed: "; errmsg += kb.errmsg;
+				return -4;
+			}
+			knv_seg_t s = { unfinished.data(), (int)unfinished.length() };
+			segs.push_back(s);
+			KnvMetrics::Add(KNV_METRIC_BATCH_UNFINISHED, nr_unfinished);
+		}
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -2;
+	}
+
+	if(req.GetReqCompress())
+		req.SetAllowCompress(true);
+	int ret = req.EncodeWithRawBodies(segs.empty()? NULL : &segs[0], segs.size(), rsp);
+	if(ret<0)
+		errmsg = "encoding response failed: " + req.GetErrorMsg();
+	return ret;
+}
+
+int KnvBatchExecutor::Execute(KnvProtocol &req, int timeout_ms, string &rsp)
+{
+	UcMem *m;
+	int ret = Execute(req, timeout_ms, m);
+	if(ret<0)
+		return ret;
+	try
+	{
+		rsp.assign((char *)m->ptr(), ret);
+	}
+	catch(...)
+	{
+		UcMemManager::Free(m);
+		errmsg = "out of memory";
+		return -100;
+	}
+	UcMemManager::Free(m);
+	return ret;
+}
@@ -0,0 +1,112 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_batch.h
+// Parallel processing of the bodies of a batch request
+//
+// A batch request carries one body (KNV_PKG_BDY_TAG) per key. KnvBatchExecutor hands
+// the bodies to a pool of worker threads and waits until all of them are done or the
+// deadline of the packet has passed. Keys not done by then are listed under
+// KNV_PKG_UNFINISHED_TAG in the response, so that the client can retry them.
+//
+// Nodes and UcMem buffers belong to the thread that allocates them, so only plain
+// bytes cross threads: a worker decodes its own copy of the request body, and the
+// response body it encodes goes into the response as is.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_BATCH__
+#define __KNV_BATCH__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include "protocol.h"
+
+using namespace std;
+
+#define KNV_BATCH_MAX_THREADS	256
+
+// Called on a worker thread for each request body
+//   req_body -- the decoded body, owned by the executor
+//   rsp_body -- the encoded response field(s), usually by KnvNode::Serialize(rsp_body),
+//               leave it empty if there is nothing to reply for this key
+//   arg      -- as given to KnvBatchExecutor
+// returns 0 if the key is done, or non-zero to list it as unfinished
+typedef int (*KnvBodyHandler)(KnvNode *req_body, string &rsp_body, void *arg);
+
+class KnvBatchExecutor
+{
+public:
+	KnvBatchExecutor(KnvBodyHandler handler, void *arg = NULL);
+	~KnvBatchExecutor();
+
+	// start nr_threads workers, returns 0 on success
+	// without workers, Execute() processes the bodies in the calling thread
+	int Start(int nr_threads);
+	// wait for running handlers and stop the workers
+	void Stop();
+
+	// Process all bodies of req and encode the response with req's header
+	// timeout_ms: deadline of the packet counted from now, <=0 for no deadline
+	// returns the length of the response, or <0 on failure
+	// the number of unfinished keys is available from GetUnfinishedNum() afterwards
+	// Execute() is not reentrant, use one executor per calling thread
+	int Execute(KnvProtocol &req, int timeout_ms, UcMem *(&rsp));
+	int Execute(KnvProtocol &req, int timeout_ms, string &rsp);
+
+	int GetThreadNum() const { return threads.size(); }
+	int GetUnfinishedNum() const { return nr_unfinished; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+	// For a handler: whether the deadline of its packet has passed, so that it can stop early
+	static bool DeadlinePassed();
+
+private:
+	KnvBatchExecutor(const KnvBatchExecutor &);
+	KnvBatchExecutor &operator=(const KnvBatchExecutor &);
+
+	struct Batch;
+	enum TaskState { TASK_PENDING, TASK_RUNNING, TASK_DONE, TASK_FAILED };
+	struct Task
+	{
+		string req;    // encoded request body
+		string rsp;    // encoded response, valid when state is TASK_DONE
+		TaskState state;
+		Batch *batch;
+	};
+	struct Batch
+	{
+		vector<Task> tasks;
+		uint64_t deadline_us; // CLOCK_MONOTONIC, 0 for none
+		int remaining;        // tasks not finished yet
+		int refs;             // Execute() and every queued or running task
+		bool abandoned;       // the deadline has passed, Execute() has returned
+		pthread_cond_t done;
+	};
+
+	static void *WorkerEntry(void *arg);
+	void WorkerLoop();
+	int RunTask(Task &t);
+	void PutBatch(Batch *b); // drop a reference, called with lock held
+	int EncodeResponse(KnvProtocol &req, const vector<KnvNode *> &bodies, Batch &b, UcMem *(&rsp));
+
+	KnvBodyHandler handler;
+	void *arg;
+	vector<pthread_t> threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work;  // signals workers about queued tasks
+	deque<Task *> queue;
+	bool stopping;
+	int nr_unfinished;
+	string errmsg;
+};
+
+#endif
@@ -0,0 +1,254 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// knv_bench.cpp
+// Replay captured requests against a server and measure throughput and latency
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include "knv_capture.h"
+#include "knv_client.h"
+#include "knv_latency.h"
+#include "knv_udp_server.h"
+#include "commands.h"
+#include "version.h"
+
+struct bench_stats
+{
+	uint64_t ok;       // updated by the client's thread
+	uint64_t failed;
+	uint64_t timeouts;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void on_reply(int ret, KnvProtocol *rsp, void *arg)
+{
+	bench_stats &st = *(bench_stats *)arg;
+	if(ret==KNV_CLIENT_OK)
+		__atomic_store_n(&st.ok, st.ok+1, __ATOMIC_RELAXED);
+	else if(ret==KNV_CLIENT_ERR_TIMEOUT)
+		__atomic_store_n(&st.timeouts, st.timeouts+1, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(&st.failed, st.failed+1, __ATOMIC_RELAXED);
+}
+
+// complete requests of the capture that fit in a datagram, only those sent to port unless it is 0,
+// e.g. not the responses of a two-way capture, packets whose ports are not known are taken
+// returns the number of invalid packets, elsewhere the number sent to other ports
+static int load_requests(KnvCapture &cap, int port, vector<KnvProtocol *> &reqs, vector<double> &ts, int &elsewhere)
+{
+	const vector<KnvCapturePacket> &pkts = cap.GetPackets();
+	int dropped = 0;
+	elsewhere = 0;
+	for(size_t i=0; i<pkts.size(); i++)
+	{
+		if(port && pkts[i].dport && pkts[i].dport!=port)
+		{
+			elsewhere ++;
+			continue;
+		}
+		KnvProtocol *p = new KnvProtocol(pkts[i].data);
+		string s;
+		if(!p->IsValid() || !p->IsComplete() || p->Encode(s)<0 || s.length()>KNV_UDP_MAX_PKT_SIZE-100)
+		{
+			delete p;
+			dropped ++;
+			continue;
+		}
+		reqs.push_back(p);
+		ts.push_back(pkts[i].ts);
+	}
+	return dropped;
+}
+
+static void show_latency(uint64_t ok, double secs)
+{
+	vector<KnvLatencyStat> stats;
+	KnvLatencyHist all;
+	KnvLatency::Snapshot(stats);
+	printf("\n%-32s %-28s %10s %9s %9s %9s %9s %9s\n", "command", "retcode", "count", "p50(us)", "p90(us)", "p99(us)", "p999(us)", "max(us)");
+	for(size_t i=0; i<stats.size(); i++)
+	{
+		const KnvLatencyStat &st = stats[i];
+		if(st.phase!=KNV_LAT_CALL)
+			continue;
+		printf("%-32s %-28s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", knv::GetCmdName(st.cmd), knv::GetErrorCodeName((uint32_t)st.retcode),
+			(unsigned long long)st.count, st.p50_ns/1000.0, st.p90_ns/1000.0, st.p99_ns/1000.0, st.p999_ns/1000.0, st.max_ns/1000.0);
+		all.Merge(st.hist);
+	}
+	if(all.GetCount()==0)
+		return;
+	double tpn = KnvLatency::GetTicksPerNs();
+	printf("%-32s %-28s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", "all", "", (unsigned long long)all.GetCount(),
+		all.GetPercentile(50)/tpn/1000, all.GetPercentile(90)/tpn/1000, all.GetPercentile(99)/tpn/1000,
+		all.GetPercentile(99.9)/tpn/1000, all.GetMax()/tpn/1000);
+	printf("\nthroughput %.0f req/s, mean latency %.1f us\n", ok/secs, all.GetSum()/tpn/1000/all.GetCount());
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fmt = KNV_CAPTURE_BIN;
+	int window = 64, port = -1, timeout_ms = 1000;
+	double rate = 0, speed = 0, duration = 10;
+	uint64_t max_reqs = 0;
+
+	while((opt=getopt(argc, argv, "thbc:r:x:d:n:p:T:")) != -1)
+	{
+		switch(opt)
+		{
+		case 't': fmt = KNV_CAPTURE_TCPDUMP; break;
+		case 'h': fmt = KNV_CAPTURE_HEX; break;
+		case 'b': fmt = KNV_CAPTURE_BIN; break;
+		case 'c': window = atoi(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'n': max_reqs = strtoull(optarg, NULL, 10); break;
+		case 'p': port = atoi(optarg); break;
+		case 'T': timeout_ms = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+
+	if(optind+2!=argc || window<=0 || (rate>0 && speed>0))
+	{
+	usage:
+		printf("knvbench v%d.%d %s\n", LIB_KNV_MAJOR_VERSION, LIB_KNV_MINOR_VERSION, LIB_KNV_EXTRA_VERSION);
+		printf("usage: %s [-t|-h|-b] [-c window] [-r rate | -x speed] [-d seconds] [-n count] [-p port] [-T timeout_ms] <capture> <ip:port>\n", argv[0]);
+		printf("  replay the requests in a capture against a server over UDP, round and round, with\n");
+		printf("  sequences of our own, then show throughput and latency by command\n");
+		printf("  -t          capture is output of tcpdump -X, as for knvshow -t\n");
+		printf("  -h          capture is a hex string of packets, as for knvshow -h\n");
+		printf("  -b          capture is packets back to back, e.g. from knvshow -ct (default)\n");
+		printf("  -c window   requests in flight at most, default 64\n");
+		printf("  -r rate     requests per second, default as many as the window allows\n");
+		printf("  -x speed    send at the pace of the tcpdump capture, speed times as fast\n");
+		printf("  -d seconds  run for this long, default 10\n");
+		printf("  -n count    stop after count requests\n");
+		printf("  -p port     only replay packets sent to port in the capture, default the port of\n");
+		printf("              <ip:port>, 0 for all; packets without ports, e.g. of -h/-b, are replayed\n");
+		printf("  -T ms       timeout of a request, default 1000\n");
+		printf("  <capture>   file name, - for stdin\n");
+		return 1;
+	}
+
+	string addr = argv[optind+1];
+	size_t colon = addr.rfind(':');
+	if(colon==string::npos)
+	{
+		fprintf(stderr, "server address should be ip:port\n");
+		return 1;
+	}
+	KnvNet::KnvSockAddr server(addr.substr(0, colon).c_str(), atoi(addr.c_str()+colon+1));
+	if(port<0)
+		port = atoi(addr.c_str()+colon+1);
+
+	KnvCapture cap;
+	if(cap.Load(argv[optind], fmt))
+	{
+		fprintf(stderr, "loading capture failed: %s\n", cap.GetErrorMsg().c_str());
+		return 2;
+	}
+	vector<KnvProtocol *> reqs;
+	vector<double> ts;
+	int elsewhere;
+	int dropped = load_requests(cap, port, reqs, ts, elsewhere);
+	printf("%d requests loaded, ", (int)reqs.size());
+	if(port)
+		printf("%d packets not sent to port %d, ", elsewhere, port);
+	printf("%d invalid or too large, %llu bytes skipped\n", dropped, (unsigned long long)cap.GetSkippedBytes());
+	if(reqs.empty())
+		return 2;
+
+	// a pass over the capture takes as long as it was captured, plus one mean gap before it repeats
+	double span = 0;
+	if(speed>0)
+	{
+		span = ts.back() - ts[0];
+		if(span<=0)
+		{
+			fprintf(stderr, "the capture has no timestamps to keep pace with\n");
+			return 1;
+		}
+		span += span/reqs.size();
+	}
+
+	KnvClient cli(window);
+	if(cli.Start(server))
+	{
+		fprintf(stderr, "starting client failed: %s\n", cli.GetErrorMsg().c_str());
+		return 3;
+	}
+
+	bench_stats st;
+	memset(&st, 0, sizeof(st));
+	uint64_t sent = 0, rejected = 0, last_done = 0;
+	uint64_t start = now_ns(), end = start + (uint64_t)(duration*1e9);
+	uint64_t next_report = start + 1000000000;
+	while(max_reqs==0 || sent<max_reqs)
+	{
+		uint64_t now = now_ns();
+		if(now>=end)
+			break;
+		if(now>=next_report)
+		{
+			uint64_t done = __atomic_load_n(&st.ok, __ATOMIC_RELAXED);
+			printf("%3llus: sent %llu, replied %llu, %llu req/s\n", (unsigned long long)(now-start)/1000000000,
+				(unsigned long long)sent, (unsigned long long)done, (unsigned long long)(done-last_done));
+			last_done = done;
+			next_report += 1000000000;
+		}
+
+		size_t i = sent % reqs.size();
+		uint64_t due = start;
+		if(rate>0)
+			due += (uint64_t)(sent*1e9/rate);
+		else if(speed>0)
+			due += (uint64_t)(((ts[i]-ts[0]) + (sent/reqs.size())*span)*1e9/speed);
+		if(due>now)
+		{
+			if(due-now>200000)
+				usleep((due-now)/1000 - 100);
+			else
+				sched_yield();
+			continue;
+		}
+		if(cli.GetPendingNum()>=window)
+		{
+			sched_yield();
+			continue;
+		}
+		if(cli.Call(*reqs[i], timeout_ms, on_reply, &st))
+			rejected ++;
+		sent ++;
+	}
+	double secs = (now_ns()-start)/1e9;
+	while(cli.GetPendingNum()>0)
+		usleep(1000);
+	cli.Stop();
+
+	printf("\nsent %llu in %.2f s, replied %llu, timed out %llu, failed %llu, not sent %llu\n", (unsigned long long)sent, secs,
+		(unsigned long long)st.ok, (unsigned long long)st.timeouts, (unsigned long long)st.failed, (unsigned long long)rejected);
+	show_latency(st.ok, secs);
+
+	for(size_t i=0; i<reqs.size(); i++)
+		delete reqs[i];
+	return st.ok? 0 : 4;
+}
@@ -0,0 +1,237 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_capture.cc
+// Implementation of KnvCapture
+//
+// 2026-10-18	Created
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "knv_capture.h"
+#include "knv_tcp.h"
+
+static inline int hex_val(char c)
+{
+	if(c>='0' && c<='9') return c - '0';
+	if(c>='a' && c<='f') return c - 'a' + 10;
+	return c - 'A' + 10;
+}
+
+int KnvCapture::HexToBin(const char *hex, int len, string &bin)
+{
+	int n = 0, hi = -1;
+	for(int i=0; i<len; i++)
+	{
+		if(!isxdigit((unsigned char)hex[i]))
+			continue;
+		if(hi<0)
+		{
+			hi = hex_val(hex[i]);
+			continue;
+		}
+		bin += (char)((hi<<4) | hex_val(hex[i]));
+		hi = -1;
+		n ++;
+	}
+	return n;
+}
+
+int KnvCapture::Load(const char *path, int fmt)
+{
+	FILE *fp = strcmp(path, "-")? fopen(path, "r") : stdin;
+	if(fp==NULL)
+	{
+		errmsg = string("failed to open ") + path + ": " + strerror(errno);
+		return -1;
+	}
+	string text;
+	char buf[65536];
+	size_t n;
+	while((n=fread(buf, 1, sizeof(buf), fp))>0)
+		text.append(buf, n);
+	bool failed = ferror(fp);
+	if(fp!=stdin)
+		fclose(fp);
+	if(failed)
+	{
+		errmsg = string("failed to read ") + path;
+		return -2;
+	}
+	return Parse(text, fmt);
+}
+
+int KnvCapture::Parse(const string &text, int fmt)
+{
+	if(fmt==KNV_CAPTURE_BIN)
+	{
+		AddPayload(text.data(), text.length(), 0, 0, 0);
+		return 0;
+	}
+	if(fmt==KNV_CAPTURE_HEX)
+	{
+		string bin;
+		HexToBin(text.data(), text.length(), bin);
+		AddPayload(bin.data(), bin.length(), 0, 0, 0);
+		return 0;
+	}
+	if(fmt==KNV_CAPTURE_TCPDUMP)
+		return ParseTcpdump(text);
+	errmsg = "unknown format";
+	return -1;
+}
+
+void KnvCapture::AddPayload(const char *data, int len, double ts, uint16_t sport, uint16_t dport)
+{
+	int off = 0;
+	while(off<len)
+	{
+		int64_t flen = KnvTcpFramer::GetFrameLength(data+off, len-off);
+		if(flen<=0 || flen>len-off) // not a packet, or cut short
+		{
+			skipped += len - off;
+			return;
+		}
+		KnvCapturePacket p;
+		p.ts = ts;
+		p.sport = sport;
+		p.dport = dport;
+		pkts.push_back(p);
+		pkts.back().data.assign(data+off, flen);
+		off += flen;
+	}
+}
+
+void KnvCapture::AddIpPacket(const string &ip, double ts)
+{
+	const uint8_t *b = (const uint8_t *)ip.data();
+	size_t n = ip.length(), off = 0, l4, end;
+	int proto;
+
+	// tcpdump -XX dumps the link layer too
+	if(n>=14 && (b[0]>>4)!=4 && (b[0]>>4)!=6)
+	{
+		uint16_t type = (b[12]<<8) | b[13];
+		if(type==0x8100 && n>=18) // VLAN tag
+		{
+			type = (b[16]<<8) | b[17];
+			off = 4;
+		}
+		if(type==0x0800 || type==0x86dd)
+			off += 14;
+	}
+	if(n>=off+20 && (b[off]>>4)==4)
+	{
+		l4 = off + (b[off]&15)*4;
+		end = off + ((b[off+2]<<8) | b[off+3]);
+		proto = b[off+9];
+	}
+	else if(n>=off+40 && (b[off]>>4)==6) // extension headers are not followed
+	{
+		l4 = off + 40;
+		end = l4 + ((b[off+4]<<8) | b[off+5]);
+		proto = b[off+6];
+	}
+	else
+	{
+		skipped += n;
+		return;
+	}
+	if(end>n) // snapped short
+		end = n;
+
+	size_t hlen;
+	if(proto==17 && end>=l4+8)
+		hlen = 8;
+	else if(proto==6 && end>=l4+20)
+		hlen = (b[l4+12]>>4)*4;
+	else
+	{
+		skipped += n;
+		return;
+	}
+	if(l4+hlen>end)
+	{
+		skipped += n;
+		return;
+	}
+	AddPayload((const char *)b+l4+hlen, end-l4-hlen, ts, (b[l4]<<8) | b[l4+1], (b[l4+2]<<8) | b[l4+3]);
+}
+
+// the capture time as seconds, from HH:MM:SS.frac or seconds since the epoch (tcpdump -tt)
+static double parse_ts(const char *ln)
+{
+	int h, m;
+	double s;
+	if(sscanf(ln, "%d:%d:%lf", &h, &m, &s)==3)
+		return h*3600 + m*60 + s;
+	if(isdigit((unsigned char)ln[0]))
+		return strtod(ln, NULL);
+	return 0;
+}
+
+int KnvCapture::ParseTcpdump(const string &text)
+{
+	string ip;
+	double ts = 0;
+	bool in_pkt = false;
+	size_t pos = 0;
+	while(pos<text.length())
+	{
+		size_t eol = text.find('\n', pos);
+		if(eol==string::npos)
+			eol = text.length();
+		string ln = text.substr(pos, eol-pos);
+		pos = eol + 1;
+		if(ln.empty())
+			continue;
+
+		if(ln[0]!=' ' && ln[0]!='\t') // a header line starts a packet
+		{
+			if(in_pkt)
+				AddIpPacket(ip, ts);
+			ip.clear();
+			ts = parse_ts(ln.c_str());
+			in_pkt = true;
+			continue;
+		}
+
+		// "\t0x0010:  4500 0054 a3c1 ...  E..T.." -- groups of hex digits split by one space,
+		// two spaces start the printable dump
+		size_t colon = ln.find(':');
+		if(!in_pkt || colon==string::npos || ln.find("0x")==string::npos || ln.find("0x")>colon)
+			continue;
+		const char *p = ln.c_str() + colon + 1;
+		while(*p==' ')
+			p ++;
+		while(isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]))
+		{
+			ip += (char)((hex_val(p[0])<<4) | hex_val(p[1]));
+			p += 2;
+			if(isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]))
+			{
+				ip += (char)((hex_val(p[0])<<4) | hex_val(p[1]));
+				p += 2;
+			}
+			if(p[0]!=' ' || p[1]==' ')
+				break;
+			p ++;
+		}
+	}
+	if(in_pkt)
+		AddIpPacket(ip, ts);
+	if(pkts.empty())
+	{
+		errmsg = "no packet found";
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_capture.h
+// Reading packets out of captured traffic
+//
+// KnvCapture takes the same inputs as knvshow, but a whole capture of them:
+//   KNV_CAPTURE_BIN     -- packets back to back, e.g. written by knvshow -ct or recorded by a server
+//   KNV_CAPTURE_HEX     -- the same as a hex string, characters other than hex digits are ignored
+//   KNV_CAPTURE_TCPDUMP -- output of tcpdump -X (or -XX), one IPv4/IPv6 UDP or TCP packet per header
+//                          line, which also gives the capture time and the ports
+// Payloads are cut into packets by KnvTcpFramer::GetFrameLength(), so a TCP segment may
+// carry several packets; bytes that are not a whole packet are skipped and counted.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_CAPTURE__
+#define __KNV_CAPTURE__
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+#define KNV_CAPTURE_BIN		0
+#define KNV_CAPTURE_HEX		1
+#define KNV_CAPTURE_TCPDUMP	2
+
+struct KnvCapturePacket
+{
+	double ts;              // seconds of the day it was captured, 0 if not known
+	uint16_t sport, dport;  // 0 if not known
+	string data;
+};
+
+class KnvCapture
+{
+public:
+	KnvCapture() : skipped(0) {}
+
+	// hex digits of hex[0..len) in pairs to bin, other characters are skipped
+	// returns the number of bytes converted
+	static int HexToBin(const char *hex, int len, string &bin);
+
+	// add the packets of file path ("-" for stdin) in fmt, returns 0 on success
+	int Load(const char *path, int fmt);
+	// add the packets of text in fmt, returns 0 on success
+	int Parse(const string &text, int fmt);
+
+	const vector<KnvCapturePacket> &GetPackets() const { return pkts; }
+	// bytes that could not be taken as packets
+	uint64_t GetSkippedBytes() const { return skipped; }
+	void Clear() { pkts.clear(); skipped = 0; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	// cut data into packets
+	void AddPayload(const char *data, int len, double ts, uint16_t sport, uint16_t dport);
+	// the payload of an IP packet, with or without an ethernet header
+	void AddIpPacket(const string &ip, double ts);
+	int ParseTcpdump(const string &text);
+
+	vector<KnvCapturePacket> pkts;
+	uint64_t skipped;
+	string errmsg;
+};
+
+#endif
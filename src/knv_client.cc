@@ -0,0 +1,525 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_client.cc
+// Implementation of KnvClient and KnvClientFuture
+//
+// 2026-10-18	Created
+// 2026-10-18	Call latency by command
+//
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "knv_client.h"
+#include "knv_udp_server.h"
+#include "knv_metrics.h"
+#include "knv_latency.h"
+
+static inline uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+KnvClientFuture::KnvClientFuture() : done(true), result(KNV_CLIENT_OK)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&lock, NULL);
+}
+
+KnvClientFuture::~KnvClientFuture()
+{
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void KnvClientFuture::Reset()
+{
+	pthread_mutex_lock(&lock);
+	done = false;
+	result = KNV_CLIENT_OK;
+	reply.clear();
+	pthread_mutex_unlock(&lock);
+}
+
+void KnvClientFuture::Complete(int ret, KnvProtocol *rsp)
+{
+	string s;
+	if(rsp && rsp->Encode(s)<0) // a received reply is encoded as received
+		ret = KNV_CLIENT_ERR_BAD_REPLY;
+	pthread_mutex_lock(&lock);
+	reply.swap(s);
+	result = ret;
+	done = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+bool KnvClientFuture::IsDone()
+{
+	pthread_mutex_lock(&lock);
+	bool d = done;
+	pthread_mutex_unlock(&lock);
+	return d;
+}
+
+bool KnvClientFuture::Wait(int timeout_ms)
+{
+	struct timespec ts;
+	if(timeout_ms>=0)
+	{
+		uint64_t deadline = now_us() + (uint64_t)timeout_ms*1000;
+		ts.tv_sec = deadline/1000000;
+		ts.tv_nsec = (deadline%1000000)*1000;
+	}
+	pthread_mutex_lock(&lock);
+	while(!done)
+	{
+		if(timeout_ms<0)
+			pthread_cond_wait(&cond, &lock);
+		else if(pthread_cond_timedwait(&cond, &lock, &ts)==ETIMEDOUT)
+			break;
+	}
+	bool d = done;
+	pthread_mutex_unlock(&lock);
+	return d;
+}
+
+KnvClient::KnvClient(int w, int t) : window(w), tick_ms(t), fd(-1), epfd(-1), evfd(-1),
+	started(false), stopping(false), sleeping(false), closed(true), next_seq(0), nr_pending(0), last_tick(0)
+{
+	if(window<1) window = 1;
+	if(tick_ms<1) tick_ms = 1;
+	pthread_mutex_init(&lock, NULL);
+}
+
+KnvClient::~KnvClient()
+{
+	Stop();
+	pthread_mutex_destroy(&lock);
+}
+
+uint64_t KnvClient::NowTick()
+{
+	return now_us()/1000/tick_ms;
+}
+
+int KnvClient::Start(const KnvNet::KnvSockAddr &addr)
+{
+	if(started)
+	{
+		errmsg = "already started";
+		return -1;
+	}
+
+	server = addr;
+	fd = socket(server.addr.sa_family, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(fd<0 || connect(fd, &server.addr, server.addr_len))
+	{
+		errmsg = "connecting socket failed: "; errmsg += strerror(errno);
+		goto fail;
+	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	evfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(epfd<0 || evfd<0)
+	{
+		errmsg = "creating epoll/eventfd failed: "; errmsg += strerror(errno);
+		goto fail;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		errmsg = "epoll_ctl failed: "; errmsg += strerror(errno);
+		goto fail;
+	}
+	ev.data.fd = evfd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev))
+	{
+		errmsg = "epoll_ctl failed: "; errmsg += strerror(errno);
+		goto fail;
+	}
+
+	try
+	{
+		entries.resize(window);
+		free_entries.clear();
+		for(int i=window-1; i>=0; i--)
+			free_entries.push_back(i);
+		wheel.assign(KNV_CLIENT_WHEEL_SLOTS, -1);
+		msgs.resize(KNV_CLIENT_BATCH);
+		iovs.resize(KNV_CLIENT_BATCH);
+		rx_mem.assign(KNV_CLIENT_BATCH, NULL);
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		goto fail;
+	}
+
+	last_tick = NowTick();
+	stopping = false;
+	closed = false;
+	if(pthread_create(&thread, NULL, LoopEntry, this))
+	{
+		errmsg = "pthread_create failed";
+		closed = true;
+		goto fail;
+	}
+	started = true;
+	return 0;
+
+fail:
+	if(fd>=0) close(fd);
+	if(epfd>=0) close(epfd);
+	if(evfd>=0) close(evfd);
+	fd = epfd = evfd = -1;
+	return -2;
+}
+
+void KnvClient::Stop()
+{
+	if(!started)
+		return;
+	uint64_t one = 1;
+	stopping = true;
+	if(write(evfd, &one, sizeof(one))<0) {} // the flag is set anyway
+	pthread_join(thread, NULL);
+	started = false;
+	close(fd);
+	close(epfd);
+	close(evfd);
+	fd = epfd = evfd = -1;
+}
+
+int KnvClient::Call(KnvProtocol &req, int timeout_ms, KnvClientCallback cb, void *arg)
+{
+	return Submit(req, timeout_ms, cb, arg, NULL);
+}
+
+int KnvClient::Call(KnvProtocol &req, int timeout_ms, KnvClientFuture &f)
+{
+	return Submit(req, timeout_ms, NULL, NULL, &f);
+}
+
+int KnvClient::Submit(KnvProtocol &req, int timeout_ms, KnvClientCallback cb, void *arg, KnvClientFuture *f)
+{
+	bool in_loop = started && pthread_equal(pthread_self(), thread);
+	Request r;
+	r.seq = __sync_add_and_fetch(&next_seq, 1);
+	r.timeout_ms = timeout_ms;
+	r.cb = cb;
+	r.arg = arg;
+	r.future = f;
+	if(req.SetSequence(r.seq) || req.Encode(r.pkt)<0)
+		return KNV_CLIENT_CALL_BAD_REQUEST;
+	if(r.pkt.length()>KNV_UDP_MAX_PKT_SIZE-100) // no room in a datagram
+		return KNV_CLIENT_CALL_TOO_LARGE;
+	if(f)
+		f->Reset();
+
+	bool wake = false, ok = true;
+	__sync_fetch_and_add(&nr_pending, 1);
+	if(in_loop) // no other thread touches the queue
+	{
+		if(closed)
+			goto closed;
+		try { queued.push_back(Request()); } catch(...) { ok = false; }
+		if(ok)
+			MoveRequest(queued.back(), r);
+	}
+	else
+	{
+		pthread_mutex_lock(&lock);
+		if(closed)
+		{
+			pthread_mutex_unlock(&lock);
+			goto closed;
+		}
+		try { submitted.push_back(Request()); } catch(...) { ok = false; }
+		if(ok)
+		{
+			MoveRequest(submitted.back(), r);
+			wake = sleeping;
+			sleeping = false;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	if(!ok)
+	{
+		__sync_fetch_and_sub(&nr_pending, 1);
+		return KNV_CLIENT_CALL_NO_MEMORY;
+	}
+
+	KnvMetrics::Add(KNV_METRIC_CLIENT_CALLS, 1);
+	if(wake)
+	{
+		uint64_t one = 1;
+		if(write(evfd, &one, sizeof(one))<0) {} // the loop is awake already
+	}
+	return 0;
+
+closed:
+	__sync_fetch_and_sub(&nr_pending, 1);
+	return KNV_CLIENT_CALL_NOT_RUNNING;
+}
+
+void *KnvClient::LoopEntry(void *arg)
+{
+	((KnvClient *)arg)->Loop();
+	return NULL;
+}
+
+// the packet is swapped rather than copied
+void KnvClient::MoveRequest(Request &to, Request &from)
+{
+	to.seq = from.seq;
+	to.timeout_ms = from.timeout_ms;
+	to.cb = from.cb;
+	to.arg = from.arg;
+	to.future = from.future;
+	to.pkt.swap(from.pkt);
+}
+
+void KnvClient::TakeSubmitted()
+{
+	deque<Request> q;
+	pthread_mutex_lock(&lock);
+	q.swap(submitted);
+	pthread_mutex_unlock(&lock);
+	if(queued.empty())
+	{
+		queued.swap(q);
+		return;
+	}
+	for(size_t i=0; i<q.size(); i++)
+	{
+		queued.push_back(Request());
+		MoveRequest(queued.back(), q[i]);
+	}
+}
+
+void KnvClient::Link(int idx)
+{
+	Entry &e = entries[idx];
+	int &head = wheel[e.deadline & (KNV_CLIENT_WHEEL_SLOTS-1)];
+	e.prev = -1;
+	e.next = head;
+	if(head>=0)
+		entries[head].prev = idx;
+	head = idx;
+}
+
+void KnvClient::Unlink(int idx)
+{
+	Entry &e = entries[idx];
+	if(e.prev>=0)
+		entries[e.prev].next = e.next;
+	else
+		wheel[e.deadline & (KNV_CLIENT_WHEEL_SLOTS-1)] = e.next;
+	if(e.next>=0)
+		entries[e.next].prev = e.prev;
+}
+
+void KnvClient::SendQueued()
+{
+	uint64_t now_tick = NowTick();
+	while(!queued.empty() && !free_entries.empty())
+	{
+		int k = 0;
+		for(deque<Request>::iterator it=queued.begin(); it!=queued.end() && k<KNV_CLIENT_BATCH && !free_entries.empty(); ++it, ++k)
+		{
+			int idx = free_entries.back();
+			free_entries.pop_back();
+			Entry &e = entries[idx];
+			e.seq = it->seq;
+			// at least timeout_ms from now, whatever part of the current tick is gone
+			e.deadline = now_tick + (it->timeout_ms + tick_ms - 1)/tick_ms + 1;
+			e.cb = it->cb;
+			e.arg = it->arg;
+			e.future = it->future;
+			e.sent = KnvLatency::Now();
+			by_seq[e.seq] = idx;
+			Link(idx);
+
+			iovs[k].iov_base = &it->pkt[0];
+			iovs[k].iov_len = it->pkt.length();
+			memset(&msgs[k].msg_hdr, 0, sizeof(msgs[k].msg_hdr));
+			msgs[k].msg_hdr.msg_iov = &iovs[k];
+			msgs[k].msg_hdr.msg_iovlen = 1;
+		}
+
+		// requests not sent, e.g. the socket buffer is full, are taken as lost and time out
+		int n = sendmmsg(fd, &msgs[0], k, MSG_DONTWAIT);
+		if(n<k)
+			KnvMetrics::Add(KNV_METRIC_CLIENT_SEND_FAILED, k-(n>0? n:0));
+		for(int i=0; i<k; i++)
+			queued.pop_front();
+	}
+}
+
+int KnvClient::RecvBatch()
+{
+	for(int i=0; i<KNV_CLIENT_BATCH; i++)
+	{
+		if(rx_mem[i]==NULL && (rx_mem[i]=UcMemManager::Alloc(KNV_UDP_MAX_PKT_SIZE))==NULL)
+			return -1;
+		iovs[i].iov_base = rx_mem[i]->ptr();
+		iovs[i].iov_len = KNV_UDP_MAX_PKT_SIZE;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int n = recvmmsg(fd, &msgs[0], KNV_CLIENT_BATCH, MSG_DONTWAIT, NULL);
+	if(n<=0)
+		return 0;
+	for(int i=0; i<n; i++)
+	{
+		if(!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+			Process(rx_mem[i], msgs[i].msg_len);
+		UcMemManager::Free(rx_mem[i]); // the reassembler keeps references of its own
+		rx_mem[i] = NULL;
+	}
+	return n;
+}
+
+void KnvClient::Process(UcMem *m, int len)
+{
+	KnvProtocol pkt(m, (char *)m->ptr(), len);
+	KnvProtocol *full = NULL, *rsp = &pkt;
+	if(!pkt.IsValid())
+	{
+		KnvMetrics::Add(KNV_METRIC_CLIENT_UNMATCHED, 1);
+		return;
+	}
+	if(!pkt.IsComplete())
+	{
+		if(reasm.Add(server, pkt, full)<=0 || full==NULL)
+			return;
+		rsp = full;
+	}
+
+	tr1::unordered_map<uint64_t, int>::iterator it = by_seq.find(rsp->GetSequence());
+	if(it==by_seq.end()) // a late reply of a timed out call
+		KnvMetrics::Add(KNV_METRIC_CLIENT_UNMATCHED, 1);
+	else
+	{
+		KnvLatency::Record(rsp->GetCommand(), rsp->GetRetCode(), KNV_LAT_CALL, KnvLatency::Now()-entries[it->second].sent);
+		Complete(it->second, KNV_CLIENT_OK, rsp);
+	}
+	delete full;
+}
+
+void KnvClient::Finish(KnvClientCallback cb, void *arg, KnvClientFuture *f, int ret, KnvProtocol *rsp)
+{
+	__sync_fetch_and_sub(&nr_pending, 1);
+	if(cb)
+		cb(ret, rsp, arg);
+	if(f)
+		f->Complete(ret, rsp);
+}
+
+void KnvClient::Complete(int idx, int ret, KnvProtocol *rsp)
+{
+	Entry &e = entries[idx];
+	Unlink(idx);
+	by_seq.erase(e.seq);
+	free_entries.push_back(idx);
+	if(ret==KNV_CLIENT_ERR_TIMEOUT)
+		KnvMetrics::Add(KNV_METRIC_CLIENT_TIMEOUTS, 1);
+	// the entry may be reused by calls made from the callback, but only once they are sent
+	Finish(e.cb, e.arg, e.future, ret, rsp);
+}
+
+void KnvClient::Expire(uint64_t now_tick)
+{
+	if(now_tick<=last_tick)
+		return;
+	uint64_t t = last_tick + 1;
+	if(now_tick-last_tick >= KNV_CLIENT_WHEEL_SLOTS) // all slots are due
+		t = now_tick - KNV_CLIENT_WHEEL_SLOTS + 1;
+	for(; t<=now_tick; t++)
+	{
+		int idx = wheel[t & (KNV_CLIENT_WHEEL_SLOTS-1)];
+		while(idx>=0)
+		{
+			int next = entries[idx].next;
+			if(entries[idx].deadline<=now_tick) // otherwise it is due in a later round
+				Complete(idx, KNV_CLIENT_ERR_TIMEOUT, NULL);
+			idx = next;
+		}
+	}
+	last_tick = now_tick;
+}
+
+void KnvClient::Loop()
+{
+	struct epoll_event evs[2];
+	while(!stopping)
+	{
+		TakeSubmitted();
+		SendQueued();
+
+		// wake up each tick while calls are in flight
+		int timeout = by_seq.empty()? 1000 : tick_ms;
+		pthread_mutex_lock(&lock);
+		if(submitted.empty())
+			sleeping = true;
+		else
+			timeout = 0;
+		pthread_mutex_unlock(&lock);
+
+		int n = epoll_wait(epfd, evs, 2, timeout);
+		for(int i=0; i<n; i++)
+		{
+			if(evs[i].data.fd==evfd)
+			{
+				uint64_t v;
+				if(read(evfd, &v, sizeof(v))<0) {} // drained
+				continue;
+			}
+			for(int round=0; round<16 && RecvBatch()==KNV_CLIENT_BATCH; round++)
+				;
+		}
+		Expire(NowTick());
+		reasm.Expire();
+	}
+
+	// complete everything left, calls made from these callbacks are refused
+	deque<Request> q;
+	pthread_mutex_lock(&lock);
+	closed = true;
+	sleeping = false;
+	q.swap(submitted);
+	pthread_mutex_unlock(&lock);
+	for(size_t i=0; i<queued.size(); i++)
+		Finish(queued[i].cb, queued[i].arg, queued[i].future, KNV_CLIENT_ERR_STOPPED, NULL);
+	queued.clear();
+	for(size_t i=0; i<q.size(); i++)
+		Finish(q[i].cb, q[i].arg, q[i].future, KNV_CLIENT_ERR_STOPPED, NULL);
+	while(!by_seq.empty())
+		Complete(by_seq.begin()->second, KNV_CLIENT_ERR_STOPPED, NULL);
+	reasm.Clear();
+	for(size_t i=0; i<rx_mem.size(); i++)
+	{
+		if(rx_mem[i])
+			UcMemManager::Free(rx_mem[i]);
+		rx_mem[i] = NULL;
+	}
+}
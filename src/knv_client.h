@@ -0,0 +1,194 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_client.h
+// Pipelined asynchronous client over UDP
+//
+// KnvClient keeps many requests in flight to one server on one socket. Each request gets
+// a sequence of the client's own, replies are matched by it, and split replies are put
+// together by a KnvReassembler. A request without a reply is completed with
+// KNV_CLIENT_ERR_TIMEOUT by a timer wheel.
+//
+// The client runs an event loop thread of its own, which sends, receives and completes
+// the calls: a callback is invoked in that thread, while a KnvClientFuture can be waited
+// on by any thread. Requests are encoded by the calling thread, so that nothing allocated
+// from one thread's pools is handed to another. Calls made from a callback skip the queue
+// between threads.
+//
+// The time from sending a request to its reply is recorded as KNV_LAT_CALL of the
+// command, see knv_latency.h.
+//
+// 2026-10-18	Created
+// 2026-10-18	Call latency by command
+// 2026-10-18	Call() returns KNV_CLIENT_CALL_* instead of setting the error message
+//
+
+#ifndef __KNV_CLIENT__
+#define __KNV_CLIENT__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include <tr1/unordered_map>
+#include "protocol.h"
+#include "knv_reassembler.h"
+
+using namespace std;
+
+#define KNV_CLIENT_DEFAULT_WINDOW	1024
+#define KNV_CLIENT_WHEEL_SLOTS		1024 // ticks of the timer wheel, longer timeouts go round again
+#define KNV_CLIENT_BATCH		64   // packets per sendmmsg()/recvmmsg()
+
+// results of a call
+#define KNV_CLIENT_OK			0
+#define KNV_CLIENT_ERR_TIMEOUT		-1 // no (complete) reply within the timeout
+#define KNV_CLIENT_ERR_STOPPED		-2 // the client stopped before the reply came
+#define KNV_CLIENT_ERR_BAD_REPLY	-3 // the reply can not be decoded
+
+// failures returned by Call(), which leaves the error message alone, as it may run in several threads
+#define KNV_CLIENT_CALL_BAD_REQUEST	-1 // encoding failed, see req.GetErrorMsg()
+#define KNV_CLIENT_CALL_TOO_LARGE	-2 // the request does not fit in a datagram
+#define KNV_CLIENT_CALL_NO_MEMORY	-3
+#define KNV_CLIENT_CALL_NOT_RUNNING	-4 // not started, or stopped
+
+// Called in the client's thread when a call is done
+//   ret -- KNV_CLIENT_OK with the reply in rsp, or KNV_CLIENT_ERR_* with rsp NULL
+//   rsp -- valid during the callback only
+typedef void (*KnvClientCallback)(int ret, KnvProtocol *rsp, void *arg);
+
+class KnvClientFuture
+{
+public:
+	KnvClientFuture();
+	~KnvClientFuture();
+
+	// wait up to timeout_ms (<0 for ever) for the call to be done, returns true if it is
+	bool Wait(int timeout_ms = -1);
+	bool IsDone();
+	// once done: KNV_CLIENT_OK, or one of KNV_CLIENT_ERR_*
+	int GetResult() const { return result; }
+	// the encoded reply, to be decoded by the waiting thread, e.g. by KnvProtocol(s.data(), s.length(), false)
+	const string &GetReply() const { return reply; }
+
+private:
+	KnvClientFuture(const KnvClientFuture &);
+	KnvClientFuture &operator=(const KnvClientFuture &);
+
+	void Reset();
+	void Complete(int ret, KnvProtocol *rsp);
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	int result;
+	string reply;
+
+	friend class KnvClient;
+};
+
+class KnvClient
+{
+public:
+	// window: requests in flight at most, more are queued
+	// tick_ms: resolution of the timeouts
+	KnvClient(int window = KNV_CLIENT_DEFAULT_WINDOW, int tick_ms = 1);
+	~KnvClient();
+
+	// connect to server and start the event loop thread, returns 0 on success
+	int Start(const KnvNet::KnvSockAddr &server);
+	// stop the event loop, calls not done yet are completed with KNV_CLIENT_ERR_STOPPED
+	void Stop();
+
+	// Send req, its sequence is replaced by the client's; can be called from any thread
+	// and from callbacks. To get split replies, allow them by req.SetReqSplit().
+	// timeout_ms: the call is completed with KNV_CLIENT_ERR_TIMEOUT after this
+	// returns 0 if req is queued, or KNV_CLIENT_CALL_* on failure, then the callback is not invoked
+	int Call(KnvProtocol &req, int timeout_ms, KnvClientCallback cb, void *arg = NULL);
+	// f must not be in another call, and must live until it is done
+	int Call(KnvProtocol &req, int timeout_ms, KnvClientFuture &f);
+
+	// calls not done yet, including queued ones
+	int GetPendingNum() const { return nr_pending; }
+	const string &GetErrorMsg() const { return errmsg; } // why Start() failed
+
+private:
+	KnvClient(const KnvClient &);
+	KnvClient &operator=(const KnvClient &);
+
+	struct Request
+	{
+		uint64_t seq;
+		int timeout_ms;
+		KnvClientCallback cb;
+		void *arg;
+		KnvClientFuture *future;
+		string pkt;
+	};
+
+	// a call in flight, linked in a slot of the timer wheel
+	struct Entry
+	{
+		uint64_t seq;
+		uint64_t deadline; // in ticks
+		uint64_t sent;     // KnvLatency::Now() when sent
+		KnvClientCallback cb;
+		void *arg;
+		KnvClientFuture *future;
+		int prev, next;
+	};
+
+	static void MoveRequest(Request &to, Request &from);
+	int Submit(KnvProtocol &req, int timeout_ms, KnvClientCallback cb, void *arg, KnvClientFuture *f);
+	static void *LoopEntry(void *arg);
+	void Loop();
+	void TakeSubmitted();
+	void SendQueued();
+	int RecvBatch();
+	void Process(UcMem *m, int len);
+	void Expire(uint64_t now_tick);
+	void Complete(int idx, int ret, KnvProtocol *rsp);
+	void Finish(KnvClientCallback cb, void *arg, KnvClientFuture *f, int ret, KnvProtocol *rsp);
+	void Link(int idx);
+	void Unlink(int idx);
+	uint64_t NowTick();
+
+	int window;
+	int tick_ms;
+	int fd;
+	int epfd;
+	int evfd;
+	KnvNet::KnvSockAddr server;
+	pthread_t thread;
+	bool started;
+	volatile bool stopping;
+
+	// between the calling threads and the loop
+	pthread_mutex_t lock;
+	deque<Request> submitted;
+	bool sleeping; // the loop waits for events, wake it up on submitting
+	bool closed;   // the loop is gone, no more calls
+	uint64_t next_seq;
+	volatile int nr_pending;
+
+	// loop thread only
+	deque<Request> queued;        // waiting for room in the window
+	vector<Entry> entries;        // calls in flight
+	vector<int> free_entries;
+	tr1::unordered_map<uint64_t, int> by_seq;
+	vector<int> wheel;            // first entry of each slot
+	uint64_t last_tick;
+	KnvReassembler reasm;
+	vector<struct mmsghdr> msgs;
+	vector<struct iovec> iovs;
+	vector<UcMem *> rx_mem;
+
+	string errmsg;
+};
+
+#endif
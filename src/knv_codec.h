@@ -10,6 +10,7 @@ Unless required by applicable law or agreed to in writing, software distributed
  * Key-N-Value data encode/decode interface
  *
  * Created 2013-10-10
+ * 2026-10-18 Decoding messages spread over several segments
  */
 
 #ifndef _KNV_CODEC_H_
@@ -73,6 +74,32 @@ typedef struct
 	const char *errmsg;
 }knv_buff_t;
 
+// a message spread over several buffers, see pb_seg_t
+typedef struct
+{
+	const char *data;
+	int len;
+} knv_seg_t;
+
+#define KNV_SEG_SCRATCH_SIZE	256
+
+typedef struct
+{
+	knv_field_t f;
+	uint32_t field_sz;
+	char straddle;
+
+	const knv_seg_t *segs;
+	int nsegs;
+	int seg;
+	int off;
+	uint64_t left;
+	int val_seg;
+	int val_off;
+
+	char scratch[KNV_SEG_SCRATCH_SIZE];
+} knv_seg_iter_t;
+
 
 typedef struct
 {
@@ -93,6 +120,12 @@ typedef struct
 	int (*knv_get_encoded_length)(knv_buff_t *b);
 	int (*knv_eval_field_length)(uint32_t tag, knv_type_t type, const knv_field_val_t *val);
 
+	// functions for iteration through segmented messages
+	knv_field_t *(*knv_seg_begin)(knv_seg_iter_t *it, const knv_seg_t *segs, int nsegs);
+	knv_field_t *(*knv_seg_next)(knv_seg_iter_t *it);
+	knv_field_t *(*knv_seg_enter)(const knv_seg_iter_t *it, knv_seg_iter_t *sub);
+	int (*knv_seg_copy)(const knv_seg_iter_t *it, void *buf);
+
 } knv_codecs_t;
 
 // the main thread is responsible for setting up correct codecs for us
@@ -106,6 +139,10 @@ typedef pb_type_t knv_type_t;
 typedef pb_field_val_t knv_field_val_t;
 typedef pb_field_t knv_field_t;
 typedef pb_buff_t knv_buff_t;
+typedef pb_seg_t knv_seg_t;
+typedef pb_seg_iter_t knv_seg_iter_t;
+
+#define KNV_SEG_SCRATCH_SIZE	PB_SEG_SCRATCH_SIZE
 
 #define KNV_VARINT  PB_TYPE_VARINT
 #define KNV_FIXED64 PB_TYPE_FIXED64
@@ -240,6 +277,45 @@ static inline int knv_eval_field_length(uint32_t tag, knv_type_t type, const knv
 	return pb_eval_field_length(tag, type, val);
 }
 
+// Segmented messages: fields are decoded in place, only a string value that straddles
+// segments is stitched into it->scratch if it is small (it->straddle is set),
+// otherwise val.str.data is NULL, use knv_seg_enter() or knv_seg_copy() for it
+static inline knv_field_t *knv_seg_begin(knv_seg_iter_t *it, const knv_seg_t *segs, int nsegs)
+{
+#ifdef USE_EXTERNAL_CODEC
+	if(g_knv_codecs)
+		return g_knv_codecs->knv_seg_begin(it, segs, nsegs);
+#endif
+	return pb_seg_begin(it, segs, nsegs);
+}
+
+static inline knv_field_t *knv_seg_next(knv_seg_iter_t *it)
+{
+#ifdef USE_EXTERNAL_CODEC
+	if(g_knv_codecs)
+		return g_knv_codecs->knv_seg_next(it);
+#endif
+	return pb_seg_next(it);
+}
+
+static inline knv_field_t *knv_seg_enter(const knv_seg_iter_t *it, knv_seg_iter_t *sub)
+{
+#ifdef USE_EXTERNAL_CODEC
+	if(g_knv_codecs)
+		return g_knv_codecs->knv_seg_enter(it, sub);
+#endif
+	return pb_seg_enter(it, sub);
+}
+
+static inline int knv_seg_copy(const knv_seg_iter_t *it, void *buf)
+{
+#ifdef USE_EXTERNAL_CODEC
+	if(g_knv_codecs)
+		return g_knv_codecs->knv_seg_copy(it, buf);
+#endif
+	return pb_seg_copy(it, buf);
+}
+
 #define KNV_GET_ERROR(p) ((p)->errmsg ? (p)->errmsg : "(none)")
 
 #ifdef __cplusplus
@@ -52,7 +52,13 @@ static knv_codecs_t codecs = // typeof convertion is a trick to suppress compile
     .knv_add_fixed64          = (typeof(codecs.knv_add_fixed64))        pb_add_fixed64,
     .knv_add_user             = (typeof(codecs.knv_add_user))           pb_add_user,
     .knv_get_encoded_length   = (typeof(codecs.knv_get_encoded_length)) my_pb_get_encoded_length,
-	.knv_eval_field_length    = (typeof(codecs.knv_eval_field_length))  my_pb_eval_field_length
+	.knv_eval_field_length    = (typeof(codecs.knv_eval_field_length))  my_pb_eval_field_length,
+
+    // segmented decoders
+    .knv_seg_begin            = (typeof(codecs.knv_seg_begin))          pb_seg_begin,
+    .knv_seg_next             = (typeof(codecs.knv_seg_next))           pb_seg_next,
+    .knv_seg_enter            = (typeof(codecs.knv_seg_enter))          pb_seg_enter,
+    .knv_seg_copy             = (typeof(codecs.knv_seg_copy))           pb_seg_copy
 };
 
 knv_codecs_t *g_knv_codecs = &codecs;
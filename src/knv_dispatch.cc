@@ -0,0 +1,213 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_dispatch.cc
+// Implementation of KnvDispatcher
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include <algorithm>
+#include "knv_dispatch.h"
+
+#define DISPATCH_MAX_DISP	65536    // displacements tried for a bucket before the table grows
+#define DISPATCH_MAX_TABLE_BITS	24       // log2 of the slots at most
+
+static bool BindingLess(const KnvCmdBinding &a, const KnvCmdBinding &b)
+{
+	return a.key < b.key;
+}
+
+KnvDispatcher::KnvDispatcher() : frozen(false), disp_mask(0), table_shift(63), def_h(NULL), def_arg(NULL)
+{
+}
+
+int KnvDispatcher::Register(uint32_t cmd, uint32_t subcmd, KnvCmdHandler h, void *arg, const KnvCmdOptions *opt)
+{
+	if(h==NULL)
+	{
+		errmsg = "no handler";
+		return -1;
+	}
+	KnvCmdBinding b;
+	memset(&b, 0, sizeof(b));
+	b.key = ((uint64_t)cmd<<32) | subcmd;
+	b.h = h;
+	b.arg = arg;
+	if(opt)
+		b.opt = *opt;
+
+	frozen = false;
+	for(size_t i=0; i<bindings.size(); i++)
+	{
+		if(bindings[i].key==b.key)
+		{
+			bindings[i] = b;
+			return 0;
+		}
+	}
+	try
+	{
+		bindings.push_back(b);
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -2;
+	}
+	return 0;
+}
+
+const KnvCmdBinding *KnvDispatcher::FindSlow(uint32_t cmd, uint32_t subcmd) const
+{
+	const KnvCmdBinding *any = NULL;
+	for(size_t i=0; i<bindings.size(); i++)
+	{
+		if(bindings[i].key==(((uint64_t)cmd<<32) | subcmd))
+			return &bindings[i];
+		if(bindings[i].key==(((uint64_t)cmd<<32) | KNV_ANY_SUBCMD))
+			any = &bindings[i];
+	}
+	return any;
+}
+
+// bigger buckets are placed first, while the table is still empty
+static bool BucketLarger(const vector<uint32_t> *a, const vector<uint32_t> *b)
+{
+	return a->size() > b->size();
+}
+
+int KnvDispatcher::Build(const vector<uint32_t> &cmds, int table_bits, uint32_t nr_buckets)
+{
+	uint32_t table_size = 1U << table_bits;
+	int shift = 64 - table_bits;
+	vector<vector<uint32_t> > buckets(nr_buckets);
+	for(size_t i=0; i<cmds.size(); i++)
+		buckets[(Mix(cmds[i])>>32) & (nr_buckets-1)].push_back(cmds[i]);
+	vector<vector<uint32_t> *> order;
+	for(uint32_t i=0; i<nr_buckets; i++)
+		if(!buckets[i].empty())
+			order.push_back(&buckets[i]);
+	stable_sort(order.begin(), order.end(), BucketLarger);
+
+	Slot empty;
+	memset(&empty, 0, sizeof(empty));
+	table.assign(table_size, empty);
+	disp.assign(nr_buckets, 0);
+	vector<uint32_t> slots;
+	for(size_t i=0; i<order.size(); i++)
+	{
+		const vector<uint32_t> &bk = *order[i];
+		uint32_t d;
+		for(d=0; d<DISPATCH_MAX_DISP; d++)
+		{
+			slots.clear();
+			size_t j;
+			for(j=0; j<bk.size(); j++)
+			{
+				uint32_t s = Place(Mix(bk[j]), d, shift);
+				if(table[s].used || find(slots.begin(), slots.end(), s)!=slots.end())
+					break;
+				slots.push_back(s);
+			}
+			if(j==bk.size())
+				break;
+		}
+		if(d==DISPATCH_MAX_DISP)
+			return -1;
+
+		disp[(Mix(bk[0])>>32) & (nr_buckets-1)] = d;
+		for(size_t j=0; j<bk.size(); j++)
+		{
+			table[slots[j]].used = true;
+			table[slots[j]].cmd = bk[j];
+		}
+	}
+	disp_mask = nr_buckets - 1;
+	table_shift = shift;
+	return 0;
+}
+
+int KnvDispatcher::Freeze()
+{
+	// bindings ordered by command, those to single sub-commands are listed by the slot
+	vector<KnvCmdBinding> sorted(bindings);
+	sort(sorted.begin(), sorted.end(), BindingLess);
+	vector<uint32_t> cmds;
+	for(size_t i=0; i<sorted.size(); i++)
+		if(cmds.empty() || cmds.back()!=(uint32_t)(sorted[i].key>>32))
+			cmds.push_back(sorted[i].key>>32);
+
+	// about 2 slots per command and 4 commands per bucket, both powers of 2
+	uint32_t n = cmds.size();
+	int table_bits = 1;
+	uint32_t nr_buckets = 1;
+	while((1U<<table_bits)<2*n)
+		table_bits ++;
+	while(nr_buckets*4<n)
+		nr_buckets <<= 1;
+
+	try
+	{
+		for(; table_bits<=DISPATCH_MAX_TABLE_BITS; table_bits++)
+		{
+			if(Build(cmds, table_bits, nr_buckets)==0)
+				break;
+		}
+		if(table_bits>DISPATCH_MAX_TABLE_BITS)
+		{
+			errmsg = "no perfect hash found";
+			return -1;
+		}
+
+		subs.clear();
+		for(size_t i=0; i<sorted.size(); i++)
+		{
+			if((uint32_t)sorted[i].key==KNV_ANY_SUBCMD)
+				continue;
+			subs.push_back(sorted[i]);
+		}
+		for(size_t i=0, k=0; i<sorted.size(); i++)
+		{
+			uint32_t cmd = sorted[i].key>>32;
+			uint64_t h = Mix(cmd);
+			Slot &s = table[Place(h, disp[(h>>32) & disp_mask], table_shift)];
+			if((uint32_t)sorted[i].key==KNV_ANY_SUBCMD)
+			{
+				s.any = sorted[i];
+				continue;
+			}
+			if(s.nr_subs==0)
+				s.first_sub = k;
+			s.nr_subs ++;
+			k ++;
+		}
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -2;
+	}
+	frozen = true;
+	return 0;
+}
+
+int KnvDispatcher::Dispatch(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer) const
+{
+	const KnvCmdBinding *b = Find(pkt.GetCommand(), pkt.GetSubCommand());
+	if(b==NULL)
+		return def_h? def_h(pkt, peer, def_arg) : KNV_DISPATCH_REJECTED;
+
+	if(b->opt.max_body_size)
+	{
+		KnvNode *body = pkt.GetBody();
+		if(body && (uint32_t)body->EvaluateSize() > b->opt.max_body_size)
+			return KNV_DISPATCH_REJECTED;
+	}
+	return b->h(pkt, peer, b->arg);
+}
@@ -0,0 +1,143 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_dispatch.h
+// Routing requests to handlers by command and sub-command
+//
+// Handlers are bound at start-up to a command (see RegisterKnvCommand() in commands.h),
+// or to a command and one of its sub-commands, together with options of the command.
+// Freeze() then builds a perfect hash table of the commands: each command is placed by a
+// hash displaced per bucket, so a lookup reads one displacement and one slot, without
+// probing, comparisons down a tree or a chain of switches. Bindings to single sub-commands
+// are listed in the slot of their command.
+//
+// A dispatcher is not changed while requests are routed; registering more handlers
+// unfreezes it, lookups are then linear until the next Freeze().
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_DISPATCH__
+#define __KNV_DISPATCH__
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "protocol.h"
+
+using namespace std;
+
+#define KNV_ANY_SUBCMD		0xffffffffU // binds a handler to all sub-commands of a command
+#define KNV_DISPATCH_REJECTED	((int)0x80000000) // no handler, or the request breaks the options
+
+// Called for each request, pkt is turned into the response in place, e.g. by ReassignBody(),
+// AddBody() or SetRetCode()
+// returns
+//   0 -- send pkt back
+//  >0 -- send nothing
+//  <0 -- send an error response with the return value as retcode and no body
+typedef int (*KnvCmdHandler)(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg);
+
+// options of a command, for the servers to apply
+struct KnvCmdOptions
+{
+	int priority;           // higher is served first by servers that queue requests, default 0
+	int deadline_ms;        // a request queued longer than this may be dropped, 0 for none
+	uint32_t max_body_size; // larger request bodies are rejected by Dispatch(), 0 for no limit
+};
+
+struct KnvCmdBinding
+{
+	uint64_t key; // cmd<<32 | subcmd
+	KnvCmdHandler h;
+	void *arg;
+	KnvCmdOptions opt;
+};
+
+class KnvDispatcher
+{
+public:
+	KnvDispatcher();
+
+	// bind h to (cmd, subcmd), a binding to a sub-command takes precedence over KNV_ANY_SUBCMD,
+	// binding a key again replaces the handler; opt NULL for the defaults
+	// returns 0 on success
+	int Register(uint32_t cmd, uint32_t subcmd, KnvCmdHandler h, void *arg = NULL, const KnvCmdOptions *opt = NULL);
+	int Register(uint32_t cmd, KnvCmdHandler h, void *arg = NULL, const KnvCmdOptions *opt = NULL)
+	{
+		return Register(cmd, KNV_ANY_SUBCMD, h, arg, opt);
+	}
+	// for requests without a binding, otherwise Dispatch() rejects them
+	void SetDefault(KnvCmdHandler h, void *arg = NULL) { def_h = h; def_arg = arg; }
+
+	// build the lookup table, returns 0 on success
+	int Freeze();
+	bool IsFrozen() const { return frozen; }
+
+	// the binding of (cmd, subcmd), or NULL if there is none
+	const KnvCmdBinding *Find(uint32_t cmd, uint32_t subcmd) const
+	{
+		if(!frozen)
+			return FindSlow(cmd, subcmd);
+		uint64_t h = Mix(cmd);
+		const Slot &s = table[Place(h, disp[(h>>32) & disp_mask], table_shift)];
+		if(s.cmd!=cmd || !s.used)
+			return NULL;
+		for(uint32_t i=0; i<s.nr_subs; i++)
+			if((uint32_t)subs[s.first_sub+i].key==subcmd)
+				return &subs[s.first_sub+i];
+		return s.any.h? &s.any : NULL;
+	}
+	// call the handler of pkt
+	// returns what the handler returns, or KNV_DISPATCH_REJECTED
+	int Dispatch(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer) const;
+
+	int GetBindingNum() const { return bindings.size(); }
+	int GetTableSize() const { return table.size(); }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	// a command, with the bindings of its sub-commands in subs
+	struct Slot
+	{
+		uint32_t cmd;
+		bool used;
+		uint32_t first_sub, nr_subs;
+		KnvCmdBinding any; // h==NULL if not bound to KNV_ANY_SUBCMD
+	};
+
+	static inline uint64_t Mix(uint64_t k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+	// the slot of a command of hash h with displacement d, by the top bits of a multiplication
+	static inline uint32_t Place(uint64_t h, uint32_t d, int shift)
+	{
+		return ((h ^ (d*0x9e3779b97f4a7c15ULL)) * 0xd6e8feb86659fd93ULL) >> shift;
+	}
+
+	const KnvCmdBinding *FindSlow(uint32_t cmd, uint32_t subcmd) const;
+	int Build(const vector<uint32_t> &cmds, int table_bits, uint32_t nr_buckets);
+
+	vector<KnvCmdBinding> bindings;
+	bool frozen;
+	vector<uint32_t> disp;       // displacement by bucket
+	vector<Slot> table;
+	vector<KnvCmdBinding> subs;
+	uint32_t disp_mask;
+	int table_shift;             // 64 - log2 of the table size
+	KnvCmdHandler def_h;
+	void *def_arg;
+	string errmsg;
+};
+
+#endif
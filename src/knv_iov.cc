@@ -0,0 +1,89 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_iov.cc
+// Implementation of KnvIov
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include "knv_iov.h"
+
+KnvIov::KnvIov(int max_iov) : cur(NULL), left(0), total(0), max_iov(max_iov), next_chunk_sz(KNV_IOV_SCRATCH_SIZE)
+{
+	if(this->max_iov<4)
+		this->max_iov = 4;
+}
+
+void KnvIov::Clear()
+{
+	for(size_t i=0; i<chunks.size(); i++)
+		UcMemManager::Free(chunks[i]);
+	chunks.clear();
+	iov.clear();
+	cur = NULL;
+	left = 0;
+	total = 0;
+	next_chunk_sz = KNV_IOV_SCRATCH_SIZE;
+}
+
+char *KnvIov::Reserve(int len)
+{
+	if(len<=left)
+		return cur;
+
+	// scratch buffers double in size, so that they never use up the iovec entries
+	uint64_t sz = next_chunk_sz;
+	while(sz < (uint64_t)len)
+		sz <<= 1;
+	UcMem *m = UcMemManager::Alloc(sz);
+	if(m==NULL)
+		return NULL;
+	chunks.push_back(m);
+	next_chunk_sz = sz<<1;
+	cur = (char *)m->ptr();
+	left = m->GetAllocSize()? m->GetAllocSize() : sz;
+	return cur;
+}
+
+int KnvIov::Append(const void *p, int len)
+{
+	if(len<=0)
+		return 0;
+	char *d = Reserve(len);
+	if(d==NULL)
+		return -1;
+	memcpy(d, p, len);
+	Commit(d, len);
+	return 0;
+}
+
+int KnvIov::AppendRef(const void *p, int len)
+{
+	if(len<=0)
+		return 0;
+	// keep half of the entries for scratch buffers
+	if(len<KNV_IOV_MIN_REF || (int)iov.size()>=max_iov/2)
+		return Append(p, len);
+
+	struct iovec v;
+	v.iov_base = (void *)p;
+	v.iov_len = len;
+	iov.push_back(v);
+	total += len;
+	return 0;
+}
+
+int KnvIov::CopyTo(string &s) const
+{
+	s.clear();
+	s.reserve(total);
+	for(size_t i=0; i<iov.size(); i++)
+		s.append((const char *)iov[i].iov_base, iov[i].iov_len);
+	return s.length();
+}
@@ -0,0 +1,90 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_iov.h
+// An iovec list for scatter-gather encoding
+//
+// Freshly encoded bytes (field heads, varints, small values) are written to scratch
+// buffers taken from UcMemManager, large unchanged values are referenced in place.
+// The result can be passed to writev()/sendmsg() directly.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_IOV__
+#define __KNV_IOV__
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <vector>
+#include <string>
+#include "mem_pool.h"
+
+using namespace std;
+
+#define KNV_IOV_SCRATCH_SIZE	4096 // size of the first scratch buffer, later ones double
+#define KNV_IOV_MIN_REF		128  // shorter values are copied, an iovec costs more than copying them
+
+class KnvIov
+{
+public:
+	// max_iov: upper bound of iovec entries, references are copied when getting close to it
+	KnvIov(int max_iov = IOV_MAX);
+	~KnvIov() { Clear(); }
+
+	void Clear(); // drop all entries and free scratch buffers
+
+	// get scratch space for up to len bytes, write to it and Commit() the bytes used
+	char *Reserve(int len);
+	void Commit(const char *p, int len);
+
+	int Append(const void *p, int len);    // copy p to scratch, returns 0 on success
+	int AppendRef(const void *p, int len); // reference p in place, p should be available until the iov is sent
+
+	struct iovec *GetIov() { return iov.empty()? NULL : &iov[0]; }
+	int GetIovCount() const { return iov.size(); }
+	int GetLength() const { return total; }
+
+	int CopyTo(string &s) const; // flatten to a string, returns the length
+
+private:
+	KnvIov(const KnvIov &);
+	KnvIov &operator=(const KnvIov &);
+
+	vector<struct iovec> iov;
+	vector<UcMem *> chunks; // scratch buffers
+	char *cur;     // free space in the last scratch buffer
+	int left;
+	int total;     // total bytes
+	int max_iov;
+	uint64_t next_chunk_sz;
+};
+
+inline void KnvIov::Commit(const char *p, int len)
+{
+	if(len<=0)
+		return;
+	cur = (char *)p + len;
+	left -= len;
+	total += len;
+	if(!iov.empty())
+	{
+		struct iovec &last = iov.back();
+		if((char *)last.iov_base + last.iov_len == p) // continuous in the same scratch buffer
+		{
+			last.iov_len += len;
+			return;
+		}
+	}
+	struct iovec v;
+	v.iov_base = (void *)p;
+	v.iov_len = len;
+	iov.push_back(v);
+}
+
+#endif
@@ -0,0 +1,339 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_latency.cc
+// Implementation of the latency histograms
+//
+// 2026-10-18	Created
+// 2026-10-18	Histograms merged from several threads are not limited to KNV_LAT_MAX_KEYS
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <new>
+#include <algorithm>
+#include <map>
+#include "knv_latency.h"
+#include "commands.h"
+
+#define LAT_SLOTS	(KNV_LAT_MAX_KEYS*2) // open addressing by key
+
+struct LatEntry
+{
+	uint64_t key; // cmd<<32 | retcode
+	KnvLatencyHist h[KNV_LAT_NR_PHASES];
+};
+
+// histograms of one thread, entries are added by the owner only
+struct LatSlab
+{
+	LatEntry *slots[LAT_SLOTS];
+	LatEntry *entries[KNV_LAT_MAX_KEYS];
+	int nr_entries; // entries[0..nr_entries) are valid, published after they are set up
+	uint64_t dropped;
+	LatSlab *next;
+};
+
+// histograms merged from several threads by key, the keys of all of them are kept
+typedef map<uint64_t, LatEntry> LatMap;
+
+static __thread LatSlab *lat_slab = NULL;
+
+static pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t lat_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lat_key;
+static LatSlab *lat_list = NULL; // slabs of live threads
+static LatMap *lat_retired;      // histograms of exited threads, never destroyed as threads may exit late
+static uint64_t lat_retired_dropped;
+
+static const char *phase_names[KNV_LAT_NR_PHASES] = { "decode", "handle", "encode", "call" };
+
+void KnvLatencyHist::Clear()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void KnvLatencyHist::Merge(const KnvLatencyHist &h)
+{
+	for(int i=0; i<KNV_LAT_BUCKETS; i++)
+		buckets[i] += __atomic_load_n(&h.buckets[i], __ATOMIC_RELAXED);
+	count += __atomic_load_n(&h.count, __ATOMIC_RELAXED);
+	sum += __atomic_load_n(&h.sum, __ATOMIC_RELAXED);
+	uint64_t m = __atomic_load_n(&h.max, __ATOMIC_RELAXED);
+	if(m>max)
+		max = m;
+}
+
+uint64_t KnvLatencyHist::GetBucketHigh(uint32_t i)
+{
+	if(i < (1U<<KNV_LAT_SUB_BITS))
+		return i;
+	int shift = (i>>KNV_LAT_SUB_BITS) - 1;
+	uint64_t low = (uint64_t)((1U<<KNV_LAT_SUB_BITS) + (i & ((1U<<KNV_LAT_SUB_BITS)-1))) << shift;
+	return low + (1ULL<<shift) - 1;
+}
+
+uint64_t KnvLatencyHist::GetPercentile(double p) const
+{
+	if(count==0)
+		return 0;
+	// the buckets of a live histogram may be a little behind count
+	uint64_t total = 0;
+	for(int i=0; i<KNV_LAT_BUCKETS; i++)
+		total += buckets[i];
+	uint64_t rank = (uint64_t)(p/100*total + 0.5);
+	if(rank<1)
+		rank = 1;
+	uint64_t n = 0;
+	for(int i=0; i<KNV_LAT_BUCKETS; i++)
+	{
+		n += buckets[i];
+		if(n>=rank)
+		{
+			uint64_t v = GetBucketHigh(i);
+			return v<max? v : max;
+		}
+	}
+	return max;
+}
+
+// returns the number of requests of e left out as memory ran out
+static uint64_t merge_entry(LatMap &to, const LatEntry *e)
+{
+	try
+	{
+		LatEntry &n = to[e->key];
+		// e may be live, its histograms are read by Merge() only
+		n.key = e->key;
+		for(int p=0; p<KNV_LAT_NR_PHASES; p++)
+			n.h[p].Merge(e->h[p]);
+		return 0;
+	}
+	catch(...)
+	{
+		uint64_t nr = 0; // requests, each recorded in one phase at least
+		for(int p=0; p<KNV_LAT_NR_PHASES; p++)
+			nr = max(nr, e->h[p].GetCount());
+		return nr;
+	}
+}
+
+// called on thread exit, fold the histograms into lat_retired
+static void detach_slab(void *arg)
+{
+	LatSlab *s = (LatSlab *)arg, **pp;
+
+	pthread_mutex_lock(&lat_lock);
+	for(pp=&lat_list; *pp; pp=&(*pp)->next)
+	{
+		if(*pp==s)
+		{
+			*pp = s->next;
+			break;
+		}
+	}
+	for(int i=0; i<s->nr_entries; i++)
+	{
+		if(lat_retired)
+			lat_retired_dropped += merge_entry(*lat_retired, s->entries[i]);
+		else
+			lat_retired_dropped += s->entries[i]->h[0].GetCount(); // hardly ever
+	}
+	lat_retired_dropped += s->dropped;
+	pthread_mutex_unlock(&lat_lock);
+
+	if(lat_slab==s)
+		lat_slab = NULL;
+	for(int i=0; i<s->nr_entries; i++)
+		delete s->entries[i];
+	free(s);
+}
+
+static void init_latency()
+{
+	pthread_key_create(&lat_key, detach_slab);
+	lat_retired = new (nothrow) LatMap;
+}
+
+static LatSlab *attach_thread()
+{
+	pthread_once(&lat_once, init_latency);
+
+	LatSlab *s = (LatSlab *)calloc(1, sizeof(LatSlab));
+	if(s==NULL)
+		return NULL;
+	pthread_mutex_lock(&lat_lock);
+	s->next = lat_list;
+	lat_list = s;
+	pthread_mutex_unlock(&lat_lock);
+
+	pthread_setspecific(lat_key, s);
+	lat_slab = s;
+	return s;
+}
+
+static LatEntry *find_entry(LatSlab *s, uint64_t key)
+{
+	uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (LAT_SLOTS-1);
+	for(;; i=(i+1)&(LAT_SLOTS-1))
+	{
+		LatEntry *e = s->slots[i];
+		if(e==NULL)
+			break;
+		if(e->key==key)
+			return e;
+	}
+	// the table is never more than half full, so there is always a free slot
+	if(s->nr_entries==KNV_LAT_MAX_KEYS)
+		return NULL;
+	LatEntry *e = new (nothrow) LatEntry;
+	if(e==NULL)
+		return NULL;
+	e->key = key;
+	s->slots[i] = e;
+	s->entries[s->nr_entries] = e;
+	__atomic_store_n(&s->nr_entries, s->nr_entries+1, __ATOMIC_RELEASE);
+	return e;
+}
+
+double KnvLatency::GetTicksPerNs()
+{
+	static double ticks_per_ns = 0;
+	double r;
+	__atomic_load(&ticks_per_ns, &r, __ATOMIC_ACQUIRE);
+	if(r>0)
+		return r;
+
+	// racing callers measure the same thing, any of the results will do
+	struct timespec ts1, ts2, req = { 0, 10000000 };
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	uint64_t t1 = Now();
+	nanosleep(&req, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	uint64_t t2 = Now();
+	int64_t ns = (int64_t)(ts2.tv_sec-ts1.tv_sec)*1000000000 + (ts2.tv_nsec-ts1.tv_nsec);
+	r = ns>0 && t2>t1? (double)(t2-t1)/ns : 1;
+	__atomic_store(&ticks_per_ns, &r, __ATOMIC_RELEASE);
+	return r;
+}
+
+void KnvLatency::Record(uint32_t cmd, int retcode, int first_phase, const uint64_t *ticks, int nr)
+{
+#ifndef KNV_NO_METRICS
+	LatSlab *s = lat_slab;
+	if(__builtin_expect(s==NULL, 0) && (s=attach_thread())==NULL)
+		return;
+	LatEntry *e = find_entry(s, ((uint64_t)cmd<<32) | (uint32_t)retcode);
+	if(e==NULL)
+	{
+		__atomic_store_n(&s->dropped, s->dropped+1, __ATOMIC_RELAXED);
+		return;
+	}
+	for(int i=0; i<nr && first_phase+i<KNV_LAT_NR_PHASES; i++)
+		e->h[first_phase+i].Add(ticks[i]);
+#endif
+}
+
+static bool StatLess(const KnvLatencyStat &a, const KnvLatencyStat &b)
+{
+	if(a.cmd!=b.cmd)
+		return a.cmd < b.cmd;
+	if(a.retcode!=b.retcode)
+		return a.retcode < b.retcode;
+	return a.phase < b.phase;
+}
+
+int KnvLatency::Snapshot(vector<KnvLatencyStat> &stats)
+{
+	stats.clear();
+	LatMap merged;
+	uint64_t lost = 0;
+
+	pthread_mutex_lock(&lat_lock);
+	if(lat_retired)
+		for(LatMap::const_iterator it=lat_retired->begin(); it!=lat_retired->end(); ++it)
+			lost += merge_entry(merged, &it->second);
+	for(LatSlab *s=lat_list; s; s=s->next)
+	{
+		int nr = __atomic_load_n(&s->nr_entries, __ATOMIC_ACQUIRE);
+		for(int i=0; i<nr; i++)
+			lost += merge_entry(merged, s->entries[i]);
+	}
+	pthread_mutex_unlock(&lat_lock);
+	if(lost)
+		return -1;
+
+	double tpn = GetTicksPerNs();
+	for(LatMap::const_iterator it=merged.begin(); it!=merged.end(); ++it)
+	{
+		const LatEntry *e = &it->second;
+		for(int p=0; p<KNV_LAT_NR_PHASES; p++)
+		{
+			const KnvLatencyHist &h = e->h[p];
+			if(h.GetCount()==0)
+				continue;
+			KnvLatencyStat st;
+			st.cmd = e->key>>32;
+			st.retcode = (int)(uint32_t)e->key;
+			st.phase = p;
+			st.hist = h;
+			st.count = h.GetCount();
+			st.mean_ns = (uint64_t)(h.GetSum()/tpn/h.GetCount());
+			st.p50_ns = (uint64_t)(h.GetPercentile(50)/tpn);
+			st.p90_ns = (uint64_t)(h.GetPercentile(90)/tpn);
+			st.p99_ns = (uint64_t)(h.GetPercentile(99)/tpn);
+			st.p999_ns = (uint64_t)(h.GetPercentile(99.9)/tpn);
+			st.max_ns = (uint64_t)(h.GetMax()/tpn);
+			stats.push_back(st);
+		}
+	}
+	sort(stats.begin(), stats.end(), StatLess);
+	return stats.size();
+}
+
+string KnvLatency::Dump()
+{
+	vector<KnvLatencyStat> stats;
+	string out;
+	Snapshot(stats);
+	for(size_t i=0; i<stats.size(); i++)
+	{
+		const KnvLatencyStat &st = stats[i];
+		char line[512];
+		snprintf(line, sizeof(line), "[#] cmd=%s, retcode=%s, phase=%s: count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu ns\n",
+			knv::GetCmdName(st.cmd), knv::GetErrorCodeName((uint32_t)st.retcode), GetPhaseName(st.phase),
+			(unsigned long long)st.count, (unsigned long long)st.mean_ns, (unsigned long long)st.p50_ns,
+			(unsigned long long)st.p90_ns, (unsigned long long)st.p99_ns, (unsigned long long)st.p999_ns,
+			(unsigned long long)st.max_ns);
+		out += line;
+	}
+	uint64_t dropped = GetDroppedNum();
+	if(dropped)
+	{
+		char line[64];
+		snprintf(line, sizeof(line), "[#] dropped=%llu\n", (unsigned long long)dropped);
+		out += line;
+	}
+	return out;
+}
+
+uint64_t KnvLatency::GetDroppedNum()
+{
+	pthread_mutex_lock(&lat_lock);
+	uint64_t n = lat_retired_dropped;
+	for(LatSlab *s=lat_list; s; s=s->next)
+		n += __atomic_load_n(&s->dropped, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lat_lock);
+	return n;
+}
+
+const char *KnvLatency::GetPhaseName(int phase)
+{
+	return phase>=0 && phase<KNV_LAT_NR_PHASES? phase_names[phase] : "unknown";
+}
@@ -0,0 +1,147 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_latency.h
+// Per-command latency histograms
+//
+// Requests are timed by phase and recorded under their command and return code:
+//   decode -- from the packet being taken off the socket to KnvProtocol being usable,
+//             including reassembly of split requests; bodies are expanded lazily, so
+//             parsing them by GetSubTree() and the like counts in handle
+//   handle -- the handler, called by KnvDispatcher
+//   encode -- encoding the response, and splitting it if it is too large
+//   call   -- on the client, from sending the request to receiving the reply; the part
+//             not spent in the server's phases is the network and the queues on the way
+//
+// Timestamps are TSC ticks where the CPU has them, converted to ns when read. Each thread
+// records into histograms of its own, without locking or atomic RMW; a snapshot merges
+// the histograms of all threads. The buckets are log-linear as in HdrHistogram, values
+// are kept to 1/16 (6.25%) of their magnitude.
+// Define KNV_NO_METRICS to compile all recording out.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_LATENCY__
+#define __KNV_LATENCY__
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+enum KnvLatencyPhase
+{
+	KNV_LAT_DECODE = 0,
+	KNV_LAT_HANDLE,
+	KNV_LAT_ENCODE,
+	KNV_LAT_CALL,
+	KNV_LAT_NR_PHASES
+};
+
+#define KNV_LAT_SUB_BITS	4  // 16 sub-buckets per power of 2
+#define KNV_LAT_MAX_BITS	44 // larger values are taken as 2^44-1 ticks, hours at any TSC rate
+#define KNV_LAT_BUCKETS		((KNV_LAT_MAX_BITS-KNV_LAT_SUB_BITS+1) << KNV_LAT_SUB_BITS)
+#define KNV_LAT_MAX_KEYS	64 // (cmd, retcode) pairs per thread, more are counted as dropped
+
+// a log-linear histogram of ticks
+class KnvLatencyHist
+{
+public:
+	KnvLatencyHist() { Clear(); }
+	void Clear();
+
+	// by the owner only, readers on other threads may see a value or two behind
+	void Add(uint64_t v)
+	{
+		if(v>=(1ULL<<KNV_LAT_MAX_BITS))
+			v = (1ULL<<KNV_LAT_MAX_BITS) - 1;
+		uint32_t i = GetBucket(v);
+		__atomic_store_n(&buckets[i], buckets[i]+1, __ATOMIC_RELAXED);
+		__atomic_store_n(&count, count+1, __ATOMIC_RELAXED);
+		__atomic_store_n(&sum, sum+v, __ATOMIC_RELAXED);
+		if(v>max)
+			__atomic_store_n(&max, v, __ATOMIC_RELAXED);
+	}
+	void Merge(const KnvLatencyHist &h);
+
+	uint64_t GetCount() const { return count; }
+	uint64_t GetSum() const { return sum; }
+	uint64_t GetMax() const { return max; }
+	// the highest value equivalent to the p-th percentile (0<p<=100), capped by max
+	uint64_t GetPercentile(double p) const;
+
+	static inline uint32_t GetBucket(uint64_t v)
+	{
+		if(v < (1U<<KNV_LAT_SUB_BITS))
+			return v;
+		int m = 63 - __builtin_clzll(v); // >= KNV_LAT_SUB_BITS
+		return ((m-KNV_LAT_SUB_BITS+1) << KNV_LAT_SUB_BITS) + ((v >> (m-KNV_LAT_SUB_BITS)) & ((1U<<KNV_LAT_SUB_BITS)-1));
+	}
+	// the largest value in bucket i
+	static uint64_t GetBucketHigh(uint32_t i);
+
+private:
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[KNV_LAT_BUCKETS];
+};
+
+// a (cmd, retcode, phase) merged over all threads
+struct KnvLatencyStat
+{
+	uint32_t cmd;
+	int retcode;
+	int phase;     // KnvLatencyPhase
+	KnvLatencyHist hist; // in ticks
+	// from hist, in ns
+	uint64_t count;
+	uint64_t mean_ns, p50_ns, p90_ns, p99_ns, p999_ns, max_ns;
+};
+
+class KnvLatency
+{
+public:
+	// a timestamp in ticks
+	static inline uint64_t Now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		uint32_t lo, hi;
+		__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+		return ((uint64_t)hi<<32) | lo;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+	}
+	// ticks per ns, measured once per process on first use (it takes about 10ms)
+	static double GetTicksPerNs();
+	static uint64_t ToNs(uint64_t ticks) { return (uint64_t)(ticks / GetTicksPerNs()); }
+
+	// record ticks[0..nr) as the phases from first_phase on of one request of cmd
+	static void Record(uint32_t cmd, int retcode, int first_phase, const uint64_t *ticks, int nr);
+	static void Record(uint32_t cmd, int retcode, int phase, uint64_t ticks)
+	{
+		Record(cmd, retcode, phase, &ticks, 1);
+	}
+
+	// merge the histograms of all threads, ordered by cmd, retcode and phase
+	// returns the number of stats filled, or -1 if merging ran out of memory
+	static int Snapshot(vector<KnvLatencyStat> &stats);
+	// same as Snapshot(), one line per stat in ns, named by GetCmdName()/GetErrorCodeName()
+	static string Dump();
+	// requests not recorded as a thread had KNV_LAT_MAX_KEYS keys already
+	static uint64_t GetDroppedNum();
+
+	static const char *GetPhaseName(int phase);
+};
+
+#endif
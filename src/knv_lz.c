@@ -0,0 +1,219 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+/* knv_lz.c
+ * Implementation of the LZ block codec, see knv_lz.h
+ *
+ * Created 2026-10-18
+ */
+
+#include <string.h>
+#include "knv_lz.h"
+
+#define LZ_MIN_MATCH     4
+#define LZ_LAST_LITERALS 5     /* the last bytes are always literals */
+#define LZ_MF_LIMIT      12    /* no match is searched within the last bytes */
+#define LZ_MAX_OFFSET    65535
+#define LZ_HASH_LOG      12
+#define LZ_SKIP_TRIGGER  6     /* search faster in data that does not compress */
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+static inline uint8_t *lz_put_length(uint8_t *op, uint32_t n)
+{
+	while(n >= 255)
+	{
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = n;
+	return op;
+}
+
+/* write one sequence, match_len is 0 for the last one
+ * returns the new output position, or NULL if it does not fit
+ */
+static inline uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, uint32_t lit_len,
+	uint32_t offset, uint32_t match_len)
+{
+	uint8_t *token;
+	if((uint64_t)(oend - op) < 1 + lit_len/255 + 1 + lit_len + 2 + match_len/255 + 1)
+		return NULL;
+
+	token = op++;
+	if(lit_len >= 15)
+	{
+		*token = 15 << 4;
+		op = lz_put_length(op, lit_len - 15);
+	}
+	else
+	{
+		*token = lit_len << 4;
+	}
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if(match_len==0)
+		return op;
+
+	op[0] = offset;
+	op[1] = offset >> 8;
+	op += 2;
+	match_len -= LZ_MIN_MATCH;
+	if(match_len >= 15)
+	{
+		*token |= 15;
+		op = lz_put_length(op, match_len - 15);
+	}
+	else
+	{
+		*token |= match_len;
+	}
+	return op;
+}
+
+int knv_lz_compress(const void *src, int len, void *dst, int cap)
+{
+	const uint8_t *base = (const uint8_t *)src;
+	const uint8_t *ip = base, *anchor = base, *iend = base + len;
+	uint8_t *op = (uint8_t *)dst, *oend = op + cap;
+	uint32_t table[1 << LZ_HASH_LOG]; /* last position of each hash */
+
+	if(len < 0 || cap <= 0)
+		return 0;
+
+	if(len > LZ_MF_LIMIT)
+	{
+		const uint8_t *mflimit = iend - LZ_MF_LIMIT;
+		const uint8_t *matchlimit = iend - LZ_LAST_LITERALS;
+
+		memset(table, 0, sizeof(table));
+		ip ++; /* position 0 is in the table already */
+		while(ip < mflimit)
+		{
+			uint32_t seq = lz_read32(ip);
+			uint32_t h = lz_hash(seq);
+			const uint8_t *ref = base + table[h];
+			const uint8_t *p, *r;
+
+			table[h] = ip - base;
+			if(ip - ref > LZ_MAX_OFFSET || lz_read32(ref)!=seq)
+			{
+				ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+				continue;
+			}
+
+			while(ip > anchor && ref > base && ip[-1]==ref[-1])
+			{
+				ip --;
+				ref --;
+			}
+			p = ip + LZ_MIN_MATCH;
+			r = ref + LZ_MIN_MATCH;
+			while(p < matchlimit && *p==*r)
+			{
+				p ++;
+				r ++;
+			}
+
+			op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, p - ip);
+			if(op==NULL)
+				return 0;
+			ip = anchor = p;
+			if(ip < mflimit)
+				table[lz_hash(lz_read32(ip - 2))] = ip - 2 - base;
+		}
+	}
+
+	op = lz_put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+	return op? op - (uint8_t *)dst : 0;
+}
+
+static inline int lz_get_length(const uint8_t **pip, const uint8_t *iend, uint64_t *n)
+{
+	const uint8_t *ip = *pip;
+	uint8_t b;
+	do
+	{
+		if(ip >= iend)
+			return -1;
+		b = *ip++;
+		*n += b;
+	}while(b==255);
+	*pip = ip;
+	return 0;
+}
+
+int knv_lz_decompress(const void *src, int len, void *dst, int raw_len)
+{
+	const uint8_t *ip = (const uint8_t *)src, *iend = ip + len;
+	uint8_t *ostart = (uint8_t *)dst, *op = ostart, *oend = op + raw_len;
+
+	if(len <= 0 || raw_len < 0)
+		return -1;
+
+	while(1)
+	{
+		uint32_t token = *ip++;
+		uint32_t offset;
+		uint64_t n = token >> 4;
+		const uint8_t *m;
+
+		if(n==15 && lz_get_length(&ip, iend, &n))
+			return -2;
+		if(n > (uint64_t)(iend - ip) || n > (uint64_t)(oend - op))
+			return -3;
+		memcpy(op, ip, n);
+		op += n;
+		ip += n;
+		if(ip==iend) /* the last sequence has no match */
+			break;
+
+		if(iend - ip < 2)
+			return -4;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset==0 || offset > (uint64_t)(op - ostart))
+			return -5;
+		n = token & 15;
+		if(n==15 && lz_get_length(&ip, iend, &n))
+			return -6;
+		n += LZ_MIN_MATCH;
+		if(n > (uint64_t)(oend - op))
+			return -7;
+
+		m = op - offset;
+		if(offset >= n)
+		{
+			memcpy(op, m, n);
+			op += n;
+		}
+		else if(offset==1)
+		{
+			memset(op, *m, n);
+			op += n;
+		}
+		else /* the match overlaps the output */
+		{
+			while(n--)
+				*op++ = *m++;
+		}
+		if(ip >= iend)
+			return -8;
+	}
+	return op==oend? raw_len : -9;
+}
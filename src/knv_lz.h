@@ -0,0 +1,50 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+/* knv_lz.h
+ * A small LZ77 block codec for compressing packet bodies
+ *
+ * The block format is that of LZ4: a sequence is a token byte (literal length in the
+ * high nibble, match length - 4 in the low nibble, 15 means more length bytes follow),
+ * the literals, a 2-byte little-endian match offset and the extra match length bytes.
+ * The last sequence has literals only. The compressor uses one hash probe per position
+ * and trades ratio for speed, the decompressor checks every length and offset.
+ *
+ * Created 2026-10-18
+ */
+
+#ifndef _KNV_LZ_H_
+#define _KNV_LZ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* the largest output of knv_lz_compress() for len bytes of input */
+#define KNV_LZ_BOUND(len)	((len) + (len)/255 + 16)
+
+/* the largest ratio of a valid block, bounding what a decompressed length can be */
+#define KNV_LZ_MAX_RATIO	255
+
+/* compress src/len to dst, which has room for cap bytes
+ * returns the compressed length, or 0 if it does not fit in cap
+ */
+int knv_lz_compress(const void *src, int len, void *dst, int cap);
+
+/* decompress src/len to dst, which must be exactly raw_len bytes
+ * returns raw_len on success, or <0 if the block is corrupted
+ */
+int knv_lz_decompress(const void *src, int len, void *dst, int raw_len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
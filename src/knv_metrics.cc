@@ -0,0 +1,361 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_metrics.cc
+// Implementation of the metrics registry
+//
+// 2026-10-18	Created
+// 2026-10-18	Publish to shared memory
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "knv_metrics.h"
+#include "mem_pool.h"
+
+__thread KnvMetricSlab *knv_metric_slab = NULL;
+
+static KnvMetricDesc local_descs[KNV_METRIC_MAX];
+static KnvMetricDesc *descs = local_descs; // points into the stats segment when published
+static int nr_descs = 0;
+
+static pthread_mutex_t metric_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t metric_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+static KnvMetricSlab *slab_list = NULL; // slabs of live threads
+static KnvMetricSlab local_retired;
+static KnvMetricSlab *retired = &local_retired; // counters of exited threads
+static KnvStatsHeader *stats_hdr = NULL;        // the stats segment, NULL if not published
+static bool metrics_inited = false;
+
+static const char *ucmem_metric_names[KNV_UCMEM_NR_METRICS] = {
+	"alloc", "hit", "free", "shrink_bytes", "used_bytes", "idle_bytes"
+};
+
+static void set_desc(int id, const char *name, KnvMetricType type)
+{
+	snprintf(descs[id].name, sizeof(descs[id].name), "%s", name);
+	descs[id].type = type;
+}
+
+// publish the number of valid descs after they are written
+static void set_nr_descs(int nr)
+{
+	nr_descs = nr;
+	if(stats_hdr)
+		__atomic_store_n(&stats_hdr->nr_metrics, nr, __ATOMIC_RELEASE);
+}
+
+static inline void slab_begin_write(KnvMetricSlab *s)
+{
+	__atomic_store_n(&s->seq, s->seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void slab_end_write(KnvMetricSlab *s)
+{
+	__atomic_store_n(&s->seq, s->seq+1, __ATOMIC_RELEASE);
+}
+
+// called on thread exit, fold counters into retired and drop the slab
+static void detach_slab(void *arg)
+{
+	KnvMetricSlab *s = (KnvMetricSlab *)arg, **pp;
+
+	pthread_mutex_lock(&metric_lock);
+	for(pp=&slab_list; *pp; pp=&(*pp)->next)
+	{
+		if(*pp==s)
+		{
+			*pp = s->next;
+			break;
+		}
+	}
+	slab_begin_write(retired);
+	for(int i=0; i<nr_descs; i++)
+	{
+		if(descs[i].type==KNV_METRIC_COUNTER)
+			retired->val[i] += s->val[i];
+	}
+	slab_end_write(retired);
+
+	if(s->in_shm) // give the slot back
+	{
+		slab_begin_write(s);
+		memset(s->val, 0, sizeof(s->val));
+		slab_end_write(s);
+		__atomic_store_n(&s->tid, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&metric_lock);
+
+	if(knv_metric_slab==s)
+		knv_metric_slab = NULL;
+	if(!s->in_shm)
+		free(s);
+}
+
+static int publish(const char *shm_name, int max_threads)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "/%s", shm_name);
+
+	int max_slots = max_threads + 1; // slot 0 is for exited threads
+	uint64_t sz = sizeof(KnvStatsHeader) + (uint64_t)max_slots*sizeof(KnvMetricSlab);
+	int fd = shm_open(path, O_RDWR|O_CREAT, 0644);
+	if(fd<0)
+		return -3;
+	// truncate first so that a segment left by a previous run starts from zero
+	if(ftruncate(fd, 0) || ftruncate(fd, sz))
+	{
+		close(fd);
+		return -4;
+	}
+	void *p = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p==MAP_FAILED)
+		return -5;
+
+	KnvStatsHeader *h = (KnvStatsHeader *)p;
+	h->version = KNV_STATS_VERSION;
+	h->max_metrics = KNV_METRIC_MAX;
+	h->max_slots = max_slots;
+	h->slab_size = sizeof(KnvMetricSlab);
+	h->nr_metrics = 0;
+	h->pid = getpid();
+
+	stats_hdr = h;
+	descs = h->descs;
+	retired = KnvStatsSlab(h, 0);
+	retired->tid = -1;
+	retired->in_shm = 1;
+	// readers check magic last
+	__atomic_store_n(&h->magic, KNV_STATS_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void init_metrics()
+{
+	metrics_inited = true;
+	pthread_key_create(&slab_key, detach_slab);
+
+	const char *shm_name = getenv("KNV_STATS_SHM");
+	if(stats_hdr==NULL && shm_name && shm_name[0])
+		publish(shm_name, 256);
+
+	set_desc(KNV_METRIC_OBJ_POOL_NEW, "objpool.new", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_OBJ_POOL_HIT, "objpool.hit", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_HT_INCREASE, "knvht.increase", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_EXPAND, "node.expand", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_EXPAND_BYTES, "node.expand_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_FOLD, "node.fold", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_FOLD_BYTES, "node.fold_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_COPY_BYTES, "node.copy_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UCMEM_DIRECT_ALLOC, "ucmem.direct_alloc", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UCMEM_LIMIT_REACHED, "ucmem.limit_reached", KNV_METRIC_COUNTER);
+
+	int nr_cls = UcMemManager::GetClassNum();
+	for(int c=0; c<nr_cls && c<KNV_METRIC_UCMEM_CLASSES; c++)
+	{
+		for(int m=0; m<KNV_UCMEM_NR_METRICS; m++)
+		{
+			char name[sizeof(descs[0].name)];
+			snprintf(name, sizeof(name), "ucmem.%llu.%s", (unsigned long long)UcMemManager::GetClassSize(c), ucmem_metric_names[m]);
+			set_desc(KNV_METRIC_UCMEM(c, m), name, m>=KNV_UCMEM_USED? KNV_METRIC_GAUGE : KNV_METRIC_COUNTER);
+		}
+	}
+	set_desc(KNV_METRIC_PROTO_DECODE, "proto.decode", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_DECODE_BYTES, "proto.decode_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_ENCODE, "proto.encode", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_ENCODE_BYTES, "proto.encode_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_SPLIT, "proto.split", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_SPLIT_PARTS, "proto.split_parts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_PART_ADDED, "proto.part_added", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_PART_OVERWRITTEN, "proto.part_overwritten", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_REASSEMBLED, "proto.reassembled", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_REASM_PENDING, "reasm.pending", KNV_METRIC_GAUGE);
+	set_desc(KNV_METRIC_REASM_BYTES, "reasm.bytes", KNV_METRIC_GAUGE);
+	set_desc(KNV_METRIC_REASM_EXPIRED, "reasm.expired", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_REASM_EVICTED, "reasm.evicted", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_REASM_DUPLICATE, "reasm.duplicate", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_BATCH_BODIES, "batch.bodies", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_BATCH_UNFINISHED, "batch.unfinished", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_BATCH_LATE, "batch.late", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_COMPRESS, "proto.compress", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_COMPRESS_SAVED, "proto.compress_saved", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_PROTO_INFLATE, "proto.inflate", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_RX_PKTS, "udp.rx_pkts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_RX_BATCHES, "udp.rx_batches", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_RX_DROPPED, "udp.rx_dropped", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_PKTS, "udp.tx_pkts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_BATCHES, "udp.tx_batches", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_DROPPED, "udp.tx_dropped", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_GSO, "udp.tx_gso", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_GSO_FALLBACK, "udp.tx_gso_fallback", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_RX_GRO, "udp.rx_gro", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_UDP_TX_ZC, "udp.tx_zc", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_TCP_RX_PKTS, "tcp.rx_pkts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_TCP_RX_BYTES, "tcp.rx_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_TCP_RX_MOVED, "tcp.rx_moved", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_TCP_TX_PKTS, "tcp.tx_pkts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_TCP_TX_BYTES, "tcp.tx_bytes", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_CLIENT_CALLS, "client.calls", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_CLIENT_TIMEOUTS, "client.timeouts", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_CLIENT_UNMATCHED, "client.unmatched", KNV_METRIC_COUNTER);
+	set_desc(KNV_METRIC_CLIENT_SEND_FAILED, "client.send_failed", KNV_METRIC_COUNTER);
+	set_nr_descs(KNV_METRIC_BUILTIN_NUM);
+}
+
+int KnvMetrics::Publish(const char *shm_name, int max_threads)
+{
+	if(shm_name==NULL || shm_name[0]==0 || max_threads<=0)
+		return -1;
+
+	int ret;
+	pthread_mutex_lock(&metric_lock);
+	if(metrics_inited || stats_hdr) // too late, or already published
+		ret = -2;
+	else
+		ret = publish(shm_name, max_threads);
+	pthread_mutex_unlock(&metric_lock);
+	if(ret==0)
+		pthread_once(&metric_once, init_metrics);
+	return ret;
+}
+
+KnvMetricSlab *KnvMetrics::AttachThread()
+{
+	pthread_once(&metric_once, init_metrics);
+
+	KnvMetricSlab *s = NULL;
+	int tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&metric_lock);
+	if(stats_hdr) // take a free slot in the stats segment
+	{
+		for(uint32_t i=1; i<stats_hdr->max_slots; i++)
+		{
+			KnvMetricSlab *slot = KnvStatsSlab(stats_hdr, i);
+			if(slot->tid==0)
+			{
+				s = slot;
+				s->in_shm = 1;
+				__atomic_store_n(&s->tid, tid, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+	}
+	if(s==NULL && (s=(KnvMetricSlab *)calloc(1, sizeof(KnvMetricSlab))))
+		s->tid = tid;
+	if(s==NULL)
+	{
+		pthread_mutex_unlock(&metric_lock);
+		return NULL;
+	}
+	s->next = slab_list;
+	slab_list = s;
+	pthread_mutex_unlock(&metric_lock);
+
+	pthread_setspecific(slab_key, s);
+	knv_metric_slab = s;
+	return s;
+}
+
+int KnvMetrics::Find(const char *name)
+{
+	pthread_once(&metric_once, init_metrics);
+
+	int id = -1;
+	pthread_mutex_lock(&metric_lock);
+	for(int i=0; i<nr_descs; i++)
+	{
+		if(descs[i].name[0] && strcmp(descs[i].name, name)==0)
+		{
+			id = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&metric_lock);
+	return id;
+}
+
+int KnvMetrics::Register(const char *name, KnvMetricType type)
+{
+	if(name==NULL || name[0]==0)
+		return -1;
+
+	int id = Find(name);
+	if(id>=0)
+		return id;
+
+	pthread_mutex_lock(&metric_lock);
+	if(nr_descs<KNV_METRIC_MAX)
+	{
+		id = nr_descs;
+		set_desc(id, name, type);
+		set_nr_descs(id+1);
+	}
+	pthread_mutex_unlock(&metric_lock);
+	return id;
+}
+
+string KnvMetrics::GetName(int id)
+{
+	pthread_once(&metric_once, init_metrics);
+
+	if(id<0 || id>=KNV_METRIC_MAX)
+		return string();
+	pthread_mutex_lock(&metric_lock);
+	string s = descs[id].name;
+	pthread_mutex_unlock(&metric_lock);
+	return s;
+}
+
+int KnvMetrics::Snapshot(vector<KnvMetricValue> &vals, bool skip_zero)
+{
+	pthread_once(&metric_once, init_metrics);
+
+	vals.clear();
+	pthread_mutex_lock(&metric_lock);
+	for(int i=0; i<nr_descs; i++)
+	{
+		if(descs[i].name[0]==0) // unused class slot
+			continue;
+
+		KnvMetricValue v;
+		v.id = i;
+		v.type = (KnvMetricType)descs[i].type;
+		v.name = descs[i].name;
+		v.value = v.type==KNV_METRIC_COUNTER? retired->val[i] : 0;
+		for(KnvMetricSlab *s=slab_list; s; s=s->next)
+			v.value += __atomic_load_n(&s->val[i], __ATOMIC_RELAXED);
+		if(skip_zero && v.value==0)
+			continue;
+		vals.push_back(v);
+	}
+	pthread_mutex_unlock(&metric_lock);
+	return vals.size();
+}
+
+string KnvMetrics::Dump(bool skip_zero)
+{
+	vector<KnvMetricValue> vals;
+	string out;
+	Snapshot(vals, skip_zero);
+	for(size_t i=0; i<vals.size(); i++)
+	{
+		char line[128];
+		snprintf(line, sizeof(line), "%s %lld\n", vals[i].name.c_str(), (long long)vals[i].value);
+		out += line;
+	}
+	return out;
+}
@@ -0,0 +1,227 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_metrics.h
+// Named, per-thread counters and gauges that can be read locally
+//
+// Each thread writes its own slab of values without locking or atomic RMW,
+// readers sum the slabs of all threads. Attr_API reporting is kept as is,
+// the metrics are always available regardless of HAS_ATTR_API.
+// Define KNV_NO_METRICS to compile all updates out.
+//
+// The values can also be published into a named POSIX shared memory segment
+// (KnvMetrics::Publish() or environment KNV_STATS_SHM=<name>), where another
+// process such as knvstat reads them with a seqlock per thread slot.
+//
+// 2026-10-18	Created
+// 2026-10-18	Publish to shared memory, protocol counters
+// 2026-10-18	Reassembly metrics
+// 2026-10-18	Batch executor metrics
+// 2026-10-18	Compression metrics
+// 2026-10-18	UDP server metrics
+// 2026-10-18	UDP GSO/GRO metrics
+// 2026-10-18	TCP metrics
+// 2026-10-18	Client metrics
+// 2026-10-18	io_uring zero copy metric
+//
+
+#ifndef __KNV_METRICS__
+#define __KNV_METRICS__
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+enum KnvMetricType
+{
+	KNV_METRIC_COUNTER = 0, // monotonic, values of exited threads are kept
+	KNV_METRIC_GAUGE = 1,   // current level, summed over live threads
+};
+
+// built-in metrics
+enum KnvMetricId
+{
+	KNV_METRIC_OBJ_POOL_NEW = 0,       // objects created by new in ObjPool
+	KNV_METRIC_OBJ_POOL_HIT,           // objects reused from ObjPool free list
+	KNV_METRIC_HT_INCREASE,            // KnvHt hash table growth
+	KNV_METRIC_EXPAND,                 // nodes expanded
+	KNV_METRIC_EXPAND_BYTES,           // bytes parsed by expanding
+	KNV_METRIC_FOLD,                   // nodes folded
+	KNV_METRIC_FOLD_BYTES,             // bytes serialized by folding
+	KNV_METRIC_COPY_BYTES,             // bytes copied into node owned buffers
+	KNV_METRIC_UCMEM_DIRECT_ALLOC,     // allocations beyond the biggest class
+	KNV_METRIC_UCMEM_LIMIT_REACHED,    // class allocations refused by the size limit
+	KNV_METRIC_PROTO_DECODE,           // packets decoded into KnvProtocol
+	KNV_METRIC_PROTO_DECODE_BYTES,
+	KNV_METRIC_PROTO_ENCODE,           // packets encoded by KnvProtocol::Encode()
+	KNV_METRIC_PROTO_ENCODE_BYTES,
+	KNV_METRIC_PROTO_SPLIT,            // protocols split into parts
+	KNV_METRIC_PROTO_SPLIT_PARTS,      // parts produced by splitting
+	KNV_METRIC_PROTO_PART_ADDED,       // parts accepted by AddPartial()
+	KNV_METRIC_PROTO_PART_OVERWRITTEN, // incomplete protocols dropped by a new part
+	KNV_METRIC_PROTO_REASSEMBLED,      // protocols completely merged from parts
+	KNV_METRIC_REASM_PENDING,          // gauge: incomplete packets held by KnvReassembler
+	KNV_METRIC_REASM_BYTES,            // gauge: bytes held by KnvReassembler
+	KNV_METRIC_REASM_EXPIRED,          // incomplete packets dropped by timeout
+	KNV_METRIC_REASM_EVICTED,          // incomplete packets dropped by the memory limit
+	KNV_METRIC_REASM_DUPLICATE,        // parts received more than once
+	KNV_METRIC_BATCH_BODIES,           // bodies handed to KnvBatchExecutor
+	KNV_METRIC_BATCH_UNFINISHED,       // bodies not done by the deadline or failed
+	KNV_METRIC_BATCH_LATE,             // handlers that finished after the deadline, their results are dropped
+	KNV_METRIC_PROTO_COMPRESS,         // packets encoded with compressed bodies
+	KNV_METRIC_PROTO_COMPRESS_SAVED,   // bytes saved by compression
+	KNV_METRIC_PROTO_INFLATE,          // compressed packets inflated on access
+	KNV_METRIC_UDP_RX_PKTS,            // packets received by KnvUdpServer
+	KNV_METRIC_UDP_RX_BATCHES,         // recvmmsg() calls that returned packets
+	KNV_METRIC_UDP_RX_DROPPED,         // received packets that are truncated or can not be decoded
+	KNV_METRIC_UDP_TX_PKTS,            // packets sent by KnvUdpServer
+	KNV_METRIC_UDP_TX_BATCHES,         // sendmmsg() calls that sent packets
+	KNV_METRIC_UDP_TX_DROPPED,         // responses that could not be encoded or sent
+	KNV_METRIC_UDP_TX_GSO,             // messages sending several packets by UDP_SEGMENT
+	KNV_METRIC_UDP_TX_GSO_FALLBACK,    // such messages refused by the kernel and sent packet by packet
+	KNV_METRIC_UDP_RX_GRO,             // buffers receiving several packets by UDP_GRO
+	KNV_METRIC_UDP_TX_ZC,              // messages sent without copying by io_uring SENDMSG_ZC
+	KNV_METRIC_TCP_RX_PKTS,            // packets framed by KnvTcpFramer
+	KNV_METRIC_TCP_RX_BYTES,           // bytes read from TCP streams
+	KNV_METRIC_TCP_RX_MOVED,           // bytes moved to a new buffer to keep a packet in one piece
+	KNV_METRIC_TCP_TX_PKTS,            // packets queued by KnvTcpConn
+	KNV_METRIC_TCP_TX_BYTES,           // bytes written to TCP streams
+	KNV_METRIC_CLIENT_CALLS,           // calls accepted by KnvClient
+	KNV_METRIC_CLIENT_TIMEOUTS,        // calls completed by timeout
+	KNV_METRIC_CLIENT_UNMATCHED,       // replies without a call, e.g. late or undecodable ones
+	KNV_METRIC_CLIENT_SEND_FAILED,     // requests the socket did not take, they time out
+	KNV_METRIC_UCMEM_CLASS_BASE,       // per-class metrics follow, see KNV_METRIC_UCMEM()
+};
+
+// metrics of each UcMemManager class
+enum KnvUcMemMetric
+{
+	KNV_UCMEM_ALLOC = 0,  // buffers handed out
+	KNV_UCMEM_HIT,        // buffers handed out from the idle list
+	KNV_UCMEM_FREE,       // buffers returned
+	KNV_UCMEM_SHRINK,     // bytes released by shrinking
+	KNV_UCMEM_USED,       // gauge: bytes in use
+	KNV_UCMEM_IDLE,       // gauge: bytes idle in the pool
+	KNV_UCMEM_NR_METRICS
+};
+
+#define KNV_METRIC_UCMEM_CLASSES	16
+#define KNV_METRIC_UCMEM(cls, m)	(KNV_METRIC_UCMEM_CLASS_BASE + (cls)*KNV_UCMEM_NR_METRICS + (m))
+#define KNV_METRIC_BUILTIN_NUM		KNV_METRIC_UCMEM(KNV_METRIC_UCMEM_CLASSES, 0)
+#define KNV_METRIC_MAX			512 // built-in and user registered
+
+struct KnvMetricDesc
+{
+	char name[60];
+	int32_t type; // KnvMetricType
+};
+
+struct KnvMetricValue
+{
+	int id;
+	KnvMetricType type;
+	string name;
+	int64_t value;
+};
+
+// values of one thread, written by the owning thread only
+struct KnvMetricSlab
+{
+	uint64_t seq;     // odd while the owner is updating val[]
+	int32_t tid;      // owner thread id, 0 if the slot is free
+	int32_t in_shm;   // slab lives in the stats segment
+	KnvMetricSlab *next; // only meaningful inside the owning process
+	int64_t val[KNV_METRIC_MAX];
+};
+
+// layout of the stats segment: header, then max_slots slabs,
+// slab 0 holds the counters of exited threads
+#define KNV_STATS_MAGIC		0x53564e4b // "KNVS"
+#define KNV_STATS_VERSION	1
+
+struct KnvStatsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t max_metrics;
+	uint32_t max_slots;
+	uint32_t slab_size;
+	uint32_t nr_metrics; // descs[0..nr_metrics) are valid
+	int32_t pid;
+	uint32_t reserved;
+	KnvMetricDesc descs[KNV_METRIC_MAX];
+};
+
+static inline KnvMetricSlab *KnvStatsSlab(KnvStatsHeader *h, int i)
+{
+	return (KnvMetricSlab *)(((char *)(h+1)) + (uint64_t)i*h->slab_size);
+}
+
+extern __thread KnvMetricSlab *knv_metric_slab;
+
+class KnvMetrics
+{
+public:
+	// register a user metric, registering an existing name returns the same id
+	// returns id>=0 on success, <0 if the registry is full
+	static int Register(const char *name, KnvMetricType type = KNV_METRIC_COUNTER);
+	static int Find(const char *name); // returns id, or -1 if not registered
+	static string GetName(int id);
+
+	// update the calling thread's value
+	static inline void Add(int id, int64_t v);
+	static inline void Set(int id, int64_t v);
+
+	// read all registered metrics, summed over all threads
+	// skip_zero=true omits metrics that are still 0
+	// returns the number of values filled
+	static int Snapshot(vector<KnvMetricValue> &vals, bool skip_zero = false);
+	// same as Snapshot(), formatted as "name value" lines
+	static string Dump(bool skip_zero = true);
+
+	// Publish all values into POSIX shared memory /shm_name, with room for max_threads threads
+	// (threads beyond that are only visible to Snapshot()).
+	// Must be called before any metric is updated, i.e. at start-up before using the library.
+	// returns 0 on success, <0 on failure
+	static int Publish(const char *shm_name, int max_threads = 256);
+
+private:
+	static KnvMetricSlab *AttachThread();
+};
+
+inline void KnvMetrics::Add(int id, int64_t v)
+{
+#ifndef KNV_NO_METRICS
+	KnvMetricSlab *s = knv_metric_slab;
+	if(__builtin_expect(s==NULL, 0) && (s=AttachThread())==NULL)
+		return;
+	// single writer: the seqlock only orders stores, no atomic RMW is needed
+	uint64_t seq = s->seq;
+	__atomic_store_n(&s->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s->val[id], s->val[id]+v, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->seq, seq+2, __ATOMIC_RELEASE);
+#endif
+}
+
+inline void KnvMetrics::Set(int id, int64_t v)
+{
+#ifndef KNV_NO_METRICS
+	KnvMetricSlab *s = knv_metric_slab;
+	if(__builtin_expect(s==NULL, 0) && (s=AttachThread())==NULL)
+		return;
+	uint64_t seq = s->seq;
+	__atomic_store_n(&s->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s->val[id], v, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->seq, seq+2, __ATOMIC_RELEASE);
+#endif
+}
+
+#endif
@@ -0,0 +1,1141 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// knv_micro.cpp
+// Microbenchmarks of the codec, tree, pool and protocol hot paths
+//
+// Each benchmark runs on trees of the shapes given (subkeys x fields, laid out like a
+// friend list: key -> domain 13 -> subkey 11 -> fields 300+), is warmed up, calibrated
+// to a number of iterations that takes at least the sample time, and then sampled
+// repeatedly. Results are the median time per operation with a 95% confidence interval
+// of the median by order statistics, written as JSON, one result per line, so that a
+// run can be compared to a stored one with -b.
+//
+// With -e, hardware counters are read by perf_event_open() over the samples of each
+// benchmark, and cycles, instructions, L1D and LLC misses and branch misses are reported
+// per operation, along with IPC and cache misses per field of the tree. Counters that
+// the machine or perf_event_paranoid does not allow are left out.
+//
+// With -j, the scalability of the thread-local pools is measured instead: a pipeline of
+// decoding a request, GetSubTree() on the thread's own data tree, UpdateSubTree() and
+// encoding the response is run for -d seconds on each number of threads given, first by
+// every thread on its own (mt.local), then by pairs of threads handing packets from a
+// producer to a consumer (mt.handoff). Reported are the throughput of each thread and in
+// total, scaling against one thread, growth of the RSS and the bytes held by the pools of
+// each thread, from their metrics, with the ratio of the biggest to the mean as imbalance.
+//
+// 2026-10-18	Add hardware counters (-e)
+// 2026-10-18	Add the multi-thread scalability mode (-j)
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include "knv_node.h"
+#include "knv_metrics.h"
+#include "protocol.h"
+#include "mem_pool.h"
+#include "pb.h"
+#include "version.h"
+
+struct shape
+{
+	int subkeys;
+	int fields;
+};
+
+// everything a benchmark works on, built once per shape
+struct bench_ctx
+{
+	shape sh;
+	string data_bin;     // the serialized data tree
+	KnvNode *data;       // expanded data tree
+	KnvNode *req;        // requests all subkeys, 3 fields each
+	KnvNode *update;     // a new value of field 301 for every other subkey
+	KnvNode *del;        // every 4th subkey
+	string pb_flat;      // subkeys*fields fields in one message
+	KnvProtocol *proto;  // data tree as body
+	vector<string> parts; // proto split at 1000 bytes
+	vector<uint64_t> keys; // the subkeys
+};
+
+typedef uint64_t (*bench_fn)(bench_ctx &c, uint64_t iters);
+
+struct bench
+{
+	const char *name;
+	bench_fn fn;
+	int ops; // operations per iteration: 0 for 1, -1 for subkeys, -2 for subkeys*fields
+};
+
+enum
+{
+	PC_CYCLES,
+	PC_INSTRUCTIONS,
+	PC_L1D_MISSES,
+	PC_LLC_MISSES,
+	PC_BRANCH_MISSES,
+	PC_NR
+};
+
+struct perf_counter
+{
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+	int fd; // -1 if not available
+};
+
+static perf_counter counters[PC_NR] = {
+	{ "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1 },
+	{ "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1 },
+	{ "l1d_misses",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16), -1 },
+	{ "llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1 },
+	{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1 },
+};
+
+struct result
+{
+	string name;
+	shape sh;
+	double median, mean, stddev, min, max, ci_low, ci_high; // ns per op
+	uint64_t iters;
+	int ops;
+	double pmu[PC_NR]; // counts per op, <0 if not counted
+};
+
+struct baseline
+{
+	double median, ci_low, ci_high;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static KnvNode *make_tree(const shape &sh, int step, int nfields, bool with_values)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *tree = KnvNode::NewTree(3501, &k), *dm;
+	if(tree==NULL || (dm=tree->InsertChild(13, KNV_NODE, NULL, true))==NULL)
+		return NULL;
+	for(int i=0; i<sh.subkeys; i+=step)
+	{
+		uint64_t u = 220200200+i;
+		knv_key_t sk(KNV_VARINT, 8, (char*)&u);
+		KnvNode *sub = dm->InsertChild(11, KNV_NODE, sk, NULL, true);
+		if(sub==NULL)
+			return NULL;
+		for(int j=0; j<nfields; j++)
+		{
+			if(!with_values)
+				sub->InsertIntLeaf(300+j, 1);
+			else if(j%2)
+				sub->InsertIntLeaf(300+j, i*j+1);
+			else
+				sub->InsertStrLeaf(300+j, "abcdefg@test.com", 8+j%9);
+		}
+	}
+	return tree;
+}
+
+static int walk(KnvNode *n)
+{
+	int nr = 1;
+	for(KnvNode *c=n->GetFirstChild(); c; c=c->GetSibling())
+		nr += c->GetType()==KNV_NODE? walk(c) : 1;
+	return nr;
+}
+
+static int setup(bench_ctx &c, const shape &sh)
+{
+	c.sh = sh;
+	KnvNode *data = make_tree(sh, 1, sh.fields, true);
+	c.req = make_tree(sh, 1, 3<sh.fields? 3 : sh.fields, false);
+	c.del = make_tree(sh, 4, 0, false);
+	c.update = make_tree(sh, 2, 0, false);
+	if(data==NULL || c.req==NULL || c.del==NULL || c.update==NULL || data->Serialize(c.data_bin))
+		return -1;
+	KnvNode::Delete(data);
+	for(KnvNode *s=c.update->GetFirstChild()->GetFirstChild(); s; s=s->GetSibling())
+		s->InsertIntLeaf(301, 99);
+
+	c.data = KnvNode::New(c.data_bin);
+	if(c.data==NULL)
+		return -1;
+	walk(c.data);
+	for(int i=0; i<sh.subkeys; i++)
+		c.keys.push_back(220200200+i);
+
+	static char buf[16*1024*1024];
+	pb_buff_t b;
+	pb_init_buff(&b, buf, sizeof(buf));
+	for(int i=0; i<sh.subkeys*sh.fields; i++)
+	{
+		if(i%2 ? pb_add_varint(&b, 300+i%sh.fields, i) : pb_add_string(&b, 300+i%sh.fields, "abcdefg@test.com", 8+i%9))
+			return -1;
+	}
+	c.pb_flat.assign(buf, pb_get_encoded_length(&b));
+
+	c.proto = new KnvProtocol(1, 2, 3);
+	KnvNode *body = c.data->Duplicate(true);
+	if(body==NULL || c.proto->AddBody(body, true))
+		return -1;
+	KnvProtocol p(1, 2, 3);
+	p.SetAllowSplit(true, 1000);
+	if(p.Split(c.data))
+		return -1;
+	c.parts.resize(p.GetTotalPartNum());
+	for(int i=0; i<p.GetTotalPartNum(); i++)
+		if(p.EncodePart(i, c.parts[i])<0)
+			return -1;
+	return 0;
+}
+
+static void cleanup(bench_ctx &c)
+{
+	KnvNode::Delete(c.data);
+	KnvNode::Delete(c.req);
+	KnvNode::Delete(c.update);
+	KnvNode::Delete(c.del);
+	delete c.proto;
+}
+
+static uint64_t b_pb_encode(bench_ctx &c, uint64_t iters)
+{
+	static char buf[16*1024*1024];
+	uint64_t sink = 0;
+	int nr = c.sh.subkeys*c.sh.fields;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		pb_buff_t b;
+		pb_init_buff(&b, buf, sizeof(buf));
+		for(int i=0; i<nr; i++)
+		{
+			if(i%2)
+				pb_add_varint(&b, 300+i%c.sh.fields, i);
+			else
+				pb_add_string(&b, 300+i%c.sh.fields, "abcdefg@test.com", 8+i%9);
+		}
+		sink += pb_get_encoded_length(&b);
+	}
+	return sink;
+}
+
+static uint64_t b_pb_decode(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		pb_field_t f;
+		for(pb_field_t *p=pb_begin(&f, c.pb_flat.data(), c.pb_flat.length()); p; p=pb_next(p))
+			sink += p->tag;
+	}
+	return sink;
+}
+
+static uint64_t b_node_new(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvNode *t = KnvNode::New(c.data_bin, false);
+		sink += t!=NULL;
+		KnvNode::Delete(t);
+	}
+	return sink;
+}
+
+static uint64_t b_node_expand(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvNode *t = KnvNode::New(c.data_bin, false);
+		sink += walk(t);
+		KnvNode::Delete(t);
+	}
+	return sink;
+}
+
+static uint64_t b_node_fold(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	string s;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		for(KnvNode *sub=c.data->GetFirstChild()->GetFirstChild(); sub; sub=sub->GetSibling())
+			sub->SetChildStr(300, 8, n%2? "testname" : "testnamf");
+		c.data->Serialize(s);
+		sink += s.length();
+	}
+	return sink;
+}
+
+static uint64_t b_node_serialize(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	string s;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		c.data->Serialize(s);
+		sink += s.length();
+	}
+	return sink;
+}
+
+static uint64_t b_get_subtree(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvNode *out = NULL, *empty = NULL; // not set on bad arguments
+		sink += c.data->GetSubTree(c.req, out, empty)==0;
+		KnvNode::Delete(out);
+		KnvNode::Delete(empty);
+	}
+	return sink;
+}
+
+static uint64_t b_update_subtree(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+		sink += c.data->UpdateSubTree(c.update, 10)==0;
+	return sink;
+}
+
+static uint64_t b_delete_subtree(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvNode *t = KnvNode::New(c.data_bin, false), *match = NULL;
+		sink += t->DeleteSubTree(c.del, match);
+		KnvNode::Delete(match);
+		KnvNode::Delete(t);
+	}
+	return sink;
+}
+
+static uint64_t b_ht_find(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	KnvNode *dm = c.data->GetFirstChild();
+	for(uint64_t n=0; n<iters; n++)
+		for(size_t i=0; i<c.keys.size(); i++)
+			sink += dm->FindChild(11, (const char *)&c.keys[i], 8)!=NULL;
+	return sink;
+}
+
+static uint64_t b_ucmem(bench_ctx &c, uint64_t iters)
+{
+	static const uint64_t sizes[16] = { 16, 100, 64, 1000, 128, 4000, 256, 200, 512, 16000, 1024, 50, 2048, 64000, 8192, 300 };
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		for(int i=0; i<16; i++)
+		{
+			UcMem *m = UcMemManager::Alloc(sizes[i]);
+			sink += m!=NULL;
+			UcMemManager::Free(m);
+		}
+	}
+	return sink;
+}
+
+static uint64_t b_proto_encode(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		UcMem *m;
+		c.proto->SetSequence(n);
+		int len = c.proto->Encode(m);
+		if(len>=0)
+		{
+			sink += len;
+			UcMemManager::Free(m);
+		}
+	}
+	return sink;
+}
+
+static uint64_t b_proto_decode(bench_ctx &c, uint64_t iters)
+{
+	string s;
+	if(c.proto->Encode(s)<0)
+		return 0;
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvProtocol p(s, false);
+		sink += p.IsValid() && p.GetBody();
+	}
+	return sink;
+}
+
+static uint64_t b_proto_split(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvProtocol p(1, 2, 3);
+		p.SetAllowSplit(true, 1000);
+		if(p.Split(c.data))
+			continue;
+		for(int i=0; i<p.GetTotalPartNum(); i++)
+		{
+			UcMem *m;
+			int len = p.EncodePart(i, m);
+			if(len>=0)
+			{
+				sink += len;
+				UcMemManager::Free(m);
+			}
+		}
+	}
+	return sink;
+}
+
+static uint64_t b_proto_add_partial(bench_ctx &c, uint64_t iters)
+{
+	uint64_t sink = 0;
+	for(uint64_t n=0; n<iters; n++)
+	{
+		KnvProtocol full;
+		for(size_t i=0; i<c.parts.size(); i++)
+		{
+			KnvProtocol part(c.parts[i], false);
+			full.AddPartial(part);
+		}
+		sink += full.IsComplete();
+	}
+	return sink;
+}
+
+static bench benches[] = {
+	{ "pb.encode",           b_pb_encode,         -2 },
+	{ "pb.decode",           b_pb_decode,         -2 },
+	{ "node.new",            b_node_new,          0 },
+	{ "node.expand",         b_node_expand,       0 },
+	{ "node.fold",           b_node_fold,         0 },
+	{ "node.serialize",      b_node_serialize,    0 },
+	{ "tree.get_subtree",    b_get_subtree,       0 },
+	{ "tree.update_subtree", b_update_subtree,    0 },
+	{ "tree.delete_subtree", b_delete_subtree,    0 },
+	{ "knvht.find",          b_ht_find,           -1 },
+	{ "ucmem.alloc_free",    b_ucmem,             16 },
+	{ "proto.encode",        b_proto_encode,      0 },
+	{ "proto.decode",        b_proto_decode,      0 },
+	{ "proto.split",         b_proto_split,       0 },
+	{ "proto.add_partial",   b_proto_add_partial, 0 },
+};
+
+// counters of this thread in user space, returns the number opened
+static int perf_open()
+{
+	int nr = 0;
+	for(int i=0; i<PC_NR; i++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counters[i].type;
+		attr.config = counters[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// counters are multiplexed when there are more than the PMU has, scale them by these
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		counters[i].fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if(counters[i].fd>=0)
+			nr ++;
+	}
+	return nr;
+}
+
+static void perf_start()
+{
+	for(int i=0; i<PC_NR; i++)
+	{
+		if(counters[i].fd<0)
+			continue;
+		ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+// the counts since perf_start(), -1 for counters not available or never scheduled
+static void perf_stop(double counts[PC_NR])
+{
+	for(int i=0; i<PC_NR; i++)
+		if(counters[i].fd>=0)
+			ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+	for(int i=0; i<PC_NR; i++)
+	{
+		uint64_t v[3]; // value, time enabled, time running
+		counts[i] = -1;
+		if(counters[i].fd>=0 && read(counters[i].fd, v, sizeof(v))==sizeof(v) && v[2]>0)
+			counts[i] = (double)v[0]*v[1]/v[2];
+	}
+}
+
+static volatile uint64_t bench_sink;
+static bool use_perf = false;
+
+static result run_bench(bench &b, bench_ctx &c, const string &name, int nr_samples, uint64_t sample_ns)
+{
+	int ops = b.ops==0? 1 : b.ops==-1? c.sh.subkeys : b.ops==-2? c.sh.subkeys*c.sh.fields : b.ops;
+	if(ops<1)
+		ops = 1;
+
+	// warm up the pools and caches, and find the iterations that take a sample's time
+	uint64_t iters = 1, t;
+	for(;;)
+	{
+		t = now_ns();
+		bench_sink += b.fn(c, iters);
+		t = now_ns() - t;
+		if(t>=sample_ns || iters>=(1ULL<<40))
+			break;
+		iters = t<sample_ns/64? iters*8 : (uint64_t)(iters*1.2*sample_ns/(t? t:1)) + 1;
+	}
+
+	vector<double> v;
+	double counts[PC_NR] = { -1, -1, -1, -1, -1 };
+	if(use_perf)
+		perf_start();
+	for(int i=0; i<nr_samples; i++)
+	{
+		t = now_ns();
+		bench_sink += b.fn(c, iters);
+		t = now_ns() - t;
+		v.push_back((double)t/iters/ops);
+	}
+	if(use_perf)
+		perf_stop(counts);
+	sort(v.begin(), v.end());
+
+	result r;
+	r.name = name;
+	r.sh = c.sh;
+	r.iters = iters;
+	r.ops = ops;
+	for(int i=0; i<PC_NR; i++)
+		r.pmu[i] = use_perf && counts[i]>=0? counts[i]/nr_samples/iters/ops : -1;
+	int n = v.size();
+	r.median = n%2? v[n/2] : (v[n/2-1]+v[n/2])/2;
+	r.min = v[0];
+	r.max = v[n-1];
+	double sum = 0, sq = 0;
+	for(int i=0; i<n; i++)
+		sum += v[i];
+	r.mean = sum/n;
+	for(int i=0; i<n; i++)
+		sq += (v[i]-r.mean)*(v[i]-r.mean);
+	r.stddev = n>1? sqrt(sq/(n-1)) : 0;
+	// ranks n/2 -+ 1.96*sqrt(n)/2 bound the median with 95% confidence
+	int lo = (int)floor(n/2.0 - 0.98*sqrt((double)n)), hi = (int)ceil(n/2.0 + 0.98*sqrt((double)n));
+	r.ci_low = v[lo<0? 0 : lo];
+	r.ci_high = v[hi>=n? n-1 : hi];
+	return r;
+}
+
+#define MT_LOCAL	0
+#define MT_HANDOFF	1
+#define MT_QUEUE_LEN	256
+
+// packets from a producer to a consumer, trees and UcMem never cross threads
+struct mt_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // one side waits at a time: the queue is never both full and empty
+	deque<string> pkts;
+	bool closed; // set by whichever side stops first
+};
+
+struct mt_job
+{
+	shape sh;
+	string data_bin; // data tree of each thread
+	string req_pkt;  // request packet, read only
+	pthread_barrier_t start;
+	int stop;
+};
+
+struct mt_worker
+{
+	pthread_t th;
+	int id;
+	int cpu;        // -1 if not pinned
+	int role;       // 0 runs the pipeline, 1 produces, 2 consumes
+	mt_job *job;
+	mt_queue *q;
+	uint64_t ops;   // written by the worker, read after the join
+	int64_t pool_bytes; // bytes in the worker's UcMem pools at the end, -1 without metrics
+	int64_t obj_new;    // objects the worker's pools had to create
+	int err;
+};
+
+struct mt_result
+{
+	string name;
+	shape sh;
+	int threads;
+	double secs;
+	uint64_t ops;
+	vector<double> thread_rate; // ops/s of each thread
+	vector<int64_t> pool_bytes;
+	vector<int64_t> obj_new;
+	double scaling;   // rate per thread over that of the fewest threads run, 1 is linear
+	double imbalance; // biggest pool over the mean, 0 without metrics
+	int64_t rss_start, rss_end; // KB
+};
+
+static int64_t get_rss_kb()
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	long size, res;
+	if(fp==NULL)
+		return -1;
+	int n = fscanf(fp, "%ld %ld", &size, &res);
+	fclose(fp);
+	return n==2? res*(sysconf(_SC_PAGESIZE)/1024) : -1;
+}
+
+// look up the request in data, apply update and answer with what was found in out,
+// without update the body of the request is applied, as a consumer does with what it is handed
+static int mt_pipeline(KnvNode *data, KnvNode *update, const string &pkt, uint64_t seq, string &out)
+{
+	KnvProtocol req(pkt, false);
+	KnvNode *body = req.GetBody(), *sub = NULL, *empty = NULL;
+	if(body==NULL)
+		return -1;
+	if(update==NULL)
+		update = body;
+	else if(data->GetSubTree(body, sub, empty))
+		return -2;
+	KnvNode::Delete(empty);
+	if(data->UpdateSubTree(update, 10))
+	{
+		KnvNode::Delete(sub);
+		return -3;
+	}
+	KnvProtocol rsp(req.GetCommand(), req.GetSubCommand(), seq);
+	if(sub && rsp.AddBody(sub, true)) // not taken on failure
+	{
+		KnvNode::Delete(sub);
+		return -4;
+	}
+	return rsp.Encode(out)<0? -5 : 0;
+}
+
+static void *mt_entry(void *arg)
+{
+	mt_worker &w = *(mt_worker *)arg;
+	mt_job &job = *w.job;
+	if(w.cpu>=0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w.cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	// trees are built in the thread that uses them
+	KnvNode *data = KnvNode::New(job.data_bin);
+	KnvNode *update[2] = { make_tree(job.sh, 2, 0, false), make_tree(job.sh, 2, 0, false) };
+	for(int i=0; i<2 && update[i]; i++)
+		for(KnvNode *sub=update[i]->GetFirstChild()->GetFirstChild(); sub; sub=sub->GetSibling())
+			sub->InsertIntLeaf(301, 99+i);
+	if(data==NULL || update[0]==NULL || update[1]==NULL)
+		w.err = -1;
+	pthread_barrier_wait(&job.start);
+
+	string out;
+	while(w.err==0 && !__atomic_load_n(&job.stop, __ATOMIC_RELAXED))
+	{
+		if(w.role==2)
+		{
+			pthread_mutex_lock(&w.q->lock);
+			while(w.q->pkts.empty() && !w.q->closed)
+				pthread_cond_wait(&w.q->cond, &w.q->lock);
+			if(w.q->pkts.empty())
+			{
+				pthread_mutex_unlock(&w.q->lock);
+				break;
+			}
+			string pkt;
+			pkt.swap(w.q->pkts.front());
+			w.q->pkts.pop_front();
+			pthread_cond_signal(&w.q->cond);
+			pthread_mutex_unlock(&w.q->lock);
+			w.err = mt_pipeline(data, NULL, pkt, w.ops, out);
+		}
+		else
+		{
+			w.err = mt_pipeline(data, update[w.ops&1], job.req_pkt, w.ops, out);
+			if(w.role==1 && w.err==0)
+			{
+				pthread_mutex_lock(&w.q->lock);
+				while(w.q->pkts.size()>=MT_QUEUE_LEN && !w.q->closed)
+					pthread_cond_wait(&w.q->cond, &w.q->lock);
+				bool closed = w.q->closed;
+				if(!closed)
+				{
+					w.q->pkts.push_back(string());
+					w.q->pkts.back().swap(out);
+					pthread_cond_signal(&w.q->cond);
+				}
+				pthread_mutex_unlock(&w.q->lock);
+				if(closed)
+					break;
+			}
+		}
+		if(w.err==0)
+			w.ops ++;
+	}
+	if(w.q)
+	{
+		pthread_mutex_lock(&w.q->lock);
+		w.q->closed = true;
+		pthread_cond_signal(&w.q->cond);
+		pthread_mutex_unlock(&w.q->lock);
+	}
+
+	KnvNode::Delete(data);
+	KnvNode::Delete(update[0]);
+	KnvNode::Delete(update[1]);
+	w.pool_bytes = -1;
+	w.obj_new = -1;
+	KnvMetricSlab *slab = knv_metric_slab;
+	if(slab)
+	{
+		w.pool_bytes = 0;
+		for(int i=0; i<UcMemManager::GetClassNum() && i<KNV_METRIC_UCMEM_CLASSES; i++)
+			w.pool_bytes += slab->val[KNV_METRIC_UCMEM(i, KNV_UCMEM_USED)] + slab->val[KNV_METRIC_UCMEM(i, KNV_UCMEM_IDLE)];
+		w.obj_new = slab->val[KNV_METRIC_OBJ_POOL_NEW];
+	}
+	return NULL;
+}
+
+static int mt_run(mt_job &job, int mode, int nr_threads, double secs, int cpu, mt_result &r)
+{
+	vector<mt_worker> workers(nr_threads);
+	vector<mt_queue> queues(nr_threads/2);
+	int nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	job.stop = 0;
+	pthread_barrier_init(&job.start, NULL, nr_threads+1);
+	r.rss_start = get_rss_kb();
+	for(int i=0; i<nr_threads; i++)
+	{
+		mt_worker &w = workers[i];
+		memset(&w, 0, sizeof(w));
+		w.id = i;
+		w.cpu = cpu>=0? (cpu+i)%nr_cpus : -1;
+		w.job = &job;
+		if(mode==MT_HANDOFF)
+		{
+			mt_queue &q = queues[i/2];
+			if(i%2==0)
+			{
+				pthread_mutex_init(&q.lock, NULL);
+				pthread_cond_init(&q.cond, NULL);
+				q.closed = false;
+			}
+			w.q = &q;
+			w.role = 1 + i%2;
+		}
+		if(pthread_create(&w.th, NULL, mt_entry, &w))
+		{
+			fprintf(stderr, "creating thread %d failed\n", i);
+			exit(3);
+		}
+	}
+	pthread_barrier_wait(&job.start);
+	uint64_t t = now_ns();
+	usleep((useconds_t)(secs*1000000));
+	__atomic_store_n(&job.stop, 1, __ATOMIC_RELAXED);
+	r.secs = (now_ns()-t)/1e9;
+	int err = 0;
+	for(int i=0; i<nr_threads; i++)
+	{
+		pthread_join(workers[i].th, NULL);
+		if(workers[i].err && err==0)
+			err = workers[i].err;
+	}
+	r.rss_end = get_rss_kb();
+	pthread_barrier_destroy(&job.start);
+	for(size_t i=0; i<queues.size(); i++)
+	{
+		pthread_mutex_destroy(&queues[i].lock);
+		pthread_cond_destroy(&queues[i].cond);
+	}
+
+	// the throughput of a handoff is what the consumers finished
+	r.sh = job.sh;
+	r.threads = nr_threads;
+	r.ops = 0;
+	int64_t pool_max = 0, pool_sum = 0;
+	for(int i=0; i<nr_threads; i++)
+	{
+		mt_worker &w = workers[i];
+		if(w.role!=1)
+			r.ops += w.ops;
+		r.thread_rate.push_back(w.ops/r.secs);
+		r.pool_bytes.push_back(w.pool_bytes);
+		r.obj_new.push_back(w.obj_new);
+		pool_sum += w.pool_bytes;
+		pool_max = max(pool_max, w.pool_bytes);
+	}
+	r.imbalance = workers[0].pool_bytes>=0 && pool_sum>0? (double)pool_max*nr_threads/pool_sum : 0;
+	r.scaling = 0;
+	return err;
+}
+
+static void print_mt_result(FILE *out, const mt_result &r, bool last)
+{
+	fprintf(out, "    {\"name\": \"%s\", \"subkeys\": %d, \"fields\": %d, \"threads\": %d, \"seconds\": %.3f, "
+		"\"ops\": %llu, \"ops_per_s\": %.1f, \"scaling\": %.3f, \"thread_ops_per_s\": [",
+		r.name.c_str(), r.sh.subkeys, r.sh.fields, r.threads, r.secs, (unsigned long long)r.ops, r.ops/r.secs, r.scaling);
+	for(size_t i=0; i<r.thread_rate.size(); i++)
+		fprintf(out, "%s%.1f", i? ", " : "", r.thread_rate[i]);
+	fprintf(out, "], \"rss_start_kb\": %lld, \"rss_end_kb\": %lld, \"rss_growth_kb\": %lld, \"pool_bytes\": [",
+		(long long)r.rss_start, (long long)r.rss_end, (long long)(r.rss_end-r.rss_start));
+	for(size_t i=0; i<r.pool_bytes.size(); i++)
+		fprintf(out, "%s%lld", i? ", " : "", (long long)r.pool_bytes[i]);
+	fprintf(out, "], \"pool_imbalance\": %.3f, \"obj_new\": [", r.imbalance);
+	for(size_t i=0; i<r.obj_new.size(); i++)
+		fprintf(out, "%s%lld", i? ", " : "", (long long)r.obj_new[i]);
+	fprintf(out, "]}%s\n", last? "" : ",");
+}
+
+static int mt_setup(mt_job &job, const shape &sh)
+{
+	job.sh = sh;
+	KnvNode *data = make_tree(sh, 1, sh.fields, true);
+	KnvNode *req = make_tree(sh, 1, 3<sh.fields? 3 : sh.fields, false);
+	KnvProtocol p(1, 2, 3);
+	int ret = data==NULL || req==NULL || data->Serialize(job.data_bin) || p.AddBody(req, true) || p.Encode(job.req_pkt)<0;
+	KnvNode::Delete(data);
+	return ret? -1 : 0;
+}
+
+static int parse_threads(const char *s, vector<int> &threads)
+{
+	while(*s)
+	{
+		char *end;
+		int n = strtol(s, &end, 10);
+		if(n<1 || n>1024 || (*end && *end!=','))
+			return -1;
+		threads.push_back(n);
+		s = *end? end+1 : end;
+	}
+	return threads.empty()? -1 : 0;
+}
+
+// -j mode, each shape in each mode on each number of threads
+static int run_threads(FILE *out, const vector<shape> &shapes, const vector<int> &threads, const char *filter, double secs, int cpu)
+{
+	static const char *mode_names[] = { "mt.local", "mt.handoff" };
+	vector<mt_result> results;
+	for(size_t s=0; s<shapes.size(); s++)
+	{
+		mt_job job;
+		if(mt_setup(job, shapes[s]))
+		{
+			fprintf(stderr, "building trees of %dx%d failed: %s\n", shapes[s].subkeys, shapes[s].fields, KnvNode::GetGlobalErrorMsg());
+			return 3;
+		}
+		for(int mode=MT_LOCAL; mode<=MT_HANDOFF; mode++)
+		{
+			double base_rate = 0; // per thread, of the fewest threads
+			for(size_t t=0; t<threads.size(); t++)
+			{
+				int nr = mode==MT_HANDOFF? threads[t]&~1 : threads[t]; // in pairs
+				char name[128];
+				snprintf(name, sizeof(name), "%s/%dx%d/t%d", mode_names[mode], shapes[s].subkeys, shapes[s].fields, nr);
+				if(nr==0 || (filter && strstr(name, filter)==NULL))
+					continue;
+				mt_result r;
+				r.name = name;
+				if(mt_run(job, mode, nr, secs, cpu, r))
+				{
+					fprintf(stderr, "%s failed: %s\n", name, KnvNode::GetGlobalErrorMsg());
+					return 3;
+				}
+				double rate = r.ops/r.secs/(mode==MT_HANDOFF? nr/2 : nr);
+				if(base_rate==0)
+					base_rate = rate;
+				r.scaling = base_rate>0? rate/base_rate : 0;
+				results.push_back(r);
+				fprintf(stderr, "%-32s %12.0f ops/s  scaling %.2f  rss %+lld KB  pool imbalance %.2f\n", name, r.ops/r.secs,
+					r.scaling, (long long)(r.rss_end-r.rss_start), r.imbalance);
+			}
+		}
+	}
+
+	fprintf(out, "{\n  \"version\": \"%d.%d\", \"seconds\": %.1f, \"time\": %lld,\n  \"results\": [\n",
+		LIB_KNV_MAJOR_VERSION, LIB_KNV_MINOR_VERSION, secs, (long long)time(NULL));
+	for(size_t i=0; i<results.size(); i++)
+		print_mt_result(out, results[i], i+1==results.size());
+	fprintf(out, "  ]\n}\n");
+	return 0;
+}
+
+// the results of a previous run by name, as written by print_result()
+static int load_baseline(const char *path, map<string, baseline> &base)
+{
+	FILE *fp = fopen(path, "r");
+	if(fp==NULL)
+		return -1;
+	char ln[4096];
+	while(fgets(ln, sizeof(ln), fp))
+	{
+		char *p = strstr(ln, "\"name\": \""), *q;
+		if(p==NULL || (q=strchr(p+9, '"'))==NULL)
+			continue;
+		baseline b;
+		const char *m = strstr(ln, "\"median_ns\": "), *l = strstr(ln, "\"ci95_low_ns\": "), *h = strstr(ln, "\"ci95_high_ns\": ");
+		if(m==NULL || l==NULL || h==NULL)
+			continue;
+		b.median = atof(m+13);
+		b.ci_low = atof(l+15);
+		b.ci_high = atof(h+16);
+		base[string(p+9, q-p-9)] = b;
+	}
+	fclose(fp);
+	return 0;
+}
+
+// a change counts when it is beyond the tolerance and the confidence intervals are apart
+static const char *compare(const result &r, const baseline &b, double tolerance)
+{
+	if(r.median > b.median*(1+tolerance) && r.ci_low > b.ci_high)
+		return "regressed";
+	if(r.median < b.median*(1-tolerance) && r.ci_high < b.ci_low)
+		return "improved";
+	return "same";
+}
+
+static void print_result(FILE *out, const result &r, int nr_samples, const baseline *b, const char *verdict, bool last)
+{
+	fprintf(out, "    {\"name\": \"%s\", \"subkeys\": %d, \"fields\": %d, \"iters\": %llu, \"samples\": %d, "
+		"\"median_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f, "
+		"\"ci95_low_ns\": %.3f, \"ci95_high_ns\": %.3f",
+		r.name.c_str(), r.sh.subkeys, r.sh.fields, (unsigned long long)r.iters, nr_samples,
+		r.median, r.mean, r.stddev, r.min, r.max, r.ci_low, r.ci_high);
+	if(use_perf)
+	{
+		// counts per op, then ipc and cache misses per field of the tree, null if not counted
+		int fields = r.sh.subkeys*r.sh.fields;
+		for(int i=0; i<PC_NR; i++)
+		{
+			if(r.pmu[i]>=0)
+				fprintf(out, ", \"%s\": %.3f", counters[i].name, r.pmu[i]);
+			else
+				fprintf(out, ", \"%s\": null", counters[i].name);
+		}
+		if(r.pmu[PC_CYCLES]>0 && r.pmu[PC_INSTRUCTIONS]>=0)
+			fprintf(out, ", \"ipc\": %.3f", r.pmu[PC_INSTRUCTIONS]/r.pmu[PC_CYCLES]);
+		else
+			fprintf(out, ", \"ipc\": null");
+		for(int i=PC_L1D_MISSES; i<=PC_LLC_MISSES; i++)
+		{
+			if(r.pmu[i]>=0)
+				fprintf(out, ", \"%s_per_field\": %.4f", counters[i].name, r.pmu[i]*r.ops/fields);
+			else
+				fprintf(out, ", \"%s_per_field\": null", counters[i].name);
+		}
+	}
+	if(b)
+		fprintf(out, ", \"baseline_median_ns\": %.3f, \"change\": %.4f, \"verdict\": \"%s\"", b->median, r.median/b->median-1, verdict);
+	fprintf(out, "}%s\n", last? "" : ",");
+}
+
+static int parse_shapes(const char *s, vector<shape> &shapes)
+{
+	while(*s)
+	{
+		shape sh;
+		char *end;
+		sh.subkeys = strtol(s, &end, 10);
+		if(*end!='x' || sh.subkeys<1)
+			return -1;
+		sh.fields = strtol(end+1, &end, 10);
+		if(sh.fields<1 || (*end && *end!=','))
+			return -1;
+		shapes.push_back(sh);
+		s = *end? end+1 : end;
+	}
+	return shapes.empty()? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, nr_samples = 15, cpu = -1;
+	double sample_ms = 20, tolerance = 5, secs = 2;
+	bool want_perf = false;
+	const char *shapes_str = "1x10,100x10,1000x5", *filter = NULL, *base_path = NULL, *out_path = NULL;
+	vector<shape> shapes;
+	vector<int> threads;
+
+	while((opt=getopt(argc, argv, "s:n:t:f:b:T:c:o:ej:d:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's': shapes_str = optarg; break;
+		case 'n': nr_samples = atoi(optarg); break;
+		case 't': sample_ms = atof(optarg); break;
+		case 'f': filter = optarg; break;
+		case 'b': base_path = optarg; break;
+		case 'T': tolerance = atof(optarg); break;
+		case 'c': cpu = atoi(optarg); break;
+		case 'o': out_path = optarg; break;
+		case 'e': want_perf = true; break;
+		case 'j': if(parse_threads(optarg, threads)) goto usage; break;
+		case 'd': secs = atof(optarg); break;
+		default: goto usage;
+		}
+	}
+
+	if(optind!=argc || nr_samples<1 || sample_ms<=0 || secs<=0 || parse_shapes(shapes_str, shapes))
+	{
+	usage:
+		printf("knvmicro v%d.%d %s\n", LIB_KNV_MAJOR_VERSION, LIB_KNV_MINOR_VERSION, LIB_KNV_EXTRA_VERSION);
+		printf("usage: %s [-s shapes] [-n samples] [-t sample_ms] [-f filter] [-b baseline.json] [-T tolerance%%] [-c cpu] [-e] [-o out.json]\n", argv[0]);
+		printf("       %s -j threads [-s shapes] [-d seconds] [-f filter] [-c cpu] [-o out.json]\n", argv[0]);
+		printf("  run microbenchmarks of the codec, trees, pools and protocol, write the results as JSON\n");
+		printf("  -s shapes    trees as subkeys x fields, comma separated, default 1x10,100x10,1000x5\n");
+		printf("  -n samples   samples per benchmark, default 15\n");
+		printf("  -t ms        time of a sample at least, default 20\n");
+		printf("  -f filter    only benchmarks whose name contains filter\n");
+		printf("  -b file      compare to the results of a previous run, exit with 1 if any regressed\n");
+		printf("  -T percent   changes of the median within this are taken as the same, default 5\n");
+		printf("  -c cpu       pin to a CPU\n");
+		printf("  -e           read hardware counters too: cycles, instructions, L1D/LLC and branch misses\n");
+		printf("  -o file      write the results to file instead of stdout\n");
+		printf("  -j threads   numbers of threads to measure scalability on, comma separated, e.g. 1,2,4,8,\n");
+		printf("               with -c the threads are pinned to CPUs from cpu on\n");
+		printf("  -d seconds   time of each number of threads, default 2\n");
+		return 2;
+	}
+
+	if(cpu>=0 && threads.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set))
+			fprintf(stderr, "pinning to cpu %d failed\n", cpu);
+	}
+	if(want_perf)
+	{
+		int nr = perf_open();
+		if(nr==0)
+			fprintf(stderr, "no hardware counters available (perf_event_paranoid, or no PMU), timing only\n");
+		else if(nr<PC_NR)
+		{
+			fprintf(stderr, "not available:");
+			for(int i=0; i<PC_NR; i++)
+				if(counters[i].fd<0)
+					fprintf(stderr, " %s", counters[i].name);
+			fprintf(stderr, "\n");
+		}
+		use_perf = nr>0;
+	}
+	map<string, baseline> base;
+	if(base_path && load_baseline(base_path, base))
+	{
+		fprintf(stderr, "failed to read baseline %s\n", base_path);
+		return 2;
+	}
+	FILE *out = out_path? fopen(out_path, "w") : stdout;
+	if(out==NULL)
+	{
+		fprintf(stderr, "failed to open %s\n", out_path);
+		return 2;
+	}
+
+	if(!threads.empty())
+	{
+		int ret = run_threads(out, shapes, threads, filter, secs, cpu);
+		if(out!=stdout)
+			fclose(out);
+		return ret;
+	}
+
+	int nr_benches = sizeof(benches)/sizeof(benches[0]);
+	vector<result> results;
+	for(size_t s=0; s<shapes.size(); s++)
+	{
+		bench_ctx c;
+		if(setup(c, shapes[s]))
+		{
+			fprintf(stderr, "building trees of %dx%d failed: %s\n", shapes[s].subkeys, shapes[s].fields, KnvNode::GetGlobalErrorMsg());
+			return 3;
+		}
+		for(int i=0; i<nr_benches; i++)
+		{
+			char name[128];
+			snprintf(name, sizeof(name), "%s/%dx%d", benches[i].name, shapes[s].subkeys, shapes[s].fields);
+			if(filter && strstr(name, filter)==NULL)
+				continue;
+			results.push_back(run_bench(benches[i], c, name, nr_samples, (uint64_t)(sample_ms*1000000)));
+			const result &r = results.back();
+			fprintf(stderr, "%-32s %12.1f ns/op  [%.1f, %.1f]", r.name.c_str(), r.median, r.ci_low, r.ci_high);
+			map<string, baseline>::iterator it = base.find(r.name);
+			if(it!=base.end())
+				fprintf(stderr, "  %+6.1f%% %s", (r.median/it->second.median-1)*100, compare(r, it->second, tolerance/100));
+			if(r.pmu[PC_CYCLES]>0 && r.pmu[PC_INSTRUCTIONS]>=0)
+				fprintf(stderr, "  ipc %.2f", r.pmu[PC_INSTRUCTIONS]/r.pmu[PC_CYCLES]);
+			if(r.pmu[PC_LLC_MISSES]>=0)
+				fprintf(stderr, "  llc %.2f/op", r.pmu[PC_LLC_MISSES]);
+			if(r.pmu[PC_BRANCH_MISSES]>=0)
+				fprintf(stderr, "  br %.2f/op", r.pmu[PC_BRANCH_MISSES]);
+			fprintf(stderr, "\n");
+		}
+		cleanup(c);
+	}
+
+	int nr_regressed = 0;
+	fprintf(out, "{\n  \"version\": \"%d.%d\", \"samples\": %d, \"sample_ms\": %.1f, \"time\": %lld,\n  \"results\": [\n",
+		LIB_KNV_MAJOR_VERSION, LIB_KNV_MINOR_VERSION, nr_samples, sample_ms, (long long)time(NULL));
+	for(size_t i=0; i<results.size(); i++)
+	{
+		map<string, baseline>::iterator it = base.find(results[i].name);
+		const baseline *b = it==base.end()? NULL : &it->second;
+		const char *verdict = b? compare(results[i], *b, tolerance/100) : NULL;
+		if(verdict && strcmp(verdict, "regressed")==0)
+			nr_regressed ++;
+		print_result(out, results[i], nr_samples, b, verdict, i+1==results.size());
+	}
+	fprintf(out, "  ]\n}\n");
+	if(out!=stdout)
+		fclose(out);
+	return nr_regressed? 1 : 0;
+}
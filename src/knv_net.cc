@@ -10,6 +10,8 @@ Unless required by applicable law or agreed to in writing, software distributed
 // Encapsulation for socket
 // 
 // 2013-10-31	Created
+// 2026-10-18	SO_REUSEPORT sockets steered by CPU
+// 2026-10-18	TCP sockets
 //
 
 #include <stdlib.h>
@@ -19,6 +21,10 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <vector>
+#include <linux/filter.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <iostream>
 
 #include "knv_net.h"
@@ -142,7 +148,184 @@ namespace KnvNet
 		return s;
 	}
 
-};
+	int CreateUdpReusePortSocket(int port, bool use_ipv6, bool nonblock)
+	{
+		int s, en;
+
+		s = socket(use_ipv6?AF_INET6:AF_INET, SOCK_DGRAM, 0);
+		if(s < 0)
+		{
+			perror("socket");
+			return -1;
+		}
+
+		int reuse_port = 1;
+		if(setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) < 0)
+		{
+			en = errno;
+			perror("setsockopt(SO_REUSEPORT)");
+			close(s);
+			errno = en;
+			return -3;
+		}
+
+		if(nonblock)
+			SetSocketNonblock(s, true);
+
+		KnvSockAddr addr(use_ipv6);
+		if(!use_ipv6)
+		{
+			memset(&addr.a4, 0, sizeof(addr.a4));
+			addr.a4.sin_family = AF_INET;
+			addr.a4.sin_port = htons(port);
+			addr.a4.sin_addr.s_addr = htonl(INADDR_ANY);
+		}
+		else
+		{
+			memset(&addr.a6, 0, sizeof(addr.a6));
+			addr.a6.sin6_family = AF_INET6;
+			addr.a6.sin6_port = htons(port);
+			addr.a6.sin6_addr = in6addr_any;
+		}
 
+		if(bind(s, &addr.addr, addr.addr_len) < 0)
+		{
+			en = errno;
+			perror("bind");
+			close(s);
+			errno = en;
+			return -2;
+		}
 
+		return s;
+	}
 
+	int SetReusePortCpuSteering(int fd, int n, const int *cpus)
+	{
+		if(n<=0 || (cpus && n>(BPF_MAXINSNS-3)/2))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		// A = cpu; if(A==cpus[i]) return i; ...; return A % n
+		std::vector<struct sock_filter> prog;
+		struct sock_filter ld = BPF_STMT(BPF_LD|BPF_W|BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+		prog.push_back(ld);
+		for(int i=0; cpus && i<n; i++)
+		{
+			struct sock_filter jeq = BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (uint32_t)cpus[i], 0, 1);
+			struct sock_filter ret = BPF_STMT(BPF_RET|BPF_K, (uint32_t)i);
+			prog.push_back(jeq);
+			prog.push_back(ret);
+		}
+		struct sock_filter mod = BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, (uint32_t)n);
+		struct sock_filter ret = BPF_STMT(BPF_RET|BPF_A, 0);
+		prog.push_back(mod);
+		prog.push_back(ret);
+
+		struct sock_fprog fprog;
+		fprog.len = prog.size();
+		fprog.filter = &prog[0];
+		return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog));
+	}
+
+	int CreateTcpListenSocket(int port, bool reuse, bool use_ipv6, bool nonblock, int backlog)
+	{
+		int s, en;
+
+		s = socket(use_ipv6?AF_INET6:AF_INET, SOCK_STREAM, 0);
+		if(s < 0)
+		{
+			perror("socket");
+			return -1;
+		}
+
+		if(reuse)
+		{
+			int reuse_addr = 1;
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr));
+		}
+
+		if(nonblock)
+			SetSocketNonblock(s, true);
+
+		KnvSockAddr addr(use_ipv6);
+		if(!use_ipv6)
+		{
+			memset(&addr.a4, 0, sizeof(addr.a4));
+			addr.a4.sin_family = AF_INET;
+			addr.a4.sin_port = htons(port);
+			addr.a4.sin_addr.s_addr = htonl(INADDR_ANY);
+		}
+		else
+		{
+			memset(&addr.a6, 0, sizeof(addr.a6));
+			addr.a6.sin6_family = AF_INET6;
+			addr.a6.sin6_port = htons(port);
+			addr.a6.sin6_addr = in6addr_any;
+		}
+
+		if(bind(s, &addr.addr, addr.addr_len) < 0 || listen(s, backlog) < 0)
+		{
+			en = errno;
+			perror("bind/listen");
+			close(s);
+			errno = en;
+			return -2;
+		}
+
+		return s;
+	}
+
+	int CreateTcpConnection(const KnvSockAddr &addr, bool nonblock, int timeout_ms)
+	{
+		int s, en;
+
+		s = socket(addr.addr.sa_family, SOCK_STREAM, 0);
+		if(s < 0)
+			return -1;
+
+		int one = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		if(timeout_ms<=0)
+		{
+			if(connect(s, &addr.addr, addr.addr_len) < 0)
+				goto fail;
+		}
+		else // connect without blocking and wait for it
+		{
+			SetSocketNonblock(s, true);
+			if(connect(s, &addr.addr, addr.addr_len) < 0)
+			{
+				if(errno!=EINPROGRESS)
+					goto fail;
+				struct pollfd pfd;
+				pfd.fd = s;
+				pfd.events = POLLOUT;
+				int r = poll(&pfd, 1, timeout_ms);
+				if(r==0)
+					errno = ETIMEDOUT;
+				if(r<=0)
+					goto fail;
+				socklen_t elen = sizeof(en);
+				if(getsockopt(s, SOL_SOCKET, SO_ERROR, &en, &elen) < 0)
+					goto fail;
+				if(en)
+				{
+					errno = en;
+					goto fail;
+				}
+			}
+		}
+		SetSocketNonblock(s, nonblock);
+		return s;
+
+	fail:
+		en = errno;
+		close(s);
+		errno = en;
+		return -2;
+	}
+};
@@ -10,6 +10,8 @@ Unless required by applicable law or agreed to in writing, software distributed
 // Encapsulation for socket
 //
 // 2013-10-31	Created
+// 2026-10-18	SO_REUSEPORT sockets steered by CPU
+// 2026-10-18	TCP sockets
 //
 
 #ifndef __KNV_NET__
@@ -54,6 +56,17 @@ namespace KnvNet
 	int SetSocketNonblock(int sockfd, bool nonblock);
 	int SetSocketRecvTimeout(int sockfd, uint64_t iTimeoutMs);
 	int CreateUdpListenSocket(int port, bool reuse = true, bool use_ipv6 = false, bool nblock = true);
+	// a socket of a SO_REUSEPORT group, all sockets bound to port by the same user share its packets
+	int CreateUdpReusePortSocket(int port, bool use_ipv6 = false, bool nblock = true);
+	// steer the packets of fd's SO_REUSEPORT group by the CPU receiving them, using a classic BPF program:
+	// socket i (in the order of binding) gets the packets of cpus[i], other CPUs are spread by cpu%n,
+	// cpus==NULL means socket i gets CPU i, returns 0 on success
+	int SetReusePortCpuSteering(int fd, int n, const int *cpus = NULL);
+	// a listening TCP socket, accepted sockets should be made non-blocking by the caller if needed
+	int CreateTcpListenSocket(int port, bool reuse = true, bool use_ipv6 = false, bool nblock = true, int backlog = 1024);
+	// connect to addr, blocking for up to timeout_ms (0 for the system's timeout), with TCP_NODELAY
+	// returns the socket or <0 on failure, with errno set
+	int CreateTcpConnection(const KnvSockAddr &addr, bool nblock = true, int timeout_ms = 0);
 };
 
 #endif
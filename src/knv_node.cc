@@ -128,6 +128,11 @@ force_inline void knv_dynamic_data_t::free()
 		UcMemManager::Free(mem);
 		mem = NULL;
 	}
+	if(shared)
+	{
+		UcMemManager::Free(shared);
+		shared = NULL;
+	}
 	data = NULL;
 	sz = 0;
 }
@@ -252,6 +257,8 @@ inline int KnvHt::increase()
 		return -1;
 	}
 
+	KnvMetrics::Add(KNV_METRIC_HT_INCREASE, 1);
+
 	uint8_t *new_bm = (uint8_t *)new_mem->ptr();
 	KnvNode **new_ht = ((KnvNode **)new_mem->ptr()) + new_bm_sz;
 	memset(new_bm, 0, new_bm_sz*sizeof(KnvNode *));
@@ -435,6 +442,7 @@ inline int KnvNode::InitNode(knv_tag_t _tag, knv_type_t _type, const knv_value_t
 					return -1;
 				}
 				memcpy(pdata, value->str.data, str_len);
+				KnvMetrics::Add(KNV_METRIC_COPY_BYTES, str_len);
 				val.str.data = pdata;
 				val.str.len = str_len;
 			}
@@ -618,6 +626,54 @@ KnvNode *KnvNode::New(const char *data, int data_len, bool own_buf)
 	return n;
 }
 
+KnvNode *KnvNode::New(UcMem *buf, const char *data, int data_len)
+{
+	if(buf==NULL)
+	{
+		errorstr = "Invalid buffer";
+		return NULL;
+	}
+	KnvNode *n = New(data, data_len, false);
+	if(n)
+		n->dyn_data.share(buf);
+	return n;
+}
+
+KnvNode *KnvNode::New(const knv_seg_t *segs, int nsegs)
+{
+	if(segs && nsegs==1)
+		return New(segs[0].data, segs[0].len, false);
+
+	if(GetNodePool()==NULL)
+	{
+		errorstr = "Out of memory";
+		Attr_API(ATTR_KNV_CREATE_POOL_FAIL, 1);
+		return NULL;
+	}
+
+	knv_seg_iter_t it;
+	if(segs==NULL || knv_seg_begin(&it, segs, nsegs)==NULL)
+	{
+		errorstr = "Invalid bin format";
+		return NULL;
+	}
+
+	KnvNode *n = nodepool->New();
+	if(n==NULL)
+	{
+		errorstr = "Out of memory";
+		return NULL;
+	}
+
+	if(n->InitFromSegs(&it, false))
+	{
+		errorstr = n->errmsg;
+		nodepool->Delete(n);
+		return NULL;
+	}
+	return n;
+}
+
 
 KnvNode *KnvNode::New(knv_tag_t _tag, knv_type_t _type,
 		knv_type_t _keytype, const knv_value_t *_key, const knv_value_t *_val, bool own_buf)
@@ -768,6 +824,8 @@ inline KnvNode *KnvNode::InnerDuplicate(bool own_buf, bool force_no_key)
 
 	if(m) // attach to dyn_data so that it will be freed automatically
 		n->dyn_data.assign(m, v.str.len);
+	else if(!own_buf && dyn_data.shared_mem()) // n references the same shared buffer
+		n->dyn_data.share(dyn_data.shared_mem());
 
 	return n;
 }
@@ -813,6 +871,25 @@ void KnvNode::Delete(KnvNode *tree)
 	if(tree) nodepool->Delete(tree);
 }
 
+int KnvNode::Reserve(int nr)
+{
+	if(GetNodePool()==NULL)
+	{
+		errorstr = "Out of memory";
+		Attr_API(ATTR_KNV_CREATE_POOL_FAIL, 1);
+		return -1;
+	}
+	return nodepool->Reserve(nr);
+}
+
+int KnvWarmup(int nodes, uint64_t bytes_per_class, int flags)
+{
+	if(KnvNode::Reserve(nodes)<0)
+		return -1;
+	UcMemManager::Warmup(bytes_per_class, flags);
+	return 0;
+}
+
 inline void KnvNode::InitChildList(int childnum)
 {
 	child_num = childnum;
@@ -837,6 +914,7 @@ inline int KnvNode::InnerExpand(bool force_no_key)
 		return 0;
 
 	knv_field_t f, *pf;
+	UcMem *shared = dyn_data.shared_mem(); // children reference it, too
 
 	const void *prev_pos, *cur_pos = val.str.data;
 	pf = knv_begin(&f, val.str.data, val.str.len);
@@ -844,6 +922,8 @@ inline int KnvNode::InnerExpand(bool force_no_key)
 	{
 		return 0;
 	}
+	KnvMetrics::Add(KNV_METRIC_EXPAND, 1);
+	KnvMetrics::Add(KNV_METRIC_EXPAND_BYTES, val.str.len);
 
 	do
 	{
@@ -875,6 +955,7 @@ inline int KnvNode::InnerExpand(bool force_no_key)
 				if(metalist) nodepool->DeleteAll(metalist);
 				return -2;
 			}
+			if(shared) n->dyn_data.share(shared);
 			n->parent = this;
 
 			metas[pf->tag] = n;
@@ -899,6 +980,7 @@ inline int KnvNode::InnerExpand(bool force_no_key)
 				if(metalist) nodepool->DeleteAll(metalist);
 				return -4;
 			}
+			if(shared) n->dyn_data.share(shared);
 			if(n->key.len>0) // mark child_has_key flag
 				child_has_key = true;
 			n->parent = this;
@@ -919,6 +1001,115 @@ inline int KnvNode::InnerExpand(bool force_no_key)
 	return 0;
 }
 
+// whether the current string value of it is a complete message
+static bool seg_is_message(const knv_seg_iter_t *it)
+{
+	knv_seg_iter_t sub;
+	if(knv_seg_enter(it, &sub)==NULL)
+		return false;
+	while(knv_seg_next(&sub))
+		;
+	return sub.f.eom;
+}
+
+int KnvNode::InitFromSegs(knv_seg_iter_t *it, bool force_no_key)
+{
+	knv_field_t *pf = &it->f;
+
+	if(!it->straddle) // in one segment, reference it
+		return InitNode(pf->tag, pf->type, &pf->val, false, true, it->field_sz, force_no_key);
+
+	if(pf->val.str.data) // short value stitched in the scratch buffer, which is reused for the next field
+		return InitNode(pf->tag, pf->type, &pf->val, true, true, it->field_sz, force_no_key);
+
+	uint32_t len = pf->val.str.len;
+	if(pf->tag<=UC_MAX_META_NUM || !seg_is_message(it))
+	{
+		// a long leaf must be contiguous
+		UcMem *m = UcMemManager::Alloc(len);
+		if(m==NULL)
+		{
+			errmsg = "Out of memory";
+			return -1;
+		}
+		knv_seg_copy(it, m->ptr());
+		KnvMetrics::Add(KNV_METRIC_COPY_BYTES, len);
+
+		knv_value_t v;
+		v.str.len = len;
+		v.str.data = (char*)m->ptr();
+		if(InitNode(pf->tag, pf->type, &v, false, true, it->field_sz, force_no_key))
+		{
+			UcMemManager::Free(m);
+			return -2;
+		}
+		dyn_data.share(m);
+		UcMemManager::Free(m);
+		return 0;
+	}
+
+	// a long message: expand it directly from the segments, it has no contiguous value
+	// and is marked dirty, so that it is folded from the children when needed
+	if(InitNode(pf->tag, pf->type, NULL, false))
+		return -3;
+	no_key = force_no_key;
+	child_has_key = false;
+	KnvMetrics::Add(KNV_METRIC_EXPAND, 1);
+	KnvMetrics::Add(KNV_METRIC_EXPAND_BYTES, len);
+
+	knv_seg_iter_t sub;
+	knv_field_t *sf = knv_seg_enter(it, &sub);
+	uint32_t first_tag = sf->tag;
+	do
+	{
+		KnvNode *n;
+		if(sf->tag<=UC_MAX_META_NUM)
+		{
+			if(metalist==NULL)
+			{
+				memset(metas, 0, sizeof(metas));
+			}
+			n = nodepool->New(metalist);
+			if(n==NULL || n->InitFromSegs(&sub, true))
+			{
+				errmsg = n? n->errmsg : "Out of memory";
+				goto failure;
+			}
+			metas[sf->tag] = n;
+		}
+		else
+		{
+			n = nodepool->New(childlist);
+			if(n==NULL || n->InitFromSegs(&sub, false))
+			{
+				errmsg = n? n->errmsg : "Out of memory";
+				goto failure;
+			}
+			if(n->key.len>0)
+				child_has_key = true;
+			ht.put(n);
+			child_num ++;
+		}
+		n->parent = this;
+	} while((sf=knv_seg_next(&sub)));
+
+	if(!force_no_key && first_tag==1 && metas[1])
+		key.init(metas[1]->type, &metas[1]->val, false);
+
+	val.str.len = 0;
+	val.str.data = NULL;
+	subnode_dirty = true;
+	eval_val_sz = len;
+	eval_sz = it->field_sz;
+	return 0;
+
+failure:
+	child_num = 0;
+	if(childlist) nodepool->DeleteAll(childlist);
+	if(metalist) nodepool->DeleteAll(metalist);
+	return -4;
+}
+
 int KnvNode::Expand()
 {
 	if(!IsValid())
@@ -1026,6 +1217,8 @@ int KnvNode::Fold()
 	val.str.data = dyn_data.assign(m, pack_len);
 	val.str.len = pack_len;
 	subnode_dirty = false;
+	KnvMetrics::Add(KNV_METRIC_FOLD, 1);
+	KnvMetrics::Add(KNV_METRIC_FOLD_BYTES, pack_len);
 
 	child_num = -1;
 	if(metalist) nodepool->DeleteAll(metalist);
@@ -1153,6 +1346,119 @@ int KnvNode::Serialize(char *buf, int &len, bool with_header)
 	return 0;
 }
 
+// encode a field (or a field head if val is NULL) into iov's scratch
+static int iov_add_field(KnvIov &iov, knv_tag_t tag, knv_type_t type, const knv_value_t *val, uint32_t str_len)
+{
+	// tag and length varints take at most 10 bytes each
+	int sz = val? knv_eval_field_length(tag, type, val) : 20;
+	char *p = iov.Reserve(sz);
+	if(p==NULL)
+		return -1;
+
+	knv_buff_t b;
+	if(knv_init_buff(&b, p, sz))
+		return -2;
+	if(val? knv_add_field_val(&b, tag, type, val) : knv_add_string_head(&b, tag, str_len))
+		return -3;
+	iov.Commit(p, knv_get_encoded_length(&b));
+	return 0;
+}
+
+int KnvNode::Serialize(KnvIov &iov, bool with_header)
+{
+	if(!IsValid())
+	{
+		errmsg = "node is invalid";
+		return -1;
+	}
+
+	int start_len = iov.GetLength();
+
+	// if there's a key, it must be in the meta (expanded), or in the value (folded)
+	if(type!=KNV_NODE || child_num<0 || (child_num==0 && metalist==NULL) || // a leaf
+		(IsBufferValid() && !subnode_dirty)) // already folded
+	{
+		if(type!=KNV_STRING)
+		{
+			if(!with_header)
+			{
+				errmsg = "not support serializing value for non-message";
+				return -5;
+			}
+			if(iov_add_field(iov, tag, type, &val, 0))
+			{
+				errmsg = "Out of memory";
+				return -3;
+			}
+			return 0;
+		}
+		if(with_header && iov_add_field(iov, tag, type, NULL, val.str.len))
+		{
+			errmsg = "Out of memory";
+			return -3;
+		}
+		if(iov.AppendRef(val.str.data, val.str.len))
+		{
+			errmsg = "Out of memory";
+			return -4;
+		}
+		return 0;
+	}
+
+	int evalsize = EvaluateSize();
+
+	// add message tag/type/length
+	if(with_header && iov_add_field(iov, tag, KNV_NODE, NULL, eval_val_sz))
+	{
+		errmsg = "Out of memory";
+		return -6;
+	}
+
+	bool finished_key = false;
+
+	// key should be placed in the first place
+	if(!no_key && key.len>0 && key.val)
+	{
+		if(iov_add_field(iov, 1, key.type, &key.GetValue(), 0))
+		{
+			errmsg = "Out of memory";
+			return -7;
+		}
+		finished_key = true;
+	}
+
+	KnvNode *f = metalist;
+	if(finished_key && f && f->tag==1) // key alread serialized above
+		f = (KnvNode *)f->next;
+
+	// metas
+	for(; f; f=(KnvNode *)f->next)
+	{
+		if(f->Serialize(iov, true))
+		{
+			errmsg = f->errmsg;
+			return -8;
+		}
+	}
+
+	for(KnvNode *n=childlist; n; n=(KnvNode *)n->next)
+	{
+		if(n->Serialize(iov, true))
+		{
+			errmsg = n->errmsg;
+			return -9;
+		}
+	}
+
+	int cur_len = iov.GetLength() - start_len;
+	if((with_header && cur_len != evalsize) || (with_header==false && cur_len != eval_val_sz))
+	{
+		errmsg = "Bug: eval size incorrect";
+		return -10;
+	}
+	return 0;
+}
+
 const KnvLeaf *KnvNode::GetValue()
 {
 	int ret = Fold();
@@ -1593,7 +1899,7 @@ int KnvNode::SetMeta(knv_tag_t _tag, knv_type_t _type, const knv_value_t *_data,
 		{
 			if(_type==KNV_STRING && own_buf)
 			{
-				m->val.str.data = dyn_data.alloc(_data->str.len);
+				m->val.str.data = m->dyn_data.alloc(_data->str.len);
 				if(m->val.str.data==NULL)
 				{
 					m->val.str.len = 0;
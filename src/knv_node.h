@@ -24,6 +24,9 @@ Unless required by applicable law or agreed to in writing, software distributed
  * 2014-01-17   Use mem_pool for dynamic memory management
  * 2014-01-28   Use KnvHt to optimize hash initialization
  * 2014-05-17   Meta use KnvNode instead of KnvLeaf
+ * 2026-10-18   Nodes may reference a shared, reference-counted UcMem
+ * 2026-10-18   Scatter-gather serialization
+ * 2026-10-18   Decoding from segmented buffers
  *
  */
 
@@ -33,6 +36,7 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include "knv_codec.h"
 #include "obj_base.h"
 #include "mem_pool.h"
+#include "knv_iov.h"
 #include <string>
 #include <ostream>
 #include <iostream>
@@ -56,15 +60,26 @@ typedef uint32_t knv_tag_t;
 class knv_dynamic_data_t // data struct for dynamically allocated data
 {
 public:
-	knv_dynamic_data_t():sz(0),data(NULL),mem(NULL){}
+	knv_dynamic_data_t():sz(0),data(NULL),mem(NULL),shared(NULL){}
 
 	char *alloc(uint32_t req_sz);
 	char *assign(UcMem *m, uint32_t size);
+	void share(UcMem *m) // hold a reference to m, which the node data points into
+	{
+		m->AddRef();
+		if(shared)
+			UcMemManager::Free(shared);
+		shared = m; // never written to or reused, data/mem are only our own buffers
+	}
+	UcMem *shared_mem() { return shared; } // the shared buffer held, or NULL
 	void free();
 private:
 	uint32_t sz; // allocated size
 	char *data;
 	UcMem *mem;
+	// kept until free(), not replaced by alloc()/assign(): after the value is rebuilt,
+	// a key initialized with own_buf=false still points into the shared buffer
+	UcMem *shared;
 	char small_buf[64];
 };
 
@@ -231,6 +246,7 @@ private:
 
 	// Expand and Fold are automatically performed when needed
 	int InnerExpand(bool force_no_key=false);
+	int InitFromSegs(knv_seg_iter_t *it, bool force_no_key); // InitNode() from the current field of it
 	int Expand(); // de-serialize
 	int Fold();   // serialize
 	int SetKey(knv_type_t _keytype, const knv_value_t *_key, bool own_buf);
@@ -272,10 +288,24 @@ public: // constructors
 	// construct from a leaf
 	static KnvNode *New(const KnvLeaf &l, bool own_buf=true);
 	static KnvNode *New(knv_tag_t _tag, knv_type_t _type, UcMem *val, int length);
+	// zero-copy construction from a reference-counted buffer, e.g. a receive buffer:
+	//    buf               -- buffer holding data/data_len, the node takes a reference of it
+	// every node expanded from the tree references buf and holds its own reference,
+	// so the buffer is recycled only after the tree and all subtrees detached from it are deleted;
+	// the caller still drops its own reference with UcMemManager::Free(buf) as usual
+	static KnvNode *New(UcMem *buf, const char *data, int data_len);
+	// construct from a message spread over several buffers, without concatenating them:
+	// values within one segment point into it, so the segments should be available as long as the tree,
+	// only short values across segment boundaries are copied, long ones are expanded in place
+	static KnvNode *New(const knv_seg_t *segs, int nsegs);
 	// construct from PB message string, you can optionally specify a tag for the node
 	// Note: if you wish to get this message back, call GetValue() instead of Serialize()
 	static KnvNode *NewFromMessage(const string &msg, knv_tag_t _tag=1);
 
+	// make the (unexpanded) node hold a reference to buf, which its value points into
+	// the reference is passed on to nodes expanded from it, see New(UcMem *, ...)
+	void AttachBuffer(UcMem *buf) { dyn_data.share(buf); }
+
 	// Delete a tree
 	// <<Warning>>: user SHOULD NOT delete a child node in a tree
 	// if you want to do this, call parent->RemoveChild()/node->Remove() instead
@@ -284,6 +314,9 @@ public: // constructors
 	// error msg for static functions: New()
 	static const char *GetGlobalErrorMsg();
 
+	// pre-allocate nr idle nodes in this thread's node pool, returns the number allocated
+	static int Reserve(int nr);
+
 	// new copy of self
 	KnvNode *Duplicate(bool own_buf);
 
@@ -292,6 +325,7 @@ public: // methods
 	bool IsExpanded()   { return child_num>=0; }
 	bool IsLeaf()       { return type!=KNV_NODE || (child_num<0 && Expand()) || (child_num==0 && metalist==NULL);  }
 	bool IsBufferValid(){ return (val.str.len>0 && val.str.data); }
+	bool IsDirty()      { return subnode_dirty; } // modified after being encoded, the buffer is outdated
 	bool IsMatch(knv_tag_t t, const char *k, int klen);
 
 	const knv_key_t &GetKey() { return key; }
@@ -305,6 +339,9 @@ public: // API for data operations
 	string GetStrVal(); // get value as a string, return empty string for non-string type
 	int Serialize(string &out); // fold(), return a buffer representing the whole knv tree
 	int Serialize(char *buf, int &len, bool with_header = true); // serialize to user given buffer (also pack tag if with_header=true)
+	// serialize to an iovec list, unchanged folded values are referenced in place,
+	// so the tree must not be modified or deleted until iov is sent
+	int Serialize(KnvIov &iov, bool with_header = true);
 	// set interface can not change key
 	// own_buf: true - node has its own buffer, false - node use passed buffer
 	int SetValue(const char *str_val, int len, bool own_buf); // message or string
@@ -463,6 +500,15 @@ private:
 };
 
 
+// Warm up the calling thread's pools before taking traffic:
+//   nodes           -- number of idle KnvNodes to pre-allocate
+//   bytes_per_class -- bytes of idle buffers to pre-allocate in each UcMemManager class
+//                      (hash tables grown by KnvHt are served from these classes, too)
+//   flags           -- UC_WARMUP_TOUCH/UC_WARMUP_LOCK, see mem_pool.h
+// Pools are per-thread, so each worker thread should call this once at start-up
+// returns 0 on success, <0 if the node pool can not be created
+int KnvWarmup(int nodes, uint64_t bytes_per_class, int flags = 0);
+
 // inline methods put here
 
 inline KnvNode *KnvNode::New(knv_tag_t _tag, knv_type_t _type, UcMem *val, int length)
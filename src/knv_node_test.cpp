@@ -9,10 +9,26 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <fstream>
 #include <iostream>
 
 #include "knv_node.h"
+#include "knv_metrics.h"
+#include "protocol.h"
+#include "knv_reassembler.h"
+#include "knv_batch.h"
+#include "knv_lz.h"
+#include "knv_udp_server.h"
+#include "knv_tcp.h"
+#include "knv_client.h"
+#include "knv_dispatch.h"
+#include "knv_latency.h"
+#include "knv_capture.h"
+#include "commands.h"
 
 static inline string key2hex(const knv_key_t &k)
 {
@@ -113,7 +129,7 @@ int ReadTest(uint64_t key)
 	return 0;
 }
 
-string to_string(int i)
+static string int2str(int i)
 {
 	char s[32];
 	sprintf(s, "%d", i);
@@ -190,7 +206,7 @@ int MakeReqTree(knv_key_t &k, KnvNode *(&req_tree), KnvNode *(&data_tree), int s
 			if(j%2)
 				guin->InsertIntLeaf(300+j, j);
 			else
-				guin->InsertStrLeaf(300+j, string("f"+to_string(j)).data(), j>9?3:2);
+				guin->InsertStrLeaf(300+j, string("f"+int2str(j)).data(), j>9?3:2);
 		}
 	}
 
@@ -333,6 +349,564 @@ int FieldTest(uint64_t key)
 	return 0;
 }
 
+// decode from a reference-counted buffer, subtrees must keep it alive after the tree is gone
+int ZeroCopyTest()
+{
+	knv_key_t k((uint64_t)12345678);
+	KnvNode *tree = KnvNode::NewTree(3501, &k);
+	if(tree==NULL)
+	{
+		cout << "KnvNode::New() returns: " << KnvNode::GetGlobalErrorMsg() << endl;
+		return -1;
+	}
+	FAIL_IF(tree->SetFieldStr(11, 6,"test11"));
+	FAIL_IF(tree->SetFieldStr(12, 6,"test12"));
+	string s;
+	FAIL_IF(tree->Serialize(s));
+	KnvNode::Delete(tree);
+
+	UcMem *m = UcMemManager::Alloc(s.length());
+	memcpy(m->ptr(), s.data(), s.length());
+	tree = KnvNode::New(m, (char*)m->ptr(), s.length());
+	if(tree==NULL)
+	{
+		cout << "KnvNode::New(UcMem) returns: " << KnvNode::GetGlobalErrorMsg() << endl;
+		return -1;
+	}
+	KnvNode *f = tree->FindChildByTag(12);
+	if(f==NULL || m->GetRefCount()<3)
+	{
+		cout << "children do not reference the buffer, ref=" << m->GetRefCount() << endl;
+		return -1;
+	}
+	KnvNode *sub = f->Duplicate(false);
+	FAIL_IF(sub? 0:-1);
+	UcMemManager::Free(m); // the caller's reference
+	KnvNode::Delete(tree);
+	if(m->GetRefCount()!=1 || sub->GetStrVal()!="test12")
+	{
+		cout << "subtree lost the buffer, ref=" << m->GetRefCount() << endl;
+		return -1;
+	}
+	KnvNode::Delete(sub); // buffer is recycled here
+
+	// a string key keeps pointing into the buffer after the value of a detached subtree
+	// is rebuilt, so the reference must outlive folding
+	knv_key_t sk(KNV_STRING, 10, (char*)"subkey-abc");
+	tree = KnvNode::NewTree(3501);
+	FAIL_IF(tree? 0:-1);
+	KnvNode *c = KnvNode::NewTree(20, &sk);
+	FAIL_IF(c? 0:-1);
+	FAIL_IF(c->SetFieldStr(11, 6, "test11"));
+	FAIL_IF(tree->InsertChild(c, false, false, false));
+	FAIL_IF(tree->Serialize(s));
+	KnvNode::Delete(tree);
+	m = UcMemManager::Alloc(s.length());
+	memcpy(m->ptr(), s.data(), s.length());
+	tree = KnvNode::New(m, (char*)m->ptr(), s.length());
+	FAIL_IF(tree? 0:-1);
+	f = tree->FindChildByTag(20);
+	FAIL_IF(f? 0:-1);
+	sub = f->Duplicate(false);
+	FAIL_IF(sub? 0:-1);
+	UcMemManager::Free(m);
+	KnvNode::Delete(tree);
+	if(sub->SetFieldStr(12, 6, "test12")<0)
+	{
+		cout << "SetFieldStr() on a detached subtree returns: " << sub->GetErrorMsg() << endl;
+		KnvNode::Delete(sub);
+		return -1;
+	}
+	sub->GetValue(); // folds into a buffer of its own
+	UcMem *x = UcMemManager::Alloc(s.length()); // would be m, had it been recycled
+	memset(x->ptr(), 'Z', s.length());
+	string ks = sub->GetKey().GetStrVal();
+	UcMemManager::Free(x);
+	if(m->GetRefCount()!=1 || ks!="subkey-abc")
+	{
+		cout << "key of a folded subtree lost the buffer, ref=" << m->GetRefCount() << ", key=" << ks << endl;
+		KnvNode::Delete(sub);
+		return -1;
+	}
+	KnvNode::Delete(sub);
+
+	// the same through KnvProtocol
+	KnvProtocol req(1, 2, 3);
+	FAIL_IF(req.AddBody(k));
+	FAIL_IF(req.Encode(s));
+	m = UcMemManager::Alloc(s.length());
+	memcpy(m->ptr(), s.data(), s.length());
+	KnvProtocol *p = new KnvProtocol(m, (char*)m->ptr(), s.length());
+	UcMemManager::Free(m);
+	if(!p->IsValid() || p->GetCommand()!=1 || p->GetSubCommand()!=2 || p->GetSequence()!=3 || p->GetBody()==NULL)
+	{
+		cout << "zero-copy protocol decoding failed" << endl;
+		delete p;
+		return -1;
+	}
+	delete p;
+	return 0;
+}
+
+// scatter-gather encoding must produce the same bytes as contiguous encoding
+int IovTest(int subkeys, int fields)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req, *tree;
+	if(MakeReqTree(k, req, tree, subkeys, fields))
+		return -1;
+	KnvNode::Delete(req);
+
+	string s, s2;
+	FAIL_IF(tree->Serialize(s));
+	KnvNode::Delete(tree);
+
+	// modify one record, all others stay folded and are referenced in place
+	tree = KnvNode::New(s);
+	FAIL_IF(tree? 0:-1);
+	KnvNode *dm = tree->FindChildByTag(13);
+	FAIL_IF(dm? 0:-1);
+	KnvNode *rec = dm->GetFirstChild();
+	FAIL_IF(rec? 0:-1);
+	FAIL_IF(rec->SetFieldStr(300, 12, "modifiedname"));
+
+	KnvIov iov;
+	FAIL_IF(tree->Serialize(iov));
+	iov.CopyTo(s2);
+	cout << "tree: " << iov.GetLength() << " bytes in " << iov.GetIovCount() << " iovecs" << endl;
+	FAIL_IF(tree->Serialize(s));
+	if(s!=s2)
+	{
+		cout << "iov serialization differs" << endl;
+		return -1;
+	}
+
+	KnvProtocol p(1, 2, 3);
+	FAIL_IF(p.EncodeWithBody(tree, iov));
+	iov.CopyTo(s2);
+	FAIL_IF(p.EncodeWithBody(tree, s));
+	if(s!=s2)
+	{
+		cout << "iov protocol encoding differs" << endl;
+		return -1;
+	}
+	KnvNode::Delete(tree);
+	return 0;
+}
+
+// parts encoded from the header template must be the same as encoding the header each time
+int SplitTest(int subkeys, int fields)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req, *tree;
+	if(MakeReqTree(k, req, tree, subkeys, fields))
+		return -1;
+	KnvNode::Delete(req);
+
+	KnvProtocol p(1, 2, 3);
+	p.SetAllowSplit(true, 1000);
+	FAIL_IF(p.Split(tree));
+	KnvNode::Delete(tree);
+	int n = p.GetTotalPartNum();
+	cout << "split into " << n << " parts" << endl;
+
+	vector<string> parts(n);
+	string s;
+	KnvIov iov;
+	for(int i=0; i<n; i++)
+	{
+		FAIL_IF(p.EncodePart(i, parts[i]));
+		iov.Clear();
+		FAIL_IF(p.EncodePart(i, iov)<0? -1:0);
+		iov.CopyTo(s);
+		if(s!=parts[i])
+		{
+			cout << "iov part " << i << " differs" << endl;
+			return -1;
+		}
+		KnvProtocol dp(parts[i], false);
+		if(!dp.IsValid() || dp.GetTotalPartNum()!=n || dp.GetSequence()!=3)
+		{
+			cout << "part " << i << " can not be decoded: " << dp.GetErrorMsg() << endl;
+			return -1;
+		}
+	}
+
+	// changing the header drops the template, parts are encoded the old way
+	FAIL_IF(p.SetSequence(3));
+	for(int i=0; i<n; i++)
+	{
+		FAIL_IF(p.EncodePart(i, s));
+		if(s!=parts[i])
+		{
+			cout << "templated part " << i << " differs" << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// two split packets from different peers, parts interleaved and out of order
+int ReassembleTest(int subkeys, int fields)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req, *tree;
+	if(MakeReqTree(k, req, tree, subkeys, fields))
+		return -1;
+	KnvNode::Delete(req);
+	string body;
+	FAIL_IF(tree->Serialize(body));
+
+	KnvProtocol p(1, 2, 3);
+	p.SetAllowSplit(true, 1000);
+	FAIL_IF(p.Split(tree));
+	KnvNode::Delete(tree);
+	int n = p.GetTotalPartNum();
+	vector<string> parts(n);
+	for(int i=0; i<n; i++)
+		FAIL_IF(p.EncodePart(i, parts[i]));
+
+	KnvNet::KnvSockAddr peer1("10.0.0.1", 1000), peer2("10.0.0.2", 1000);
+	KnvReassembler ra;
+	KnvProtocol *full;
+	int done = 0;
+	for(int i=n-1; i>=0; i--) // last part first
+	{
+		for(int j=0; j<2; j++)
+		{
+			KnvProtocol dp(parts[i], false);
+			int ret = ra.Add(j? peer2 : peer1, dp, full, 1000);
+			if(ret<0 || (ret==1) != (i==0))
+			{
+				cout << "adding part " << i << " returns " << ret << ": " << ra.GetErrorMsg() << endl;
+				return -1;
+			}
+			if(ret==1)
+			{
+				string s;
+				if(full->GetBody()==NULL || full->GetBody()->Serialize(s) || s!=body)
+				{
+					cout << "reassembled body differs" << endl;
+					delete full;
+					return -1;
+				}
+				delete full;
+				done ++;
+			}
+			if(i==n-1 && j==1) // duplicate
+			{
+				KnvProtocol dup(parts[i], false);
+				FAIL_IF(ra.Add(peer2, dup, full, 1000));
+			}
+		}
+	}
+	if(done!=2 || ra.GetPendingNum()!=0 || ra.GetMemUsed()!=0)
+	{
+		cout << "reassembler is not empty after completion" << endl;
+		return -1;
+	}
+
+	// timeout, then memory limit
+	KnvProtocol p0(parts[0], false), p1(parts[1], false);
+	FAIL_IF(ra.Add(peer1, p0, full, 1000));
+	if(ra.Expire(1000+KNV_REASM_DEFAULT_TIMEOUT_MS)!=1 || ra.GetPendingNum()!=0)
+	{
+		cout << "stale packet is not expired" << endl;
+		return -1;
+	}
+	KnvReassembler small(1000, (uint64_t)n*1000);
+	FAIL_IF(small.Add(peer1, p0, full, 1000));
+	FAIL_IF(small.Add(peer2, p1, full, 1000));
+	if(small.GetPendingNum()!=1)
+	{
+		cout << "memory limit does not evict the oldest packet" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+// decode a packet cut into chunks of every size, the tree must encode back to the same bytes
+int SegmentTest(int subkeys, int fields)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req, *tree;
+	if(MakeReqTree(k, req, tree, subkeys, fields))
+		return -1;
+	KnvNode::Delete(req);
+	KnvProtocol p(1, 2, 3);
+	string pkg, s;
+	FAIL_IF(p.EncodeWithBody(tree, pkg));
+	KnvNode::Delete(tree);
+
+	int chunk_sizes[] = {1, 3, 100, 1000, 4096, (int)pkg.length()};
+	for(size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++)
+	{
+		int csz = chunk_sizes[c];
+		int nsegs = (pkg.length()+csz-1)/csz;
+		vector<string> chunks(nsegs); // separate buffers
+		vector<knv_seg_t> segs(nsegs);
+		for(int i=0; i<nsegs; i++)
+		{
+			chunks[i] = pkg.substr(i*csz, csz);
+			segs[i].data = chunks[i].data();
+			segs[i].len = chunks[i].length();
+		}
+		KnvProtocol dp(&segs[0], nsegs);
+		if(!dp.IsValid() || dp.GetSequence()!=3 || dp.GetBody()==NULL)
+		{
+			cout << "decoding " << nsegs << " segments failed: " << dp.GetErrorMsg() << endl;
+			return -1;
+		}
+		KnvNode *b = dp.GetBody()->GetFirstChild();
+		FAIL_IF(b? 0:-1);
+		FAIL_IF(dp.EncodeWithBody(dp.GetBody(), s));
+		if(s!=pkg)
+		{
+			cout << "packet decoded from " << nsegs << " segments differs" << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Peek() must agree with full decoding, for KNV and OIDB packets
+int PeekTest(int loops)
+{
+	KnvProtocol p(11, 22, 33);
+	knv_key_t k((uint64_t)12345678);
+	KnvNode *dm;
+	string pkgs[2];
+	if(p.AddBody(k) || p.SetRspAddr(KnvNet::KnvSockAddr("192.168.1.2", 8080)) ||
+		(dm=p.AddDomain(11))==NULL || dm->SetFieldStr(101, 7, "Shaneyu") ||
+		p.Encode(pkgs[0]) || p.EncodeOidb(pkgs[1]))
+	{
+		cout << "building packets failed: " << p.GetErrorMsg() << endl;
+		return -1;
+	}
+	for(int i=0; i<2; i++)
+	{
+		string &s = pkgs[i];
+		KnvHeaderInfo info;
+		KnvProtocol dp(s, false);
+		if(KnvProtocol::Peek(s.data(), s.length(), info) || !dp.IsValid() ||
+			info.cmd!=dp.GetCommand() || info.subcmd!=dp.GetSubCommand() || info.seq!=dp.GetSequence() ||
+			info.pkg_len!=(int)s.length() || info.rspaddr.addr_len!=dp.GetRspAddr().addr_len ||
+			memcmp(&info.rspaddr.addr, &dp.GetRspAddr().addr, info.rspaddr.addr_len) ||
+			!info.has_key || info.key_type!=KNV_VARINT || info.key.i64!=12345678)
+		{
+			cout << "peeking " << (i? "OIDB" : "KNV") << " packet differs from decoding" << endl;
+			return -1;
+		}
+
+		struct timeval t1, t2;
+		uint64_t sum = 0;
+		gettimeofday(&t1, NULL);
+		for(int n=0; n<loops; n++)
+		{
+			KnvProtocol::Peek(s.data(), s.length(), info);
+			sum += info.seq;
+		}
+		gettimeofday(&t2, NULL);
+		double ns = ((t2.tv_sec-t1.tv_sec)*1e9 + (t2.tv_usec-t1.tv_usec)*1e3) / (loops? loops:1);
+		cout << (i? "OIDB" : "KNV") << " packet of " << s.length() << " bytes: " << ns << " ns/peek" << (sum? "" : " ") << endl;
+	}
+	return 0;
+}
+
+// responses encoded with the header template must match the ones encoded through the header nodes
+int RspHeaderTest(int loops)
+{
+	KnvProtocol p(11, 22, 33);
+	knv_key_t k((uint64_t)12345678);
+	KnvNode *dm;
+	string req, s, expected;
+	if(p.AddBody(k) || p.SetRspAddr(KnvNet::KnvSockAddr("192.168.1.2", 8080)) || p.SetReqSplit(true, 1000) ||
+		(dm=p.AddDomain(11))==NULL || dm->SetFieldStr(101, 7, "Shaneyu") || p.Encode(req)<0)
+	{
+		cout << "building request failed: " << p.GetErrorMsg() << endl;
+		return -1;
+	}
+
+	// the old way: ret/err written to the header nodes, then the whole tree is encoded
+	string err("no such key");
+	KnvProtocol d0(req, false);
+	KnvNode *h = d0.GetMutableHeader();
+	if(h==NULL || h->SetFieldInt(KNV_PKG_HDR_RET_TAG, 5) || h->SetFieldStr(KNV_PKG_HDR_ERR_TAG, err.length(), err.data()) ||
+		d0.RemoveAllBodies() || d0.Encode(expected)<0)
+	{
+		cout << "encoding the old way failed: " << d0.GetErrorMsg() << endl;
+		return -1;
+	}
+
+	KnvProtocol d1(req, false);
+	KnvIov iov;
+	if(d1.EncodeWithError(5, err, s)<0 || s!=expected)
+	{
+		cout << "templated response differs" << endl;
+		return -1;
+	}
+	if(d1.EncodeWithError(5, err, iov)<0 || iov.CopyTo(s)<0 || s!=expected)
+	{
+		cout << "templated iov response differs" << endl;
+		return -1;
+	}
+	// ret/err reach the header nodes when they are read
+	if(d1.GetHeaderIntField(KNV_PKG_HDR_RET_TAG)!=5 || d1.GetHeaderStringField(KNV_PKG_HDR_ERR_TAG)!=err ||
+		d1.GetRetCode()!=5 || d1.GetRetMsg()!=err)
+	{
+		cout << "ret/err not synced to the header" << endl;
+		return -1;
+	}
+	// changes through GetMutableHeader() reach the response, also when the template is a copy already
+	KnvProtocol d3(req, false);
+	for(uint64_t seq=44; seq<46; seq++)
+	{
+		h = d3.GetMutableHeader();
+		if(h==NULL || h->SetFieldInt(KNV_PKG_HDR_SEQ_TAG, seq) || d3.EncodeWithError(5, err, s)<0)
+		{
+			cout << "encoding a modified header failed: " << d3.GetErrorMsg() << endl;
+			return -1;
+		}
+		KnvProtocol r(s, false);
+		if(r.GetHeaderIntField(KNV_PKG_HDR_SEQ_TAG)!=seq || r.GetRetCode()!=5)
+		{
+			cout << "header change is not in the response" << endl;
+			return -1;
+		}
+	}
+	// now that the header has a ret field, it is kept as 0 like SetRetCode(0) does
+	KnvProtocol d2(req, false);
+	h = d2.GetMutableHeader();
+	if(h==NULL || h->SetFieldInt(KNV_PKG_HDR_RET_TAG, 0) || d2.RemoveAllBodies() || d2.Encode(expected)<0 ||
+		d1.EncodeWithError(0, "", s)<0 || s!=expected)
+	{
+		cout << "response without error differs" << endl;
+		return -1;
+	}
+
+	struct timeval t1, t2;
+	for(int tmpl=0; tmpl<2; tmpl++)
+	{
+		gettimeofday(&t1, NULL);
+		for(int n=0; n<loops; n++)
+		{
+			UcMem *m = NULL;
+			KnvProtocol dp(req, false);
+			if(tmpl)
+			{
+				dp.GetHeader(); // a handler reading the header
+				dp.EncodeWithError(5, err, m);
+			}
+			else
+			{
+				h = dp.GetMutableHeader();
+				h->SetFieldInt(KNV_PKG_HDR_RET_TAG, 5);
+				h->SetFieldStr(KNV_PKG_HDR_ERR_TAG, err.length(), err.data());
+				dp.Encode(m);
+			}
+			if(m) UcMemManager::Free(m);
+		}
+		gettimeofday(&t2, NULL);
+		double ns = ((t2.tv_sec-t1.tv_sec)*1e9 + (t2.tv_usec-t1.tv_usec)*1e3) / (loops? loops:1);
+		cout << (tmpl? "header template" : "header nodes") << ": " << ns << " ns/response (decoding included)" << endl;
+	}
+	return 0;
+}
+
+// replies field 101 = key*2 after 2ms, the last key never finishes before the deadline
+static int EchoBody(KnvNode *req, string &rsp, void *arg)
+{
+	uint64_t key = req->GetKey().GetIntVal();
+	if(key==*(uint64_t *)arg)
+	{
+		while(!KnvBatchExecutor::DeadlinePassed())
+			usleep(1000);
+		return -1;
+	}
+	usleep(2000);
+	KnvNode *b = KnvNode::NewTree(KNV_PKG_BDY_TAG, &req->GetKey());
+	if(b==NULL || b->SetFieldInt(101, key*2) || b->Serialize(rsp))
+	{
+		KnvNode::Delete(b);
+		return -2;
+	}
+	KnvNode::Delete(b);
+	return 0;
+}
+
+int BatchTest(int nbodies, int nthreads)
+{
+	KnvProtocol p(11, 22, 33);
+	string req, rsp;
+	for(int i=0; i<nbodies; i++)
+	{
+		knv_key_t k((uint64_t)(1000+i));
+		if(p.AddBody(k))
+		{
+			cout << "AddBody failed: " << p.GetErrorMsg() << endl;
+			return -1;
+		}
+	}
+	if(p.Encode(req)<0)
+	{
+		cout << "Encode failed: " << p.GetErrorMsg() << endl;
+		return -1;
+	}
+
+	uint64_t slow_key = 1000+nbodies-1;
+	KnvBatchExecutor ex(EchoBody, &slow_key);
+	KnvProtocol dp(req, false);
+	struct timeval t1, t2;
+	gettimeofday(&t1, NULL);
+	if(ex.Start(nthreads) || ex.Execute(dp, 100, rsp)<0)
+	{
+		cout << "executing failed: " << ex.GetErrorMsg() << endl;
+		return -1;
+	}
+	gettimeofday(&t2, NULL);
+	cout << nbodies << " bodies with " << nthreads << " threads: " <<
+		(t2.tv_sec-t1.tv_sec)*1000 + (t2.tv_usec-t1.tv_usec)/1000 << " ms" << endl;
+
+	KnvProtocol rp(rsp, false);
+	int n = 0;
+	for(KnvNode *b=rp.GetFirstRequest(); b; b=rp.GetNextRequest(), n++)
+	{
+		uint64_t key = b->GetKey().GetIntVal();
+		if(key<1000 || key>=slow_key || b->GetFieldInt(101)!=key*2)
+		{
+			cout << "bad response body for key " << key << endl;
+			return -1;
+		}
+	}
+	if(!rp.IsValid() || rp.GetSequence()!=33 || n!=nbodies-1 || ex.GetUnfinishedNum()!=1)
+	{
+		cout << "response has " << n << " bodies, " << ex.GetUnfinishedNum() << " unfinished" << endl;
+		return -1;
+	}
+
+	// KNV_PKG_UNFINISHED_TAG lists the slow key
+	char expected[16];
+	knv_buff_t kb;
+	knv_init_buff(&kb, expected, sizeof(expected));
+	knv_add_varint(&kb, 1, slow_key);
+	KnvNode *t = KnvNode::New(rsp, false);
+	KnvNode *u = t? t->FindChildByTag(KNV_PKG_UNFINISHED_TAG) : NULL;
+	const KnvLeaf *l = u? u->GetValue() : NULL;
+	if(l==NULL || l->GetValue().str.len!=(uint32_t)knv_get_encoded_length(&kb) ||
+		memcmp(l->GetValue().str.data, expected, knv_get_encoded_length(&kb)))
+	{
+		cout << "unfinished keys are not listed" << endl;
+		KnvNode::Delete(t);
+		return -1;
+	}
+	KnvNode::Delete(t);
+	return 0;
+}
+
 int WriteTest(uint64_t key)
 {
 	knv_key_t k(key);
@@ -539,24 +1113,1107 @@ int WriteTest(uint64_t key)
 	return 0;
 }
 
-int main(int argc, char *argv[])
+// compressed packets must decode to the same bodies, be forwarded as received, and split into fewer parts
+int CompressTest(int subkeys, int fields)
 {
-	if(argc<2)
+	// the codec on its own, random data of varying redundancy must come back, garbage must not crash
+	srand(1);
+	string src, z, out;
+	for(int len=0; len<70000; len=len*3+7)
 	{
-	err:
-		cout << "Arguments: " << endl;
-		cout << "           " << argv[0] << " r <uin>  # read test" << endl;
-		cout << "           " << argv[0] << " w <uin>  # write test" << endl;
-		cout << "           " << argv[0] << " rw <uin> # read and write test" << endl;
-		cout << "           " << argv[0] << " wr <uin> # write and read test" << endl;
-		cout << "           " << argv[0] << " pc  <subkey_num> <field_num>  # decode/encode pressure test" << endl;
-		cout << "           " << argv[0] << " pe  <subkey_num> <field_num>  # extract pressure test" << endl;
-		cout << "           " << argv[0] << " f        # test field api" << endl;
-		return 1;
+		for(int r=1; r<=256; r*=16)
+		{
+			src.resize(len);
+			for(int i=0; i<len; i++)
+				src[i] = (rand()%r) + (i%13==0? i : 0);
+			z.resize(KNV_LZ_BOUND(len));
+			out.resize(len);
+			int zl = knv_lz_compress(src.data(), len, &z[0], z.length());
+			if(zl<=0 || knv_lz_decompress(z.data(), zl, &out[0], len)!=len || out!=src)
+			{
+				cout << "lz round trip of " << len << " bytes failed" << endl;
+				return -1;
+			}
+			for(int i=0; i<zl; i+=7)
+			{
+				z[i] ^= 0x5a;
+				knv_lz_decompress(z.data(), zl, &out[0], len);
+			}
+		}
 	}
 
-	if(strcmp(argv[1], "r")==0)
-	{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req, *tree;
+	if(MakeReqTree(k, req, tree, subkeys, fields))
+		return -1;
+	KnvNode::Delete(req);
+	string body, raw, pkg, s;
+	FAIL_IF(tree->Serialize(body));
+
+	KnvProtocol p(1, 2, 3);
+	FAIL_IF(p.EncodeWithBody(tree, raw));
+	p.SetAllowCompress(true);
+	FAIL_IF(p.EncodeWithBody(tree, pkg));
+	KnvHeaderInfo info;
+	if(KnvProtocol::Peek(pkg.data(), pkg.length(), info) || info.seq!=3 || info.compressed_len+16<body.length())
+	{
+		cout << "compressed packet can not be peeked" << endl;
+		return -1;
+	}
+	cout << "packet of " << raw.length() << " bytes compressed to " << pkg.length() << " bytes" << endl;
+
+	// forwarded without inflating, then inflated on access
+	KnvProtocol dp(pkg, false);
+	FAIL_IF(dp.Encode(s));
+	if(!dp.IsCompressed() || s!=pkg)
+	{
+		cout << "compressed packet is not forwarded as is" << endl;
+		return -1;
+	}
+	if(dp.GetBody()==NULL || dp.IsCompressed() || dp.GetBody()->Serialize(s) || s!=body)
+	{
+		cout << "inflated body differs: " << dp.GetErrorMsg() << endl;
+		return -1;
+	}
+	FAIL_IF(dp.Encode(s));
+	if(s!=raw)
+	{
+		cout << "inflated packet differs" << endl;
+		return -1;
+	}
+
+	// the peer asks for compression: the request is forwarded uncompressed, the response is compressed
+	// when the responder allows it, an error response is never compressed
+	KnvProtocol q(1, 2, 4);
+	FAIL_IF(q.SetReqCompress(true));
+	FAIL_IF(q.AddBody(tree));
+	FAIL_IF(q.Encode(s));
+	KnvProtocol sp(s, false);
+	FAIL_IF(sp.Encode(s));
+	KnvProtocol fp(s, false);
+	if(sp.GetAllowCompress() || !sp.GetReqCompress() || fp.IsCompressed())
+	{
+		cout << "forwarded request is compressed" << endl;
+		return -1;
+	}
+	sp.SetAllowCompress(sp.GetReqCompress());
+	FAIL_IF(sp.EncodeWithBody(tree, s));
+	KnvProtocol cp(s, false);
+	if(!cp.IsCompressed() || cp.GetBody()==NULL || cp.GetBody()->Serialize(s) || s!=body)
+	{
+		cout << "response is not compressed as requested: " << cp.GetErrorMsg() << endl;
+		return -1;
+	}
+	KnvProtocol ep(pkg, false);
+	FAIL_IF(ep.EncodeWithError(-1, "failed", s));
+	KnvProtocol ecp(s, false);
+	if(ecp.IsCompressed() || ecp.GetRetCode()!=(uint32_t)-1 || ecp.GetBody())
+	{
+		cout << "error response of a compressed request is wrong" << endl;
+		return -1;
+	}
+
+	// fewer parts, which still reassemble
+	int nparts[2];
+	for(int c=0; c<2; c++)
+	{
+		KnvProtocol sp(1, 2, 3);
+		sp.SetAllowSplit(true, 1000);
+		sp.SetAllowCompress(c!=0);
+		FAIL_IF(sp.Split(tree));
+		nparts[c] = sp.GetTotalPartNum();
+		KnvProtocol merged;
+		for(int i=0; i<nparts[c]; i++)
+		{
+			FAIL_IF(sp.EncodePart(i, s));
+			KnvProtocol part(s);
+			FAIL_IF(merged.AddPartial(part));
+		}
+		if(!merged.IsComplete() || merged.GetBody()==NULL || merged.GetBody()->Serialize(s) || s!=body)
+		{
+			cout << "merged body differs" << endl;
+			return -1;
+		}
+	}
+	cout << "split into " << nparts[1] << " parts instead of " << nparts[0] << endl;
+	if(nparts[1]>nparts[0])
+		return -1;
+
+	struct timeval t1, t2;
+	int loops = 100;
+	gettimeofday(&t1, NULL);
+	for(int i=0; i<loops; i++)
+		FAIL_IF(p.EncodeWithBody(tree, s));
+	gettimeofday(&t2, NULL);
+	double us = ((t2.tv_sec-t1.tv_sec)*1e6 + (t2.tv_usec-t1.tv_usec)) / loops;
+	cout << "encode with compression: " << raw.length()/us << " MB/s" << endl;
+	gettimeofday(&t1, NULL);
+	for(int i=0; i<loops; i++)
+	{
+		KnvProtocol d(pkg, false);
+		FAIL_IF(d.GetBody()? 0:-1);
+	}
+	gettimeofday(&t2, NULL);
+	us = ((t2.tv_sec-t1.tv_sec)*1e6 + (t2.tv_usec-t1.tv_usec)) / loops;
+	cout << "decode with inflation: " << raw.length()/us << " MB/s" << endl;
+	KnvNode::Delete(tree);
+	return 0;
+}
+
+static int EchoRequest(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg)
+{
+	return 0;
+}
+
+static void *UdpServerEntry(void *arg)
+{
+	KnvUdpServer *srv = (KnvUdpServer *)arg;
+	if(srv->Run())
+		cout << "server failed: " << srv->GetErrorMsg() << endl;
+	return NULL;
+}
+
+// an echo server over loopback, loaded with small requests and with requests replied in parts
+int UdpTest(int duration_ms, int window, int backend = KNV_IO_EPOLL)
+{
+	KnvUdpServer srv;
+	struct sockaddr_in a;
+	socklen_t alen = sizeof(a);
+	srv.SetBackend(backend);
+	int fd = KnvNet::CreateUdpListenSocket(0, true, false, true);
+	if(fd<0 || getsockname(fd, (struct sockaddr *)&a, &alen) || srv.Attach(fd))
+	{
+		cout << "starting server failed: " << srv.GetErrorMsg() << endl;
+		return -1;
+	}
+	if(srv.GetBackend()!=backend)
+		cout << "io_uring is not available, running on epoll" << endl;
+	srv.SetHandler(1, EchoRequest);
+	pthread_t thr;
+	if(pthread_create(&thr, NULL, UdpServerEntry, &srv))
+		return -1;
+
+	KnvNet::KnvSockAddr to("127.0.0.1", ntohs(a.sin_port));
+	KnvUdpLoadGen gen(window);
+	int ret = 0;
+	for(int big=0; big<2 && ret==0; big++)
+	{
+		uint64_t kv = 12345678;
+		knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+		KnvNode *req_tree, *tree;
+		if(MakeReqTree(k, req_tree, tree, big? 200 : 1, 10))
+			return -1;
+		KnvNode::Delete(req_tree);
+		KnvProtocol req(1, 2, 0);
+		FAIL_IF(req.AddBody(tree, true));
+		FAIL_IF(req.SetReqSplit(true, big? 1000 : 0));
+
+		KnvUdpLoadStats st;
+		if(gen.Run(to, req, duration_ms, st))
+		{
+			cout << "load generator failed: " << gen.GetErrorMsg() << endl;
+			ret = -1;
+			break;
+		}
+		cout << (big? "split replies: " : "small requests: ") << st.received*1000000/(st.elapsed_us? st.elapsed_us:1) << " req/s";
+		cout << ", latency avg " << st.lat_sum_us/(st.received? st.received:1) << " us, max " << st.lat_max_us << " us";
+		cout << ", sent " << st.sent << ", lost " << st.lost << endl;
+		if(st.received==0)
+			ret = -1;
+	}
+
+	// a command without handler gets an error
+	KnvProtocol bad(99, 0, 7);
+	string s;
+	char buf[1024];
+	int cfd = socket(AF_INET, SOCK_DGRAM, 0);
+	KnvNet::SetSocketRecvTimeout(cfd, 1000);
+	if(ret==0 && (bad.Encode(s) || sendto(cfd, s.data(), s.length(), 0, &to.addr, to.addr_len)<0))
+		ret = -1;
+	int n = ret? -1 : recv(cfd, buf, sizeof(buf), 0);
+	KnvProtocol rsp(buf, n>0? n:0, false);
+	if(ret==0 && (n<=0 || !rsp.IsValid() || rsp.GetSequence()!=7 || rsp.GetRetCode()!=knv::UC_BadRequest))
+	{
+		cout << "unknown command is not rejected" << endl;
+		ret = -1;
+	}
+	close(cfd);
+
+	// a split request sent as one UDP_SEGMENT message, the server gets it in one GRO buffer
+	// if the kernel keeps it together, otherwise part by part
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req_tree, *tree;
+	if(ret==0 && MakeReqTree(k, req_tree, tree, 50, 10))
+		ret = -1;
+	if(ret==0)
+	{
+		KnvNode::Delete(req_tree);
+		KnvProtocol sreq(1, 2, 8);
+		sreq.SetAllowSplit(true, 1000);
+		FAIL_IF(sreq.AddBody(tree, true));
+		FAIL_IF(sreq.Split());
+		int seg = 0;
+		s.clear();
+		for(int i=0; i<sreq.GetTotalPartNum(); i++)
+		{
+			string part;
+			FAIL_IF(sreq.EncodePart(i, part));
+			if(i==0)
+				seg = part.length();
+			else if(part.length()>(size_t)seg || (part.length()<(size_t)seg && i<sreq.GetTotalPartNum()-1))
+			{
+				cout << "parts differ in size" << endl;
+				ret = -1;
+			}
+			s += part;
+		}
+
+		char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+		struct iovec iov = { &s[0], s.length() };
+		struct msghdr h;
+		memset(&h, 0, sizeof(h));
+		h.msg_name = &to.addr;
+		h.msg_namelen = to.addr_len;
+		h.msg_iov = &iov;
+		h.msg_iovlen = 1;
+		h.msg_control = ctrl;
+		h.msg_controllen = sizeof(ctrl);
+		struct cmsghdr *c = CMSG_FIRSTHDR(&h);
+		c->cmsg_level = IPPROTO_UDP;
+		c->cmsg_type = UDP_SEGMENT;
+		c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		uint16_t seg16 = seg;
+		memcpy(CMSG_DATA(c), &seg16, sizeof(seg16));
+
+		cfd = socket(AF_INET, SOCK_DGRAM, 0);
+		KnvNet::SetSocketRecvTimeout(cfd, 1000);
+		vector<char> rbuf(KNV_UDP_MAX_PKT_SIZE);
+		if(ret==0 && sendmsg(cfd, &h, 0)<0)
+		{
+			cout << "sending by UDP_SEGMENT failed: " << strerror(errno) << ", skipped" << endl;
+		}
+		else if(ret==0)
+		{
+			n = recv(cfd, &rbuf[0], rbuf.size(), 0);
+			KnvProtocol srsp(&rbuf[0], n>0? n:0, false);
+			if(n<=0 || !srsp.IsValid() || srsp.GetSequence()!=8 || srsp.GetRetCode())
+			{
+				cout << "split request by UDP_SEGMENT is not served" << endl;
+				ret = -1;
+			}
+		}
+		close(cfd);
+	}
+
+	srv.Stop();
+	pthread_join(thr, NULL);
+
+	vector<KnvMetricValue> vals;
+	KnvMetrics::Snapshot(vals, true);
+	for(size_t i=0; i<vals.size(); i++)
+		if(vals[i].name.compare(0, 4, "udp.")==0)
+			cout << vals[i].name << " " << vals[i].value << endl;
+	return ret;
+}
+
+struct GroupClient
+{
+	int port;
+	int duration_ms;
+	int cpu; // -1 if not pinned
+	KnvUdpLoadStats st;
+	int ret;
+};
+
+// each client builds its request in its own thread, as the pools are per thread
+static void *GroupClientEntry(void *arg)
+{
+	GroupClient &c = *(GroupClient *)arg;
+	c.ret = -1;
+	if(c.cpu>=0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(c.cpu, &set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			return NULL;
+	}
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req_tree, *tree;
+	if(MakeReqTree(k, req_tree, tree, 1, 10))
+		return NULL;
+	KnvNode::Delete(req_tree);
+	KnvProtocol req(1, 2, 0);
+	if(req.AddBody(tree, true)==0)
+	{
+		KnvUdpLoadGen gen(16);
+		c.ret = gen.Run(KnvNet::KnvSockAddr("127.0.0.1", c.port), req, c.duration_ms, c.st);
+	}
+	return NULL;
+}
+
+static int RunGroupClients(vector<GroupClient> &clients, uint64_t &received)
+{
+	vector<pthread_t> thr(clients.size());
+	received = 0;
+	for(size_t i=0; i<clients.size(); i++)
+		if(pthread_create(&thr[i], NULL, GroupClientEntry, &clients[i]))
+			return -1;
+	int ret = 0;
+	for(size_t i=0; i<clients.size(); i++)
+	{
+		pthread_join(thr[i], NULL);
+		if(clients[i].ret)
+			ret = -1;
+		received += clients[i].st.received;
+	}
+	return ret;
+}
+
+// workers on SO_REUSEPORT sockets of one port, first spread by the kernel, then steered by CPU
+int UdpGroupTest(int duration_ms, int nr_workers)
+{
+	int nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(nr_cpus<1) nr_cpus = 1;
+	vector<int> cpus(nr_workers);
+	for(int i=0; i<nr_workers; i++)
+		cpus[i] = i % nr_cpus;
+
+	for(int steer=0; steer<2; steer++)
+	{
+		KnvUdpServerGroup grp;
+		grp.SetHandler(1, EchoRequest);
+		grp.SetWarmup(1000, 1<<20);
+		if(grp.Start(0, nr_workers, &cpus[0], steer))
+		{
+			cout << "starting group failed: " << grp.GetErrorMsg() << endl;
+			return -1;
+		}
+
+		// without steering, several client sockets are hashed over the workers,
+		// with it, a client pinned to the CPU of the last worker is served by the first worker of that CPU
+		vector<GroupClient> clients(steer? 1 : nr_workers*2);
+		for(size_t i=0; i<clients.size(); i++)
+		{
+			clients[i].port = grp.GetPort();
+			clients[i].duration_ms = duration_ms;
+			clients[i].cpu = steer? cpus[nr_workers-1] : -1;
+		}
+		uint64_t received;
+		int ret = RunGroupClients(clients, received);
+		grp.Stop();
+		if(ret)
+		{
+			cout << "load generator failed" << endl;
+			return -1;
+		}
+
+		uint64_t total = 0;
+		cout << (steer? "steered by cpu: " : "spread by hash: ") << received*1000/duration_ms << " req/s, per worker:";
+		for(int i=0; i<nr_workers; i++)
+		{
+			cout << " " << grp.GetRecvCount(i);
+			total += grp.GetRecvCount(i);
+		}
+		cout << endl;
+		if(received==0 || total<received)
+		{
+			cout << "workers received less than was replied" << endl;
+			return -1;
+		}
+		if(steer)
+		{
+			int expected = cpus[nr_workers-1]; // cpus[i]==i for i<nr_cpus
+			if(grp.GetRecvCount(expected)*10 < total*9)
+			{
+				cout << "packets are not steered to worker " << expected << endl;
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// each packet of the stream has its index as sequence, see TcpTest()
+static int CheckFramed(KnvProtocol *p, const vector<string> &pkgs, size_t &got)
+{
+	string s;
+	int ret = 0;
+	if(got>=pkgs.size() || !p->IsValid() || p->GetSequence()!=got)
+		ret = -1;
+	else if(pkgs[got][0]!=STX_IPV6_PB && (p->Encode(s)<0 || s!=pkgs[got])) // forwarded as received
+		ret = -1;
+	if(ret)
+		cout << "packet " << got << " is not framed right: " << p->GetErrorMsg() << endl;
+	delete p;
+	got ++;
+	return ret;
+}
+
+static int DropRequest(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg)
+{
+	return 1;
+}
+
+struct ClientBench
+{
+	KnvClient *cli;
+	volatile bool resubmit;
+	uint64_t done;   // updated by the client's thread
+	uint64_t failed;
+};
+
+static void ClientBenchCallback(int ret, KnvProtocol *rsp, void *arg)
+{
+	ClientBench &b = *(ClientBench *)arg;
+	if(ret || rsp->GetBody()==NULL)
+		b.failed ++;
+	else
+		b.done ++;
+	if(b.resubmit) // the next request, built in the client's thread
+	{
+		uint64_t kv = 12345678;
+		KnvProtocol req(1, 2, 0);
+		if(req.AddBody(knv_key_t(KNV_VARINT, 8, (char*)&kv)) || b.cli->Call(req, 1000, ClientBenchCallback, arg))
+			b.failed ++;
+	}
+}
+
+static uint64_t ClientNowUs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec*1000000ULL + tv.tv_usec;
+}
+
+// a pipelined client against an echo server over loopback
+int ClientTest(int duration_ms, int window)
+{
+	KnvUdpServer srv;
+	struct sockaddr_in a;
+	socklen_t alen = sizeof(a);
+	int fd = KnvNet::CreateUdpListenSocket(0, true, false, true);
+	if(fd<0 || getsockname(fd, (struct sockaddr *)&a, &alen) || srv.Attach(fd))
+	{
+		cout << "starting server failed: " << srv.GetErrorMsg() << endl;
+		return -1;
+	}
+	srv.SetHandler(1, EchoRequest);
+	srv.SetHandler(3, DropRequest);
+	pthread_t thr;
+	if(pthread_create(&thr, NULL, UdpServerEntry, &srv))
+		return -1;
+
+	int ret = -1;
+	KnvClient cli(window);
+	ClientBench b;
+	b.cli = &cli;
+	b.done = b.failed = 0;
+	uint64_t kv = 12345678, start;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvProtocol req(1, 2, 0);
+	KnvClientFuture f;
+	if(cli.Start(KnvNet::KnvSockAddr("127.0.0.1", ntohs(a.sin_port))) || req.AddBody(k))
+	{
+		cout << "starting client failed: " << cli.GetErrorMsg() << endl;
+		goto out;
+	}
+
+	// callbacks keep the window full from the client's thread
+	b.resubmit = true;
+	start = ClientNowUs();
+	for(int i=0; i<window; i++)
+		cli.Call(req, 1000, ClientBenchCallback, &b);
+	usleep(duration_ms*1000);
+	b.resubmit = false;
+	while(cli.GetPendingNum()>0)
+		usleep(1000);
+	cout << "calls from callbacks: " << b.done*1000000/(ClientNowUs()-start) << " req/s, failed " << b.failed << endl;
+	if(b.failed || b.done==0)
+		goto out;
+
+	// calls from this thread, handed over to the client's thread
+	b.done = 0;
+	start = ClientNowUs();
+	while(ClientNowUs()-start < (uint64_t)duration_ms*1000)
+	{
+		if(cli.GetPendingNum()>=window)
+			sched_yield();
+		else if(cli.Call(req, 1000, ClientBenchCallback, &b))
+			goto out;
+	}
+	while(cli.GetPendingNum()>0)
+		usleep(1000);
+	cout << "calls from another thread: " << b.done*1000000/(ClientNowUs()-start) << " req/s, failed " << b.failed << endl;
+	if(b.failed)
+		goto out;
+
+	// a split reply through a future
+	{
+		KnvNode *req_tree, *tree;
+		if(MakeReqTree(k, req_tree, tree, 200, 10))
+			goto out;
+		KnvNode::Delete(req_tree);
+		KnvProtocol big(1, 2, 0);
+		string body;
+		if(big.AddBody(tree, true) || big.SetReqSplit(true, 1000) || tree->Serialize(body) || cli.Call(big, 1000, f) || !f.Wait())
+			goto out;
+		KnvProtocol rsp(f.GetReply().data(), f.GetReply().length(), false);
+		string rbody;
+		if(f.GetResult() || !rsp.IsValid() || rsp.GetBody()==NULL || rsp.GetBody()->Serialize(rbody) || rbody!=body)
+		{
+			cout << "split reply is wrong: " << f.GetResult() << ", " << f.GetReply().length() << " bytes" << endl;
+			goto out;
+		}
+	}
+
+	// no reply, then a call cut short by stopping
+	start = ClientNowUs();
+	req.SetCommand(3);
+	if(cli.Call(req, 50, f) || !f.Wait(1000) || f.GetResult()!=KNV_CLIENT_ERR_TIMEOUT || ClientNowUs()-start<50000)
+	{
+		cout << "call is not timed out: " << f.GetResult() << endl;
+		goto out;
+	}
+	if(cli.Call(req, 10000, f))
+		goto out;
+	cli.Stop();
+	if(!f.IsDone() || f.GetResult()!=KNV_CLIENT_ERR_STOPPED || cli.Call(req, 100, f)!=KNV_CLIENT_CALL_NOT_RUNNING)
+	{
+		cout << "pending call is not stopped" << endl;
+		goto out;
+	}
+	ret = 0;
+
+out:
+	cli.Stop();
+	srv.Stop();
+	pthread_join(thr, NULL);
+	return ret;
+}
+
+static int TagHandler(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg)
+{
+	return (int)(intptr_t)arg;
+}
+
+// bindings found through the frozen table must be the registered ones, and lookups
+// are timed against a std::map
+int DispatchTest(int loops)
+{
+	KnvDispatcher d;
+	map<uint32_t, int> ref;
+	const uint32_t known[] = { knv::CacheReadCommand, knv::CacheWriteCommand, knv::CacheEraseCommand,
+		knv::CacheSyncCommand, knv::CacheFillbackCommand, knv::CacheFastSyncCommand, knv::CacheReadAllCommand,
+		knv::CacheWriteAllCommand, knv::CacheEraseAllCommand, knv::ScSyncNoData, knv::ScSyncWithData,
+		knv::UsReadCommand, knv::ProfileSet, knv::ProfileBatchGetSimple, knv::ProfileBatchGetDetail };
+	int nr_known = sizeof(known)/sizeof(known[0]);
+	uint32_t x = 12345;
+	int ret = 0;
+	for(int i=0; i<1000; i++)
+	{
+		uint32_t cmd = i<nr_known? known[i] : (x = x*1103515245 + 12345) % 0x100000;
+		if(ref.count(cmd))
+			continue;
+		ref[cmd] = i + 1;
+		ret |= d.Register(cmd, TagHandler, (void *)(intptr_t)(i+1));
+	}
+	// a sub-command of its own, and a body limit
+	KnvCmdOptions opt = { 0, 0, 100 };
+	ret |= d.Register(knv::CacheSyncCommand, knv::CacheSyncErase, TagHandler, (void *)(intptr_t)5000);
+	ret |= d.Register(knv::CacheWriteCommand, TagHandler, (void *)(intptr_t)6000, &opt);
+	ref[knv::CacheWriteCommand] = 6000;
+	if(ret || d.Freeze())
+	{
+		cout << "building dispatcher failed: " << d.GetErrorMsg() << endl;
+		return -1;
+	}
+	cout << d.GetBindingNum() << " bindings in " << d.GetTableSize() << " slots" << endl;
+
+	for(map<uint32_t, int>::iterator it=ref.begin(); it!=ref.end(); ++it)
+	{
+		const KnvCmdBinding *b = d.Find(it->first, 0);
+		if(b==NULL || b->arg!=(void *)(intptr_t)it->second)
+		{
+			cout << "binding of " << it->first << " is not found" << endl;
+			return -1;
+		}
+	}
+	const KnvCmdBinding *b1 = d.Find(knv::CacheSyncCommand, knv::CacheSyncErase);
+	const KnvCmdBinding *b2 = d.Find(knv::CacheSyncCommand, knv::CacheSyncUpdate);
+	if(b1==NULL || b1->arg!=(void *)5000 || b2==NULL || b2->arg==(void *)5000 ||
+		d.Find(0x100001, 0) || d.Find(knv::CacheReadCommand+0x1000000, 0))
+	{
+		cout << "sub-command bindings or misses are wrong" << endl;
+		return -1;
+	}
+
+	// a body over the limit is rejected, one within it is handled
+	KnvNet::KnvSockAddr peer("127.0.0.1", 1);
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req_tree, *tree;
+	if(MakeReqTree(k, req_tree, tree, 20, 10))
+		return -1;
+	KnvNode::Delete(req_tree);
+	KnvProtocol big(knv::CacheWriteCommand, 0, 1), small(knv::CacheWriteCommand, 0, 2), none(0x100001, 0, 3);
+	FAIL_IF(big.AddBody(tree, true));
+	FAIL_IF(small.AddBody(k));
+	if(d.Dispatch(big, peer)!=KNV_DISPATCH_REJECTED || d.Dispatch(small, peer)!=6000 ||
+		d.Dispatch(none, peer)!=KNV_DISPATCH_REJECTED)
+	{
+		cout << "dispatching does not apply the options" << endl;
+		return -1;
+	}
+
+	vector<uint32_t> cmds;
+	for(map<uint32_t, int>::iterator it=ref.begin(); it!=ref.end(); ++it)
+		cmds.push_back(it->first);
+	struct timeval t1, t2;
+	for(int i=0; i<2; i++)
+	{
+		uint64_t sum = 0;
+		gettimeofday(&t1, NULL);
+		for(int n=0; n<loops; n++)
+		{
+			uint32_t cmd = cmds[n % cmds.size()];
+			if(i==0)
+				sum += (intptr_t)d.Find(cmd, 0)->arg;
+			else
+				sum += ref.find(cmd)->second;
+		}
+		gettimeofday(&t2, NULL);
+		double ns = ((t2.tv_sec-t1.tv_sec)*1e9 + (t2.tv_usec-t1.tv_usec)*1e3) / (loops? loops:1);
+		cout << (i? "std::map" : "KnvDispatcher") << ": " << ns << " ns/lookup" << (sum? "" : " ") << endl;
+	}
+	return 0;
+}
+
+// send pkgs from cli, srv echoes each one back as received
+static int FailWrite(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg)
+{
+	return pkt.SetRetCode(knv::CacheWrite_RequestBodyEmpty);
+}
+
+// walks the body like a read handler looking up its subkeys
+static int ReadBody(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, void *arg)
+{
+	KnvNode *body = pkt.GetBody();
+	string s;
+	return body && body->Serialize(s)==0? 0 : -1;
+}
+
+// the phases of the histograms must add up to each call, per command and retcode
+static int CheckLatency(int calls)
+{
+	const uint32_t cmds[] = { knv::CacheReadCommand, knv::CacheWriteCommand, knv::UsReadCommand };
+	const int retcodes[] = { 0, knv::CacheWrite_RequestBodyEmpty, 0 };
+	vector<KnvLatencyStat> stats;
+	KnvLatency::Snapshot(stats);
+	for(int c=0; c<3; c++)
+	{
+		int phases = 0;
+		for(size_t i=0; i<stats.size(); i++)
+		{
+			const KnvLatencyStat &st = stats[i];
+			if(st.cmd!=cmds[c])
+				continue;
+			if(st.retcode!=retcodes[c] || st.count!=(uint64_t)calls || st.p50_ns>st.p99_ns || st.p99_ns>st.max_ns)
+			{
+				cout << "wrong stat of " << knv::GetCmdName(st.cmd) << " " << KnvLatency::GetPhaseName(st.phase) << ": retcode " << st.retcode << ", count " << st.count << endl;
+				return -1;
+			}
+			phases |= 1<<st.phase;
+		}
+		if(phases!=(1<<KNV_LAT_NR_PHASES)-1)
+		{
+			cout << knv::GetCmdName(cmds[c]) << " lacks phases: " << phases << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// records KNV_LAT_MAX_KEYS/2+1 retcodes of a command of its own, *arg is the command
+static void *RecordManyKeys(void *arg)
+{
+	for(int r=0; r<KNV_LAT_MAX_KEYS/2+1; r++)
+		KnvLatency::Record(*(uint32_t *)arg, r, KNV_LAT_HANDLE, 1000);
+	return NULL;
+}
+
+// buckets must cover values to 1/16, the keys of threads add up beyond one thread's limit,
+// then commands served over loopback are recorded by phase
+int LatencyTest(int calls)
+{
+	KnvLatencyHist h;
+	for(uint64_t v=1; v<(1ULL<<40); v+=v/7+1)
+	{
+		uint64_t hi = KnvLatencyHist::GetBucketHigh(KnvLatencyHist::GetBucket(v));
+		if(hi<v || (v>=16 && hi-v > v/16) || KnvLatencyHist::GetBucket(hi+1)!=KnvLatencyHist::GetBucket(v)+1)
+		{
+			cout << "bucket of " << v << " ends at " << hi << endl;
+			return -1;
+		}
+	}
+	for(uint64_t v=1; v<=10000; v++)
+		h.Add(v);
+	uint64_t p50 = h.GetPercentile(50), p99 = h.GetPercentile(99), p100 = h.GetPercentile(100);
+	if(p50<5000 || p50>5000+5000/16 || p99<9900 || p99>9900+9900/16 || p100!=10000 || h.GetCount()!=10000)
+	{
+		cout << "wrong percentiles: p50 " << p50 << ", p99 " << p99 << ", p100 " << p100 << endl;
+		return -1;
+	}
+
+	// the keys of an exited thread and a live one
+	uint32_t many_cmds[2] = { 0xfff01, 0xfff02 };
+	pthread_t many_thr;
+	if(pthread_create(&many_thr, NULL, RecordManyKeys, &many_cmds[0]))
+		return -1;
+	pthread_join(many_thr, NULL);
+	RecordManyKeys(&many_cmds[1]);
+	vector<KnvLatencyStat> many;
+	int nr_many = 0;
+	KnvLatency::Snapshot(many);
+	for(size_t i=0; i<many.size(); i++)
+		if(many[i].cmd==many_cmds[0] || many[i].cmd==many_cmds[1])
+			nr_many ++;
+	if(nr_many!=2*(KNV_LAT_MAX_KEYS/2+1) || KnvLatency::GetDroppedNum())
+	{
+		cout << "keys of threads are lost: " << nr_many << ", dropped " << KnvLatency::GetDroppedNum() << endl;
+		return -1;
+	}
+
+	KnvUdpServer srv;
+	struct sockaddr_in a;
+	socklen_t alen = sizeof(a);
+	int fd = KnvNet::CreateUdpListenSocket(0, true, false, true);
+	if(fd<0 || getsockname(fd, (struct sockaddr *)&a, &alen) || srv.Attach(fd))
+	{
+		cout << "starting server failed: " << srv.GetErrorMsg() << endl;
+		return -1;
+	}
+	srv.SetHandler(knv::CacheReadCommand, EchoRequest);
+	srv.SetHandler(knv::CacheWriteCommand, FailWrite);
+	srv.SetHandler(knv::UsReadCommand, ReadBody);
+	pthread_t thr;
+	if(pthread_create(&thr, NULL, UdpServerEntry, &srv))
+		return -1;
+
+	int ret = -1;
+	KnvClient cli(16);
+	KnvClientFuture f;
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	KnvNode *req_tree, *tree;
+	KnvProtocol req(1, 2, 0);
+	const uint32_t cmds[] = { knv::CacheReadCommand, knv::CacheWriteCommand, knv::UsReadCommand };
+	if(MakeReqTree(k, req_tree, tree, 20, 10))
+		goto out;
+	KnvNode::Delete(req_tree);
+	if(req.AddBody(tree, true) || cli.Start(KnvNet::KnvSockAddr("127.0.0.1", ntohs(a.sin_port))))
+	{
+		cout << "starting client failed: " << cli.GetErrorMsg() << endl;
+		goto out;
+	}
+	for(int c=0; c<3; c++)
+	{
+		req.SetCommand(cmds[c]);
+		for(int i=0; i<calls; i++)
+		{
+			if(cli.Call(req, 1000, f) || !f.Wait(2000) || f.GetResult())
+			{
+				cout << "call failed: " << f.GetResult() << endl;
+				goto out;
+			}
+		}
+	}
+	if(CheckLatency(calls))
+		goto out;
+	ret = 0;
+
+out:
+	cli.Stop();
+	srv.Stop();
+	pthread_join(thr, NULL);
+	// the histograms of the server's thread are kept after it exits
+	if(ret==0 && CheckLatency(calls)==0)
+		cout << KnvLatency::Dump();
+	else
+		ret = -1;
+	return ret;
+}
+
+// ip as tcpdump -X prints it, after a header line captured at ts
+static void DumpIp(string &out, const string &ip, const char *ts)
+{
+	char ln[128];
+	snprintf(ln, sizeof(ln), "%s IP 127.0.0.1.40000 > 127.0.0.1.8000: UDP, length %d\n", ts, (int)ip.length()-28);
+	out += ln;
+	for(size_t off=0; off<ip.length(); off+=16)
+	{
+		int n = snprintf(ln, sizeof(ln), "\t0x%04x:  ", (int)off);
+		for(size_t i=off; i<off+16 && i<ip.length(); i++)
+			n += snprintf(ln+n, sizeof(ln)-n, (i-off)%2? "%02x " : "%02x", (uint8_t)ip[i]);
+		snprintf(ln+n, sizeof(ln)-n, " ..9adb.e\n"); // the printable part must not be taken as hex
+		out += ln;
+	}
+}
+
+// an IPv4 packet of proto carrying payload, with a transport header of hlen bytes
+static string MakeIp(int proto, int hlen, uint16_t dport, const string &payload)
+{
+	string ip(20+hlen, '\0');
+	ip += payload;
+	ip[0] = 0x45;
+	ip[2] = ip.length()>>8;
+	ip[3] = ip.length()&0xff;
+	ip[9] = proto;
+	ip[20+2] = dport>>8;
+	ip[20+3] = dport&0xff;
+	if(proto==6)
+		ip[20+12] = (hlen/4)<<4;
+	return ip;
+}
+
+// packets must come out of binary, hex and tcpdump captures as they went in
+int CaptureTest()
+{
+	vector<string> pkgs;
+	for(int i=0; i<3; i++)
+	{
+		uint64_t kv = 12345678+i;
+		knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+		KnvNode *req_tree, *tree;
+		if(MakeReqTree(k, req_tree, tree, i? 3 : 1, 10))
+			return -1;
+		KnvNode::Delete(req_tree);
+		KnvProtocol p(knv::CacheReadCommand+i, 0, 100+i);
+		string s;
+		FAIL_IF(p.AddBody(tree, true));
+		if(p.Encode(s)<0)
+			return -1;
+		pkgs.push_back(s);
+	}
+
+	string bin = pkgs[0] + pkgs[1] + pkgs[2], hex, dump;
+	for(size_t i=0; i<bin.length(); i++)
+	{
+		char h[4];
+		snprintf(h, sizeof(h), i%16==15? "%02x\n" : "%02x ", (uint8_t)bin[i]);
+		hex += h;
+	}
+	DumpIp(dump, MakeIp(17, 8, 8000, pkgs[0]), "10:00:00.250000");
+	DumpIp(dump, MakeIp(6, 32, 8001, pkgs[1]+pkgs[2]), "10:00:01.500000"); // TCP with options, two packets
+	DumpIp(dump, MakeIp(17, 8, 8000, pkgs[2].substr(0, 10)), "10:00:02.000000"); // snapped short
+
+	const char *names[] = { "binary", "hex", "tcpdump" };
+	const string *texts[] = { &bin, &hex, &dump };
+	for(int f=KNV_CAPTURE_BIN; f<=KNV_CAPTURE_TCPDUMP; f++)
+	{
+		KnvCapture cap;
+		if(cap.Parse(*texts[f], f))
+		{
+			cout << names[f] << " capture failed: " << cap.GetErrorMsg() << endl;
+			return -1;
+		}
+		const vector<KnvCapturePacket> &got = cap.GetPackets();
+		bool ok = got.size()==pkgs.size();
+		for(size_t i=0; ok && i<got.size(); i++)
+			ok = got[i].data==pkgs[i];
+		if(ok && f==KNV_CAPTURE_TCPDUMP)
+			ok = got[0].dport==8000 && got[2].dport==8001 && got[0].ts==36000.25 && got[1].ts==36001.5 && cap.GetSkippedBytes()==10;
+		if(!ok)
+		{
+			cout << names[f] << " capture gives " << got.size() << " packets, " << cap.GetSkippedBytes() << " bytes skipped" << endl;
+			return -1;
+		}
+	}
+	cout << "parsed " << pkgs.size() << " packets from binary, hex and tcpdump captures" << endl;
+	return 0;
+}
+
+static int TcpEcho(KnvTcpConn &cli, KnvTcpConn &srv, const vector<string> &pkgs)
+{
+	KnvProtocol *p;
+	size_t got = 0;
+	for(size_t i=0; i<pkgs.size(); i++)
+	{
+		UcMem *m = UcMemManager::Alloc(pkgs[i].length());
+		if(m==NULL)
+			return -1;
+		memcpy(m->ptr(), pkgs[i].data(), pkgs[i].length());
+		if(cli.Send(m, pkgs[i].length())<0)
+			goto fail;
+	}
+	while(got<pkgs.size())
+	{
+		int ret;
+		if(cli.Flush()<0)
+			goto fail;
+		while((ret=srv.Recv(p))>0)
+		{
+			ret = srv.Send(*p);
+			delete p;
+			if(ret<0)
+				goto fail;
+		}
+		if(ret<0 || srv.Flush()<0)
+			goto fail;
+		while((ret=cli.Recv(p))>0)
+		{
+			if(CheckFramed(p, pkgs, got))
+				return -1;
+		}
+		if(ret<0)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	cout << "connection failed: " << cli.GetErrorMsg() << srv.GetErrorMsg() << endl;
+	return -1;
+}
+
+// small, large and OidbIpv6 packets framed from a stream fed piece by piece, then over loopback
+int TcpTest(int subkeys, int fields)
+{
+	uint64_t kv = 12345678;
+	knv_key_t k(KNV_VARINT, 8, (char*)&kv);
+	vector<string> pkgs(6);
+	string stream;
+	for(size_t i=0; i<pkgs.size(); i++)
+	{
+		KnvNode *req_tree, *tree;
+		if(MakeReqTree(k, req_tree, tree, i%3==1? subkeys : 1, fields))
+			return -1;
+		KnvNode::Delete(req_tree);
+		KnvProtocol p(1, 2, i);
+		if(p.AddBody(tree, true)<0)
+			return -1;
+		if((i%3==2? p.EncodeCompatOidb(pkgs[i]) : p.Encode(pkgs[i]))<0)
+		{
+			cout << "encoding failed: " << p.GetErrorMsg() << endl;
+			return -1;
+		}
+		stream += pkgs[i];
+	}
+	cout << "stream of " << pkgs.size() << " packets, " << stream.length() << " bytes, largest " << pkgs[1].length() << endl;
+
+	int pieces[] = {1, 7, 1000, 4096, 65536, (int)stream.length()};
+	for(size_t c=0; c<sizeof(pieces)/sizeof(pieces[0]); c++)
+	{
+		KnvTcpFramer fr(4096);
+		KnvProtocol *p;
+		size_t got = 0;
+		for(size_t off=0; off<stream.length(); off+=pieces[c])
+		{
+			if(fr.Feed(stream.data()+off, min((size_t)pieces[c], stream.length()-off)))
+			{
+				cout << "feeding failed: " << fr.GetErrorMsg() << endl;
+				return -1;
+			}
+			int ret;
+			while((ret=fr.Next(p))>0)
+			{
+				if(CheckFramed(p, pkgs, got))
+					return -1;
+			}
+			if(ret<0)
+			{
+				cout << "framing failed: " << fr.GetErrorMsg() << endl;
+				return -1;
+			}
+		}
+		if(got!=pkgs.size() || fr.GetBufferedBytes())
+		{
+			cout << "fed by " << pieces[c] << " bytes, got " << got << " packets" << endl;
+			return -1;
+		}
+	}
+
+	KnvTcpFramer junk;
+	KnvProtocol *p;
+	if(junk.Feed("\x0a\x03" "abc", 5) || junk.Next(p)>=0)
+	{
+		cout << "junk is not rejected" << endl;
+		return -1;
+	}
+
+	// the server side echoes each packet back as received
+	struct sockaddr_in a;
+	socklen_t alen = sizeof(a);
+	int lfd = KnvNet::CreateTcpListenSocket(0, true, false, false);
+	if(lfd<0 || getsockname(lfd, (struct sockaddr *)&a, &alen))
+		return -1;
+	KnvTcpConn cli, srv;
+	if(cli.Connect(KnvNet::KnvSockAddr("127.0.0.1", ntohs(a.sin_port)), 1000) || srv.Attach(accept(lfd, NULL, NULL)))
+	{
+		cout << "connecting failed: " << cli.GetErrorMsg() << srv.GetErrorMsg() << endl;
+		close(lfd);
+		return -1;
+	}
+	close(lfd);
+
+	const int rounds = 50;
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	for(int r=0; r<rounds; r++)
+	{
+		if(TcpEcho(cli, srv, pkgs))
+			return -1;
+	}
+	gettimeofday(&end, NULL);
+	uint64_t us = (end.tv_sec-start.tv_sec)*1000000ULL + end.tv_usec - start.tv_usec;
+	cout << "echoed " << rounds*pkgs.size() << " packets over loopback: " << rounds*stream.length()/(us? us:1) << " MB/s" << endl;
+
+	vector<KnvMetricValue> vals;
+	KnvMetrics::Snapshot(vals, true);
+	for(size_t i=0; i<vals.size(); i++)
+		if(vals[i].name.compare(0, 4, "tcp.")==0)
+			cout << vals[i].name << " " << vals[i].value << endl;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc<2)
+	{
+	err:
+		cout << "Arguments: " << endl;
+		cout << "           " << argv[0] << " r <uin>  # read test" << endl;
+		cout << "           " << argv[0] << " w <uin>  # write test" << endl;
+		cout << "           " << argv[0] << " rw <uin> # read and write test" << endl;
+		cout << "           " << argv[0] << " wr <uin> # write and read test" << endl;
+		cout << "           " << argv[0] << " pc  <subkey_num> <field_num>  # decode/encode pressure test" << endl;
+		cout << "           " << argv[0] << " pe  <subkey_num> <field_num>  # extract pressure test" << endl;
+		cout << "           " << argv[0] << " pm  <subkey_num> <field_num>  # decode/encode pressure test, then dump metrics" << endl;
+		cout << "           " << argv[0] << " f        # test field api" << endl;
+		cout << "           " << argv[0] << " z        # test zero-copy decoding from UcMem" << endl;
+		cout << "           " << argv[0] << " v  <subkey_num> <field_num>  # test scatter-gather encoding" << endl;
+		cout << "           " << argv[0] << " s  <subkey_num> <field_num>  # test splitting into parts" << endl;
+		cout << "           " << argv[0] << " a  <subkey_num> <field_num>  # test reassembling split packets" << endl;
+		cout << "           " << argv[0] << " g  <subkey_num> <field_num>  # test decoding from segments" << endl;
+		cout << "           " << argv[0] << " k  [loops]  # test header peeking and its speed" << endl;
+		cout << "           " << argv[0] << " h  [loops]  # test response header template and its speed" << endl;
+		cout << "           " << argv[0] << " b  <body_num> <thread_num>  # test parallel batch execution" << endl;
+		cout << "           " << argv[0] << " c  <subkey_num> <field_num>  # test body compression" << endl;
+		cout << "           " << argv[0] << " u  <duration_ms> <window>  # test batched UDP server and its throughput" << endl;
+		cout << "           " << argv[0] << " uu <duration_ms> <window>  # test UDP server on io_uring and its throughput" << endl;
+		cout << "           " << argv[0] << " ug <duration_ms> <worker_num>  # test SO_REUSEPORT server group" << endl;
+		cout << "           " << argv[0] << " t  <subkey_num> <field_num>  # test TCP framing and transport" << endl;
+		cout << "           " << argv[0] << " cl <duration_ms> <window>  # test pipelined client and its throughput" << endl;
+		cout << "           " << argv[0] << " d  [loops]  # test command dispatch and its speed" << endl;
+		cout << "           " << argv[0] << " lh [calls]  # test per-command latency histograms" << endl;
+		cout << "           " << argv[0] << " cp       # test reading packets from captures" << endl;
+		return 1;
+	}
+
+	if(strcmp(argv[1], "r")==0)
+	{
 		if(ReadTest(argc>2? strtoul(argv[2],NULL,10):12345678)==0)
 			cout << "Read successfully." << endl;
 		return 0;
@@ -601,11 +2258,120 @@ int main(int argc, char *argv[])
 			cout << "Extract press test successfully." << endl;
 		return 0;
 	}
+	if(strcmp(argv[1], "pm")==0 && argc==4)
+	{
+		if(PressTest(atoi(argv[2]), atoi(argv[3]), false)==0)
+			cout << "Encode/Decode press test successfully." << endl;
+		cout << KnvMetrics::Dump();
+		return 0;
+	}
 	if(strcmp(argv[1], "f")==0)
 	{
 		if(FieldTest(1)==0)
 			cout << "Field test successfully." << endl;
 		return 0;
 	}
+	if(strcmp(argv[1], "z")==0)
+	{
+		if(ZeroCopyTest()==0)
+			cout << "Zero-copy test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "v")==0 && argc==4)
+	{
+		if(IovTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Iov test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "s")==0 && argc==4)
+	{
+		if(SplitTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Split test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "a")==0 && argc==4)
+	{
+		if(ReassembleTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Reassemble test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "g")==0 && argc==4)
+	{
+		if(SegmentTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Segment test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "k")==0)
+	{
+		if(PeekTest(argc>2? atoi(argv[2]) : 1000000)==0)
+			cout << "Peek test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "h")==0)
+	{
+		if(RspHeaderTest(argc>2? atoi(argv[2]) : 1000000)==0)
+			cout << "Response header test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "b")==0 && argc==4)
+	{
+		if(BatchTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Batch test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "c")==0 && argc==4)
+	{
+		if(CompressTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Compress test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "u")==0 && argc==4)
+	{
+		if(UdpTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "UDP server test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "uu")==0 && argc==4)
+	{
+		if(UdpTest(atoi(argv[2]), atoi(argv[3]), KNV_IO_URING)==0)
+			cout << "UDP server on io_uring test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "ug")==0 && argc==4)
+	{
+		if(UdpGroupTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "UDP server group test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "t")==0 && argc==4)
+	{
+		if(TcpTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "TCP test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "cl")==0 && argc==4)
+	{
+		if(ClientTest(atoi(argv[2]), atoi(argv[3]))==0)
+			cout << "Client test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "d")==0)
+	{
+		if(DispatchTest(argc>2? atoi(argv[2]) : 10000000)==0)
+			cout << "Dispatch test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "lh")==0)
+	{
+		if(LatencyTest(argc>2? atoi(argv[2]) : 1000)==0)
+			cout << "Latency test successfully." << endl;
+		return 0;
+	}
+	if(strcmp(argv[1], "cp")==0)
+	{
+		if(CaptureTest()==0)
+			cout << "Capture test successfully." << endl;
+		return 0;
+	}
 	goto err;
 }
@@ -0,0 +1,264 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_reassembler.cc
+// Implementation of KnvReassembler
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include <sys/time.h>
+#include "knv_reassembler.h"
+#include "knv_metrics.h"
+
+static inline uint64_t now_in_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+}
+
+KnvReassembler::Key::Key(const KnvNet::KnvSockAddr &peer, uint64_t s) : seq(s)
+{
+	memset(addr, 0, sizeof(addr));
+	addr_len = peer.addr_len<=sizeof(addr)? peer.addr_len : sizeof(addr);
+	memcpy(addr, &peer.addr, addr_len);
+}
+
+bool KnvReassembler::Key::operator<(const Key &k) const
+{
+	if(seq!=k.seq)
+		return seq<k.seq;
+	if(addr_len!=k.addr_len)
+		return addr_len<k.addr_len;
+	return memcmp(addr, k.addr, addr_len)<0;
+}
+
+KnvReassembler::KnvReassembler(int timeout, uint64_t max_sz) :
+	oldest(NULL), newest(NULL), timeout_ms(timeout), max_bytes(max_sz), mem_used(0)
+{
+}
+
+void KnvReassembler::Drop(Entry *e)
+{
+	if(e->prev) e->prev->next = e->next;
+	else oldest = e->next;
+	if(e->next) e->next->prev = e->prev;
+	else newest = e->prev;
+
+	if(e->buf) UcMemManager::Free(e->buf);
+	if(e->pending) UcMemManager::Free(e->pending);
+	mem_used -= e->mem;
+	KnvMetrics::Add(KNV_METRIC_REASM_PENDING, -1);
+	KnvMetrics::Add(KNV_METRIC_REASM_BYTES, -(int64_t)e->mem);
+	entries.erase(e->key);
+	delete e;
+}
+
+void KnvReassembler::Clear()
+{
+	while(oldest)
+		Drop(oldest);
+}
+
+int KnvReassembler::Expire(uint64_t now_ms)
+{
+	if(now_ms==0)
+		now_ms = now_in_ms();
+	int n = 0;
+	// all entries have the same timeout, so the list is also in the order of creation
+	while(oldest && oldest->expire_ms<=now_ms)
+	{
+		Drop(oldest);
+		n ++;
+	}
+	if(n)
+		KnvMetrics::Add(KNV_METRIC_REASM_EXPIRED, n);
+	return n;
+}
+
+UcMem *KnvReassembler::Alloc(Entry *e, uint64_t sz)
+{
+	if(sz > max_bytes)
+	{
+		errmsg = "packet is larger than the reassembly memory limit";
+		return NULL;
+	}
+	while(mem_used + sz > max_bytes)
+	{
+		Entry *victim = oldest==e? e->next : oldest;
+		if(victim==NULL)
+		{
+			errmsg = "reassembly memory limit reached";
+			return NULL;
+		}
+		Drop(victim);
+		KnvMetrics::Add(KNV_METRIC_REASM_EVICTED, 1);
+	}
+
+	UcMem *m = UcMemManager::Alloc(sz);
+	if(m==NULL)
+	{
+		errmsg = "UcMemManager out of memory";
+		return NULL;
+	}
+	e->mem += sz;
+	mem_used += sz;
+	KnvMetrics::Add(KNV_METRIC_REASM_BYTES, sz);
+	return m;
+}
+
+int KnvReassembler::Add(const KnvNet::KnvSockAddr &peer, KnvProtocol &part, KnvProtocol *(&full), uint64_t now_ms)
+{
+	full = NULL;
+	if(!part.IsValid())
+	{
+		errmsg = "part is invalid";
+		return -1;
+	}
+	if(part.IsComplete()) // not split
+		return 1;
+
+	if(now_ms==0)
+		now_ms = now_in_ms();
+	Expire(now_ms);
+
+	int total = part.GetTotalPartNum();
+	int idx = part.GetPartIndex();
+	const KnvLeaf *l = part.GetPartData();
+	if(l==NULL || idx>=total || l->GetValue().str.len==0)
+	{
+		errmsg = "bad part";
+		return -2;
+	}
+	const char *data = l->GetValue().str.data;
+	uint32_t len = l->GetValue().str.len;
+	bool is_last = (idx==total-1);
+
+	Key k(peer, part.GetSequence());
+	Entry *e;
+	EntryMap::iterator it = entries.find(k);
+	if(it!=entries.end() && it->second->total!=total) // the peer reused the sequence
+	{
+		Drop(it->second);
+		KnvMetrics::Add(KNV_METRIC_PROTO_PART_OVERWRITTEN, 1);
+		it = entries.end();
+	}
+	if(it==entries.end())
+	{
+		try
+		{
+			e = new Entry(k);
+			entries[k] = e;
+		}
+		catch(...)
+		{
+			errmsg = "out of memory";
+			return -3;
+		}
+		e->expire_ms = now_ms + timeout_ms;
+		e->total = total;
+		e->received = 0;
+		e->sz_part = e->last_len = 0;
+		e->buf = e->pending = NULL;
+		e->mem = 0;
+		memset(e->got, 0, sizeof(e->got));
+		e->next = NULL;
+		e->prev = newest;
+		if(newest) newest->next = e;
+		else oldest = e;
+		newest = e;
+		KnvMetrics::Add(KNV_METRIC_REASM_PENDING, 1);
+	}
+	else
+	{
+		e = it->second;
+	}
+
+	if(e->got[idx>>3] & (1<<(idx&7)))
+	{
+		KnvMetrics::Add(KNV_METRIC_REASM_DUPLICATE, 1);
+		return 0;
+	}
+
+	if(is_last ? (e->sz_part && len>e->sz_part) : (e->sz_part && len!=e->sz_part))
+	{
+		errmsg = "part length does not match the others";
+		Drop(e);
+		return -4;
+	}
+
+	if(!is_last && e->sz_part==0) // now the buffer size is known
+	{
+		e->sz_part = len;
+		e->buf = Alloc(e, (uint64_t)total*len);
+		if(e->buf==NULL)
+		{
+			Drop(e);
+			return -5;
+		}
+		if(e->pending)
+		{
+			if(e->last_len>len)
+			{
+				errmsg = "last part is longer than the others";
+				Drop(e);
+				return -4;
+			}
+			memcpy((char*)e->buf->ptr()+(uint64_t)(total-1)*len, e->pending->ptr(), e->last_len);
+			UcMemManager::Free(e->pending);
+			e->pending = NULL;
+		}
+	}
+
+	if(e->buf)
+	{
+		memcpy((char*)e->buf->ptr()+(uint64_t)idx*e->sz_part, data, len);
+	}
+	else // only the last part is here yet
+	{
+		e->pending = Alloc(e, len);
+		if(e->pending==NULL)
+		{
+			Drop(e);
+			return -5;
+		}
+		memcpy(e->pending->ptr(), data, len);
+	}
+	if(is_last)
+		e->last_len = len;
+	e->got[idx>>3] |= (1<<(idx&7));
+	e->received ++;
+	KnvMetrics::Add(KNV_METRIC_PROTO_PART_ADDED, 1);
+
+	if(e->received < e->total)
+		return 0;
+
+	// all parts are in place, decode directly from the buffer
+	UcMem *m = e->buf? e->buf : e->pending;
+	uint64_t merged_len = (uint64_t)(total-1)*e->sz_part + e->last_len;
+	try
+	{
+		full = new KnvProtocol(m, (char*)m->ptr(), merged_len);
+	}
+	catch(...)
+	{
+		full = NULL;
+	}
+	Drop(e); // the protocol keeps its own reference to m
+	if(full==NULL || !full->IsValid())
+	{
+		errmsg = "decoding merged packet failed";
+		if(full) errmsg += ": " + full->GetErrorMsg();
+		delete full;
+		full = NULL;
+		return -6;
+	}
+	KnvMetrics::Add(KNV_METRIC_PROTO_REASSEMBLED, 1);
+	return 1;
+}
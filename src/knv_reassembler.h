@@ -0,0 +1,106 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_reassembler.h
+// Reassembly of split packets from many peers
+//
+// Unlike KnvProtocol::AddPartial(), which merges into one protocol held by the caller,
+// KnvReassembler tracks any number of split packets in flight, keyed by (peer, seq).
+// Parts may arrive in any order, each one is copied straight to its final place in one
+// buffer, and the complete packet is decoded from that buffer without copying again.
+// Incomplete packets are dropped after a timeout, or when the memory limit is reached.
+//
+// Like the pools, a reassembler is meant to be used by one thread.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_REASSEMBLER__
+#define __KNV_REASSEMBLER__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include "protocol.h"
+
+using namespace std;
+
+#define KNV_REASM_DEFAULT_TIMEOUT_MS	3000
+#define KNV_REASM_DEFAULT_MAX_BYTES	(64ULL<<20)
+
+class KnvReassembler
+{
+public:
+	// timeout_ms: incomplete packets older than this are dropped
+	// max_bytes: upper bound of buffered bytes, the oldest packets are dropped to make room
+	KnvReassembler(int timeout_ms = KNV_REASM_DEFAULT_TIMEOUT_MS, uint64_t max_bytes = KNV_REASM_DEFAULT_MAX_BYTES);
+	~KnvReassembler() { Clear(); }
+
+	// Add a received packet from peer
+	// now_ms is the current time in milliseconds, 0 to read the clock
+	// returns
+	//   1 -- a packet is complete: full is a new protocol that the caller deletes,
+	//        or NULL if part is not split at all, then part itself is the packet
+	//   0 -- part is kept (or it is a duplicate), waiting for the other parts
+	//  <0 -- part is rejected, see GetErrorMsg()
+	int Add(const KnvNet::KnvSockAddr &peer, KnvProtocol &part, KnvProtocol *(&full), uint64_t now_ms = 0);
+
+	// drop packets that timed out, Add() does this too
+	// returns the number of packets dropped
+	int Expire(uint64_t now_ms = 0);
+
+	void Clear(); // drop everything
+
+	int GetPendingNum() const { return entries.size(); }
+	uint64_t GetMemUsed() const { return mem_used; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvReassembler(const KnvReassembler &);
+	KnvReassembler &operator=(const KnvReassembler &);
+
+	struct Key
+	{
+		uint64_t seq;
+		socklen_t addr_len;
+		char addr[sizeof(struct sockaddr_in6)];
+
+		Key(const KnvNet::KnvSockAddr &peer, uint64_t seq);
+		bool operator<(const Key &k) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		uint64_t expire_ms;
+		int total;          // number of parts
+		int received;
+		uint32_t sz_part;   // length of all parts but the last, 0 until known
+		uint32_t last_len;  // length of the last part, 0 until received
+		UcMem *buf;         // total*sz_part bytes, part i goes to offset i*sz_part
+		UcMem *pending;     // the last part, if it comes before sz_part is known
+		uint64_t mem;       // bytes accounted to this entry
+		uint8_t got[32];    // received parts bitmap, there are at most 256 parts
+		Entry *prev, *next; // in the order of expiration
+
+		Entry(const Key &k) : key(k) {}
+	};
+
+	typedef map<Key, Entry *> EntryMap;
+
+	UcMem *Alloc(Entry *e, uint64_t sz); // allocate for e, making room if needed
+	void Drop(Entry *e);
+
+	EntryMap entries;
+	Entry *oldest, *newest;
+	int timeout_ms;
+	uint64_t max_bytes;
+	uint64_t mem_used;
+	string errmsg;
+};
+
+#endif
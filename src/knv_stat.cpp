@@ -0,0 +1,242 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// knv_stat.cpp
+// Read the stats segment published by KnvMetrics::Publish() and show the values live
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "knv_metrics.h"
+#include "version.h"
+
+static KnvStatsHeader *hdr;
+
+static int open_stats(const char *name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "/%s", name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if(fd<0)
+	{
+		fprintf(stderr, "shm_open(%s) failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size<(off_t)sizeof(KnvStatsHeader))
+	{
+		fprintf(stderr, "%s is not a stats segment\n", path);
+		close(fd);
+		return -2;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p==MAP_FAILED)
+	{
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		return -3;
+	}
+	hdr = (KnvStatsHeader *)p;
+	if(__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE)!=KNV_STATS_MAGIC || hdr->version!=KNV_STATS_VERSION ||
+		hdr->max_metrics!=KNV_METRIC_MAX || hdr->slab_size!=sizeof(KnvMetricSlab) ||
+		sizeof(KnvStatsHeader)+(uint64_t)hdr->max_slots*hdr->slab_size > (uint64_t)st.st_size)
+	{
+		fprintf(stderr, "%s has unknown format, the process may use a different library version\n", path);
+		return -4;
+	}
+	return 0;
+}
+
+// take a consistent copy of one thread's values
+static int read_slab(KnvMetricSlab *s, int64_t *vals, int nr)
+{
+	for(int tries=0; tries<10000; tries++)
+	{
+		uint64_t seq1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if(seq1 & 1) // being updated
+		{
+			sched_yield();
+			continue;
+		}
+		for(int i=0; i<nr; i++)
+			vals[i] = __atomic_load_n(&s->val[i], __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED)==seq1)
+			return 0;
+	}
+	return -1;
+}
+
+struct stats_snap
+{
+	int nr_metrics;
+	int nr_threads;
+	struct timeval tv;
+	int64_t total[KNV_METRIC_MAX];
+	int tids[1024];
+	int64_t (*per_thread)[KNV_METRIC_MAX]; // nr_threads rows
+};
+
+static void take_snap(stats_snap &sn, bool with_threads)
+{
+	static int64_t vals[KNV_METRIC_MAX];
+
+	sn.nr_metrics = __atomic_load_n(&hdr->nr_metrics, __ATOMIC_ACQUIRE);
+	if(sn.nr_metrics>KNV_METRIC_MAX)
+		sn.nr_metrics = KNV_METRIC_MAX;
+	sn.nr_threads = 0;
+	gettimeofday(&sn.tv, NULL);
+	memset(sn.total, 0, sizeof(sn.total));
+
+	for(uint32_t i=0; i<hdr->max_slots; i++)
+	{
+		KnvMetricSlab *s = KnvStatsSlab(hdr, i);
+		int tid = __atomic_load_n(&s->tid, __ATOMIC_ACQUIRE);
+		if(tid==0)
+			continue;
+		if(read_slab(s, vals, sn.nr_metrics))
+			continue;
+		for(int m=0; m<sn.nr_metrics; m++)
+		{
+			// gauges of exited threads are meaningless
+			if(tid<0 && hdr->descs[m].type==KNV_METRIC_GAUGE)
+				continue;
+			sn.total[m] += vals[m];
+		}
+		if(tid>0 && with_threads && sn.nr_threads<(int)(sizeof(sn.tids)/sizeof(sn.tids[0])))
+		{
+			sn.tids[sn.nr_threads] = tid;
+			memcpy(sn.per_thread[sn.nr_threads], vals, sizeof(vals));
+		}
+		if(tid>0)
+			sn.nr_threads ++;
+	}
+}
+
+static void show(const stats_snap &cur, const stats_snap *prev, bool show_zero, bool with_threads)
+{
+	char tmstr[64];
+	time_t t = cur.tv.tv_sec;
+	strftime(tmstr, sizeof(tmstr), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	bool alive = kill(hdr->pid, 0)==0 || errno!=ESRCH;
+	printf("--- pid %d%s, %d threads, %s ---\n", hdr->pid, alive? "" : " (exited)", cur.nr_threads, tmstr);
+
+	double secs = 0;
+	if(prev)
+	{
+		secs = (cur.tv.tv_sec-prev->tv.tv_sec) + (cur.tv.tv_usec-prev->tv.tv_usec)/1000000.0;
+		printf("%-40s %16s %14s %14s\n", "name", "value", "delta", "rate/s");
+	}
+	else
+	{
+		printf("%-40s %16s\n", "name", "value");
+	}
+
+	for(int m=0; m<cur.nr_metrics; m++)
+	{
+		const KnvMetricDesc &d = hdr->descs[m];
+		if(d.name[0]==0)
+			continue;
+		int64_t delta = prev && m<prev->nr_metrics? cur.total[m]-prev->total[m] : cur.total[m];
+		if(!show_zero && cur.total[m]==0 && delta==0)
+			continue;
+		if(prev)
+		{
+			if(d.type==KNV_METRIC_GAUGE)
+				printf("%-40.*s %16lld %14lld %14s\n", (int)sizeof(d.name), d.name, (long long)cur.total[m], (long long)delta, "-");
+			else
+				printf("%-40.*s %16lld %14lld %14.1f\n", (int)sizeof(d.name), d.name, (long long)cur.total[m], (long long)delta, secs>0? delta/secs : 0.0);
+		}
+		else
+		{
+			printf("%-40.*s %16lld\n", (int)sizeof(d.name), d.name, (long long)cur.total[m]);
+		}
+		if(with_threads)
+		{
+			int n = cur.nr_threads<(int)(sizeof(cur.tids)/sizeof(cur.tids[0]))? cur.nr_threads : sizeof(cur.tids)/sizeof(cur.tids[0]);
+			for(int i=0; i<n; i++)
+			{
+				if(cur.per_thread[i][m])
+					printf("    tid %-32d %16lld\n", cur.tids[i], (long long)cur.per_thread[i][m]);
+			}
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	bool show_zero = false, with_threads = false;
+	int interval = 0, count = 0;
+
+	while((opt=getopt(argc, argv, "ztc:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'z': show_zero = true; break;
+		case 't': with_threads = true; break;
+		case 'c': count = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+
+	if(optind>=argc)
+	{
+	usage:
+		printf("knvstat v%d.%d %s\n", LIB_KNV_MAJOR_VERSION, LIB_KNV_MINOR_VERSION, LIB_KNV_EXTRA_VERSION);
+		printf("usage: %s [-z] [-t] [-c count] <shm_name> [interval]\n", argv[0]);
+		printf("  read the stats segment published by a process with KnvMetrics::Publish(shm_name)\n");
+		printf("  or started with environment KNV_STATS_SHM=shm_name\n");
+		printf("  -z        show metrics that are 0\n");
+		printf("  -t        show per-thread values\n");
+		printf("  -c count  stop after count intervals\n");
+		printf("  interval  seconds between snapshots, the difference to the previous one is shown\n");
+		return 1;
+	}
+
+	if(open_stats(argv[optind]))
+		return 2;
+	if(optind+1<argc)
+		interval = atoi(argv[optind+1]);
+
+	static stats_snap snaps[2];
+	for(int i=0; i<2; i++)
+	{
+		snaps[i].per_thread = with_threads? (int64_t (*)[KNV_METRIC_MAX])calloc(sizeof(snaps[i].tids)/sizeof(snaps[i].tids[0]), sizeof(int64_t)*KNV_METRIC_MAX) : NULL;
+		if(with_threads && snaps[i].per_thread==NULL)
+		{
+			fprintf(stderr, "out of memory\n");
+			return 3;
+		}
+	}
+
+	int cur = 0;
+	take_snap(snaps[cur], with_threads);
+	show(snaps[cur], NULL, show_zero, with_threads);
+	for(int n=0; interval>0 && (count<=0 || n<count); n++)
+	{
+		sleep(interval);
+		cur = !cur;
+		take_snap(snaps[cur], with_threads);
+		show(snaps[cur], &snaps[!cur], show_zero, with_threads);
+	}
+	return 0;
+}
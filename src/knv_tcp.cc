@@ -0,0 +1,359 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_tcp.cc
+// Implementation of KnvTcpFramer and KnvTcpConn
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <new>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include "knv_tcp.h"
+#include "knv_metrics.h"
+
+#define TCP_MAX_IOV	64 // buffers sent by one call
+
+KnvTcpFramer::KnvTcpFramer(int chunk, int max_len) : cur(NULL), cap(0), rd(0), wr(0), need(0),
+	chunk_size(chunk), max_pkg_len(max_len)
+{
+	if(chunk_size<4096) chunk_size = 4096;
+	if(max_pkg_len<=0) max_pkg_len = KNV_TCP_DEFAULT_MAX_PKG;
+}
+
+int64_t KnvTcpFramer::GetFrameLength(const char *buf, int len)
+{
+	if(len<=0)
+		return 0;
+
+	if(buf[0]==STX_IPV6_PB) // STX + dwHeadLen + dwBodyLen + header + body + ETX
+	{
+		if(len<9)
+			return 0;
+		uint32_t hlen, blen;
+		memcpy(&hlen, buf+1, 4);
+		memcpy(&blen, buf+5, 4);
+		return (int64_t)ntohl(hlen) + ntohl(blen) + 10;
+	}
+
+	// packet tag and content length, both varints
+	const uint8_t *p = (const uint8_t *)buf, *end = p + len;
+	uint64_t v[2];
+	for(int i=0; i<2; i++)
+	{
+		uint8_t b;
+		int shift = 0;
+		v[i] = 0;
+		do
+		{
+			if(p>=end)
+				return 0;
+			if(shift>63)
+				return -1;
+			b = *p++;
+			v[i] |= (uint64_t)(b & 0x7f) << shift;
+			shift += 7;
+		}while(b & 0x80);
+
+		if(i==0 && v[0]!=((KNV_PKG_TAG<<3)|KNV_STRING))
+			return -1;
+	}
+	if(v[1] > (1ULL<<40)) // way beyond any limit, and no overflow below
+		return -1;
+	return (p - (const uint8_t *)buf) + (int64_t)v[1];
+}
+
+void KnvTcpFramer::Clear()
+{
+	if(cur)
+		UcMemManager::Free(cur);
+	cur = NULL;
+	cap = rd = wr = 0;
+	need = 0;
+}
+
+int KnvTcpFramer::ParseHead()
+{
+	if(need || rd==wr)
+		return 0;
+	int64_t l = GetFrameLength((char *)cur->ptr() + rd, wr - rd);
+	if(l<0)
+	{
+		errmsg = "bad packet framing";
+		return -1;
+	}
+	if(l>max_pkg_len)
+	{
+		errmsg = "packet is too large";
+		return -2;
+	}
+	need = l;
+	return 0;
+}
+
+int KnvTcpFramer::Prepare()
+{
+	if(ParseHead())
+		return -1;
+
+	int data = wr - rd;
+	if(cur && data==0 && cur->GetRefCount()==1) // all handed out and deleted, start over
+		rd = wr = 0;
+	if(cur && wr<cap && rd+need<=cap) // the packet at rd fits, or its length is not known yet
+		return 0;
+
+	// a new buffer for the packet at rd, the bytes of it received so far are moved
+	int64_t sz = need>chunk_size? need : chunk_size;
+	if(data>=sz) // complete packets are waiting, leave room for more
+		sz = data + chunk_size;
+	UcMem *m = UcMemManager::Alloc(sz);
+	if(m==NULL)
+	{
+		errmsg = "UcMemManager::Alloc failed";
+		return -2;
+	}
+	if(data)
+	{
+		memcpy(m->ptr(), (char *)cur->ptr() + rd, data);
+		KnvMetrics::Add(KNV_METRIC_TCP_RX_MOVED, data);
+	}
+	if(cur)
+		UcMemManager::Free(cur); // protocols decoded from it keep their own references
+	cur = m;
+	cap = m->GetAllocSize()>(uint64_t)sz? (int64_t)m->GetAllocSize() : sz;
+	rd = 0;
+	wr = data;
+	return 0;
+}
+
+int KnvTcpFramer::Read(int fd)
+{
+	if(Prepare())
+		return -2;
+	ssize_t n = read(fd, (char *)cur->ptr() + wr, cap - wr);
+	if(n>0)
+	{
+		wr += n;
+		KnvMetrics::Add(KNV_METRIC_TCP_RX_BYTES, n);
+		return n;
+	}
+	if(n==0)
+	{
+		errmsg = "connection closed by peer";
+		return -1;
+	}
+	if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+		return 0;
+	errmsg = "read failed: "; errmsg += strerror(errno);
+	return -3;
+}
+
+int KnvTcpFramer::Feed(const char *data, int len)
+{
+	while(len>0)
+	{
+		if(Prepare())
+			return -1;
+		int n = cap - wr;
+		if(n>len)
+			n = len;
+		memcpy((char *)cur->ptr() + wr, data, n);
+		wr += n;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int KnvTcpFramer::Next(KnvProtocol *(&pkt))
+{
+	pkt = NULL;
+	if(ParseHead())
+		return -1;
+	if(need==0 || wr-rd<need)
+		return 0;
+
+	char *p = (char *)cur->ptr() + rd;
+	if(p[0]==STX_IPV6_PB && p[need-1]!=ETX_IPV6_PB)
+	{
+		errmsg = "ETX token missing";
+		return -2;
+	}
+	pkt = new (nothrow) KnvProtocol(cur, p, need);
+	if(pkt==NULL)
+	{
+		errmsg = "out of memory";
+		return -3;
+	}
+	rd += need;
+	need = 0;
+	KnvMetrics::Add(KNV_METRIC_TCP_RX_PKTS, 1);
+	return 1;
+}
+
+KnvTcpConn::KnvTcpConn(int chunk_size, int max_pkg_len) : fd(-1), framer(chunk_size, max_pkg_len),
+	out_off(0), pending(0)
+{
+}
+
+int KnvTcpConn::Connect(const KnvNet::KnvSockAddr &addr, int timeout_ms)
+{
+	if(fd>=0)
+	{
+		errmsg = "already connected";
+		return -1;
+	}
+	int s = KnvNet::CreateTcpConnection(addr, true, timeout_ms);
+	if(s<0)
+	{
+		errmsg = "connect failed: "; errmsg += strerror(errno);
+		return -2;
+	}
+	return Attach(s);
+}
+
+int KnvTcpConn::Attach(int s)
+{
+	if(fd>=0)
+	{
+		errmsg = "already connected";
+		return -1;
+	}
+	fd = s;
+	KnvNet::SetSocketNonblock(fd, true);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return 0;
+}
+
+void KnvTcpConn::Close()
+{
+	if(fd>=0)
+		close(fd);
+	fd = -1;
+	framer.Clear();
+	while(!out.empty())
+	{
+		UcMemManager::Free(out.front().m);
+		out.pop_front();
+	}
+	out_off = 0;
+	pending = 0;
+}
+
+int KnvTcpConn::Recv(KnvProtocol *(&pkt))
+{
+	if(fd<0)
+	{
+		errmsg = "not connected";
+		return -2;
+	}
+	while(true)
+	{
+		int ret = framer.Next(pkt);
+		if(ret>0)
+			return 1;
+		if(ret<0)
+		{
+			errmsg = framer.GetErrorMsg();
+			return -3;
+		}
+		ret = framer.Read(fd);
+		if(ret<=0)
+		{
+			if(ret<0)
+				errmsg = framer.GetErrorMsg();
+			return ret<-1? -4 : ret;
+		}
+	}
+}
+
+int KnvTcpConn::Send(KnvProtocol &pkt)
+{
+	UcMem *m;
+	int len = pkt.Encode(m);
+	if(len<0)
+	{
+		errmsg = "encoding failed: " + pkt.GetErrorMsg();
+		return -1;
+	}
+	return Send(m, len);
+}
+
+int KnvTcpConn::Send(UcMem *m, int len)
+{
+	if(fd<0)
+	{
+		UcMemManager::Free(m);
+		errmsg = "not connected";
+		return -2;
+	}
+	try
+	{
+		OutBuf b = { m, len };
+		out.push_back(b);
+	}
+	catch(...)
+	{
+		UcMemManager::Free(m);
+		errmsg = "out of memory";
+		return -3;
+	}
+	pending += len;
+	KnvMetrics::Add(KNV_METRIC_TCP_TX_PKTS, 1);
+	return Flush();
+}
+
+int KnvTcpConn::Flush()
+{
+	while(!out.empty())
+	{
+		struct iovec iov[TCP_MAX_IOV];
+		int n = 0;
+		for(deque<OutBuf>::iterator it=out.begin(); it!=out.end() && n<TCP_MAX_IOV; ++it, ++n)
+		{
+			int off = n? 0 : out_off;
+			iov[n].iov_base = (char *)it->m->ptr() + off;
+			iov[n].iov_len = it->len - off;
+		}
+
+		struct msghdr h;
+		memset(&h, 0, sizeof(h));
+		h.msg_iov = iov;
+		h.msg_iovlen = n;
+		ssize_t w = sendmsg(fd, &h, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if(w<0)
+		{
+			if(errno==EINTR)
+				continue;
+			if(errno==EAGAIN || errno==EWOULDBLOCK)
+				break;
+			errmsg = "send failed: "; errmsg += strerror(errno);
+			return -4;
+		}
+		KnvMetrics::Add(KNV_METRIC_TCP_TX_BYTES, w);
+		pending -= w;
+		while(w>0)
+		{
+			OutBuf &b = out.front();
+			if(w < b.len-out_off)
+			{
+				out_off += w;
+				break;
+			}
+			w -= b.len - out_off;
+			UcMemManager::Free(b.m);
+			out.pop_front();
+			out_off = 0;
+		}
+	}
+	return pending;
+}
@@ -0,0 +1,136 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_tcp.h
+// Packets over TCP streams
+//
+// A packet on a stream is framed by itself: a KNV packet starts with the packet tag
+// (9A DB 01) and the varint length of its content, an OidbIpv6 packet is STX, the header
+// and body lengths, the content and ETX. Packets are not limited to KNV_DEFUALT_MAX_PKG_SIZE,
+// so large values need no splitting.
+//
+// KnvTcpFramer reads a stream into UcMem buffers and hands out each complete packet
+// decoded in place. Once the length of the next packet is known, a buffer is allocated
+// large enough for all of it, so only the bytes of a packet received before its buffer
+// was switched are moved, and a large packet is read straight into its own buffer.
+// Buffers are recycled to the pool when the framer and all protocols decoded from them
+// are done.
+//
+// KnvTcpConn couples a framer with a queue of encoded packets sent by writev().
+//
+// Like the pools, a framer or a connection is meant to be used by one thread.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_TCP__
+#define __KNV_TCP__
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include "protocol.h"
+
+using namespace std;
+
+#define KNV_TCP_DEFAULT_CHUNK	(256*1024)
+#define KNV_TCP_DEFAULT_MAX_PKG	(64*1024*1024)
+
+class KnvTcpFramer
+{
+public:
+	// chunk_size: size of the receive buffers, larger packets get a buffer of their own
+	// max_pkg_len: longer packets are taken as a broken stream
+	KnvTcpFramer(int chunk_size = KNV_TCP_DEFAULT_CHUNK, int max_pkg_len = KNV_TCP_DEFAULT_MAX_PKG);
+	~KnvTcpFramer() { Clear(); }
+
+	// the length of the packet buf starts with
+	// returns >0 for the length, 0 if more bytes are needed to tell, <0 if buf is not a packet
+	static int64_t GetFrameLength(const char *buf, int len);
+
+	// read what fd has for us, once
+	// returns the number of bytes read, 0 if none is available, -1 if the peer closed, <-1 on error
+	int Read(int fd);
+	// append data received by other means, returns 0 on success
+	int Feed(const char *data, int len);
+
+	// get the next complete packet
+	// returns
+	//   1 -- pkt is a new protocol decoded in place, the caller deletes it
+	//        (it may still be invalid if its content is corrupted, see IsValid())
+	//   0 -- more data is needed
+	//  <0 -- the stream is broken, see GetErrorMsg()
+	int Next(KnvProtocol *(&pkt));
+
+	int GetBufferedBytes() const { return wr - rd; }
+	void Clear(); // drop everything buffered
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvTcpFramer(const KnvTcpFramer &);
+	KnvTcpFramer &operator=(const KnvTcpFramer &);
+
+	int ParseHead(); // find the length of the packet at rd
+	int Prepare();   // make room after wr for the packet at rd
+
+	UcMem *cur;   // the buffer being filled
+	int cap;      // its size
+	int rd, wr;   // start of the data not handed out, end of the data
+	int64_t need; // length of the packet at rd, 0 if unknown yet
+	int chunk_size;
+	int max_pkg_len;
+	string errmsg;
+};
+
+class KnvTcpConn
+{
+public:
+	KnvTcpConn(int chunk_size = KNV_TCP_DEFAULT_CHUNK, int max_pkg_len = KNV_TCP_DEFAULT_MAX_PKG);
+	~KnvTcpConn() { Close(); }
+
+	// returns 0 on success
+	int Connect(const KnvNet::KnvSockAddr &addr, int timeout_ms = 0);
+	// use a connected socket, e.g. from accept(), the connection closes it
+	int Attach(int fd);
+	int GetSocket() const { return fd; }
+	void Close();
+
+	// get the next packet, reading the socket if none is buffered
+	// returns 1 with pkt to be deleted by the caller, 0 if none is available yet,
+	// -1 if the peer closed, <-1 on error; the connection should be closed on <0
+	int Recv(KnvProtocol *(&pkt));
+
+	// queue the encoded pkt and send as much as the socket takes
+	// returns the number of bytes still queued, or <0 on failure
+	int Send(KnvProtocol &pkt);
+	int Send(UcMem *m, int len); // takes m
+	// send what is queued, returns the number of bytes still queued, or <0 on failure
+	int Flush();
+	int GetPendingBytes() const { return pending; }
+
+	KnvTcpFramer &GetFramer() { return framer; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvTcpConn(const KnvTcpConn &);
+	KnvTcpConn &operator=(const KnvTcpConn &);
+
+	struct OutBuf
+	{
+		UcMem *m;
+		int len;
+	};
+
+	int fd;
+	KnvTcpFramer framer;
+	deque<OutBuf> out;
+	int out_off; // bytes of out.front() already sent
+	int pending;
+	string errmsg;
+};
+
+#endif
@@ -0,0 +1,1308 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_udp_server.cc
+// Implementation of KnvUdpServer, KnvUdpServerGroup and KnvUdpLoadGen
+//
+// 2026-10-18	Created
+// 2026-10-18	io_uring backend
+// 2026-10-18	Per-command latency histograms
+//
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include "knv_udp_server.h"
+#include "knv_metrics.h"
+#include "knv_latency.h"
+#include "commands.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP	17
+#endif
+
+// room for the UDP_SEGMENT or UDP_GRO control message of a message
+#define UDP_CTRL_SIZE	CMSG_SPACE(sizeof(int))
+
+// user_data of the io_uring entries
+#define URING_RX	1ULL       // the multishot recvmsg
+#define URING_WAKE	2ULL       // the poll of evfd
+#define URING_CANCEL	3ULL       // cancelling the recvmsg
+#define URING_TX	(1ULL<<32) // | bank<<16 | message, and URING_TX_ZC
+#define URING_TX_ZC	(1ULL<<31)
+#define URING_BGID	0
+// a provided buffer starts with io_uring_recvmsg_out, the address and the cmsgs
+#define URING_RX_HEADROOM	256
+#define URING_RX_BUF_SIZE	(KNV_UDP_MAX_PKT_SIZE+URING_RX_HEADROOM)
+// messages from this size go by SENDMSG_ZC, below it copying is cheaper than the notification
+#define URING_ZC_MIN_BYTES	16384
+
+// the segment size of a UDP_GRO buffer of len bytes, len if it holds one packet
+static int GetGroSize(struct msghdr &h, bool gro, int len)
+{
+	int seg_size = len;
+	for(struct cmsghdr *c=gro && h.msg_controllen? CMSG_FIRSTHDR(&h) : NULL; c; c=CMSG_NXTHDR(&h, c))
+	{
+		if(c->cmsg_level==SOL_UDP && c->cmsg_type==UDP_GRO && c->cmsg_len>=CMSG_LEN(sizeof(int)))
+		{
+			memcpy(&seg_size, CMSG_DATA(c), sizeof(int));
+			if(seg_size<=0 || seg_size>len)
+				seg_size = len;
+		}
+	}
+	return seg_size;
+}
+
+// put the UDP_SEGMENT control message of seg_size into h, with room for it at ctrl
+static void SetSegmentSize(struct msghdr &h, char *ctrl, int seg_size)
+{
+	h.msg_control = ctrl;
+	h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+	struct cmsghdr *c = CMSG_FIRSTHDR(&h);
+	c->cmsg_level = SOL_UDP;
+	c->cmsg_type = UDP_SEGMENT;
+	c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	uint16_t sz = seg_size;
+	memcpy(CMSG_DATA(c), &sz, sizeof(sz));
+}
+
+static inline uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+KnvUdpServer::KnvUdpServer(int b) : fd(-1), epfd(-1), evfd(-1), stopping(false), batch(b),
+	backend_req(KNV_IO_EPOLL), backend(KNV_IO_EPOLL), use_gso(true), use_gro(true), gso(false), gro(false),
+	tx_msg_num(0), tx_num(0), rx_missing(0), rx_armed(false), wake_armed(false), zc(false), nr_received(0)
+{
+	if(batch<1) batch = 1;
+	if(batch>KNV_UDP_MAX_BATCH) batch = KNV_UDP_MAX_BATCH;
+	for(int b=0; b<2; b++)
+		banks[b].nr_mem = banks[b].inflight = 0;
+}
+
+KnvUdpServer::~KnvUdpServer()
+{
+	if(backend==KNV_IO_URING)
+		CloseUring();
+	else
+		Flush();
+	for(size_t i=0; i<rx_mem.size(); i++)
+		if(rx_mem[i]) UcMemManager::Free(rx_mem[i]);
+	if(fd>=0) close(fd);
+	if(epfd>=0) close(epfd);
+	if(evfd>=0) close(evfd);
+}
+
+int KnvUdpServer::Listen(int port, bool use_ipv6)
+{
+	if(fd>=0)
+	{
+		errmsg = "already listening";
+		return -1;
+	}
+	int s = KnvNet::CreateUdpListenSocket(port, true, use_ipv6, true);
+	if(s<0)
+	{
+		errmsg = "creating socket failed: "; errmsg += strerror(errno);
+		return -2;
+	}
+	return Attach(s);
+}
+
+int KnvUdpServer::Attach(int s)
+{
+	if(fd>=0)
+	{
+		errmsg = "already listening";
+		return -1;
+	}
+	fd = s;
+	KnvNet::SetSocketNonblock(fd, true);
+	return Init();
+}
+
+int KnvUdpServer::Init()
+{
+	evfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(evfd<0)
+	{
+		errmsg = "creating eventfd failed: "; errmsg += strerror(errno);
+		return -3;
+	}
+	try
+	{
+		tx_msgs.resize(batch);
+		tx_info.resize(batch);
+		tx_ctrl.resize(batch*UDP_CTRL_SIZE);
+		tx_addr.resize(batch);
+		tx_iov.resize(batch);
+		tx_mem.resize(batch, NULL);
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -5;
+	}
+
+	// setting a segment size of 0 only tells whether the kernel knows UDP_SEGMENT
+	int zero = 0, one = 1;
+	gso = use_gso && setsockopt(fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero))==0;
+	gro = use_gro && setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one))==0;
+
+	backend = KNV_IO_EPOLL;
+	if(backend_req==KNV_IO_URING && InitUring()==0)
+	{
+		backend = KNV_IO_URING;
+		return 0;
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd<0)
+	{
+		errmsg = "creating epoll failed: "; errmsg += strerror(errno);
+		return -3;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)==0)
+	{
+		ev.data.fd = evfd;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev)==0)
+			goto alloc;
+	}
+	errmsg = "epoll_ctl failed: "; errmsg += strerror(errno);
+	return -4;
+
+alloc:
+	try
+	{
+		rx_msgs.resize(batch);
+		rx_iov.resize(batch);
+		rx_addr.resize(batch);
+		rx_mem.resize(batch, NULL);
+		rx_ctrl.resize(batch*UDP_CTRL_SIZE);
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -5;
+	}
+	return 0;
+}
+
+void KnvUdpServer::SetHandler(uint32_t cmd, KnvUdpHandler h, void *arg)
+{
+	dispatcher.Register(cmd, h, arg);
+}
+
+void KnvUdpServer::SetDefaultHandler(KnvUdpHandler h, void *arg)
+{
+	dispatcher.SetDefault(h, arg);
+}
+
+void KnvUdpServer::Stop()
+{
+	uint64_t one = 1;
+	stopping = true;
+	if(evfd>=0 && write(evfd, &one, sizeof(one))<0) {} // the flag is set anyway
+}
+
+int KnvUdpServer::Run()
+{
+	while(!stopping)
+	{
+		int ret = RunOnce(1000);
+		if(ret<0)
+			return ret;
+	}
+	stopping = false;
+	return 0;
+}
+
+int KnvUdpServer::RunOnce(int timeout_ms)
+{
+	if(fd<0)
+	{
+		errmsg = "not listening";
+		return -1;
+	}
+	if(!dispatcher.IsFrozen() && dispatcher.Freeze())
+	{
+		errmsg = "freezing handlers failed: " + dispatcher.GetErrorMsg();
+		return -1;
+	}
+	if(backend==KNV_IO_URING)
+		return RunOnceUring(timeout_ms);
+
+	struct epoll_event evs[2];
+	int n = epoll_wait(epfd, evs, 2, timeout_ms);
+	if(n<0)
+	{
+		if(errno==EINTR)
+			return 0;
+		errmsg = "epoll_wait failed: "; errmsg += strerror(errno);
+		return -2;
+	}
+
+	int total = 0;
+	for(int i=0; i<n; i++)
+	{
+		if(evs[i].data.fd==evfd)
+		{
+			uint64_t v;
+			if(read(evfd, &v, sizeof(v))<0) {} // drained
+			continue;
+		}
+		// a few batches in a row, but give the other events a chance under flood
+		for(int round=0; round<16; round++)
+		{
+			int r = RecvBatch();
+			if(r<0)
+				return r;
+			total += r;
+			if(r<batch)
+				break;
+		}
+	}
+	reasm.Expire();
+	return total;
+}
+
+int KnvUdpServer::RecvBatch()
+{
+	for(int i=0; i<batch; i++)
+	{
+		if(rx_mem[i]==NULL && (rx_mem[i]=UcMemManager::Alloc(KNV_UDP_MAX_PKT_SIZE))==NULL)
+		{
+			errmsg = "UcMemManager::Alloc failed";
+			return -3;
+		}
+		rx_iov[i].iov_base = rx_mem[i]->ptr();
+		rx_iov[i].iov_len = KNV_UDP_MAX_PKT_SIZE;
+		memset(&rx_msgs[i].msg_hdr, 0, sizeof(rx_msgs[i].msg_hdr));
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		rx_msgs[i].msg_hdr.msg_name = &rx_addr[i];
+		rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_addr[i]);
+		if(gro)
+		{
+			rx_msgs[i].msg_hdr.msg_control = &rx_ctrl[i*UDP_CTRL_SIZE];
+			rx_msgs[i].msg_hdr.msg_controllen = UDP_CTRL_SIZE;
+		}
+	}
+
+	int n = recvmmsg(fd, &rx_msgs[0], batch, MSG_DONTWAIT, NULL);
+	if(n<0)
+	{
+		if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+			return 0;
+		errmsg = "recvmmsg failed: "; errmsg += strerror(errno);
+		return -4;
+	}
+	KnvMetrics::Add(KNV_METRIC_UDP_RX_BATCHES, 1);
+
+	int nr_pkts = 0;
+	for(int i=0; i<n; i++)
+	{
+		struct msghdr &h = rx_msgs[i].msg_hdr;
+		KnvNet::KnvSockAddr peer((struct sockaddr *)h.msg_name, h.msg_namelen);
+		int len = rx_msgs[i].msg_len;
+		nr_pkts += Deliver(rx_mem[i], (char *)rx_mem[i]->ptr(), len, GetGroSize(h, gro, len), h.msg_flags & MSG_TRUNC, peer);
+		// protocols kept by the reassembler hold their own references
+		UcMemManager::Free(rx_mem[i]);
+		rx_mem[i] = NULL;
+	}
+	KnvMetrics::Add(KNV_METRIC_UDP_RX_PKTS, nr_pkts);
+	nr_received += nr_pkts;
+	Flush();
+	return n;
+}
+
+int KnvUdpServer::Deliver(UcMem *m, char *p, int len, int seg_size, bool truncated, const KnvNet::KnvSockAddr &peer)
+{
+	if(truncated)
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_RX_DROPPED, 1);
+		return 1;
+	}
+	// a GRO buffer is a run of packets of seg_size, the last one may be shorter
+	int nr_pkts = 0;
+	if(seg_size<len)
+		KnvMetrics::Add(KNV_METRIC_UDP_RX_GRO, 1);
+	for(int off=0; off<len; off+=seg_size, nr_pkts++)
+		Process(m, p+off, len-off<seg_size? len-off : seg_size, peer);
+	return nr_pkts;
+}
+
+void KnvUdpServer::Process(UcMem *m, char *data, int len, const KnvNet::KnvSockAddr &peer)
+{
+	uint64_t t0 = KnvLatency::Now();
+	KnvProtocol pkt(m, data, len);
+	if(!pkt.IsValid())
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_RX_DROPPED, 1);
+		return;
+	}
+	if(pkt.IsComplete())
+	{
+		Reply(pkt, peer, t0);
+		return;
+	}
+
+	KnvProtocol *full;
+	int ret = reasm.Add(peer, pkt, full);
+	if(ret<0)
+		KnvMetrics::Add(KNV_METRIC_UDP_RX_DROPPED, 1);
+	if(ret<=0 || full==NULL)
+		return;
+	Reply(*full, peer, t0);
+	delete full;
+}
+
+void KnvUdpServer::Reply(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, uint64_t t0)
+{
+	static const string no_msg;
+	uint64_t t[4]; // decode started, handle started, encode started, encode done
+	t[0] = t0;
+	t[1] = KnvLatency::Now();
+	int ret = dispatcher.Dispatch(pkt, peer);
+	t[2] = KnvLatency::Now();
+	if(ret==KNV_DISPATCH_REJECTED)
+		ret = knv::UC_BadRequest;
+	else if(ret>0)
+	{
+		RecordLatency(pkt, pkt.GetRetCode(), t, 2);
+		return;
+	}
+
+	const KnvNet::KnvSockAddr &to = pkt.GetRspAddr().addr_len? pkt.GetRspAddr() : peer;
+	int retcode = ret? ret : pkt.GetRetCode();
+	UcMem *m;
+	if(pkt.GetReqCompress()) // only the response follows the request's ACCEPT_COMPRESS
+		pkt.SetAllowCompress(true);
+	int len = ret? pkt.EncodeWithError(ret, no_msg, m) : pkt.Encode(m);
+	if(len<0)
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, 1);
+		return;
+	}
+	if(ret || len<=pkt.GetMaxPkgSize() || !pkt.GetAllowSplit())
+	{
+		t[3] = KnvLatency::Now();
+		RecordLatency(pkt, retcode, t, 3);
+		Queue(m, len, to);
+		return;
+	}
+
+	// too large for one packet, the peer accepts parts
+	UcMemManager::Free(m);
+	if(pkt.Split())
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, 1);
+		return;
+	}
+	// parts are queued as they are encoded, queueing may flush the batch, which is not encoding
+	uint64_t queued = 0;
+	for(int i=0; i<pkt.GetTotalPartNum(); i++)
+	{
+		len = pkt.EncodePart(i, m);
+		if(len<0)
+		{
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, pkt.GetTotalPartNum()-i);
+			return;
+		}
+		uint64_t q = KnvLatency::Now();
+		Queue(m, len, to, i>0);
+		queued += KnvLatency::Now() - q;
+	}
+	t[3] = KnvLatency::Now() - queued;
+	RecordLatency(pkt, retcode, t, 3);
+}
+
+void KnvUdpServer::RecordLatency(const KnvProtocol &pkt, int retcode, const uint64_t *t, int nr_phases)
+{
+	uint64_t ticks[3];
+	for(int i=0; i<nr_phases; i++)
+		ticks[i] = t[i+1] - t[i];
+	KnvLatency::Record(pkt.GetCommand(), retcode, KNV_LAT_DECODE, ticks, nr_phases);
+}
+
+int KnvUdpServer::Queue(UcMem *m, int len, const KnvNet::KnvSockAddr &to, bool join)
+{
+	if(tx_num==batch)
+	{
+		Flush();
+		join = false;
+	}
+	int i = tx_num++;
+	tx_mem[i] = m;
+	tx_iov[i].iov_base = m->ptr();
+	tx_iov[i].iov_len = len;
+
+	// a packet can follow a run of equally sized packets, ending it if it is shorter
+	if(join && gso && tx_msg_num>0)
+	{
+		TxMsg &g = tx_info[tx_msg_num-1];
+		if(g.nr_segs*g.seg_size==g.bytes && len<=g.seg_size &&
+			g.nr_segs<KNV_UDP_GSO_MAX_SEGS && g.bytes+len<=KNV_UDP_GSO_MAX_BYTES)
+		{
+			tx_msgs[tx_msg_num-1].msg_hdr.msg_iovlen ++;
+			g.nr_segs ++;
+			g.bytes += len;
+			return 0;
+		}
+	}
+
+	int k = tx_msg_num++;
+	tx_info[k].seg_size = len;
+	tx_info[k].nr_segs = 1;
+	tx_info[k].bytes = len;
+	tx_addr[k] = to;
+	memset(&tx_msgs[k].msg_hdr, 0, sizeof(tx_msgs[k].msg_hdr));
+	tx_msgs[k].msg_hdr.msg_iov = &tx_iov[i];
+	tx_msgs[k].msg_hdr.msg_iovlen = 1;
+	tx_msgs[k].msg_hdr.msg_name = &tx_addr[k].addr;
+	tx_msgs[k].msg_hdr.msg_namelen = tx_addr[k].addr_len;
+	return 0;
+}
+
+void KnvUdpServer::SendSegments(const struct msghdr &msg, int nr_segs)
+{
+	struct msghdr h = msg;
+	struct iovec *iov = h.msg_iov;
+	h.msg_iovlen = 1;
+	h.msg_control = NULL;
+	h.msg_controllen = 0;
+	for(int i=0; i<nr_segs; i++)
+	{
+		h.msg_iov = iov + i;
+		if(sendmsg(fd, &h, MSG_DONTWAIT)<0)
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, 1);
+		else
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_PKTS, 1);
+	}
+}
+
+void KnvUdpServer::Flush()
+{
+	if(backend==KNV_IO_URING)
+	{
+		FlushUring();
+		return;
+	}
+	for(int k=0; k<tx_msg_num; k++)
+	{
+		if(tx_info[k].nr_segs>1)
+			SetSegmentSize(tx_msgs[k].msg_hdr, &tx_ctrl[k*UDP_CTRL_SIZE], tx_info[k].seg_size);
+	}
+
+	int off = 0;
+	while(off<tx_msg_num)
+	{
+		int n = sendmmsg(fd, &tx_msgs[off], tx_msg_num-off, MSG_DONTWAIT);
+		if(n>0)
+		{
+			int pkts = 0, nr_gso = 0;
+			for(int k=off; k<off+n; k++)
+			{
+				pkts += tx_info[k].nr_segs;
+				nr_gso += tx_info[k].nr_segs>1;
+			}
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_BATCHES, 1);
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_PKTS, pkts);
+			if(nr_gso)
+				KnvMetrics::Add(KNV_METRIC_UDP_TX_GSO, nr_gso);
+			off += n;
+		}
+		else if(n<0 && errno==EINTR)
+		{
+			continue;
+		}
+		else if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) // the socket buffer is full, drop the rest
+		{
+			int pkts = 0;
+			for(int k=off; k<tx_msg_num; k++)
+				pkts += tx_info[k].nr_segs;
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, pkts);
+			break;
+		}
+		else if(tx_info[off].nr_segs>1)
+		{
+			// e.g. segments larger than the path MTU, or EIO if the device can not checksum them
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_GSO_FALLBACK, 1);
+			if(errno==EIO)
+				gso = false;
+			SendSegments(tx_msgs[off].msg_hdr, tx_info[off].nr_segs);
+			off ++;
+		}
+		else // this one fails, e.g. too large, go on with the others
+		{
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, 1);
+			off ++;
+		}
+	}
+	for(int i=0; i<tx_num; i++)
+		UcMemManager::Free(tx_mem[i]);
+	tx_num = 0;
+	tx_msg_num = 0;
+}
+
+int KnvUdpServer::InitUring()
+{
+	if(!KnvUring::IsSupported() || uring.Init(batch*2+8))
+		return -1;
+
+	unsigned nr = 1;
+	while(nr<(unsigned)batch)
+		nr <<= 1;
+	if(uring.SetupBufRing(URING_BGID, nr))
+	{
+		uring.Exit();
+		return -2;
+	}
+	try
+	{
+		rx_bufs.resize(nr, NULL);
+		cqes.resize(batch*4);
+		for(int b=0; b<2; b++)
+		{
+			banks[b].msgs.resize(batch);
+			banks[b].info.resize(batch);
+			banks[b].ctrl.resize(batch*UDP_CTRL_SIZE);
+			banks[b].addr.resize(batch);
+			banks[b].iov.resize(batch);
+			banks[b].mem.resize(batch, NULL);
+		}
+	}
+	catch(...)
+	{
+		uring.Exit();
+		return -3;
+	}
+	rx_missing = nr; // provided by the thread running the server, whose pools they come from
+
+	// what multishot recvmsg puts at the start of each buffer, the payload follows
+	memset(&rx_uring_hdr, 0, sizeof(rx_uring_hdr));
+	rx_uring_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+	rx_uring_hdr.msg_controllen = gro? UDP_CTRL_SIZE : 0;
+	zc = uring.HasOp(IORING_OP_SENDMSG_ZC);
+	return 0;
+}
+
+void KnvUdpServer::CloseUring()
+{
+	FlushUring();
+	for(; !deferred.empty(); deferred.pop_front()) // taken while waiting for the sends, not delivered any more
+		if(deferred.front().user_data==URING_RX && !(deferred.front().flags & IORING_CQE_F_MORE))
+			rx_armed = false;
+
+	// the receive has to be gone before its buffers are freed
+	struct io_uring_sqe *sqe = rx_armed? GetSqe() : NULL;
+	if(sqe)
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = URING_RX;
+		sqe->user_data = URING_CANCEL;
+	}
+	for(int tries=0; (rx_armed || banks[0].inflight || banks[1].inflight) && tries<100; tries++)
+	{
+		if(uring.Enter(1, 10)<0)
+			break;
+		int n = uring.Reap(&cqes[0], cqes.size());
+		for(int i=0; i<n; i++)
+		{
+			if(cqes[i].user_data==URING_RX && !(cqes[i].flags & IORING_CQE_F_MORE))
+				rx_armed = false;
+			else if(cqes[i].user_data>=URING_TX)
+				OnSend(cqes[i]);
+		}
+	}
+	uring.Exit();
+
+	for(size_t i=0; i<rx_bufs.size(); i++)
+		if(rx_bufs[i]) UcMemManager::Free(rx_bufs[i]);
+	rx_bufs.clear();
+	for(int b=0; b<2; b++)
+		ReleaseBank(banks[b]);
+}
+
+struct io_uring_sqe *KnvUdpServer::GetSqe()
+{
+	struct io_uring_sqe *sqe = uring.GetSqe();
+	if(sqe==NULL && uring.Enter()>=0) // the queue is full, submitting empties it
+		sqe = uring.GetSqe();
+	return sqe;
+}
+
+int KnvUdpServer::ArmRecv()
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if(sqe==NULL)
+	{
+		errmsg = "io_uring submission queue is stuck";
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)&rx_uring_hdr;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_RX;
+	rx_armed = true;
+	return 0;
+}
+
+void KnvUdpServer::ArmWake()
+{
+	// a read of a non-blocking eventfd would fail at once, so poll it
+	struct io_uring_sqe *sqe = GetSqe();
+	if(sqe==NULL)
+		return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = evfd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_WAKE;
+	wake_armed = true;
+}
+
+int KnvUdpServer::RunOnceUring(int timeout_ms)
+{
+	// the end of the receive or a wake-up may have been taken by WaitSends() after the last round,
+	// they are handled before re-arming
+	int total = HandleDeferred();
+	for(int i=0; rx_missing && i<(int)rx_bufs.size(); i++)
+		if(rx_bufs[i]==NULL) Reprovide(i);
+	uring.CommitBufs();
+	if(rx_missing==(int)rx_bufs.size())
+	{
+		errmsg = "UcMemManager::Alloc failed";
+		return -3;
+	}
+	if(!rx_armed && ArmRecv())
+		return -2;
+	if(!wake_armed)
+		ArmWake();
+
+	// submits the sends of the last round too, no waiting if there is something to do already
+	int ret = uring.Enter(1, total || !deferred.empty() || tx_msg_num? 0 : timeout_ms);
+	if(ret<0)
+	{
+		errmsg = "io_uring_enter failed: "; errmsg += strerror(-ret);
+		return -2;
+	}
+
+	// a few rounds in a row, but go back to re-arming under flood
+	for(int round=0; round<16; round++)
+	{
+		int n = uring.Reap(&cqes[0], cqes.size());
+		int pkts = 0;
+		for(int i=0; i<n; i++)
+		{
+			pkts += OnCompletion(cqes[i]);
+			total += HandleDeferred();
+		}
+		uring.CommitBufs();
+		if(pkts)
+		{
+			KnvMetrics::Add(KNV_METRIC_UDP_RX_BATCHES, 1);
+			KnvMetrics::Add(KNV_METRIC_UDP_RX_PKTS, pkts);
+			nr_received += pkts;
+			total += pkts;
+		}
+		if(n<(int)cqes.size())
+			break;
+	}
+	Flush();
+	if(!deferred.empty()) // from the flush, their responses are sent now too, any left go first next time
+	{
+		total += HandleDeferred();
+		uring.CommitBufs();
+		Flush();
+	}
+	// submit the responses now rather than with the next wait
+	uring.Enter();
+	reasm.Expire();
+	return total;
+}
+
+int KnvUdpServer::HandleDeferred()
+{
+	int pkts = 0;
+	while(!deferred.empty())
+	{
+		struct io_uring_cqe c = deferred.front();
+		deferred.pop_front();
+		pkts += OnCompletion(c);
+	}
+	if(pkts)
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_RX_PKTS, pkts);
+		nr_received += pkts;
+	}
+	return pkts;
+}
+
+int KnvUdpServer::OnCompletion(const struct io_uring_cqe &c)
+{
+	if(c.user_data==URING_RX)
+		return OnRecv(c);
+	if(c.user_data>=URING_TX)
+	{
+		OnSend(c);
+	}
+	else if(c.user_data==URING_WAKE)
+	{
+		uint64_t v;
+		if(read(evfd, &v, sizeof(v))<0) {} // drained
+		wake_armed = false;
+	}
+	return 0;
+}
+
+int KnvUdpServer::OnRecv(const struct io_uring_cqe &c)
+{
+	// ENOBUFS ends it when all buffers are taken, it is armed again after they are provided
+	if(!(c.flags & IORING_CQE_F_MORE))
+		rx_armed = false;
+	if(c.res<0 || !(c.flags & IORING_CQE_F_BUFFER))
+		return 0;
+
+	int bid = c.flags >> IORING_CQE_BUFFER_SHIFT;
+	UcMem *m = rx_bufs[bid];
+	struct io_uring_recvmsg_out *o = (struct io_uring_recvmsg_out *)m->ptr();
+	char *name = (char *)(o + 1);
+	char *ctrl = name + rx_uring_hdr.msg_namelen;
+	char *p = ctrl + rx_uring_hdr.msg_controllen;
+	int len = c.res - (p - (char *)o);
+	if(len<0)
+		len = 0;
+
+	KnvNet::KnvSockAddr peer((struct sockaddr *)name, o->namelen<rx_uring_hdr.msg_namelen? o->namelen : rx_uring_hdr.msg_namelen);
+	struct msghdr h;
+	memset(&h, 0, sizeof(h));
+	h.msg_control = ctrl;
+	h.msg_controllen = o->controllen;
+	int nr_pkts = Deliver(m, p, len, GetGroSize(h, gro, len), o->flags & MSG_TRUNC, peer);
+	Reprovide(bid);
+	return nr_pkts;
+}
+
+void KnvUdpServer::Reprovide(int bid)
+{
+	UcMem *&m = rx_bufs[bid];
+	if(m && m->GetRefCount()>1) // protocols kept by the reassembler hold their own references
+	{
+		UcMemManager::Free(m);
+		m = NULL;
+		rx_missing ++;
+	}
+	if(m==NULL)
+	{
+		if((m=UcMemManager::Alloc(URING_RX_BUF_SIZE))==NULL)
+			return; // tried again by the next round
+		rx_missing --;
+	}
+	uring.ProvideBuf(m->ptr(), URING_RX_BUF_SIZE, bid);
+}
+
+void KnvUdpServer::OnSend(const struct io_uring_cqe &c)
+{
+	TxBank &bk = banks[(c.user_data>>16) & 1];
+	int k = c.user_data & 0xffff;
+	if(c.flags & IORING_CQE_F_NOTIF) // the kernel is done with the buffers of a zero copy send
+	{
+		if(--bk.inflight==0)
+			ReleaseBank(bk);
+		return;
+	}
+
+	const TxMsg &t = bk.info[k];
+	int res = c.res;
+	if(res<0 && res!=-EAGAIN && (c.user_data & URING_TX_ZC))
+	{
+		// zero copy is refused for some sockets and devices, e.g. with UDP_SEGMENT over
+		// loopback, so it is given up and the message sent by copying
+		zc = false;
+		res = sendmsg(fd, &bk.msgs[k], MSG_DONTWAIT)<0? -errno : 0;
+	}
+	else if(res>=0 && (c.user_data & URING_TX_ZC))
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_ZC, 1);
+	}
+
+	if(res>=0)
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_PKTS, t.nr_segs);
+		if(t.nr_segs>1)
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_GSO, 1);
+	}
+	else if(res!=-EAGAIN && t.nr_segs>1)
+	{
+		// see Flush()
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_GSO_FALLBACK, 1);
+		if(res==-EIO)
+			gso = false;
+		SendSegments(bk.msgs[k], t.nr_segs);
+	}
+	else
+	{
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, t.nr_segs);
+	}
+	// a zero copy send is followed by its notification
+	if(!(c.flags & IORING_CQE_F_MORE) && --bk.inflight==0)
+		ReleaseBank(bk);
+}
+
+void KnvUdpServer::ReleaseBank(TxBank &bk)
+{
+	for(int i=0; i<bk.nr_mem; i++)
+		UcMemManager::Free(bk.mem[i]);
+	bk.nr_mem = 0;
+}
+
+void KnvUdpServer::WaitSends()
+{
+	struct io_uring_cqe cs[64];
+	if(uring.Enter(1, 1000)<0)
+		return;
+	int n = uring.Reap(cs, 64);
+	for(int i=0; i<n; i++)
+	{
+		if(cs[i].user_data>=URING_TX)
+			OnSend(cs[i]);
+		else
+			deferred.push_back(cs[i]); // not handled in the middle of a round
+	}
+}
+
+void KnvUdpServer::FlushUring()
+{
+	if(tx_msg_num==0)
+		return;
+
+	// sends of a bank are usually complete by the time the next batch is ready
+	int b = -1;
+	for(int tries=0; b<0; tries++)
+	{
+		if(banks[0].inflight==0)
+			b = 0;
+		else if(banks[1].inflight==0)
+			b = 1;
+		else if(tries<100)
+			WaitSends();
+		else
+			break;
+	}
+	if(b<0)
+	{
+		int pkts = 0;
+		for(int k=0; k<tx_msg_num; k++)
+			pkts += tx_info[k].nr_segs;
+		KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, pkts);
+		for(int i=0; i<tx_num; i++)
+			UcMemManager::Free(tx_mem[i]);
+		tx_num = 0;
+		tx_msg_num = 0;
+		return;
+	}
+
+	TxBank &bk = banks[b];
+	for(int i=0; i<tx_num; i++)
+	{
+		bk.iov[i] = tx_iov[i];
+		bk.mem[i] = tx_mem[i];
+	}
+	bk.nr_mem = tx_num;
+	for(int k=0; k<tx_msg_num; k++)
+	{
+		bk.info[k] = tx_info[k];
+		bk.addr[k] = tx_addr[k];
+		struct msghdr &h = bk.msgs[k];
+		h = tx_msgs[k].msg_hdr;
+		h.msg_iov = &bk.iov[h.msg_iov - &tx_iov[0]];
+		h.msg_name = &bk.addr[k].addr;
+		h.msg_control = NULL;
+		h.msg_controllen = 0;
+		if(bk.info[k].nr_segs>1)
+			SetSegmentSize(h, &bk.ctrl[k*UDP_CTRL_SIZE], bk.info[k].seg_size);
+
+		struct io_uring_sqe *sqe = GetSqe();
+		if(sqe==NULL)
+		{
+			KnvMetrics::Add(KNV_METRIC_UDP_TX_DROPPED, bk.info[k].nr_segs);
+			continue;
+		}
+		bool send_zc = zc && bk.info[k].bytes>=URING_ZC_MIN_BYTES;
+		sqe->opcode = send_zc? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)&h;
+		sqe->len = 1;
+		sqe->user_data = URING_TX | (send_zc? URING_TX_ZC : 0) | (uint64_t)b<<16 | k;
+		bk.inflight ++;
+	}
+	KnvMetrics::Add(KNV_METRIC_UDP_TX_BATCHES, 1);
+	tx_num = 0;
+	tx_msg_num = 0;
+	if(bk.inflight==0)
+		ReleaseBank(bk);
+}
+
+KnvUdpServerGroup::KnvUdpServerGroup(int b) : batch(b), backend(KNV_IO_EPOLL), port(0), warm_nodes(0), warm_bytes(0)
+{
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+KnvUdpServerGroup::~KnvUdpServerGroup()
+{
+	Stop();
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void KnvUdpServerGroup::SetHandler(uint32_t cmd, KnvUdpHandler h, void *arg)
+{
+	dispatcher.Register(cmd, h, arg);
+}
+
+void KnvUdpServerGroup::SetDefaultHandler(KnvUdpHandler h, void *arg)
+{
+	dispatcher.SetDefault(h, arg);
+}
+
+int KnvUdpServerGroup::Start(int p, int nr_workers, const int *cpus, bool steer_by_cpu, bool use_ipv6)
+{
+	if(!workers.empty())
+	{
+		errmsg = "already started";
+		return -1;
+	}
+	if(nr_workers<1 || (steer_by_cpu && cpus==NULL))
+	{
+		errmsg = "bad number of workers or no cpus to steer to";
+		return -2;
+	}
+
+	try
+	{
+		workers.resize(nr_workers);
+	}
+	catch(...)
+	{
+		errmsg = "out of memory";
+		return -3;
+	}
+
+	// sockets are bound in worker order, which is the index the steering program returns
+	port = p;
+	int ret = 0;
+	for(int i=0; i<nr_workers; i++)
+	{
+		Worker &w = workers[i];
+		w.group = this;
+		w.cpu = cpus? cpus[i] : -1;
+		w.started = w.ready = false;
+		w.ret = 0;
+		w.srv = NULL;
+		w.received = 0;
+		w.fd = -1;
+		if(ret)
+			continue;
+		w.fd = KnvNet::CreateUdpReusePortSocket(port, use_ipv6, true);
+		if(w.fd<0)
+		{
+			errmsg = "creating socket failed: "; errmsg += strerror(errno);
+			ret = -4;
+		}
+		else if(port==0) // the others join the port the first one got
+		{
+			KnvNet::KnvSockAddr a(use_ipv6);
+			if(getsockname(w.fd, &a.addr, &a.addr_len)==0)
+				port = ntohs(use_ipv6? a.a6.sin6_port : a.a4.sin_port);
+			else
+			{
+				errmsg = "getsockname failed: "; errmsg += strerror(errno);
+				ret = -4;
+			}
+		}
+	}
+	if(ret==0 && steer_by_cpu && KnvNet::SetReusePortCpuSteering(workers[0].fd, nr_workers, cpus))
+	{
+		errmsg = "attaching steering program failed: "; errmsg += strerror(errno);
+		ret = -5;
+	}
+
+	for(int i=0; ret==0 && i<nr_workers; i++)
+	{
+		Worker &w = workers[i];
+		int r = pthread_create(&w.thread, NULL, WorkerEntry, &w);
+		if(r)
+		{
+			errmsg = "pthread_create failed: "; errmsg += strerror(r);
+			ret = -6;
+			break;
+		}
+		w.started = true;
+	}
+
+	// wait for the workers to be serving, so that a failed start-up is reported here
+	pthread_mutex_lock(&lock);
+	for(int i=0; i<nr_workers; i++)
+	{
+		Worker &w = workers[i];
+		if(!w.started)
+			continue;
+		while(!w.ready)
+			pthread_cond_wait(&cond, &lock);
+		if(w.ret && ret==0)
+		{
+			errmsg = w.errmsg;
+			ret = -7;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if(ret)
+		Stop();
+	return ret;
+}
+
+void KnvUdpServerGroup::Stop()
+{
+	pthread_mutex_lock(&lock);
+	for(size_t i=0; i<workers.size(); i++)
+		if(workers[i].srv)
+			workers[i].srv->Stop();
+	pthread_mutex_unlock(&lock);
+
+	for(size_t i=0; i<workers.size(); i++)
+	{
+		Worker &w = workers[i];
+		if(w.started)
+			pthread_join(w.thread, NULL);
+		else if(w.fd>=0) // never handed over
+			close(w.fd);
+	}
+	workers.clear();
+}
+
+void *KnvUdpServerGroup::WorkerEntry(void *arg)
+{
+	Worker &w = *(Worker *)arg;
+	w.group->WorkerMain(w);
+	return NULL;
+}
+
+// everything of the request path is created by the worker thread itself,
+// so that the server, its buffers and the pools it allocates from belong to this thread
+void KnvUdpServerGroup::WorkerMain(Worker &w)
+{
+	int ret = 0;
+	if(w.cpu>=0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w.cpu, &set);
+		int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(r)
+		{
+			w.errmsg = "pinning to cpu failed: "; w.errmsg += strerror(r);
+			ret = -1;
+		}
+	}
+	if(ret==0 && (warm_nodes || warm_bytes) && KnvWarmup(warm_nodes, warm_bytes))
+	{
+		w.errmsg = "warming up pools failed";
+		ret = -2;
+	}
+
+	KnvUdpServer srv(batch);
+	srv.GetDispatcher() = dispatcher;
+	srv.SetBackend(backend);
+
+	if(ret)
+		close(w.fd);
+	else if(srv.Attach(w.fd))
+	{
+		w.errmsg = srv.GetErrorMsg();
+		ret = -3;
+	}
+
+	pthread_mutex_lock(&lock);
+	w.ret = ret;
+	w.ready = true;
+	if(ret==0)
+		w.srv = &srv;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	if(ret)
+		return;
+
+	srv.Run();
+
+	pthread_mutex_lock(&lock);
+	w.srv = NULL;
+	w.received = srv.GetRecvCount();
+	pthread_mutex_unlock(&lock);
+}
+
+KnvUdpLoadGen::KnvUdpLoadGen(int w, int t) : window(w), timeout_ms(t), fd(-1)
+{
+	if(window<1) window = 1;
+	if(timeout_ms<1) timeout_ms = 1;
+}
+
+KnvUdpLoadGen::~KnvUdpLoadGen()
+{
+	if(fd>=0) close(fd);
+}
+
+// the sequence is written with all 10 bytes of a varint, so it can be rewritten in place
+#define LOADGEN_SEQ_BASE	(1ULL<<63)
+
+static inline void put_seq(char *p, uint64_t seq)
+{
+	for(int i=0; i<9; i++, seq>>=7)
+		p[i] = (seq & 0x7f) | 0x80;
+	p[9] = seq;
+}
+
+int KnvUdpLoadGen::Run(const KnvNet::KnvSockAddr &server, KnvProtocol &req, int duration_ms, KnvUdpLoadStats &st)
+{
+	memset(&st, 0, sizeof(st));
+	if(fd<0)
+	{
+		fd = socket(server.addr.sa_family, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+		if(fd<0 || connect(fd, &server.addr, server.addr_len))
+		{
+			errmsg = "connecting socket failed: "; errmsg += strerror(errno);
+			return -1;
+		}
+	}
+
+	// find the sequence in the encoded request
+	string pkt;
+	char seq_field[11];
+	seq_field[0] = (KNV_PKG_HDR_SEQ_TAG<<3) | KNV_VARINT;
+	put_seq(seq_field+1, LOADGEN_SEQ_BASE);
+	if(req.SetSequence(LOADGEN_SEQ_BASE) || req.Encode(pkt))
+	{
+		errmsg = "encoding request failed: " + req.GetErrorMsg();
+		return -2;
+	}
+	size_t seq_off = pkt.find(string(seq_field, sizeof(seq_field)));
+	if(seq_off==string::npos)
+	{
+		errmsg = "sequence not found in the encoded request";
+		return -3;
+	}
+	seq_off ++;
+
+	int batch = window<KNV_UDP_MAX_BATCH? window : KNV_UDP_MAX_BATCH;
+	vector<string> bufs(window, pkt);
+	vector<Slot> slots(window);
+	vector<int> parts(window, 0);
+	vector<struct mmsghdr> msgs(batch);
+	vector<struct iovec> iovs(batch);
+	vector<char> rx_buf((size_t)batch*KNV_UDP_MAX_PKT_SIZE);
+	uint64_t counter = 0;
+	for(int i=0; i<window; i++)
+		slots[i].seq = 0;
+
+	uint64_t start = now_us(), end = start + (uint64_t)duration_ms*1000, now = start;
+	while(now<end)
+	{
+		// (re)send every free or timed out slot
+		int k = 0;
+		for(int i=0; i<window; i++)
+		{
+			Slot &s = slots[i];
+			if(s.seq && now-s.sent_us < (uint64_t)timeout_ms*1000)
+				continue;
+			if(s.seq)
+				st.lost ++;
+			// the slot is found again from the sequence of the reply
+			s.seq = LOADGEN_SEQ_BASE | ((++counter)*window + i);
+			s.sent_us = now;
+			parts[i] = 0;
+			put_seq(&bufs[i][seq_off], s.seq);
+			iovs[k].iov_base = &bufs[i][0];
+			iovs[k].iov_len = bufs[i].length();
+			memset(&msgs[k].msg_hdr, 0, sizeof(msgs[k].msg_hdr));
+			msgs[k].msg_hdr.msg_iov = &iovs[k];
+			msgs[k].msg_hdr.msg_iovlen = 1;
+			if(++k==batch)
+			{
+				// unsent ones time out and count as lost
+				int n = sendmmsg(fd, &msgs[0], k, 0);
+				st.sent += n>0? n : 0;
+				k = 0;
+			}
+		}
+		if(k)
+		{
+			int n = sendmmsg(fd, &msgs[0], k, 0);
+			st.sent += n>0? n : 0;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, 1)<=0)
+		{
+			now = now_us();
+			continue;
+		}
+		for(int i=0; i<batch; i++)
+		{
+			iovs[i].iov_base = &rx_buf[(size_t)i*KNV_UDP_MAX_PKT_SIZE];
+			iovs[i].iov_len = KNV_UDP_MAX_PKT_SIZE;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(fd, &msgs[0], batch, MSG_DONTWAIT, NULL);
+		now = now_us();
+		for(int i=0; i<n; i++)
+		{
+			KnvHeaderInfo info;
+			if(KnvProtocol::Peek((char *)iovs[i].iov_base, msgs[i].msg_len, info) || !(info.seq & LOADGEN_SEQ_BASE))
+				continue;
+			int idx = (info.seq & ~LOADGEN_SEQ_BASE) % window;
+			Slot &s = slots[idx];
+			if(s.seq!=info.seq) // late reply of a lost request
+				continue;
+			// a split reply is done when all parts are here
+			if(info.total_split_count>1 && ++parts[idx]<info.total_split_count)
+				continue;
+			uint64_t lat = now - s.sent_us;
+			st.received ++;
+			st.lat_sum_us += lat;
+			if(lat>st.lat_max_us)
+				st.lat_max_us = lat;
+			s.seq = 0;
+		}
+	}
+	st.elapsed_us = now - start;
+	return 0;
+}
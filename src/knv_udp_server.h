@@ -0,0 +1,313 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_udp_server.h
+// Batched UDP server loop and a load generator for it
+//
+// KnvUdpServer waits on an epoll set, receives up to a batch of packets per recvmmsg()
+// into UcMem buffers and decodes them in place. Split requests are put together by a
+// KnvReassembler. Each request is routed by a KnvDispatcher to the handler of its command,
+// which turns the protocol into the response; responses, split into parts if the peer allows, are queued
+// and sent by sendmmsg() once the batch is done.
+//
+// Where the kernel supports it, the parts of a split response go out as one UDP_SEGMENT (GSO)
+// message per run of equally sized parts, and with UDP_GRO the kernel hands a burst of parts
+// from one peer over in one buffer, which is cut back into packets by the segment size.
+//
+// With the KNV_IO_URING backend, the server runs on an io_uring instead: one multishot
+// recvmsg keeps receiving into a ring of provided UcMem buffers, the kernel picking a buffer
+// per packet, and responses are submitted as a batch of sendmsg entries, large ones as
+// SENDMSG_ZC so that the encoded buffers are sent without a copy. Waiting for completions
+// and submitting the sends take one io_uring_enter(). If the kernel lacks what is needed,
+// the server falls back to epoll.
+//
+// KnvUdpLoadGen keeps a window of requests in flight against a server and measures
+// throughput and latency, so that a server can be benchmarked over loopback.
+//
+// Like the pools, a server or a load generator is meant to be run by one thread.
+//
+// KnvUdpServerGroup runs a KnvUdpServer per worker thread, each on its own SO_REUSEPORT
+// socket of the same port, so that workers share no socket, pool or state. Workers can be
+// pinned to CPUs and packets steered to the worker of the CPU that received them.
+//
+// 2026-10-18	Created
+// 2026-10-18	KnvUdpServerGroup
+// 2026-10-18	UDP GSO/GRO
+// 2026-10-18	io_uring backend
+// 2026-10-18	Handlers looked up by KnvDispatcher
+// 2026-10-18	Per-command latency, see knv_latency.h
+// 2026-10-18	Completions taken while waiting for sends are handled before the next wait
+//
+
+#ifndef __KNV_UDP_SERVER__
+#define __KNV_UDP_SERVER__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include "protocol.h"
+#include "knv_reassembler.h"
+#include "knv_uring.h"
+#include "knv_dispatch.h"
+
+using namespace std;
+
+#define KNV_UDP_DEFAULT_BATCH	64
+#define KNV_UDP_MAX_BATCH	1024
+#define KNV_UDP_MAX_PKT_SIZE	65536
+#define KNV_UDP_GSO_MAX_SEGS	64    // packets in a UDP_SEGMENT message, the limit of older kernels
+#define KNV_UDP_GSO_MAX_BYTES	65000 // payload of a UDP_SEGMENT message, fits in an IP datagram
+
+// I/O backends of KnvUdpServer
+#define KNV_IO_EPOLL	0 // epoll_wait(), recvmmsg() and sendmmsg()
+#define KNV_IO_URING	1 // io_uring with multishot recvmsg, see above
+
+// Called for each request, see KnvCmdHandler; pkt is encoded by KnvProtocol::Encode() after returning
+typedef KnvCmdHandler KnvUdpHandler;
+
+class KnvUdpServer
+{
+public:
+	KnvUdpServer(int batch = KNV_UDP_DEFAULT_BATCH);
+	~KnvUdpServer();
+
+	// bind to port on all addresses, returns 0 on success
+	int Listen(int port, bool use_ipv6 = false);
+	// serve on a bound socket created elsewhere, the server closes it on destruction
+	int Attach(int fd);
+	int GetSocket() const { return fd; }
+	// use UDP_SEGMENT for sending parts and UDP_GRO for receiving, both on by default,
+	// takes effect by Listen()/Attach(), either is left off if the kernel does not support it
+	void SetOffload(bool gso, bool gro) { use_gso = gso; use_gro = gro; }
+	// KNV_IO_EPOLL (the default) or KNV_IO_URING, takes effect by Listen()/Attach()
+	void SetBackend(int b) { backend_req = b; }
+	// the backend in use, KNV_IO_EPOLL if io_uring was asked for but is not available
+	int GetBackend() const { return backend; }
+
+	// bind h to all sub-commands of cmd
+	void SetHandler(uint32_t cmd, KnvUdpHandler h, void *arg = NULL);
+	// for commands without a handler, otherwise they get UC_BadRequest
+	void SetDefaultHandler(KnvUdpHandler h, void *arg = NULL);
+	// for binding sub-commands and command options, requests rejected by it get UC_BadRequest;
+	// it is frozen when the server runs
+	KnvDispatcher &GetDispatcher() { return dispatcher; }
+
+	// serve until Stop() is called, returns 0 after Stop() or <0 on failure
+	int Run();
+	// wait up to timeout_ms for packets and process them,
+	// returns the number of packets received or <0 on failure
+	int RunOnce(int timeout_ms);
+	// make Run() return, can be called from any thread or a signal handler
+	void Stop();
+
+	KnvReassembler &GetReassembler() { return reasm; }
+	// packets received so far
+	uint64_t GetRecvCount() const { return nr_received; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvUdpServer(const KnvUdpServer &);
+	KnvUdpServer &operator=(const KnvUdpServer &);
+
+	int Init();
+	int RecvBatch();
+	// hand the packets in a received buffer to Process(), returns the number of packets
+	int Deliver(UcMem *m, char *p, int len, int seg_size, bool truncated, const KnvNet::KnvSockAddr &peer);
+	void Process(UcMem *m, char *data, int len, const KnvNet::KnvSockAddr &peer);
+	// t0: when decoding started, for the latency histograms
+	void Reply(KnvProtocol &pkt, const KnvNet::KnvSockAddr &peer, uint64_t t0);
+	// record the phases from decode on between the timestamps t[0..nr_phases]
+	static void RecordLatency(const KnvProtocol &pkt, int retcode, const uint64_t *t, int nr_phases);
+	// takes m, join appends it to the last message queued, which has the same destination
+	int Queue(UcMem *m, int len, const KnvNet::KnvSockAddr &to, bool join = false);
+	void Flush();
+	void SendSegments(const struct msghdr &msg, int nr_segs); // send the packets of a UDP_SEGMENT message one by one
+
+	// io_uring backend
+	int InitUring();
+	void CloseUring();
+	int RunOnceUring(int timeout_ms);
+	struct io_uring_sqe *GetSqe();
+	int ArmRecv();
+	void ArmWake();
+	int OnCompletion(const struct io_uring_cqe &c); // returns the number of packets received
+	int HandleDeferred(); // completions taken by WaitSends(), returns the number of packets received
+	int OnRecv(const struct io_uring_cqe &c);
+	void OnSend(const struct io_uring_cqe &c);
+	void Reprovide(int bid);
+	void FlushUring();
+	void WaitSends(); // until a send bank is free
+
+	int fd;
+	int epfd;
+	int evfd; // wakes up epoll_wait() for Stop()
+	volatile bool stopping;
+	int batch;
+	int backend_req, backend;
+	bool use_gso, use_gro;
+	bool gso, gro; // enabled on the socket
+
+	// receive slots
+	vector<struct mmsghdr> rx_msgs;
+	vector<struct iovec> rx_iov;
+	vector<struct sockaddr_in6> rx_addr;
+	vector<UcMem *> rx_mem;
+	vector<char> rx_ctrl;
+
+	// send queue, a message takes one packet, or a run of packets of the same size
+	// (the last one may be shorter) sent by UDP_SEGMENT
+	struct TxMsg
+	{
+		int seg_size;
+		int nr_segs;
+		int bytes;
+	};
+	vector<struct mmsghdr> tx_msgs;
+	vector<TxMsg> tx_info;
+	vector<char> tx_ctrl;
+	vector<KnvNet::KnvSockAddr> tx_addr;
+	int tx_msg_num;
+	vector<struct iovec> tx_iov; // per packet
+	vector<UcMem *> tx_mem;
+	int tx_num;
+
+	// io_uring backend
+	KnvUring uring;
+	vector<UcMem *> rx_bufs;    // provided buffers by id, NULL if it could not be replaced
+	int rx_missing;             // number of NULLs in rx_bufs
+	struct msghdr rx_uring_hdr; // tells multishot recvmsg the room for the address and cmsgs
+	bool rx_armed, wake_armed;
+	bool zc;                    // SENDMSG_ZC is available
+	vector<struct io_uring_cqe> cqes;
+	deque<struct io_uring_cqe> deferred; // taken while waiting for sends, handled afterwards
+	// the send queue is moved to a bank when submitted, and stays there until the kernel is done
+	struct TxBank
+	{
+		vector<struct msghdr> msgs;
+		vector<TxMsg> info;
+		vector<char> ctrl;
+		vector<KnvNet::KnvSockAddr> addr;
+		vector<struct iovec> iov;
+		vector<UcMem *> mem;
+		int nr_mem;
+		int inflight; // completions still to come, including zero copy notifications
+	};
+	TxBank banks[2];
+	void ReleaseBank(TxBank &bk);
+
+	KnvDispatcher dispatcher;
+	KnvReassembler reasm;
+	uint64_t nr_received;
+	string errmsg;
+};
+
+class KnvUdpServerGroup
+{
+public:
+	KnvUdpServerGroup(int batch = KNV_UDP_DEFAULT_BATCH);
+	~KnvUdpServerGroup();
+
+	// handlers and warm-up are applied to each worker by Start(), args are shared by all workers
+	void SetHandler(uint32_t cmd, KnvUdpHandler h, void *arg = NULL);
+	void SetDefaultHandler(KnvUdpHandler h, void *arg = NULL);
+	// copied to each worker
+	KnvDispatcher &GetDispatcher() { return dispatcher; }
+	// each worker warms up its own pools before taking traffic, see KnvWarmup()
+	void SetWarmup(int nodes, uint64_t bytes_per_class) { warm_nodes = nodes; warm_bytes = bytes_per_class; }
+	// see KnvUdpServer::SetBackend(), each worker has a ring of its own
+	void SetBackend(int b) { backend = b; }
+
+	// open nr_workers SO_REUSEPORT sockets on port (0 for an ephemeral one, see GetPort()),
+	// and serve each by a thread of its own; if cpus is not NULL, worker i is pinned to cpus[i],
+	// and with steer_by_cpu, packets received on cpus[i] go to worker i
+	// returns 0 after all workers are serving, or <0 on failure with no worker left running
+	int Start(int port, int nr_workers, const int *cpus = NULL, bool steer_by_cpu = false, bool use_ipv6 = false);
+	// stop and join all workers
+	void Stop();
+
+	int GetPort() const { return port; }
+	int GetWorkerNum() const { return workers.size(); }
+	// packets received by a worker, valid after Stop()
+	uint64_t GetRecvCount(int i) const { return workers[i].received; }
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvUdpServerGroup(const KnvUdpServerGroup &);
+	KnvUdpServerGroup &operator=(const KnvUdpServerGroup &);
+
+	struct Worker
+	{
+		KnvUdpServerGroup *group;
+		int fd;       // owned by the worker's server once started
+		int cpu;      // -1 if not pinned
+		pthread_t thread;
+		bool started; // thread created
+		bool ready;   // start-up finished, ret is valid
+		int ret;
+		KnvUdpServer *srv; // NULL when not running, guarded by lock
+		uint64_t received;
+		string errmsg;
+	};
+
+	static void *WorkerEntry(void *arg);
+	void WorkerMain(Worker &w);
+
+	int batch;
+	int backend;
+	int port;
+	int warm_nodes;
+	uint64_t warm_bytes;
+	KnvDispatcher dispatcher;
+	vector<Worker> workers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	string errmsg;
+};
+
+struct KnvUdpLoadStats
+{
+	uint64_t sent;
+	uint64_t received;
+	uint64_t lost;         // requests given up after the timeout
+	uint64_t elapsed_us;
+	uint64_t lat_sum_us;   // over received replies
+	uint64_t lat_max_us;
+};
+
+class KnvUdpLoadGen
+{
+public:
+	// window: requests kept in flight, timeout_ms: a request without a reply is resent after this
+	KnvUdpLoadGen(int window = 64, int timeout_ms = 1000);
+	~KnvUdpLoadGen();
+
+	// send req to server for duration_ms, each copy with its own sequence
+	// returns 0 on success
+	int Run(const KnvNet::KnvSockAddr &server, KnvProtocol &req, int duration_ms, KnvUdpLoadStats &st);
+
+	const string &GetErrorMsg() const { return errmsg; }
+
+private:
+	KnvUdpLoadGen(const KnvUdpLoadGen &);
+	KnvUdpLoadGen &operator=(const KnvUdpLoadGen &);
+
+	struct Slot
+	{
+		uint64_t seq;      // 0 if free
+		uint64_t sent_us;
+	};
+
+	int window;
+	int timeout_ms;
+	int fd;
+	string errmsg;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_uring.cc
+// Implementation of KnvUring
+//
+// 2026-10-18	Created
+//
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "knv_uring.h"
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+KnvUring::KnvUring() : ring_fd(-1), features(0), sq_ring(NULL), sq_ring_sz(0), cq_ring(NULL), cq_ring_sz(0),
+	sqes(NULL), sqes_sz(0), sq_head(NULL), sq_tail(NULL), sq_array(NULL), sq_mask(0), sq_entries(0), sqe_tail(0),
+	cq_head(NULL), cq_tail(NULL), cq_mask(0), cqes(NULL), br(NULL), br_sz(0), br_mask(0), br_bgid(0), br_staged(0)
+{
+	memset(ops, 0, sizeof(ops));
+}
+
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+static bool uring_supported;
+
+static void probe_uring()
+{
+	KnvUring r;
+	uring_supported = r.Init(4)==0 && r.HasOp(IORING_OP_RECVMSG) && r.SetupBufRing(0, 1)==0;
+}
+
+bool KnvUring::IsSupported()
+{
+	pthread_once(&uring_once, probe_uring); // servers of a group may start at the same time
+	return uring_supported;
+}
+
+int KnvUring::Init(unsigned entries)
+{
+	if(ring_fd>=0)
+		return -EBUSY;
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_COOP_TASKRUN; // completions are only reaped in io_uring_enter() anyway
+	int fd = sys_io_uring_setup(entries, &p);
+	if(fd<0 && errno==EINVAL)
+	{
+		memset(&p, 0, sizeof(p));
+		fd = sys_io_uring_setup(entries, &p);
+	}
+	if(fd<0)
+		return -errno;
+	ring_fd = fd;
+	features = p.features;
+	if(!(features & IORING_FEAT_EXT_ARG)) // no waiting with a timeout
+	{
+		Exit();
+		return -ENOSYS;
+	}
+
+	sq_ring_sz = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	cq_ring_sz = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if(features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(cq_ring_sz>sq_ring_sz)
+			sq_ring_sz = cq_ring_sz;
+		cq_ring_sz = sq_ring_sz;
+	}
+	sq_ring = mmap(NULL, sq_ring_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(sq_ring==MAP_FAILED)
+	{
+		int e = errno;
+		sq_ring = NULL;
+		Exit();
+		return -e;
+	}
+	if(features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cq_ring = sq_ring;
+	}
+	else
+	{
+		cq_ring = mmap(NULL, cq_ring_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(cq_ring==MAP_FAILED)
+		{
+			int e = errno;
+			cq_ring = NULL;
+			Exit();
+			return -e;
+		}
+	}
+	sqes_sz = p.sq_entries*sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe *)mmap(NULL, sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqes==MAP_FAILED)
+	{
+		int e = errno;
+		sqes = NULL;
+		Exit();
+		return -e;
+	}
+
+	char *sq = (char *)sq_ring, *cq = (char *)cq_ring;
+	sq_head = (unsigned *)(sq + p.sq_off.head);
+	sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	sq_array = (unsigned *)(sq + p.sq_off.array);
+	sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	sq_entries = p.sq_entries;
+	cq_head = (unsigned *)(cq + p.cq_off.head);
+	cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// entries are submitted in the order they are got, so the index array never changes
+	for(unsigned i=0; i<sq_entries; i++)
+		sq_array[i] = i;
+	sqe_tail = *sq_tail;
+
+	// an older kernel without the probe just leaves all opcodes unknown
+	char probe_buf[sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op)];
+	struct io_uring_probe *probe = (struct io_uring_probe *)probe_buf;
+	memset(probe_buf, 0, sizeof(probe_buf));
+	if(sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256)==0)
+	{
+		for(int i=0; i<probe->ops_len && i<256; i++)
+			if(probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+				ops[probe->ops[i].op] = 1;
+	}
+	return 0;
+}
+
+void KnvUring::Exit()
+{
+	// the kernel holds on to the pages of the rings until it is done with them
+	if(ring_fd>=0)
+		close(ring_fd);
+	ring_fd = -1;
+	if(sqes)
+		munmap(sqes, sqes_sz);
+	if(cq_ring && cq_ring!=sq_ring)
+		munmap(cq_ring, cq_ring_sz);
+	if(sq_ring)
+		munmap(sq_ring, sq_ring_sz);
+	if(br)
+		munmap(br, br_sz);
+	sqes = NULL;
+	sq_ring = cq_ring = NULL;
+	br = NULL;
+	br_staged = 0;
+	memset(ops, 0, sizeof(ops));
+}
+
+bool KnvUring::HasOp(int op) const
+{
+	return op>=0 && op<256 && ops[op];
+}
+
+struct io_uring_sqe *KnvUring::GetSqe()
+{
+	if(sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		return NULL;
+	struct io_uring_sqe *sqe = &sqes[sqe_tail & sq_mask];
+	sqe_tail ++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+unsigned KnvUring::GetUnsubmitted() const
+{
+	return sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+int KnvUring::Enter(unsigned wait_nr, int timeout_ms)
+{
+	__atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = GetUnsubmitted();
+	if(to_submit==0 && wait_nr==0)
+		return 0;
+
+	unsigned flags = 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG/8;
+	if(wait_nr)
+	{
+		flags |= IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG;
+		if(timeout_ms>=0)
+		{
+			ts.tv_sec = timeout_ms/1000;
+			ts.tv_nsec = (long long)(timeout_ms%1000)*1000000;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+	int n = sys_io_uring_enter(ring_fd, to_submit, wait_nr, flags, flags? &arg : NULL, flags? sizeof(arg) : 0);
+	if(n<0)
+	{
+		// EBUSY: completions overflowed, they are reaped before anything more is submitted
+		if(errno==ETIME || errno==EINTR || errno==EBUSY || errno==EAGAIN)
+			return 0;
+		return -errno;
+	}
+	return n;
+}
+
+int KnvUring::Reap(struct io_uring_cqe *out, int max)
+{
+	unsigned head = *cq_head;
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	int n = 0;
+	for(; head!=tail && n<max; head++, n++)
+		out[n] = cqes[head & cq_mask];
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+int KnvUring::SetupBufRing(unsigned short bgid, unsigned nr)
+{
+	if(ring_fd<0 || br)
+		return -EBUSY;
+	if(nr==0 || (nr & (nr-1)) || nr>32768)
+		return -EINVAL;
+
+	br_sz = nr*sizeof(struct io_uring_buf);
+	void *p = mmap(NULL, br_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p==MAP_FAILED)
+		return -errno;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)p;
+	reg.ring_entries = nr;
+	reg.bgid = bgid;
+	if(sys_io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1)<0)
+	{
+		int e = errno;
+		munmap(p, br_sz);
+		return -e;
+	}
+	br = (struct io_uring_buf_ring *)p;
+	br_mask = nr - 1;
+	br_bgid = bgid;
+	br_staged = 0;
+	return 0;
+}
+
+void KnvUring::ProvideBuf(void *addr, unsigned len, unsigned short bid)
+{
+	// the tail shares the first slot with a reserved field, so only the buffer fields are set;
+	// the slots are not reached by br->bufs, which C++ may place after the empty struct of
+	// __DECLARE_FLEX_ARRAY
+	struct io_uring_buf *b = (struct io_uring_buf *)br + ((unsigned short)(br->tail + br_staged) & br_mask);
+	b->addr = (uint64_t)(uintptr_t)addr;
+	b->len = len;
+	b->bid = bid;
+	br_staged ++;
+}
+
+void KnvUring::CommitBufs()
+{
+	if(br_staged==0)
+		return;
+	__atomic_store_n(&br->tail, (unsigned short)(br->tail + br_staged), __ATOMIC_RELEASE);
+	br_staged = 0;
+}
@@ -0,0 +1,91 @@
+/*
+Tencent is pleased to support the open source community by making Key-N-Value Protocol Engine available.
+Copyright (C) 2015 THL A29 Limited, a Tencent company. All rights reserved.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+// knv_uring.h
+// A small io_uring over the raw system calls
+//
+// KnvUring sets up a submission and a completion ring, hands out submission entries,
+// submits them and waits for completions in one io_uring_enter(), and keeps a ring of
+// provided buffers for receives that pick their buffer in the kernel. It covers what the
+// servers need and no more, so there is no dependency on liburing.
+//
+// A ring is meant to be used by one thread.
+//
+// 2026-10-18	Created
+//
+
+#ifndef __KNV_URING__
+#define __KNV_URING__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+class KnvUring
+{
+public:
+	KnvUring();
+	~KnvUring() { Exit(); }
+
+	// whether the kernel has provided buffer rings, and with them multishot recvmsg,
+	// probed once per process
+	static bool IsSupported();
+
+	// entries: size of the submission queue, the completion queue gets twice as many
+	// returns 0 on success, or -errno
+	int Init(unsigned entries);
+	void Exit();
+	bool IsReady() const { return ring_fd>=0; }
+	// whether the kernel knows the opcode, e.g. IORING_OP_SENDMSG_ZC
+	bool HasOp(int op) const;
+
+	// a zeroed submission entry, or NULL if the queue is full and needs Enter() first
+	struct io_uring_sqe *GetSqe();
+	// entries got but not submitted yet
+	unsigned GetUnsubmitted() const;
+	// submit what is queued and wait for at least wait_nr completions or timeout_ms (<0 for ever)
+	// returns the number submitted, or -errno; timing out or being interrupted is not an error
+	int Enter(unsigned wait_nr = 0, int timeout_ms = -1);
+	// take up to max completions off the queue, returns the number taken
+	int Reap(struct io_uring_cqe *cqes, int max);
+
+	// register a ring of nr (a power of 2) provided buffers as group bgid, returns 0 or -errno
+	int SetupBufRing(unsigned short bgid, unsigned nr);
+	// hand a buffer to the kernel, visible to it after CommitBufs()
+	void ProvideBuf(void *addr, unsigned len, unsigned short bid);
+	void CommitBufs();
+
+private:
+	KnvUring(const KnvUring &);
+	KnvUring &operator=(const KnvUring &);
+
+	int ring_fd;
+	unsigned features;
+	unsigned char ops[256]; // IO_URING_OP_SUPPORTED by opcode
+
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring; // the same as sq_ring with IORING_FEAT_SINGLE_MMAP
+	size_t cq_ring_sz;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+
+	unsigned *sq_head, *sq_tail, *sq_array;
+	unsigned sq_mask, sq_entries;
+	unsigned sqe_tail; // entries handed out
+	unsigned *cq_head, *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	unsigned br_mask;
+	unsigned short br_bgid;
+	unsigned short br_staged; // buffers provided since the last commit
+};
+
+#endif
@@ -10,10 +10,93 @@ Unless required by applicable law or agreed to in writing, software distributed
 // A memory buffer pool based on ObjPool
 //
 // 2013-1-15	Created
+// 2026-10-18	Serve large classes from mmap-ed, huge page backed regions
 //
 #include <iostream>
 #include "mem_pool.h"
 
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+// how large buffers are backed, shared by all threads
+static struct
+{
+	UcHugePageMode mode;
+	uint64_t threshold; // classes >= threshold are mmap-ed
+} g_map_conf = { UC_HUGEPAGE_THP, 1048576 };
+
+static inline bool use_map(uint64_t sz)
+{
+	return g_map_conf.mode!=UC_HUGEPAGE_NONE && sz>=g_map_conf.threshold;
+}
+
+// map sz bytes, map_sz is set to the real size of the mapping
+static void *map_mem(uint64_t sz, uint64_t &map_sz)
+{
+	void *p;
+	map_sz = (sz + 4095) & (~4095UL);
+
+	if(g_map_conf.mode==UC_HUGEPAGE_HUGETLB)
+	{
+		uint64_t hsz = (sz + UC_HUGE_PAGE_SIZE - 1) & (~(UC_HUGE_PAGE_SIZE - 1));
+		p = mmap(NULL, hsz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(p!=MAP_FAILED)
+		{
+			map_sz = hsz;
+			return p;
+		}
+		// huge page pool exhausted or not configured, try THP instead
+		Attr_API(ATTR_MEM_POOL_HUGETLB_FAIL, 1);
+	}
+
+	if(g_map_conf.mode==UC_HUGEPAGE_MMAP || map_sz < UC_HUGE_PAGE_SIZE)
+	{
+		p = mmap(NULL, map_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if(p==MAP_FAILED)
+		{
+			Attr_API(ATTR_MEM_POOL_MMAP_FAIL, 1);
+			return NULL;
+		}
+		return p;
+	}
+
+	// over-map to get a huge page aligned region, then trim head and tail
+	uint64_t over_sz = map_sz + UC_HUGE_PAGE_SIZE;
+	char *raw = (char *)mmap(NULL, over_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(raw==MAP_FAILED)
+	{
+		Attr_API(ATTR_MEM_POOL_MMAP_FAIL, 1);
+		return NULL;
+	}
+	char *aligned = (char *)(((uintptr_t)raw + UC_HUGE_PAGE_SIZE - 1) & (~(UC_HUGE_PAGE_SIZE - 1)));
+	if(aligned > raw)
+		munmap(raw, aligned - raw);
+	if(raw + over_sz > aligned + map_sz)
+		munmap(aligned + map_sz, raw + over_sz - (aligned + map_sz));
+	madvise(aligned, map_sz, MADV_HUGEPAGE);
+	return aligned;
+}
+
+// allocate memory for m, either from malloc or mmap
+static inline void *alloc_mem(uint64_t sz, uint64_t &map_sz)
+{
+	if(use_map(sz))
+		return map_mem(sz, map_sz);
+	map_sz = 0;
+	return malloc(sz);
+}
+
+void UcMem::Release()
+{
+	if(map_sz)
+		munmap(mem, map_sz);
+	else
+		free(mem);
+	mem = NULL;
+	map_sz = 0;
+}
+
 
 UcMem *UcMemPool::Alloc(bool &exceed_limit)
 {
@@ -34,12 +117,13 @@ UcMem *UcMemPool::Alloc(bool &exceed_limit)
 		if(sz_total + sz_each > sz_max) // out of memory
 		{
 			Attr_API(ATTR_MEM_POOL_LIMIT_REACHED, 1); // limit reached
+			KnvMetrics::Add(KNV_METRIC_UCMEM_LIMIT_REACHED, 1);
 			pool.Delete(m);
 			exceed_limit = true;
 			return NULL;
 		}
 
-		m->mem = malloc(sz_each);
+		m->mem = alloc_mem(sz_each, m->map_sz);
 		if(m->mem==NULL)
 		{
 			Attr_API(ATTR_MEM_POOL_MALLOC_FAIL, 1); // malloc failed
@@ -59,7 +143,11 @@ UcMem *UcMemPool::Alloc(bool &exceed_limit)
 			sz_free -= sz_each;
 		}
 		sz_total += sz_each;
+		KnvMetrics::Add(KNV_METRIC_UCMEM(cls, KNV_UCMEM_HIT), 1);
 	}
+	KnvMetrics::Add(KNV_METRIC_UCMEM(cls, KNV_UCMEM_ALLOC), 1);
+	KnvMetrics::Set(KNV_METRIC_UCMEM(cls, KNV_UCMEM_USED), sz_total);
+	KnvMetrics::Set(KNV_METRIC_UCMEM(cls, KNV_UCMEM_IDLE), sz_free);
 	return m;
 }
 
@@ -75,6 +163,9 @@ void UcMemPool::Free(UcMem *m)
 	{
 		sz_total -= sz_each;
 	}
+	KnvMetrics::Add(KNV_METRIC_UCMEM(cls, KNV_UCMEM_FREE), 1);
+	KnvMetrics::Set(KNV_METRIC_UCMEM(cls, KNV_UCMEM_USED), sz_total);
+	KnvMetrics::Set(KNV_METRIC_UCMEM(cls, KNV_UCMEM_IDLE), sz_free);
 }
 
 
@@ -112,9 +203,8 @@ uint64_t UcMemPool::Shrink()
 				pool.Delete(m);
 				break;
 			}
-			// free from free space
-			free(m->mem);
-			m->mem = NULL;
+			// free from free space, mmap-ed buffers are unmapped immediately
+			m->Release();
 			pool.Delete(m);
 			if(sz_free < sz_each)
 			{
@@ -140,9 +230,83 @@ uint64_t UcMemPool::Shrink()
 	{
 		sz_max -= shk;
 	}
+	if(shk)
+	{
+		KnvMetrics::Add(KNV_METRIC_UCMEM(cls, KNV_UCMEM_SHRINK), shk);
+		KnvMetrics::Set(KNV_METRIC_UCMEM(cls, KNV_UCMEM_IDLE), sz_free);
+	}
 	return shk;
 }
 
+uint64_t UcMemPool::Purge(bool lazy)
+{
+	UcMem *list = NULL, *m;
+	uint64_t nr = sz_free / sz_each, purged = 0;
+
+	// take all idle buffers out of the pool, advise and put them back,
+	// shells without a buffer, left by Shrink() or a failed Alloc(), are taken out and put back likewise,
+	// a new object that never had a pool means the free list is used up
+	while(nr > 0 && (m = pool.New()))
+	{
+		bool used_up = m->mem==NULL && m->pool==NULL;
+		if(m->mem)
+		{
+			if(m->map_sz)
+			{
+				if(lazy==false || madvise(m->mem, m->map_sz, MADV_FREE))
+					madvise(m->mem, m->map_sz, MADV_DONTNEED); // MADV_FREE is not supported before linux 4.5
+				purged += m->map_sz;
+			}
+			nr --;
+		}
+		m->next = list;
+		list = m;
+		if(used_up)
+			break;
+	}
+	while(list)
+	{
+		m = list;
+		list = (UcMem *)m->next;
+		pool.Delete(m);
+	}
+	if(purged)
+	{
+		Attr_API(ATTR_MEM_POOL_PURGE, 1);
+	}
+	return purged;
+}
+
+uint64_t UcMemPool::Reserve(uint64_t bytes, int flags)
+{
+	UcMem *list = NULL, *m;
+	uint64_t held = 0;
+	bool exceed_limit;
+
+	// allocate until enough buffers are idle, then put them all back,
+	// idle buffers handed out by Alloc() leave sz_free, so they are only counted in held
+	while(sz_free + held + sz_each <= bytes && (m = Alloc(exceed_limit)))
+	{
+		if(flags & (UC_WARMUP_TOUCH|UC_WARMUP_LOCK))
+		{
+			for(uint64_t off=0; off<sz_each; off+=4096)
+				((volatile char *)m->mem)[off] = 0;
+		}
+		if(flags & UC_WARMUP_LOCK)
+			mlock(m->mem, sz_each);
+		held += sz_each;
+		m->next = list;
+		list = m;
+	}
+	while(list)
+	{
+		m = list;
+		list = (UcMem *)m->next;
+		Free(m);
+	}
+	return sz_free;
+}
+
 // each thread shall have its own set of pools
 static __thread struct
 {
@@ -211,6 +375,7 @@ inline UcMemPool *UcMemManager::GetPool(int magic)
 		}
 		magics[magic].pool->sz_each = magics[magic].sz;
 		magics[magic].pool->sz_max = sz_max/nr_magics;
+		magics[magic].pool->cls = magic;
 	}
 	return magics[magic].pool;
 }
@@ -263,7 +428,15 @@ UcMem *UcMemManager::Alloc(uint64_t sz)
 		if(alloc_sz > biggest_magic)
 		{
 			Attr_API(ATTR_MEM_POOL_ALLOC_DIRECTLY, 1); // allocate directly
-			return new UcMem(sz);
+			KnvMetrics::Add(KNV_METRIC_UCMEM_DIRECT_ALLOC, 1);
+			m = new UcMem();
+			m->mem = alloc_mem(sz, m->map_sz);
+			if(m->mem==NULL)
+			{
+				delete m;
+				return NULL;
+			}
+			return m;
 		}
 
 		pool = mng->GetPool(magic);
@@ -306,6 +479,11 @@ void UcMemManager::Free(UcMem *m)
 {
 	if(m)
 	{
+		if(m->ref>0) // still referenced by others
+		{
+			m->ref --;
+			return;
+		}
 		if(m->pool)
 			m->pool->Free(m);
 		else // allocated directly
@@ -313,6 +491,46 @@ void UcMemManager::Free(UcMem *m)
 	}
 }
 
+void UcMemManager::SetHugePageMode(UcHugePageMode mode, uint64_t threshold)
+{
+	g_map_conf.mode = mode;
+	g_map_conf.threshold = threshold;
+}
+
+uint64_t UcMemManager::Purge(bool lazy)
+{
+	uint64_t purged = 0;
+	for(unsigned i=0; i<nr_magics; i++)
+	{
+		if(magics[i].pool)
+			purged += magics[i].pool->Purge(lazy);
+	}
+	return purged;
+}
+
+uint64_t UcMemManager::Warmup(uint64_t bytes_per_class, int flags)
+{
+	uint64_t total = 0;
+	UcMemManager *mng = GetInstance();
+	for(unsigned i=0; i<nr_magics; i++)
+	{
+		UcMemPool *p = mng->GetPool(i);
+		if(p)
+			total += p->Reserve(bytes_per_class, flags);
+	}
+	return total;
+}
+
+int UcMemManager::GetClassNum()
+{
+	return nr_magics;
+}
+
+uint64_t UcMemManager::GetClassSize(int cls)
+{
+	return (cls>=0 && cls<(int)nr_magics)? magics[cls].sz : 0;
+}
+
 UcMemManager *UcMemManager::GetInstance()
 {
 	static UcMemManager g_mp_manager(1024*1024*1024UL);
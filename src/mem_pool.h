@@ -10,6 +10,8 @@ Unless required by applicable law or agreed to in writing, software distributed
 // A memory buffer pool based on ObjPool
 //
 // 2014-1-15	Created
+// 2026-10-18	Serve large classes from mmap-ed, huge page backed regions
+// 2026-10-18	Reference count for buffers shared by several holders
 //
 
 #include <stdint.h>
@@ -19,6 +21,7 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <map>
 #include <string>
@@ -33,20 +36,31 @@ using namespace std;
 class UcMemPool;
 class UcMemManager;
 
+// how buffers in large classes are backed
+enum UcHugePageMode
+{
+	UC_HUGEPAGE_NONE = 0,    // malloc() only, as before
+	UC_HUGEPAGE_MMAP = 1,    // anonymous mmap() with normal pages
+	UC_HUGEPAGE_THP = 2,     // anonymous mmap() advised with MADV_HUGEPAGE (transparent huge pages)
+	UC_HUGEPAGE_HUGETLB = 3, // MAP_HUGETLB from the explicit huge page pool, fall back to THP if unavailable
+};
+
+#define UC_HUGE_PAGE_SIZE	(2*1024*1024UL)
+
 class UcMem : public ObjBase
 {
 public:
-	UcMem() : ObjBase(), mem(NULL), pool(NULL)
+	UcMem() : ObjBase(), mem(NULL), map_sz(0), ref(0), pool(NULL)
 	{
 	}
-	UcMem(uint64_t sz) : ObjBase(), pool(NULL)
+	UcMem(uint64_t sz) : ObjBase(), map_sz(0), ref(0), pool(NULL)
 	{
 		mem = malloc(sz);
 	}
 
 	virtual ~UcMem()
 	{
-		if(mem) free(mem);
+		if(mem) Release();
 	}
 
 	virtual void ReleaseObject()
@@ -58,9 +72,20 @@ public:
 	void *ptr() { return (void *)mem; }
 
 	uint64_t GetAllocSize();
+	bool IsMapped() const { return map_sz!=0; }
+
+	// Take one more reference, each reference is dropped by UcMemManager::Free(),
+	// the buffer is recycled when the last one is dropped.
+	// Like the pools, references are not thread-safe: all holders must live in the allocating thread.
+	void AddRef() { ref ++; }
+	int GetRefCount() const { return ref+1; }
 
 private:
+	void Release(); // return mem to the system, either by free() or munmap()
+
 	void *mem;
+	uint64_t map_sz; // >0 if mem is mmap-ed, size of the mapping
+	int ref; // number of references besides the allocator's
 
 	friend class UcMemPool;
 	friend class UcMemManager;
@@ -73,19 +98,22 @@ private:
 class UcMemPool
 {
 public:
-	UcMemPool() : sz_each(0), sz_total(0), sz_free(0), sz_max(0), pool(){ }
+	UcMemPool() : sz_each(0), sz_total(0), sz_free(0), sz_max(0), cls(0), pool(){ }
 	~UcMemPool() {}
 
 	UcMem *Alloc(bool &exceed_limit);
 	void Free(UcMem *m);
 
 	uint64_t Shrink(); // shrink memory for other pool, return the shrinked size
+	uint64_t Purge(bool lazy); // give pages of idle mmap-ed buffers back to the system, return the purged size
+	uint64_t Reserve(uint64_t bytes, int flags); // make at least bytes of buffers idle in the pool, return the reserved size
 	uint64_t GetMemSize() { return sz_each; }
 private:
 	uint64_t sz_each;  // size of each mem
 	uint64_t sz_total; // current total size
 	uint64_t sz_free;  // current free size
 	uint64_t sz_max;   // max total size
+	int cls;           // index of the size class, for metrics
 	ObjPool<UcMem> pool;
 
 friend class UcMemManager;
@@ -96,6 +124,10 @@ inline uint64_t UcMem::GetAllocSize()
 	return pool? pool->GetMemSize() : 0;
 }
 
+// flags for warming up pools
+#define UC_WARMUP_TOUCH	1 // write to every page so that no page fault happens on first use
+#define UC_WARMUP_LOCK	2 // mlock() the buffers, implies UC_WARMUP_TOUCH
+
 class UcMemManager
 {
 public:
@@ -104,6 +136,25 @@ public:
 
 	static void SetMaxSize(uint64_t sz) { GetInstance()->sz_max = sz; }
 
+	// Buffers of classes >= threshold (and direct allocations beyond the biggest class)
+	// are mmap-ed according to mode, default is UC_HUGEPAGE_THP for classes >= 1MB.
+	// Changes only take effect on buffers allocated afterwards.
+	static void SetHugePageMode(UcHugePageMode mode, uint64_t threshold = 1048576);
+
+	// Release physical pages of idle buffers held in this thread's large class pools,
+	// buffers stay in the pools and are faulted in again on reuse.
+	// lazy=true uses MADV_FREE, which lets the kernel reclaim them only under memory pressure.
+	// returns the number of bytes advised
+	static uint64_t Purge(bool lazy = false);
+
+	// Pre-populate this thread's pools with bytes_per_class of idle buffers in each class,
+	// so that the first requests after start-up do not pay for malloc()/mmap()
+	// returns the total number of bytes reserved
+	static uint64_t Warmup(uint64_t bytes_per_class, int flags = 0);
+	// size classes served by the pools
+	static int GetClassNum();
+	static uint64_t GetClassSize(int cls);
+
 private:
 	static UcMemManager *GetInstance();
 	UcMemManager(uint64_t max_sz):sz_max(max_sz) {}
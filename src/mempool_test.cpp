@@ -7,6 +7,7 @@ Unless required by applicable law or agreed to in writing, software distributed
 */
 
 #include <iostream>
+#include <stdio.h>
 #include "mem_pool.h"
 
 using namespace std;
@@ -217,15 +218,144 @@ int test_cpplib()
 	return 0;
 }
 
+static long get_rss_kb()
+{
+	long rss = -1;
+	char ln[256];
+	FILE *fp = fopen("/proc/self/status", "r");
+	if(fp==NULL)
+		return -1;
+	while(fgets(ln, sizeof(ln), fp))
+	{
+		if(strncmp(ln, "VmRSS:", 6)==0)
+		{
+			rss = atol(ln+6);
+			break;
+		}
+	}
+	fclose(fp);
+	return rss;
+}
+
+int test_hugepage()
+{
+	UcMemManager::SetMaxSize(1024*1024*1024UL);
+	UcMemManager::SetHugePageMode(UC_HUGEPAGE_THP);
+	UcMem *ma[32];
+	int i;
+
+	cout << "rss before burst: " << get_rss_kb() << " KB" << endl;
+	for(i=0; i<32; i++)
+	{
+		ma[i] = UcMemManager::Alloc(i%2? 4194304 : 20000000);
+		if(ma[i]==NULL)
+		{
+			cout << "alloc ["<<i<<"] failed" << endl;
+			return -1;
+		}
+		if(!ma[i]->IsMapped())
+		{
+			cout << "buffer ["<<i<<"] is not mmap-ed" << endl;
+			return -1;
+		}
+		memset(ma[i]->ptr(), i, i%2? 4194304 : 20000000);
+	}
+	cout << "rss after burst: " << get_rss_kb() << " KB" << endl;
+	for(i=0; i<32; i++)
+		UcMemManager::Free(ma[i]);
+	cout << "rss after free: " << get_rss_kb() << " KB" << endl;
+	uint64_t purged = UcMemManager::Purge();
+	cout << "purged " << purged << " bytes, rss after purge: " << get_rss_kb() << " KB" << endl;
+	return purged==16*4194304UL? 0 : -1;
+}
+
+int test_warmup()
+{
+	UcMemManager::SetMaxSize(1024*1024*1024UL);
+	cout << "rss before warmup: " << get_rss_kb() << " KB" << endl;
+	uint64_t reserved = UcMemManager::Warmup(1024*1024, UC_WARMUP_TOUCH);
+	cout << "reserved " << reserved << " bytes, rss after warmup: " << get_rss_kb() << " KB" << endl;
+
+	// a second warmup finds the buffers already idle and allocates nothing new
+	long rss = get_rss_kb();
+	if(UcMemManager::Warmup(1024*1024, UC_WARMUP_TOUCH)!=reserved)
+		return -1;
+	if(get_rss_kb()-rss >= 1024)
+		return -1;
+
+	// idle buffers count once: with 4MB idle in the 1MB class, warming up to 8MB
+	// leaves 8 buffers idle, so taking them all touches no new memory
+	UcMem *ma[8];
+	int i;
+	for(i=0; i<4; i++)
+		ma[i] = UcMemManager::Alloc(1024*1024);
+	for(i=0; i<4; i++)
+		UcMemManager::Free(ma[i]);
+	UcMemManager::Warmup(8*1024*1024, UC_WARMUP_TOUCH);
+	rss = get_rss_kb();
+	for(i=0; i<8; i++)
+	{
+		ma[i] = UcMemManager::Alloc(1024*1024);
+		if(ma[i]==NULL)
+			return -1;
+		memset(ma[i]->ptr(), 1, 1024*1024);
+	}
+	long grown = get_rss_kb()-rss;
+	cout << "rss grown by taking 8 warm buffers: " << grown << " KB" << endl;
+	for(i=0; i<8; i++)
+		UcMemManager::Free(ma[i]);
+	return grown < 1024? 0 : -1;
+}
+
+// idle buffers under the shells left by Shrink() are still purged
+int test_shrink()
+{
+	UcMemManager::SetMaxSize(640*1024*1024UL); // 64MB per class
+	UcMem *big[4], *ma[17];
+	int i;
+
+	// the 16MB class: one in use, three idle
+	for(i=0; i<4; i++)
+	{
+		if((big[i]=UcMemManager::Alloc(16*1024*1024))==NULL)
+			return -1;
+	}
+	for(i=1; i<4; i++)
+		UcMemManager::Free(big[i]);
+
+	// the 4MB class goes beyond its limit, which shrinks the 16MB class: some idle buffers are released,
+	// and their shells are put in front of the others
+	for(i=0; i<17; i++)
+	{
+		if((ma[i]=UcMemManager::Alloc(4*1024*1024))==NULL)
+		{
+			cout << "alloc ["<<i<<"] failed" << endl;
+			return -1;
+		}
+	}
+	uint64_t purged = UcMemManager::Purge();
+	cout << "purged " << purged << " bytes after shrinking" << endl;
+	for(i=0; i<17; i++)
+		UcMemManager::Free(ma[i]);
+	UcMemManager::Free(big[0]);
+	return purged? 0 : -1;
+}
+
 int main(int argc, char *argv[])
 {
 	if(argc!=2)
 	{
-		cout << "usage: " << argv[0] << " [pool|libc|cpp]  -- pool: use mempool method; libc: use libc method; cpp: use new/delete" << endl;
+		cout << "usage: " << argv[0] << " [pool|libc|cpp|huge|warmup|shrink]  -- pool: use mempool method; libc: use libc method; cpp: use new/delete; huge: mmap-ed large classes and purge; warmup: pre-allocate pools; shrink: purge after shrinking" << endl;
 		return -1;
 	}
 	if(strcmp(argv[1],"pool")==0)
 		cout << "test_mempool() returns " << test_mempool() << endl;
+	else if(strcmp(argv[1],"huge")==0)
+		cout << "test_hugepage() returns " << test_hugepage() << endl;
+	else if(strcmp(argv[1],"warmup")==0)
+		cout << "test_warmup() returns " << test_warmup() << endl;
+	else if(strcmp(argv[1],"shrink")==0)
+		cout << "test_shrink() returns " << test_shrink() << endl;
 	else if(strcmp(argv[1],"libc")==0)
 		cout << "test_clib() returns " << test_clib() << endl;
 	else
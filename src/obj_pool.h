@@ -19,6 +19,7 @@ Unless required by applicable law or agreed to in writing, software distributed
 
 #include "obj_base.h"
 #include "report_attr.h"
+#include "knv_metrics.h"
 
 #ifndef __UC_OBJ_POOL__
 #define __UC_OBJ_POOL__
@@ -48,6 +49,7 @@ public:
 	int Detach(obj_type *&first, obj_type *obj); // Remove object obj from list pointed by first, obj must be deleted with Delete(obj) when no longer in use
 	int DeleteAll(obj_type *&first); // Delete all objects in list pointed by first
 	int AddToFreeList(obj_type *first); // Add list to free list
+	int Reserve(int nr); // Pre-allocate nr objects into free list, returns the number allocated
 
 private:
 	obj_type *obj_freelist; // list for keeping released objects
@@ -65,10 +67,12 @@ template<class obj_type> inline obj_type *ObjPool<obj_type>::New()
 	{
 		o = obj_freelist;
 		obj_freelist = (obj_type *)obj_freelist->next;
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_HIT, 1);
 	}
 	else
 	{
 		Attr_API(ATTR_OBJ_POOL_NEW_OBJ, 1);
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_NEW, 1);
 		try {
 			o = new obj_type();
 		}catch(...) {
@@ -101,10 +105,12 @@ template<class obj_type> inline obj_type *ObjPool<obj_type>::New(obj_type *&firs
 	{
 		o = obj_freelist;
 		obj_freelist = (obj_type *)obj_freelist->next;
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_HIT, 1);
 	}
 	else
 	{
 		Attr_API(ATTR_OBJ_POOL_NEW_OBJ, 1);
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_NEW, 1);
 		try {
 			o = new obj_type();
 		}catch(...) {
@@ -138,10 +144,12 @@ template<class obj_type> inline obj_type *ObjPool<obj_type>::NewFront(obj_type *
 	{
 		o = obj_freelist;
 		obj_freelist = (obj_type *)obj_freelist->next;
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_HIT, 1);
 	}
 	else
 	{
 		Attr_API(ATTR_OBJ_POOL_NEW_OBJ, 1);
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_NEW, 1);
 		try {
 			o = new obj_type();
 		}catch(...) {
@@ -224,6 +232,26 @@ template<class obj_type> inline int ObjPool<obj_type>::AddToFreeList(obj_type *o
 	return 0;
 }
 
+template<class obj_type> inline int ObjPool<obj_type>::Reserve(int nr)
+{
+	int i;
+	for(i=0; i<nr; i++)
+	{
+		obj_type *o;
+		Attr_API(ATTR_OBJ_POOL_NEW_OBJ, 1);
+		KnvMetrics::Add(KNV_METRIC_OBJ_POOL_NEW, 1);
+		try {
+			o = new obj_type();
+		}catch(...) {
+			Attr_API(ATTR_OBJ_POOL_NEW_OBJ_FAIL, 1);
+			break;
+		}
+		o->next = obj_freelist;
+		obj_freelist = o;
+	}
+	return i;
+}
+
 template<class obj_type> inline int ObjPool<obj_type>::DeleteAll(obj_type *&first)
 {
 	obj_type *o = first;
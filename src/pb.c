@@ -10,6 +10,7 @@ Unless required by applicable law or agreed to in writing, software distributed
  * Low-level protobuf handling routines intended to directly access pb streams without .proto file
  *
  * Created 2013-09-11
+ * 2026-10-18 Decoding messages spread over several segments
  */
 
 #include "pb.h"
@@ -388,3 +389,203 @@ int pb_add_fixed64(pb_buff_t *b, uint32_t tag, uint64_t value)
 	return pb_add_ddword(b, value);
 }
 
+
+
+/* Segmented messages, the helpers are plain static functions, as always_inline can not be honored for them */
+
+static void pb_seg_normalize(pb_seg_iter_t *it)
+{
+	while(it->off >= it->segs[it->seg].len && it->seg+1 < it->nsegs)
+	{
+		it->seg ++;
+		it->off = 0;
+	}
+}
+
+static int pb_seg_get(pb_seg_iter_t *it, void *buf, uint64_t count)
+{
+	if(it->left < count)
+		RETURN_WITH_ERROR(&it->f, -1, "end of buffer");
+
+	it->left -= count;
+	while(count)
+	{
+		pb_seg_normalize(it);
+		uint64_t n = it->segs[it->seg].len - it->off;
+		if(n > count)
+			n = count;
+		if(buf)
+		{
+			memcpy(buf, it->segs[it->seg].data + it->off, n);
+			buf = (char*)buf + n;
+		}
+		it->off += n;
+		count -= n;
+	}
+	return 0;
+}
+
+static int pb_seg_decode_varint(pb_seg_iter_t *it, uint64_t *v)
+{
+	uint8_t byte;
+	uint8_t bitpos = 0;
+	uint64_t result = 0;
+
+	do
+	{
+		if (bitpos >= 64)
+			RETURN_WITH_ERROR(&it->f, -1, "varint overflow");
+
+		if(it->left==0)
+			RETURN_WITH_ERROR(&it->f, -2, "end of buffer");
+		pb_seg_normalize(it);
+		byte = (uint8_t)it->segs[it->seg].data[it->off++];
+		it->left --;
+
+		result |= (uint64_t)(byte & 0x7F) << bitpos;
+		bitpos = (uint8_t)(bitpos + 7);
+	} while (byte & 0x80);
+
+	*v = result;
+	return 0;
+}
+
+static int pb_seg_decode_tag(pb_seg_iter_t *it)
+{
+	pb_field_t *f = &it->f;
+	uint64_t start_left = it->left;
+	uint64_t v;
+
+	it->straddle = 0;
+	if(it->left==0)
+	{
+		f->eom = 1; // signal end-of-message
+		return -1;
+	}
+	if(pb_seg_decode_varint(it, &v))
+		return -1;
+	if(v == 0)
+	{
+		f->eom = 1; // Allow 0-terminated messages.
+		RETURN_WITH_ERROR(f, -2, "0-terminated msg");
+	}
+
+	f->tag = v >> 3;
+	f->type = (pb_type_t)(v & 7);
+
+	switch (f->type)
+	{
+		case PB_TYPE_VARINT:
+			if(pb_seg_decode_varint(it, &f->val.i64))
+				return -3;
+			break;
+		case PB_TYPE_FIXED64:
+			if(pb_seg_get(it, &f->val.i64, 8))
+				return -3;
+			break;
+		case PB_TYPE_FIXED32:
+			if(pb_seg_get(it, &f->val.i32, 4))
+				return -3;
+			break;
+		case PB_TYPE_STRING:
+			if(pb_seg_decode_varint(it, &v))
+				return -3;
+			if(v > it->left)
+				RETURN_WITH_ERROR(f, -4, "string overflow");
+			pb_seg_normalize(it);
+			it->val_seg = it->seg;
+			it->val_off = it->off;
+			f->val.str.len = (uint32_t)v;
+			if(it->segs[it->seg].len - it->off >= v) // in one segment, zero-copy
+			{
+				f->val.str.data = (char*)it->segs[it->seg].data + it->off;
+				it->off += v;
+				it->left -= v;
+			}
+			else if(v <= PB_SEG_SCRATCH_SIZE) // small, stitch it
+			{
+				it->straddle = 1;
+				f->val.str.data = it->scratch;
+				pb_seg_get(it, it->scratch, v);
+			}
+			else
+			{
+				it->straddle = 1;
+				f->val.str.data = NULL;
+				pb_seg_get(it, NULL, v);
+			}
+			break;
+		default: RETURN_WITH_ERROR(f, -5, "invalid type");
+	}
+
+	it->field_sz = start_left - it->left;
+	return 0;
+}
+
+pb_field_t *pb_seg_begin(pb_seg_iter_t *it, const pb_seg_t *segs, int nsegs)
+{
+	int i;
+
+	it->f.start = it->f.ptr = NULL;
+	it->f.size = it->f.left = 0;
+	it->f.eom = 0;
+	it->f.errmsg = NULL;
+	it->segs = segs;
+	it->nsegs = nsegs;
+	it->seg = it->off = 0;
+	it->left = 0;
+	for(i=0; i<nsegs; i++)
+		it->left += segs[i].len;
+	if(nsegs<=0)
+		RETURN_WITH_ERROR(&it->f, NULL, "no segment");
+
+	if(pb_seg_decode_tag(it))
+		return NULL;
+	return &it->f;
+}
+
+pb_field_t *pb_seg_next(pb_seg_iter_t *it)
+{
+	if(pb_seg_decode_tag(it))
+		return NULL;
+	return &it->f;
+}
+
+pb_field_t *pb_seg_enter(const pb_seg_iter_t *it, pb_seg_iter_t *sub)
+{
+	sub->f.start = sub->f.ptr = NULL;
+	sub->f.size = sub->f.left = 0;
+	sub->f.eom = 0;
+	sub->f.errmsg = NULL;
+	if(it->f.type!=PB_TYPE_STRING)
+		RETURN_WITH_ERROR(&sub->f, NULL, "not a string");
+
+	sub->segs = it->segs;
+	sub->nsegs = it->nsegs;
+	sub->seg = it->val_seg;
+	sub->off = it->val_off;
+	sub->left = it->f.val.str.len;
+
+	if(pb_seg_decode_tag(sub))
+		return NULL;
+	return &sub->f;
+}
+
+int pb_seg_copy(const pb_seg_iter_t *it, void *buf)
+{
+	pb_seg_iter_t tmp;
+	if(it->f.type!=PB_TYPE_STRING)
+		return -1;
+	if(it->f.val.str.data) // contiguous or stitched already
+	{
+		memcpy(buf, it->f.val.str.data, it->f.val.str.len);
+		return 0;
+	}
+	tmp.f.errmsg = NULL;
+	tmp.segs = it->segs;
+	tmp.nsegs = it->nsegs;
+	tmp.seg = it->val_seg;
+	tmp.off = it->val_off;
+	tmp.left = it->f.val.str.len;
+	return pb_seg_get(&tmp, buf, it->f.val.str.len);
+}
@@ -10,6 +10,7 @@ Unless required by applicable law or agreed to in writing, software distributed
  * Low-level protobuf handling routines intended to directly access pb streams without .proto file
  *
  * Created 2013-09-11
+ * 2026-10-18 Decoding messages spread over several segments
  */
 
 #ifndef _PB_H_
@@ -84,6 +85,42 @@ static inline pb_field_t *pb_end() { return NULL; }
 int pb_skip_field(pb_field_t *f, pb_type_t wire_type); // skip one specific field
 
 
+/* Segmented messages
+ * A message may be spread over several non-contiguous buffers (received packets,
+ * stream reads). Fields are decoded in place; a string value that straddles
+ * segments is stitched into the iterator's scratch buffer if it is small,
+ * otherwise val.str.data is NULL and the caller either iterates into it with
+ * pb_seg_enter(), or copies it out with pb_seg_copy().
+ */
+typedef struct {
+	const char *data;
+	int len;
+} pb_seg_t;
+
+#define PB_SEG_SCRATCH_SIZE	256
+
+typedef struct {
+	pb_field_t f;       // current field, f.start/ptr/left are not used
+	uint32_t field_sz;  // encoded size of the current field, including tag and length
+	char straddle;      // the current string value spans segments
+
+	const pb_seg_t *segs;
+	int nsegs;
+	int seg;            // current position
+	int off;
+	uint64_t left;      // bytes left in this message
+	int val_seg;        // start of the current string value
+	int val_off;
+
+	char scratch[PB_SEG_SCRATCH_SIZE];
+} pb_seg_iter_t;
+
+pb_field_t *pb_seg_begin(pb_seg_iter_t *it, const pb_seg_t *segs, int nsegs);
+pb_field_t *pb_seg_next(pb_seg_iter_t *it);
+pb_field_t *pb_seg_enter(const pb_seg_iter_t *it, pb_seg_iter_t *sub); // iterate the fields in the current string value
+int pb_seg_copy(const pb_seg_iter_t *it, void *buf); // copy the current string value (val.str.len bytes) to buf
+
+
 
 typedef struct 
 {
@@ -15,6 +15,8 @@ Unless required by applicable law or agreed to in writing, software distributed
 
 #include "knv_codec.h"
 #include "protocol.h"
+#include "knv_metrics.h"
+#include "knv_lz.h"
 
 #define INIT_HEADER_INFO() do{ \
 	cmd = 0; \
@@ -25,6 +27,10 @@ Unless required by applicable law or agreed to in writing, software distributed
 	retmsg = NULL; \
 	rspaddr.addr_len = 0; \
 	allow_split = max_pkg_sz = total_split_count = curr_split_index = 0; \
+	split_hdr.clear(); \
+	allow_compress = peer_compress = compress_threshold = zbody_len = 0; \
+	rsp_hdr_split = -1; \
+	rsp_unsynced = false; \
 }while(0)
 
 #define InitHeaderInfo() (\
@@ -91,6 +97,16 @@ Unless required by applicable law or agreed to in writing, software distributed
 		{\
 			curr_split_index = m->GetValue().i64;\
 		}\
+		m = header->FindChildByTag(KNV_PKG_HDR_ACCEPT_COMPRESS);\
+		if(m && m->GetType()==KNV_VARINT && m->GetValue().i64)\
+		{\
+			peer_compress = true;\
+		}\
+		m = header->FindChildByTag(KNV_PKG_HDR_COMPRESSED);\
+		if(m && m->GetType()==KNV_VARINT && m->GetValue().i64)\
+		{\
+			zbody_len = m->GetValue().i64;\
+		}\
 	}\
 	0;\
 })
@@ -129,6 +145,7 @@ Unless required by applicable law or agreed to in writing, software distributed
 KnvProtocol::KnvProtocol(KnvProtocol &proto, bool take_ownership, bool deep_copy): \
 	tree(proto.tree), header(NULL), body(NULL), retmsg(NULL), auto_delete(take_ownership)
 {
+	proto.SyncHeader();
 	if(!proto.IsValid())
 	{
 		tree = NULL;
@@ -197,7 +214,7 @@ failure:
 	InitProtocol();
 }
 
-void KnvProtocol::InitFromOidbPkg(const char *buf, int buflen, bool own_buf)
+void KnvProtocol::InitFromOidbPkg(const char *buf, int buflen, bool own_buf, UcMem *shared)
 {
 	//
 	// OIDB packet
@@ -233,6 +250,7 @@ void KnvProtocol::InitFromOidbPkg(const char *buf, int buflen, bool own_buf)
 		errmsg += KnvNode::GetGlobalErrorMsg();
 		return;
 	}
+	if(shared) header->AttachBuffer(shared);
 
 	//KNV supports multiple bodies, but OIDB allows only one body
 	//hence, we pack all bodies together into OIDB's body
@@ -249,6 +267,7 @@ void KnvProtocol::InitFromOidbPkg(const char *buf, int buflen, bool own_buf)
 			KnvNode::Delete(header); header = NULL;
 			return;
 		}
+		if(shared) tree->AttachBuffer(shared);
 		if(tree->InsertChild(header, true, true, false)<0) // insert in front
 		{
 			errmsg = "Insert header to knv tree failed: ";
@@ -263,6 +282,8 @@ void KnvProtocol::InitFromOidbPkg(const char *buf, int buflen, bool own_buf)
 		v.str.data = (char*)(buf+9+hlen);
 		v.str.len = blen;
 		body = KnvNode::New(KNV_PKG_BDY_TAG, KNV_NODE, KNV_VARINT, NULL, &v, own_buf);
+		if(body && shared)
+			body->AttachBuffer(shared);
 		if(body)
 			tree = KnvNode::NewTree(KNV_PKG_TAG);
 		if(body==NULL || tree==NULL)
@@ -311,6 +332,8 @@ KnvProtocol::KnvProtocol(const string &buf, bool own_buf): \
 		}
 	}
 	InitProtocol();
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE_BYTES, buf.length());
 }
 
 KnvProtocol::KnvProtocol(const char *buf, int buf_len, bool own_buf): \
@@ -330,6 +353,240 @@ KnvProtocol::KnvProtocol(const char *buf, int buf_len, bool own_buf): \
 		}
 	}
 	InitProtocol();
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE_BYTES, buf_len);
+}
+
+KnvProtocol::KnvProtocol(UcMem *buf, const char *data, int buf_len): \
+	tree(NULL), header(NULL), body(NULL), retmsg(NULL), auto_delete(true)
+{
+	if(buf==NULL || data==NULL || buf_len<=0)
+	{
+		errmsg = "Invalid buffer";
+	}
+	else if(data[0]==STX_IPV6_PB) // OidbIpv6 packet
+	{
+		InitFromOidbPkg(data, buf_len, false, buf);
+	}
+	else // Knv packet
+	{
+		tree = KnvNode::New(buf, data, buf_len);
+		if(tree==NULL)
+		{
+			errmsg = "Construct knv tree failed: ";
+			errmsg += KnvNode::GetGlobalErrorMsg();
+		}
+	}
+	InitProtocol();
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE_BYTES, buf_len);
+}
+
+// A minimal cursor over the PB wire format for Peek(), the packet framing is PB anyway.
+// It is much cheaper than knv_begin()/knv_next() for the few fields of a header.
+struct peek_cursor
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	uint32_t tag;
+	uint32_t type;
+	uint64_t v;         // varint value, or string length
+	const char *str;    // string data
+};
+
+static inline bool peek_varint(peek_cursor &c, uint64_t &v)
+{
+	if(c.p<c.end && *c.p<0x80) // most varints in a header are one byte
+	{
+		v = *c.p++;
+		return true;
+	}
+	v = 0;
+	for(int shift=0; c.p<c.end && shift<64; shift+=7)
+	{
+		uint8_t b = *c.p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// move to the next field, returns false at the end or on a malformed field
+static inline bool peek_next(peek_cursor &c)
+{
+	uint64_t t;
+	if(c.p>=c.end || !peek_varint(c, t) || t==0)
+		return false;
+	c.tag = t >> 3;
+	c.type = t & 7;
+	switch(c.type)
+	{
+	case KNV_VARINT: return peek_varint(c, c.v);
+	case KNV_FIXED64: if(c.end-c.p<8) return false; memcpy(&c.v, c.p, 8); c.p += 8; return true;
+	case KNV_FIXED32: if(c.end-c.p<4) return false; c.v = 0; memcpy(&c.v, c.p, 4); c.p += 4; return true;
+	case KNV_STRING:
+		if(!peek_varint(c, c.v) || c.v>(uint64_t)(c.end-c.p))
+			return false;
+		c.str = (const char *)c.p;
+		c.p += c.v;
+		return true;
+	default: return false;
+	}
+}
+
+static inline void peek_init(peek_cursor &c, const char *data, uint64_t len)
+{
+	c.p = (const uint8_t *)data;
+	c.end = c.p + len;
+	c.tag = 0;
+	c.type = 0;
+	c.v = 0;
+	c.str = NULL;
+}
+
+static inline void peek_header(const char *data, int len, KnvHeaderInfo &info)
+{
+	peek_cursor c;
+	peek_init(c, data, len);
+	while(peek_next(c))
+	{
+		if(c.type==KNV_VARINT)
+		{
+			switch(c.tag)
+			{
+			case KNV_PKG_HDR_CMD_TAG: info.cmd = c.v; break;
+			case KNV_PKG_HDR_SUBCMD_TAG: info.subcmd = c.v; break;
+			case KNV_PKG_HDR_SEQ_TAG: info.seq = c.v; break;
+			case KNV_PKG_HDR_RET_TAG: info.retcode = c.v; break;
+			case KNV_PKG_HDR_TOTAL_SPLIT_COUNT: info.total_split_count = c.v; break;
+			case KNV_PKG_HDR_CURR_SPLIT_INDEX: info.curr_split_index = c.v; break;
+			case KNV_PKG_HDR_COMPRESSED: info.compressed_len = c.v; break;
+			default: break;
+			}
+		}
+		else if(c.type==KNV_STRING && c.tag==KNV_PKG_HDR_RSP_ADDR &&
+			(c.v==sizeof(info.rspaddr.a4) || c.v==sizeof(info.rspaddr.a6)))
+		{
+			info.rspaddr.addr_len = c.v;
+			memcpy(&info.rspaddr.addr, c.str, c.v);
+		}
+	}
+}
+
+static inline void peek_key(const char *data, int len, KnvHeaderInfo &info)
+{
+	peek_cursor c;
+	peek_init(c, data, len);
+	if(peek_next(c) && c.tag==1)
+	{
+		info.has_key = true;
+		info.key_type = (knv_type_t)c.type;
+		if(c.type==KNV_STRING)
+		{
+			info.key.str.len = c.v;
+			info.key.str.data = (char *)c.str;
+		}
+		else
+		{
+			info.key.i64 = c.v;
+		}
+	}
+}
+
+int KnvProtocol::Peek(const char *buf, int buf_len, KnvHeaderInfo &info)
+{
+	info.cmd = info.subcmd = info.retcode = 0;
+	info.seq = 0;
+	info.rspaddr.addr_len = 0;
+	info.total_split_count = info.curr_split_index = 0;
+	info.has_key = false;
+	info.compressed_len = 0;
+	info.pkg_len = 0;
+
+	if(buf==NULL || buf_len<3)
+		return -1;
+
+	if(buf[0]==STX_IPV6_PB) // OidbIpv6 packet, see InitFromOidbPkg()
+	{
+		if(buf_len<10)
+			return -1;
+		uint32_t hlen = ntohl(*(uint32_t*)(buf+1));
+		uint32_t blen = ntohl(*(uint32_t*)(buf+5));
+		uint64_t total_len = (uint64_t)hlen+blen+10;
+		if(total_len > (uint64_t)buf_len)
+			return -1;
+		if(buf[total_len-1]!=ETX_IPV6_PB)
+			return -2;
+		info.pkg_len = total_len;
+		peek_header(buf+9, hlen, info);
+
+		const char *b = buf+9+hlen;
+		if(blen>=2 && ntohs(*(uint16_t*)b)==STX_KNV_BDY) // KNV bodies
+		{
+			peek_cursor c;
+			peek_init(c, b, blen);
+			if(peek_next(c) && c.tag==KNV_PKG_BDY_TAG && c.type==KNV_STRING)
+				peek_key(c.str, c.v, info);
+		}
+		else if(blen) // compat with non-KNV style PB
+		{
+			peek_key(b, blen, info);
+		}
+		return 0;
+	}
+
+	peek_cursor c;
+	uint64_t t, l;
+	peek_init(c, buf, buf_len);
+	if(!peek_varint(c, t))
+		return c.p>=c.end? -1 : -2;
+	if(t!=((KNV_PKG_TAG<<3)|KNV_STRING))
+		return -2;
+	if(!peek_varint(c, l))
+		return c.p>=c.end? -1 : -2;
+	if(l > (uint64_t)(c.end-c.p))
+		return -1;
+	info.pkg_len = (const char *)c.p - buf + l;
+
+	bool got_hdr = false, got_bdy = false;
+	peek_init(c, (const char *)c.p, l);
+	while(!(got_hdr && got_bdy) && peek_next(c))
+	{
+		if(c.type!=KNV_STRING)
+			continue;
+		if(c.tag==KNV_PKG_HDR_TAG && !got_hdr)
+		{
+			peek_header(c.str, c.v, info);
+			got_hdr = true;
+		}
+		else if(c.tag==KNV_PKG_BDY_TAG && !got_bdy)
+		{
+			peek_key(c.str, c.v, info);
+			got_bdy = true;
+		}
+	}
+	return got_hdr? 0 : -3;
+}
+
+KnvProtocol::KnvProtocol(const knv_seg_t *segs, int nsegs): \
+	tree(NULL), header(NULL), body(NULL), retmsg(NULL), auto_delete(true)
+{
+	int total = 0;
+	tree = KnvNode::New(segs, nsegs);
+	if(tree==NULL)
+	{
+		errmsg = "Construct knv tree failed: ";
+		errmsg += KnvNode::GetGlobalErrorMsg();
+	}
+	else
+	{
+		for(int i=0; i<nsegs; i++)
+			total += segs[i].len;
+	}
+	InitProtocol();
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_DECODE_BYTES, total);
 }
 
 int KnvProtocol::assign(const char *buf, int buf_len, bool own_buf)
@@ -449,7 +706,7 @@ int KnvProtocol::EncodeAllOidb(UcMem *(&mem))
 	}
 	*(uint32_t*)(buf+5) = htonl(bdy_sz);
 	buf[hdr_sz+bdy_sz+9] = ETX_IPV6_PB;
-	return hdr_sz+bdy_sz+9;
+	return hdr_sz+bdy_sz+10;
 }
 
 int KnvProtocol::EncodeCompatOidb(UcMem *(&mem), KnvNode *body_tree)
@@ -485,26 +742,47 @@ int KnvProtocol::Encode(UcMem *(&mem), uint32_t ret, const char *err, int errlen
 	if(!IsValid())
 		return -1;
 
-	if(ret!=retcode && SetRetCode(ret))
+	// a native response is the header template plus ret/err, the header nodes are left alone
+	bool use_tmpl = !encode_oidb && BuildRspHeader()==0;
+	if(use_tmpl)
 	{
-		errmsg = "Set retcode failed: " + errmsg;
-		return -2;
+		if(SetRspRet(ret, err, errlen))
+			return -3;
 	}
-
-	if(err!=retmsg || errlen!=(int)retmsglen)
+	else
 	{
-		if(SetRetErrorMsg(err, errlen))
+		SyncHeader();
+		if(Unzip()) // the header nodes are encoded, COMPRESSED has to go
+			return -11;
+		if(ret!=retcode && SetRetCode(ret))
 		{
-			errmsg = "Set ret msg failed: " + errmsg;
-			return -3;
+			errmsg = "Set retcode failed: " + errmsg;
+			return -2;
+		}
+
+		if(err!=retmsg || errlen!=(int)retmsglen)
+		{
+			if(SetRetErrorMsg(err, errlen))
+			{
+				errmsg = "Set ret msg failed: " + errmsg;
+				return -3;
+			}
 		}
 	}
 
 	if(encode_oidb)
-		return compat_oidb? EncodeCompatOidb(mem, body_tree) : EncodeOidb(mem, body_tree);
+	{
+		ret = compat_oidb? EncodeCompatOidb(mem, body_tree) : EncodeOidb(mem, body_tree);
+		if((int)ret>0)
+		{
+			KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+			KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, (int)ret);
+		}
+		return ret;
+	}
 
 	// pack tag + len + header + body_tree
-	int hdr_sz = header->EvaluateSize();
+	int hdr_sz = use_tmpl? RspHeaderSize() : header->EvaluateSize();
 	int bdy_sz = body_tree? body_tree->EvaluateSize() : 0;
 
 	int total_val_sz = hdr_sz + bdy_sz;
@@ -542,12 +820,18 @@ int KnvProtocol::Encode(UcMem *(&mem), uint32_t ret, const char *err, int errlen
 
 	int cur_len = knv_get_encoded_length(&b);
 	int left = total_sz - cur_len;
-	ret = header->Serialize(((char*)mem->ptr())+cur_len, left);
+	if(use_tmpl)
+		ret = EncodeRspHeader(((char*)mem->ptr())+cur_len, left);
+	else
+		ret = header->Serialize(((char*)mem->ptr())+cur_len, left);
 	if(ret)
 	{
 		UcMemManager::Free(mem);
 		mem = NULL;
-		errmsg = "serializing header failed: "; errmsg += header->GetErrorMsg();
+		if(!use_tmpl)
+		{
+			errmsg = "serializing header failed: "; errmsg += header->GetErrorMsg();
+		}
 		return -9;
 	}
 	cur_len += left;
@@ -566,9 +850,214 @@ int KnvProtocol::Encode(UcMem *(&mem), uint32_t ret, const char *err, int errlen
 		cur_len += left;
 	}
 
+	total_sz = CompressPkg(mem, total_sz);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, total_sz);
+	return total_sz;
+}
+
+int KnvProtocol::Encode(KnvIov &iov, uint32_t ret, const char *err, int errlen, KnvNode *body_tree)
+{
+	if(!IsValid())
+		return -1;
+
+	bool use_tmpl = BuildRspHeader()==0;
+	if(use_tmpl)
+	{
+		if(SetRspRet(ret, err, errlen))
+			return -3;
+	}
+	else
+	{
+		SyncHeader();
+		if(Unzip()) // the header nodes are encoded, COMPRESSED has to go
+			return -11;
+		if(ret!=retcode && SetRetCode(ret))
+		{
+			errmsg = "Set retcode failed: " + errmsg;
+			return -2;
+		}
+
+		if(err!=retmsg || errlen!=(int)retmsglen)
+		{
+			if(SetRetErrorMsg(err, errlen))
+			{
+				errmsg = "Set ret msg failed: " + errmsg;
+				return -3;
+			}
+		}
+	}
+
+	iov.Clear();
+
+	// pack tag + len + header + body_tree
+	int hdr_sz = use_tmpl? RspHeaderSize() : header->EvaluateSize();
+	int bdy_sz = body_tree? body_tree->EvaluateSize() : 0;
+	int total_val_sz = hdr_sz + bdy_sz;
+
+	// the templated header goes to the same scratch space
+	int head_sz = use_tmpl? 20+hdr_sz : 20;
+	char *p = iov.Reserve(head_sz);
+	if(p==NULL)
+	{
+		errmsg = "KnvIov out of memory";
+		return -6;
+	}
+	knv_buff_t b;
+	ret = knv_init_buff(&b, p, 20);
+	if(ret)
+	{
+		errmsg = "knv_init_buff failed: "; errmsg += b.errmsg;
+		return -7;
+	}
+	ret = knv_add_string_head(&b, KNV_PKG_TAG, total_val_sz);
+	if(ret)
+	{
+		errmsg = "knv_add_string_head failed: "; errmsg += b.errmsg;
+		return -8;
+	}
+	int n = knv_get_encoded_length(&b);
+	if(use_tmpl)
+	{
+		int hl = head_sz - n;
+		if(EncodeRspHeader(p+n, hl))
+			return -9;
+		iov.Commit(p, n+hl);
+	}
+	else
+	{
+		iov.Commit(p, n);
+	}
+
+	if(!use_tmpl && header->Serialize(iov))
+	{
+		iov.Clear();
+		errmsg = "serializing header failed: "; errmsg += header->GetErrorMsg();
+		return -9;
+	}
+	if(bdy_sz>0 && body_tree->Serialize(iov))
+	{
+		iov.Clear();
+		errmsg = "serializing body failed: "; errmsg += body_tree->GetErrorMsg();
+		return -10;
+	}
+
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, iov.GetLength());
+	return iov.GetLength();
+}
+
+int KnvProtocol::EncodeWithRawBodies(const knv_seg_t *bodies, int nbodies, UcMem *(&mem))
+{
+	if(!IsValid())
+	{
+		errmsg = "Protocol is not initialized";
+		return -1;
+	}
+
+	// ret/err are cleared as EncodeWithBody() does
+	bool use_tmpl = BuildRspHeader()==0;
+	if(use_tmpl)
+	{
+		if(SetRspRet(0, NULL, 0))
+			return -3;
+	}
+	else
+	{
+		SyncHeader();
+		if(Unzip())
+			return -10;
+		if(retcode && SetRetCode(0))
+		{
+			errmsg = "Set retcode failed: " + errmsg;
+			return -2;
+		}
+		if((retmsg || retmsglen) && SetRetErrorMsg(NULL, 0))
+		{
+			errmsg = "Set ret msg failed: " + errmsg;
+			return -3;
+		}
+	}
+
+	int hdr_sz = use_tmpl? RspHeaderSize() : header->EvaluateSize();
+	uint64_t bdy_sz = 0;
+	for(int i=0; i<nbodies; i++)
+		bdy_sz += bodies[i].len;
+	if(hdr_sz + bdy_sz > 0x7fffff00ULL)
+	{
+		errmsg = "bodies are too large";
+		return -4;
+	}
+
+	knv_value_t v;
+	v.str.len = hdr_sz + bdy_sz;
+	int total_sz = knv_eval_field_length(KNV_PKG_TAG, KNV_NODE, &v);
+	mem = UcMemManager::Alloc(total_sz);
+	if(mem==NULL)
+	{
+		errmsg = "UcMemManager::Alloc failed";
+		return -6;
+	}
+
+	char *p = (char *)mem->ptr();
+	knv_buff_t b;
+	if(knv_init_buff(&b, p, total_sz) || knv_add_string_head(&b, KNV_PKG_TAG, v.str.len))
+	{
+		UcMemManager::Free(mem);
+		mem = NULL;
+		errmsg = "knv_add_string_head failed: "; errmsg += b.errmsg;
+		return -8;
+	}
+	int cur_len = knv_get_encoded_length(&b);
+	int left = total_sz - cur_len;
+	if(use_tmpl? EncodeRspHeader(p+cur_len, left) : header->Serialize(p+cur_len, left))
+	{
+		UcMemManager::Free(mem);
+		mem = NULL;
+		if(!use_tmpl)
+		{
+			errmsg = "serializing header failed: "; errmsg += header->GetErrorMsg();
+		}
+		return -9;
+	}
+	cur_len += left;
+	for(int i=0; i<nbodies; i++)
+	{
+		memcpy(p+cur_len, bodies[i].data, bodies[i].len);
+		cur_len += bodies[i].len;
+	}
+
+	total_sz = CompressPkg(mem, total_sz);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, total_sz);
 	return total_sz;
 }
 
+int KnvProtocol::EncodeAll(KnvIov &iov)
+{
+	if(!IsValid())
+	{
+		errmsg = "Protocol is not initialized";
+		return -1;
+	}
+
+	SyncHeader();
+	iov.Clear();
+	if(tree->Serialize(iov))
+	{
+		iov.Clear();
+		errmsg = "Serializing tree failed: ";
+		if(tree->GetErrorMsg())
+			errmsg += tree->GetErrorMsg();
+		else
+			errmsg += "Unknown error";
+		return -3;
+	}
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, iov.GetLength());
+	return iov.GetLength();
+}
+
 int KnvProtocol::AddBody(KnvNode *b, bool take_ownership)
 {
 	if(!IsValid())
@@ -601,6 +1090,10 @@ int KnvProtocol::SetHeaderIntField(uint32_t ftag, uint64_t new_val)
 		return -1;
 	}
 
+	SyncHeader();
+	split_hdr.clear();
+	if(ftag!=KNV_PKG_HDR_RET_TAG) // ret is not in the template
+		rsp_hdr_split = -1;
 	if(header->SetFieldInt(ftag, new_val))
 	{
 		errmsg = "Set header meta failed: "; errmsg += header->GetErrorMsg();
@@ -626,6 +1119,10 @@ int KnvProtocol::SetHeaderStringField(uint32_t ftag, uint32_t new_len, char *new
 		return -1;
 	}
 
+	SyncHeader();
+	split_hdr.clear();
+	if(ftag!=KNV_PKG_HDR_ERR_TAG) // err is not in the template
+		rsp_hdr_split = -1;
 	int ret;
 	if(new_val && new_len)
 		ret = header->SetFieldStr(ftag, new_len, new_val);
@@ -653,7 +1150,10 @@ int KnvProtocol::SetRspAddr(const KnvNet::KnvSockAddr &addr)
 		return -1;
 	}
 
+	SyncHeader();
 	rspaddr = addr;
+	split_hdr.clear();
+	rsp_hdr_split = -1;
 
 	int ret;
 	uint32_t new_len = rspaddr.addr_len;
@@ -708,6 +1208,7 @@ int KnvProtocol::AddPartial(KnvProtocol &part, bool own_buf)
 		if(!this_complete)
 		{
 			Attr_API(ATTR_PROTO_INCOMPLETE_PART_OVERWRITTEN, 1); // incomplete part overwritten
+			KnvMetrics::Add(KNV_METRIC_PROTO_PART_OVERWRITTEN, 1);
 		}
 		return assign(part, own_buf);
 	}
@@ -743,6 +1244,7 @@ int KnvProtocol::AddPartial(KnvProtocol &part, bool own_buf)
 		errmsg += tree->GetErrorMsg();
 		return -5;
 	}
+	KnvMetrics::Add(KNV_METRIC_PROTO_PART_ADDED, 1);
 
 	// now check if all parts are available
 	int total_len = 0;
@@ -815,6 +1317,7 @@ int KnvProtocol::AddPartial(KnvProtocol &part, bool own_buf)
 	}
 	// now packet is fully merged
 	UcMemManager::Free(m);
+	KnvMetrics::Add(KNV_METRIC_PROTO_REASSEMBLED, 1);
 	return 0;
 }
 
@@ -834,7 +1337,15 @@ int KnvProtocol::Split(KnvNode *b)
 	}
 
 	// these fields should not be present in the network packets
+	SyncHeader();
+	if(Unzip())
+	{
+		errmsg = "Inflate failed: " + errmsg;
+		return -10;
+	}
 	total_split_count = 1;
+	split_hdr.clear();
+	rsp_hdr_split = -1;
 	header->RemoveChildrenByTag(KNV_PKG_HDR_TOTAL_SPLIT_COUNT);
 	header->RemoveChildrenByTag(KNV_PKG_HDR_CURR_SPLIT_INDEX);
 
@@ -889,7 +1400,8 @@ no_need_split:
 	if(encoded_len <= (int)max_sz) // warning: real size is smaller than eval size
 	{
 		// there will be no harm except one unnecessary encoding wasted
-		Attr_API(ATTR_PROTO_REAL_SIZE_SMALLER_THAN_EVAL_SIZE, 1);
+		if(!allow_compress) // expected if the bodies were compressed
+			Attr_API(ATTR_PROTO_REAL_SIZE_SMALLER_THAN_EVAL_SIZE, 1);
 		UcMemManager::Free(m);
 		goto no_need_split;
 	}
@@ -927,12 +1439,28 @@ no_need_split:
 		return -7;
 	}
 
+	// the header is the same for all parts except CURR_SPLIT_INDEX, which goes last,
+	// keep its encoded form so that EncodePart() does not serialize it every time
+	const KnvLeaf *hl = header->GetValue();
+	if(hl)
+	{
+		try
+		{
+			split_hdr.assign(hl->GetValue().str.data, hl->GetValue().str.len);
+		}
+		catch(...)
+		{
+			split_hdr.clear(); // EncodePart() falls back to encoding the header
+		}
+	}
+
+	// parts are views of m, each holding a reference to it
 	for(uint32_t i=0; i<nr_pkgs; i++)
 	{
 		knv_value_t v;
 		v.str.len = i==last? sz_last : sz_part;
 		v.str.data = ((char *)m->ptr())+(i*sz_part);
-		KnvNode *part = KnvNode::New(KNV_PKG_PART_TAG_BASE+i, KNV_STRING, KNV_DEFAULT_TYPE, NULL, &v, true);
+		KnvNode *part = KnvNode::New(KNV_PKG_PART_TAG_BASE+i, KNV_STRING, KNV_DEFAULT_TYPE, NULL, &v, false);
 		if(part==NULL)
 		{
 			errmsg = "construct part body failed: ";
@@ -940,6 +1468,7 @@ no_need_split:
 			UcMemManager::Free(m);
 			return -8;
 		}
+		part->AttachBuffer(m);
 
 		tree->RemoveChildrenByTag(KNV_PKG_PART_TAG_BASE+i);
 		if(tree->InsertChild(part, true, true))
@@ -951,7 +1480,9 @@ no_need_split:
 			return -9;
 		}
 	}
-	UcMemManager::Free(m);
+	UcMemManager::Free(m); // drop our reference, the parts keep m alive
+	KnvMetrics::Add(KNV_METRIC_PROTO_SPLIT, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_SPLIT_PARTS, nr_pkgs);
 	return 0;
 }
 
@@ -989,13 +1520,468 @@ int KnvProtocol::EncodePart(int index, UcMem *(&mem))
 		errmsg = "No such part";
 		return -2;
 	}
-	if(header->SetChildInt(KNV_PKG_HDR_CURR_SPLIT_INDEX, index))
+	const KnvLeaf *l;
+	if(split_hdr.empty() || (l=b->GetValue())==NULL)
 	{
-		errmsg = "set header part index failed: ";
-		errmsg += header->GetErrorMsg();
+		if(header->SetChildInt(KNV_PKG_HDR_CURR_SPLIT_INDEX, index))
+		{
+			errmsg = "set header part index failed: ";
+			errmsg += header->GetErrorMsg();
+			return -3;
+		}
+		rsp_hdr_split = -1;
+		return EncodeWithBody(b, mem);
+	}
+
+	// fast path: header template + index + payload
+	const knv_value_t &pv = l->GetValue();
+	int sz = split_hdr.length() + pv.str.len + 40;
+	mem = UcMemManager::Alloc(sz);
+	if(mem==NULL)
+	{
+		errmsg = "UcMemManager::Alloc failed";
+		return -4;
+	}
+	char *p = (char *)mem->ptr();
+	int hl = EncodePartHead(index, pv.str.len, p, sz);
+	if(hl<0)
+	{
+		UcMemManager::Free(mem);
+		mem = NULL;
+		return hl;
+	}
+	memcpy(p+hl, pv.str.data, pv.str.len);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, hl+pv.str.len);
+	return hl + pv.str.len;
+}
+
+int KnvProtocol::EncodePart(int index, KnvIov &iov)
+{
+	if(!IsValid())
+	{
+		errmsg = "Protocol not initialized";
+		return -1;
+	}
+	if(index>=total_split_count)
+	{
+		errmsg = "Bad part index";
+		return -1;
+	}
+	KnvNode *b = tree->FindChildByTag(KNV_PKG_PART_TAG_BASE+index);
+	const KnvLeaf *l;
+	if(total_split_count==1 || b==NULL || split_hdr.empty() || (l=b->GetValue())==NULL)
+	{
+		// rare cases, encode contiguously
+		UcMem *m;
+		int ret = EncodePart(index, m);
+		if(ret<0)
+			return ret;
+		if(iov.Append(m->ptr(), ret))
+		{
+			UcMemManager::Free(m);
+			errmsg = "out of memory";
+			return -100;
+		}
+		UcMemManager::Free(m);
+		return ret;
+	}
+
+	const knv_value_t &pv = l->GetValue();
+	int sz = split_hdr.length() + 40;
+	char *p = iov.Reserve(sz);
+	if(p==NULL)
+	{
+		errmsg = "out of memory";
+		return -100;
+	}
+	int hl = EncodePartHead(index, pv.str.len, p, sz);
+	if(hl<0)
+		return hl;
+	iov.Commit(p, hl);
+	if(iov.AppendRef(pv.str.data, pv.str.len))
+	{
+		errmsg = "out of memory";
+		return -100;
+	}
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_ENCODE_BYTES, hl+pv.str.len);
+	return hl + pv.str.len;
+}
+
+// produces exactly what EncodeWithBody() does after header->SetChildInt(KNV_PKG_HDR_CURR_SPLIT_INDEX, index),
+// as the index is the last child of the header
+int KnvProtocol::EncodePartHead(int index, uint32_t part_len, char *buf, int sz)
+{
+	knv_value_t v;
+	v.i64 = index;
+	uint32_t hdr_val_sz = split_hdr.length() + knv_eval_field_length(KNV_PKG_HDR_CURR_SPLIT_INDEX, KNV_VARINT, &v);
+	v.str.len = hdr_val_sz;
+	int hdr_sz = knv_eval_field_length(KNV_PKG_HDR_TAG, KNV_NODE, &v);
+	v.str.len = part_len;
+	int part_sz = knv_eval_field_length(KNV_PKG_PART_TAG_BASE+index, KNV_STRING, &v);
+
+	knv_buff_t b;
+	if(knv_init_buff(&b, buf, sz) ||
+	   knv_add_string_head(&b, KNV_PKG_TAG, hdr_sz + part_sz) ||
+	   knv_add_string_head(&b, KNV_PKG_HDR_TAG, hdr_val_sz) ||
+	   knv_add_user(&b, split_hdr.data(), split_hdr.length()) ||
+	   knv_add_varint(&b, KNV_PKG_HDR_CURR_SPLIT_INDEX, index) ||
+	   knv_add_string_head(&b, KNV_PKG_PART_TAG_BASE+index, part_len))
+	{
+		errmsg = "encoding part header failed: "; errmsg += b.errmsg;
+		return -5;
+	}
+	return knv_get_encoded_length(&b);
+}
+
+// The template normally refers to the encoded header in place, as the request header is
+// not modified after decoding. If the header has ret/err fields or has been modified, the
+// fields except ret/err are copied to rsp_hdr. ret/err are written after the metas by
+// EncodeRspHeader(), where SetRetCode()/SetRetErrorMsg() would append them.
+// GetMutableHeader() and the Set*() methods reset the template, a header read through
+// GetHeader() keeps it, unless it is modified after all, which shows as IsDirty()
+int KnvProtocol::BuildRspHeader()
+{
+	if(rsp_hdr_split>=0)
+	{
+		const char *src = rsp_hdr_data==rsp_hdr.data()? rsp_hdr_src : rsp_hdr_data;
+		if(src==NULL) // copied from a modified header
+			return 0;
+		if(!header->IsDirty() && header->GetValue()->GetValue().str.data==src)
+			return 0;
+		rsp_hdr_split = -1;
+	}
+
+	char local_buf[512];
+	UcMem *m = NULL;
+	const char *data;
+	int len;
+	peek_cursor c;
+	int ret = 0;
+	bool in_place = !header->IsDirty() && header->IsBufferValid();
+	if(in_place)
+	{
+		const knv_value_t &v = header->GetValue()->GetValue();
+		data = v.str.data;
+		len = v.str.len;
+	}
+	else
+	{
+		char *buf = local_buf;
+		len = header->EvaluateSize();
+		if(len>(int)sizeof(local_buf))
+		{
+			m = UcMemManager::Alloc(len);
+			if(m==NULL)
+			{
+				errmsg = "UcMemManager::Alloc failed";
+				return -1;
+			}
+			buf = (char *)m->ptr();
+		}
+		if(header->Serialize(buf, len))
+		{
+			errmsg = "serializing header failed: "; errmsg += header->GetErrorMsg();
+			ret = -2;
+			goto out;
+		}
+		peek_init(c, buf, len);
+		if(!peek_next(c) || c.type!=KNV_STRING)
+		{
+			errmsg = "bad header encoding";
+			ret = -3;
+			goto out;
+		}
+		data = c.str;
+		len = c.v;
+	}
+
+	// the first pass finds ret/err and where the metas end, the second copies if needed
+	for(int pass=0; pass<2; pass++)
+	{
+		int kept = 0, split = -1;
+		bool has_err = false;
+		rsp_hdr_has_ret = false;
+		peek_init(c, data, len);
+		while(c.p<c.end)
+		{
+			const char *f = (const char *)c.p;
+			if(!peek_next(c))
+			{
+				errmsg = "bad header field";
+				ret = -3;
+				goto out;
+			}
+			if(c.tag==KNV_PKG_HDR_RET_TAG || c.tag==KNV_PKG_HDR_ERR_TAG || c.tag==KNV_PKG_HDR_COMPRESSED)
+			{
+				if(c.tag==KNV_PKG_HDR_RET_TAG)
+					rsp_hdr_has_ret = true;
+				else // a compressed request does not make a compressed response
+					has_err = true;
+				continue;
+			}
+			if(split<0 && c.tag>UC_MAX_META_NUM) // metas go first
+				split = kept;
+			if(pass)
+				memcpy(&rsp_hdr[kept], f, (const char *)c.p-f);
+			kept += (const char *)c.p-f;
+		}
+		rsp_hdr_split = split<0? kept : split;
+		rsp_hdr_len = kept;
+		rsp_hdr_src = in_place? data : NULL;
+		if(pass==0 && in_place && !rsp_hdr_has_ret && !has_err)
+		{
+			rsp_hdr_data = data;
+			break;
+		}
+		if(pass==0)
+		{
+			try
+			{
+				rsp_hdr.resize(kept);
+			}
+			catch(...)
+			{
+				errmsg = "out of memory";
+				rsp_hdr_split = -1;
+				ret = -4;
+				goto out;
+			}
+			rsp_hdr_data = rsp_hdr.data();
+		}
+	}
+out:
+	if(m)
+		UcMemManager::Free(m);
+	return ret;
+}
+
+int KnvProtocol::RspHeaderSize(uint32_t *val_sz)
+{
+	knv_value_t v;
+	uint32_t sz = rsp_hdr_len;
+	if(retcode || rsp_hdr_has_ret)
+	{
+		v.i64 = retcode;
+		sz += knv_eval_field_length(KNV_PKG_HDR_RET_TAG, KNV_VARINT, &v);
+	}
+	if(retmsglen)
+	{
+		v.str.len = retmsglen;
+		sz += knv_eval_field_length(KNV_PKG_HDR_ERR_TAG, KNV_STRING, &v);
+	}
+	if(val_sz)
+		*val_sz = sz;
+	v.str.len = sz;
+	return knv_eval_field_length(KNV_PKG_HDR_TAG, KNV_NODE, &v);
+}
+
+int KnvProtocol::EncodeRspHeader(char *buf, int &len)
+{
+	uint32_t val_sz;
+	RspHeaderSize(&val_sz);
+
+	knv_buff_t b;
+	if(knv_init_buff(&b, buf, len) ||
+	   knv_add_string_head(&b, KNV_PKG_HDR_TAG, val_sz) ||
+	   knv_add_user(&b, rsp_hdr_data, rsp_hdr_split) ||
+	   ((retcode || rsp_hdr_has_ret) && knv_add_varint(&b, KNV_PKG_HDR_RET_TAG, retcode)) ||
+	   (retmsglen && knv_add_string(&b, KNV_PKG_HDR_ERR_TAG, retmsg, retmsglen)) ||
+	   knv_add_user(&b, rsp_hdr_data+rsp_hdr_split, rsp_hdr_len-rsp_hdr_split))
+	{
+		errmsg = "encoding response header failed: "; errmsg += b.errmsg;
+		return -1;
+	}
+	len = knv_get_encoded_length(&b);
+	return 0;
+}
+
+int KnvProtocol::SetRspRet(uint32_t ret, const char *err, int errlen)
+{
+	if(err==NULL || errlen<=0)
+	{
+		errlen = 0;
+	}
+	else if(err!=rsp_err.data() || errlen!=(int)rsp_err.length()) // err may not outlive this call
+	{
+		try
+		{
+			rsp_err.assign(err, errlen);
+		}
+		catch(...)
+		{
+			errmsg = "Set ret msg failed: out of memory";
+			return -1;
+		}
+	}
+	retcode = ret;
+	retmsglen = errlen;
+	retmsg = errlen? (char *)rsp_err.data() : NULL;
+	rsp_unsynced = true;
+	return 0;
+}
+
+int KnvProtocol::FlushRspRet()
+{
+	rsp_unsynced = false;
+	if((retcode || header->GetMeta(KNV_PKG_HDR_RET_TAG)) && header->SetFieldInt(KNV_PKG_HDR_RET_TAG, retcode))
+	{
+		errmsg = "Set header meta failed: "; errmsg += header->GetErrorMsg();
+		return -1;
+	}
+	if(retmsglen? header->SetFieldStr(KNV_PKG_HDR_ERR_TAG, retmsglen, retmsg) : header->RemoveField(KNV_PKG_HDR_ERR_TAG))
+	{
+		errmsg = "Set header meta failed: "; errmsg += header->GetErrorMsg();
+		return -2;
+	}
+	// point to the header's copy, rsp_err is reused by the next Encode()
+	KnvLeaf *m = retmsglen? header->GetMeta(KNV_PKG_HDR_ERR_TAG) : NULL;
+	if(m && m->GetType()==KNV_STRING)
+		retmsg = m->GetValue().str.data;
+	return 0;
+}
+
+// The fields after the header are compressed as one block, so the header stays readable
+// for routing and splitting, and the packet is still one KNV_PKG_TAG field:
+//   PKG{ HDR{ ..., COMPRESSED:raw_len }, ZBDY:lz(BDY{...} BDY{...} ...) }
+int KnvProtocol::CompressPkg(UcMem *(&mem), int len)
+{
+	// parts of a split packet are compressed as a whole already
+	if(!allow_compress || zbody_len || total_split_count>1 || len<(int)GetCompressThreshold())
+		return len;
+
+	peek_cursor c;
+	uint64_t t, l;
+	peek_init(c, (const char *)mem->ptr(), len);
+	if(!peek_varint(c, t) || t!=((KNV_PKG_TAG<<3)|KNV_STRING) || !peek_varint(c, l) || l!=(uint64_t)(c.end-c.p))
+		return len;
+	peek_init(c, (const char *)c.p, l);
+	if(!peek_next(c) || c.tag!=KNV_PKG_HDR_TAG || c.type!=KNV_STRING)
+		return len;
+	const char *hdr = c.str;
+	uint32_t hdr_len = c.v;
+	const char *raw = (const char *)c.p;
+	int raw_len = c.end - c.p;
+	if(raw_len<(int)GetCompressThreshold())
+		return len;
+
+	// compress behind the room for the heads, then move it in place
+	int room = hdr_len + 48;
+	int cap = raw_len - raw_len/8; // not worth it if saving less
+	UcMem *out = UcMemManager::Alloc(room + cap);
+	if(out==NULL)
+		return len;
+	char *p = (char *)out->ptr();
+	int zlen = knv_lz_compress(raw, raw_len, p+room, cap);
+	if(zlen==0)
+	{
+		UcMemManager::Free(out);
+		return len;
+	}
+
+	knv_value_t v;
+	v.i64 = raw_len;
+	uint32_t hdr_val_len = hdr_len + knv_eval_field_length(KNV_PKG_HDR_COMPRESSED, KNV_VARINT, &v);
+	v.str.len = zlen;
+	uint32_t pkg_val_len = knv_eval_field_length(KNV_PKG_ZBDY_TAG, KNV_STRING, &v);
+	v.str.len = hdr_val_len;
+	pkg_val_len += knv_eval_field_length(KNV_PKG_HDR_TAG, KNV_NODE, &v);
+
+	knv_buff_t b;
+	if(knv_init_buff(&b, p, room) ||
+	   knv_add_string_head(&b, KNV_PKG_TAG, pkg_val_len) ||
+	   knv_add_string_head(&b, KNV_PKG_HDR_TAG, hdr_val_len) ||
+	   knv_add_user(&b, hdr, hdr_len) ||
+	   knv_add_varint(&b, KNV_PKG_HDR_COMPRESSED, raw_len) ||
+	   knv_add_string_head(&b, KNV_PKG_ZBDY_TAG, zlen))
+	{
+		UcMemManager::Free(out);
+		return len;
+	}
+	int head_len = knv_get_encoded_length(&b);
+	memmove(p+head_len, p+room, zlen);
+
+	UcMemManager::Free(mem);
+	mem = out;
+	KnvMetrics::Add(KNV_METRIC_PROTO_COMPRESS, 1);
+	KnvMetrics::Add(KNV_METRIC_PROTO_COMPRESS_SAVED, len - (head_len+zlen));
+	return head_len + zlen;
+}
+
+int KnvProtocol::Inflate()
+{
+	uint32_t raw_len = zbody_len;
+	if(!IsValid())
+		return -1;
+	zbody_len = 0; // inflate only once, even on failure
+	SyncHeader();
+
+	KnvNode *z = tree->FindChildByTag(KNV_PKG_ZBDY_TAG);
+	const KnvLeaf *l = (z && z->GetType()==KNV_STRING)? z->GetValue() : NULL;
+	if(l==NULL)
+	{
+		errmsg = "compressed body is missing";
+		return -2;
+	}
+	const knv_value_t &zv = l->GetValue();
+	if(raw_len > (uint64_t)zv.str.len*KNV_LZ_MAX_RATIO + 16) // do not allocate for a forged length
+	{
+		errmsg = "bad length of compressed body";
 		return -3;
 	}
-	return EncodeWithBody(b, mem);
+	UcMem *m = UcMemManager::Alloc(raw_len);
+	if(m==NULL)
+	{
+		errmsg = "UcMemManager::Alloc failed";
+		return -4;
+	}
+	const char *raw = (const char *)m->ptr();
+	if(knv_lz_decompress(zv.str.data, zv.str.len, m->ptr(), raw_len)!=(int)raw_len)
+	{
+		UcMemManager::Free(m);
+		errmsg = "corrupted compressed body";
+		return -5;
+	}
+
+	// check all fields first, so that the tree is left alone if any is bad
+	peek_cursor c;
+	peek_init(c, raw, raw_len);
+	while(c.p<c.end)
+	{
+		if(!peek_next(c))
+		{
+			UcMemManager::Free(m);
+			errmsg = "bad field in compressed body";
+			return -6;
+		}
+	}
+
+	// each field becomes a child of the tree, referencing m
+	peek_init(c, raw, raw_len);
+	while(c.p<c.end)
+	{
+		const char *f = (const char *)c.p;
+		peek_next(c);
+		KnvNode *n = KnvNode::New(m, f, (const char *)c.p-f);
+		if(n==NULL || tree->InsertChild(n, true, false))
+		{
+			errmsg = "inserting inflated field failed: ";
+			errmsg += n? tree->GetErrorMsg() : KnvNode::GetGlobalErrorMsg();
+			if(n) KnvNode::Delete(n);
+			UcMemManager::Free(m);
+			return -7;
+		}
+	}
+	UcMemManager::Free(m); // the nodes keep m alive
+
+	tree->RemoveChildByPos(z, NULL);
+	header->RemoveChildrenByTag(KNV_PKG_HDR_COMPRESSED);
+	split_hdr.clear();
+	rsp_hdr_split = -1;
+	body = FindFirstBody(tree->GetFirstChild());
+	KnvMetrics::Add(KNV_METRIC_PROTO_INFLATE, 1);
+	return 0;
 }
 
 #include "commands.h"
@@ -1007,6 +1993,7 @@ int KnvProtocol::Print(const string &prefix, ostream &outstr)
 		outstr << prefix << "Invalid protocol tree." << endl;
 		return -1;
 	}
+	SyncHeader();
 
 	outstr << prefix;
 	outstr << "[#] cmd=" << knv::GetCmdName(cmd);
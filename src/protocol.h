@@ -13,6 +13,13 @@ Unless required by applicable law or agreed to in writing, software distributed
 // 2013-10-23	Created
 // 2013-11-01	Support batch request (mutiple requests in a tree)
 // 2014-06-18	Support OIDB protocol format
+// 2026-10-18	Zero-copy decoding from reference-counted buffers
+// 2026-10-18	Scatter-gather encoding
+// 2026-10-18	Split into views of one encoded buffer, templated part headers
+// 2026-10-18	Header-only Peek() for routing
+// 2026-10-18	Response header template, Encode() does not touch the header nodes
+// 2026-10-18	EncodeWithRawBodies() for bodies encoded elsewhere
+// 2026-10-18	Body compression, see KNV_PKG_HDR_COMPRESSED
 //
 
 #ifndef __KNV_PROTOCOL__
@@ -25,11 +32,13 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include <string>
 
 #define KNV_DEFUALT_MAX_PKG_SIZE    64000
+#define KNV_DEFAULT_COMPRESS_THRESHOLD  1024 // bodies shorter than this are not compressed
 //#define KNV_DEFUALT_MAX_PKG_SIZE    512
 
 #define KNV_PKG_TAG             0xdb3 // paket  tag, first 3 bytes: 9A DB 01
 #define KNV_PKG_HDR_TAG         0xbad // header tag, first 3 bytes: EA BA 01
 #define KNV_PKG_BDY_TAG         0xdad // body   tag, first 3 bytes: EA DA 01
+#define KNV_PKG_ZBDY_TAG        0xdae // compressed fields after the header, see KNV_PKG_HDR_COMPRESSED
 #define KNV_PKG_UNFINISHED_TAG  0xddd // for batch request response: tag for unfinished keys, each key is a repeated field with tag 1
 #define KNV_PKG_PART_TAG_BASE   0x1ee // splitted partial tag base
                                       // the k's splitted packet has tag KNV_PKG_PART_BDY_TAG_BASE+k
@@ -46,6 +55,8 @@ Unless required by applicable law or agreed to in writing, software distributed
 #define KNV_PKG_HDR_MAX_PKG_SIZE          2003 // user supplied max_pkg_size for splitting
 #define KNV_PKG_HDR_TOTAL_SPLIT_COUNT     2004 // totoal splitted packet count
 #define KNV_PKG_HDR_CURR_SPLIT_INDEX      2005 // current index (0~(total-1))
+#define KNV_PKG_HDR_COMPRESSED            2006 // fields after the header are compressed (knv_lz.h) into KNV_PKG_ZBDY_TAG, value is their raw length
+#define KNV_PKG_HDR_ACCEPT_COMPRESS       2007 // allow compressing the rsp packet
 
 #define KNV_DM_TAGLIST_TAG      2 // tag number of taglist in domain node, used in packing request for union session
 #define KNV_DM_UPDATE_TIME_TAG  2 // tag number of update time in domain node, updated on write
@@ -68,6 +79,23 @@ using namespace std;
 // accessible through UcProtocol
 #define UcProtocol KnvProtocol
 
+// Header fields for routing, filled by KnvProtocol::Peek() without building a tree
+struct KnvHeaderInfo
+{
+	uint32_t cmd;
+	uint32_t subcmd;
+	uint64_t seq;
+	uint32_t retcode;
+	KnvNet::KnvSockAddr rspaddr; // rspaddr.addr_len==0 if not present
+	uint8_t total_split_count;
+	uint8_t curr_split_index;
+	bool has_key;        // whether the first body has a key
+	knv_type_t key_type;
+	knv_value_t key;     // a string key points into the packet
+	uint32_t compressed_len; // raw length of compressed bodies, then the key is not available
+	int pkg_len;         // length of the packet at the start of the buffer
+};
+
 // This is an  encapsulation for KnvNode
 class KnvProtocol
 {
@@ -93,6 +121,27 @@ private:
 	uint16_t max_pkg_sz;
 	uint8_t total_split_count;
 	uint8_t curr_split_index;
+	// encoded header fields shared by all parts, set up by Split(), CURR_SPLIT_INDEX is appended per part
+	// empty if the header has changed since then
+	string split_hdr;
+
+	// compression-support parameters
+	uint8_t  allow_compress; // set locally only, never by a decoded header
+	uint8_t  peer_compress;  // ACCEPT_COMPRESS in a decoded header: the sender accepts a compressed response
+	uint32_t compress_threshold;
+	uint32_t zbody_len; // raw length of KNV_PKG_ZBDY_TAG if it is not inflated yet, or 0
+
+	// response header template for Encode(), see BuildRspHeader():
+	// encoded header fields except ret/err, which are written at offset rsp_hdr_split
+	const char *rsp_hdr_data; // the header's own encoding, or rsp_hdr
+	int rsp_hdr_len;
+	int rsp_hdr_split;    // <0 if not built yet or the header has changed since then
+	const char *rsp_hdr_src; // the unmodified encoded header rsp_hdr was copied from, NULL if it was modified
+	string rsp_hdr;
+	bool rsp_hdr_has_ret; // the header has a ret field, keep it even if ret is 0
+	// ret/err of the last Encode() are only in retcode/retmsg, see SyncHeader()
+	bool rsp_unsynced;
+	string rsp_err;       // retmsg points here while rsp_unsynced
 
 	string errmsg;
 	bool auto_delete; // delete tree on destruction
@@ -107,7 +156,7 @@ public:
 
 public:
 	// construct but not initialize, user should call assign() before using it
-	KnvProtocol():tree(NULL),header(NULL),body(NULL) {}
+	KnvProtocol():tree(NULL),header(NULL),body(NULL),allow_compress(0),peer_compress(0),compress_threshold(0),zbody_len(0),rsp_hdr_split(-1),rsp_unsynced(false) {}
 
 	// construct from a existing protocol
 	// if take_ownership is true, proto will no longer owns the tree, deep_copy is not used
@@ -121,6 +170,12 @@ public:
 	// construct from decoding a stream, use IsValid() to check whether decoding is successful
 	KnvProtocol(const char *buf, int buf_len, bool own_buf = true);
 	KnvProtocol(const string &buf, bool own_buf = true);
+	// zero-copy decoding: nodes point into buf (data/buf_len lies in it) and hold references to it,
+	// buf is recycled after the protocol and all subtrees taken from it are deleted,
+	// the caller drops its own reference with UcMemManager::Free(buf) whenever it likes
+	KnvProtocol(UcMem *buf, const char *data, int buf_len);
+	// decoding a KNV packet spread over several buffers, see KnvNode::New(const knv_seg_t *, int)
+	KnvProtocol(const knv_seg_t *segs, int nsegs);
 
 	// construct a new tree with header info
 	KnvProtocol(uint32_t dwCmd, uint32_t dwSubCmd, uint32_t dwSeq);
@@ -130,7 +185,10 @@ public:
 
 	// decode
 	bool IsValid();
+	// to read the header, the response header template is kept
 	KnvNode *GetHeader();
+	// to modify the header nodes directly, the template is rebuilt by the next Encode()
+	KnvNode *GetMutableHeader();
 	KnvNode *GetBody();
 	const knv_key_t *GetKey();
 
@@ -182,6 +240,8 @@ public:
 
 	// Encode the protocol tree to a string
 	// Note that retcode/retmsg will effect the output, call SetRetCode()/SetRetErrorMsg() to update them
+	// A response reuses the encoded request header and writes ret/err into it, the header nodes
+	// are updated only when the header is accessed again
 	// the user is responsible for calling UcMemManager::Free(mem) to free memory
 	int Encode(UcMem *(&mem));
 	int EncodeWithError(uint32_t ret, const string &errmsg, UcMem *(&mem));
@@ -193,6 +253,18 @@ public:
 	int EncodeWithError(uint32_t ret, const string &errmsg, string &s);
 	int EncodeWithBody(KnvNode *b, string &s);
 
+	// scatter-gather version, header and length prefixes are encoded into iov's scratch buffers
+	// and folded bodies are referenced in place, the result can be passed to writev()/sendmsg()
+	// the protocol and the body must not be modified or deleted until iov is sent
+	int Encode(KnvIov &iov);
+	int EncodeWithError(uint32_t ret, const string &errmsg, KnvIov &iov);
+	int EncodeWithBody(KnvNode *b, KnvIov &iov);
+
+	// encode with bodies that are already encoded, e.g. by other threads,
+	// each segment holds complete fields (KNV_PKG_BDY_TAG bodies or others) and is copied as is
+	int EncodeWithRawBodies(const knv_seg_t *bodies, int nbodies, UcMem *(&mem));
+	int EncodeWithRawBodies(const knv_seg_t *bodies, int nbodies, string &s);
+
 	// OidbIPv6 encoding in UC style, i.e. multiple bodies are encoded inside the OIDB's body
 	int EncodeOidb(string &s);
 	int EncodeOidbWithError(uint32_t ret, const string &errmsg, string &s);
@@ -219,17 +291,43 @@ public:
 
 	int EvalMaxSize(); // calculate the message size
 
+	// Decode only the header fields in KnvHeaderInfo and the key of the first body,
+	// for both KNV and OidbIpv6 packets, no tree or memory is allocated
+	// returns 0 on success, -1 if buf is too short, -2 if it is not a valid packet, -3 if there is no header
+	static int Peek(const char *buf, int buf_len, KnvHeaderInfo &info);
+
 	// Splitting support, body in part will become invalid
 	bool GetAllowSplit() const { return allow_split!=0; }
 	uint16_t GetMaxPkgSize() const { return (max_pkg_sz<128 || max_pkg_sz>KNV_DEFUALT_MAX_PKG_SIZE)? KNV_DEFUALT_MAX_PKG_SIZE : max_pkg_sz; }
 	void SetAllowSplit(bool allow, uint32_t pkg_sz=0); // set allow splitting for sending a packet
 	int SetReqSplit(bool allow, uint32_t pkg_sz=0); // set whether the peer could split the reply packet or not
-	bool IsComplete() { return IsValid() && (retcode!=0 || total_split_count==0 || GetBody() != NULL); }
+	bool IsComplete() { return IsValid() && (retcode!=0 || total_split_count==0 || zbody_len || GetBody() != NULL); }
 	int AddPartial(KnvProtocol &part, bool own_buf=true); // if part's buffer can be used by this, set own_buf to false
+	// parts reference one encoded copy of the body, no per-part copying is done
+	// header changes through the Set*() methods are picked up, if the header is modified
+	// through GetMutableHeader() directly, call Split() again
 	int Split(KnvNode *b = NULL); // if b is NULL, split GetBody()
 	int GetTotalPartNum() const { return total_split_count; }
+	int GetPartIndex() const { return curr_split_index; } // index of a received part
+	const KnvLeaf *GetPartData(); // payload of a received part, NULL if there is none
 	int EncodePart(int index, UcMem *(&mem));
 	int EncodePart(int index, string &s);
+	// iovec version, the part payload is referenced in place and stays valid as long as the protocol
+	int EncodePart(int index, KnvIov &iov);
+
+	// Compression support, Encode() compresses the bodies if allowed and they are larger than the
+	// threshold, the bodies of a compressed packet are inflated when they are accessed first,
+	// a packet that is only forwarded is encoded as received. Split() compresses before splitting.
+	// A decoded request with ACCEPT_COMPRESS does not allow compression by itself, so that it is not
+	// compressed when it is sent onward: the responder checks GetReqCompress() and allows it for the
+	// response, as KnvUdpServer and KnvBatchExecutor do.
+	// The scatter-gather Encode(KnvIov &) never compresses.
+	bool GetAllowCompress() const { return allow_compress!=0; }
+	bool GetReqCompress() const { return peer_compress!=0; } // whether the sender accepts a compressed response
+	uint32_t GetCompressThreshold() const { return compress_threshold? compress_threshold : KNV_DEFAULT_COMPRESS_THRESHOLD; }
+	void SetAllowCompress(bool allow, uint32_t threshold=0); // set allow compression for sending a packet
+	int SetReqCompress(bool allow); // set whether the peer could compress the reply packet or not
+	bool IsCompressed() const { return zbody_len!=0; } // whether the bodies are not inflated yet
 
 	// Debugging
 	int Print(const string &prefix=string(""), ostream &outstr=cout);
@@ -247,15 +345,47 @@ private:
 	// string version
 	int Encode(string &s, uint32_t ret, const char *err, int errlen, KnvNode *body_tree, bool encode_oidb = false, bool compat_oidb = false);
 	int EncodeAll(string &s, bool encode_oidb = false, bool compat_oidb = false);
+
+	// iovec version
+	int Encode(KnvIov &iov, uint32_t ret, const char *err, int errlen, KnvNode *body_tree);
+	int EncodeAll(KnvIov &iov);
+
 	int EncodeOidb(UcMem *(&mem), KnvNode *body_tree); // encode oidb with a given tree
 	int EncodeAllOidb(UcMem *(&mem)); // encode the whole tree to oidb
 	int EncodeCompatOidb(UcMem *(&mem), KnvNode *body_tree);
 
-	void InitFromOidbPkg(const char *buf, int buflen, bool own_buf);
+	// write everything of part index before the payload, using split_hdr
+	// returns the number of bytes written or < 0 on failure
+	int EncodePartHead(int index, uint32_t part_len, char *buf, int sz);
+
+	// response header template, returns 0 if it can be used
+	int BuildRspHeader();
+	// length of the header field written by EncodeRspHeader(), the value length goes to val_sz
+	int RspHeaderSize(uint32_t *val_sz = NULL);
+	// write the header field with current retcode/retmsg, len is the buffer size on input
+	// and the encoded length on output, returns 0 on success
+	int EncodeRspHeader(char *buf, int &len);
+	// set retcode/retmsg for the template without touching the header nodes
+	int SetRspRet(uint32_t ret, const char *err, int errlen);
+	// write retcode/retmsg to the header nodes if SetRspRet() has deferred it,
+	// anything reading or changing the header nodes should call this first
+	int SyncHeader() { return rsp_unsynced? FlushRspRet() : 0; }
+	int FlushRspRet();
+
+	// inflate KNV_PKG_ZBDY_TAG into the tree if it is not yet,
+	// anything accessing the bodies or encoding them with a modified header should call this first
+	int Unzip() { return zbody_len? Inflate() : 0; }
+	int Inflate();
+	// compress the fields after the header of the encoded packet in mem if it pays off,
+	// mem is replaced then, returns the length of mem
+	int CompressPkg(UcMem *(&mem), int len);
+
+	void InitFromOidbPkg(const char *buf, int buflen, bool own_buf, UcMem *shared = NULL);
 };
 
 inline int KnvProtocol::assign(KnvProtocol &prot, bool own_buf)
 {
+	prot.SyncHeader();
 	cmd = prot.cmd;
 	subcmd = prot.subcmd;
 	seq = prot.seq;
@@ -265,6 +395,13 @@ inline int KnvProtocol::assign(KnvProtocol &prot, bool own_buf)
 	max_pkg_sz = prot.max_pkg_sz;
 	total_split_count = prot.total_split_count;
 	curr_split_index = prot.curr_split_index;
+	allow_compress = prot.allow_compress;
+	peer_compress = prot.peer_compress;
+	compress_threshold = prot.compress_threshold;
+	zbody_len = prot.zbody_len;
+	split_hdr.clear();
+	rsp_hdr_split = -1;
+	rsp_unsynced = false;
 
 	Delete();
 	if(own_buf)
@@ -328,21 +465,40 @@ inline bool KnvProtocol::IsValid()
 
 inline KnvNode *KnvProtocol::GetHeader()
 {
-	return IsValid()? header:NULL;
+	if(!IsValid())
+		return NULL;
+	SyncHeader();
+	return header;
+}
+
+inline KnvNode *KnvProtocol::GetMutableHeader()
+{
+	KnvNode *h = GetHeader();
+	rsp_hdr_split = -1;
+	return h;
 }
 
 inline KnvNode *KnvProtocol::GetBody()
 {
+	Unzip();
 	return (IsValid() && body && body->IsValid())? body:NULL;
 }
 
+inline const KnvLeaf *KnvProtocol::GetPartData()
+{
+	KnvNode *p = IsValid()? tree->FindChildByTag(KNV_PKG_PART_TAG_BASE+curr_split_index) : NULL;
+	return (p && p->GetType()==KNV_STRING)? p->GetValue() : NULL;
+}
+
 inline const knv_key_t *KnvProtocol::GetKey()
 {
+	Unzip();
 	return (IsValid() && body && body->IsValid())? &body->GetKey() : NULL;
 }
 
 inline uint64_t KnvProtocol::GetHeaderIntField(uint32_t ftag)
 {
+	SyncHeader();
 	if(header)
 		return header->GetFieldInt(ftag);
 	return 0;
@@ -351,6 +507,7 @@ inline uint64_t KnvProtocol::GetHeaderIntField(uint32_t ftag)
 inline string KnvProtocol::GetHeaderStringField(uint32_t ftag)
 {
 	static string empty_str;
+	SyncHeader();
 	if(header)
 		return header->GetFieldStr(ftag);
 	return empty_str;
@@ -366,6 +523,7 @@ inline KnvNode *FindFirstBody(KnvNode *b)
 
 inline KnvNode *KnvProtocol::GetFirstRequest()
 {
+	if(tree) Unzip();
 	KnvNode *b = FindFirstBody(tree? tree->GetFirstChild():NULL);
 	return b? (body=b):NULL;
 }
@@ -401,6 +559,7 @@ inline int KnvProtocol::RemoveAllBodies() // allow user to reuse the protocol tr
 		errmsg = "Protocol not initialized";
 		return -1;
 	}
+	Unzip(); // there may be other fields
 	if(tree->RemoveChildrenByTag(KNV_PKG_BDY_TAG)<0)
 	{
 		errmsg = "Failed to remove body tag: ";
@@ -422,20 +581,20 @@ inline int KnvProtocol::ReassignBody(KnvNode *new_body, bool take_ownership)
 
 inline int KnvProtocol::GetDomainNum()
 {
-	if(IsValid() && body)
+	if(IsValid() && Unzip()==0 && body)
 		return body->GetChildNum();
 	return 0;
 }
 
 inline KnvNode *KnvProtocol::GetFirstDomain()
 {
-	if(body) return body->GetFirstChild();
+	if(IsValid() && Unzip()==0 && body) return body->GetFirstChild();
 	return NULL;
 }
 
 inline KnvNode *KnvProtocol::GetDomain(int iDomainId)
 {
-	if(!IsValid() || body==NULL || !body->IsValid())
+	if(!IsValid() || Unzip() || body==NULL || !body->IsValid())
 		return NULL;
 	// The current definition, domain has no key field
 	return body->FindChild(iDomainId, NULL, 0);
@@ -443,7 +602,7 @@ inline KnvNode *KnvProtocol::GetDomain(int iDomainId)
 
 inline KnvNode *KnvProtocol::AddDomain(int iDomainId)
 {
-	if(!IsValid() || body==NULL || !body->IsValid())
+	if(!IsValid() || Unzip() || body==NULL || !body->IsValid())
 	{
 		errmsg = "Protocol not initialized";
 		return NULL;
@@ -463,7 +622,7 @@ inline KnvNode *KnvProtocol::AddDomain(int iDomainId)
 
 inline int KnvProtocol::AddDomain(KnvNode *domain, bool take_ownership)
 {
-	if(!IsValid() || body==NULL || !body->IsValid())
+	if(!IsValid() || Unzip() || body==NULL || !body->IsValid())
 	{
 		errmsg = "Protocol not initialized";
 		return -1;
@@ -485,7 +644,7 @@ inline int KnvProtocol::AddDomain(KnvNode *domain, bool take_ownership)
 
 inline int KnvProtocol::RemoveDomain(int iDomainId)
 {
-	if(!IsValid() || body==NULL || !body->IsValid())
+	if(!IsValid() || Unzip() || body==NULL || !body->IsValid())
 	{
 		errmsg = "Protocol not initialized";
 		return -1;
@@ -506,6 +665,7 @@ inline int KnvProtocol::EvalMaxSize()
 		errmsg = "Protocol not initialized";
 		return -1;
 	}
+	SyncHeader();
 	return tree->EvaluateSize();
 }
 
@@ -539,6 +699,21 @@ inline int KnvProtocol::EncodeWithBody(KnvNode *b, UcMem *(&mem))
 	return Encode(mem, 0, NULL, 0, b);
 }
 
+inline int KnvProtocol::Encode(KnvIov &iov)
+{
+	return retcode? Encode(iov, retcode, retmsg, retmsglen, NULL) : EncodeAll(iov);
+}
+
+inline int KnvProtocol::EncodeWithError(uint32_t ret, const string &errmsg, KnvIov &iov)
+{
+	return Encode(iov, ret, errmsg.c_str(), errmsg.length(), NULL);
+}
+
+inline int KnvProtocol::EncodeWithBody(KnvNode *b, KnvIov &iov)
+{
+	return Encode(iov, 0, NULL, 0, b);
+}
+
 inline int KnvProtocol::Encode(string &s)
 {
 	return retcode? Encode(s, retcode, retmsg, retmsglen, NULL) : EncodeAll(s);
@@ -549,6 +724,26 @@ inline int KnvProtocol::EncodeWithError(uint32_t ret, const string &errmsg, stri
 	return Encode(s, ret, errmsg.c_str(), errmsg.length(), NULL);
 }
 
+inline int KnvProtocol::EncodeWithRawBodies(const knv_seg_t *bodies, int nbodies, string &s)
+{
+	UcMem *m;
+	int ret = EncodeWithRawBodies(bodies, nbodies, m);
+	if(ret<0)
+		return ret;
+	try
+	{
+		s.assign((char *)m->ptr(), ret);
+	}
+	catch(...)
+	{
+		UcMemManager::Free(m);
+		errmsg = "out of memory";
+		return -100;
+	}
+	UcMemManager::Free(m);
+	return ret;
+}
+
 inline int KnvProtocol::EncodeWithBody(KnvNode *b, string &s)
 {
 	return Encode(s, 0, NULL, 0, b);
@@ -562,8 +757,11 @@ inline int KnvProtocol::EncodeAll(UcMem *(&mem), bool encode_oidb, bool compat_o
 		return -1;
 	}
 
+	SyncHeader();
 	if(encode_oidb)
 	{
+		if(Unzip())
+			return -4;
 		if(compat_oidb)
 			return EncodeCompatOidb(mem, body);
 		else
@@ -588,7 +786,7 @@ inline int KnvProtocol::EncodeAll(UcMem *(&mem), bool encode_oidb, bool compat_o
 			errmsg += "Unknown error";
 		return -3;
 	}
-	return sz;
+	return CompressPkg(mem, sz);
 }
 
 inline int KnvProtocol::EncodeOidb(string &s)
@@ -647,6 +845,34 @@ inline void KnvProtocol::SetAllowSplit(bool allow, uint32_t pkg_sz)
 	if(pkg_sz) max_pkg_sz = pkg_sz;
 }
 
+// set allow compression for sending a packet
+inline void KnvProtocol::SetAllowCompress(bool allow, uint32_t threshold)
+{
+	allow_compress = allow;
+	if(threshold) compress_threshold = threshold;
+}
+
+// set whether the peer could reply with compressed packet or not
+inline int KnvProtocol::SetReqCompress(bool allow)
+{
+	if(!IsValid())
+	{
+		errmsg = "protocol is not initialized";
+		return -1;
+	}
+
+	SyncHeader();
+	split_hdr.clear();
+	rsp_hdr_split = -1;
+	if(allow? header->SetChildInt(KNV_PKG_HDR_ACCEPT_COMPRESS, 1) : header->RemoveChildrenByTag(KNV_PKG_HDR_ACCEPT_COMPRESS)<0)
+	{
+		errmsg = "Set header accept_compress field failed: ";
+		errmsg += header->GetErrorMsg();
+		return -2;
+	}
+	return 0;
+}
+
 // set whether the peer could reply with splitted packet or not
 inline int KnvProtocol::SetReqSplit(bool allow, uint32_t pkg_sz)
 {
@@ -658,6 +884,9 @@ inline int KnvProtocol::SetReqSplit(bool allow, uint32_t pkg_sz)
 		return -1;
 	}
 
+	SyncHeader();
+	split_hdr.clear();
+	rsp_hdr_split = -1;
 	if(allow)
 		ret = header->SetChildInt(KNV_PKG_HDR_ALLOW_SPLIT, 1);
 	else
@@ -31,6 +31,9 @@ enum KnvAttrs
 	ATTR_MEM_POOL_EXCEED_LIMIT_AFTER_SHRINK = 380778,
 	ATTR_MEM_POOL_SUCC_AFTER_SHRINK = 380779,
 	ATTR_MEM_POOL_NO_SPACE_SHRUNK = 380780,
+	ATTR_MEM_POOL_MMAP_FAIL = 380781,
+	ATTR_MEM_POOL_HUGETLB_FAIL = 380782,
+	ATTR_MEM_POOL_PURGE = 380783,
 	ATTR_OBJ_POOL_NEW_OBJ = 390992,
 	ATTR_OBJ_POOL_NEW_OBJ_FAIL = 391020,
 	ATTR_PROTO_INCOMPLETE_PART_OVERWRITTEN = 391963,